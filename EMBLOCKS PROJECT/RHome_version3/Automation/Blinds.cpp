@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include "FreeRTOS.h"
 #include "task.h"
+#include "StateVersion.h"
 
 void Blind::setType(BlindType type)
 {
@@ -73,6 +74,7 @@ void Blind::setBounds(int boundMin, int boundMid, int boundMax)
 
 int Blind::getPosition(bool read)
 {
+    (void)read;
     return currPosition;
 }
 
@@ -126,26 +128,36 @@ void Blind::setPosition(int pos)
         }
     }
 
-    int lowestDiff = -1;
     if (abs(currPosition-minPosition) < abs(currPosition-midPosition) && abs(currPosition-minPosition) < abs(currPosition-maxPosition))
     {
-        lowestDiff = minPosition;
         currPositionState = kBlindStateMin;
     }
     else if (abs(currPosition-midPosition) < abs(currPosition-minPosition) && abs(currPosition-midPosition) < abs(currPosition-maxPosition))
     {
-        lowestDiff = midPosition;
         currPositionState = kBlindStateMid;
     }
     else
     {
-        lowestDiff = maxPosition;
         currPositionState = kBlindStateMax;
     }
 }
 
 void Blind::toggleState(int newState)
 {
+    startMove(newState);
+
+    vTaskDelay(kBlindMoveTime / portTICK_RATE_MS);
+
+    finishMove();
+}
+
+void Blind::startMove(int newState)
+{
+    //
+    // Enables the output and moves the blind without waiting for it
+    // Call finishMove() once the servo had enough time to reach the position
+    //
+
     if (newState == -1)
     {
         newState = (currPositionState == kBlindStateMid)? kBlindStateMax : (currPositionState == kBlindStateMax)? kBlindStateMin : kBlindStateMid;
@@ -166,8 +178,11 @@ void Blind::toggleState(int newState)
         setPosition(maxPosition);
     }
 
-    vTaskDelay(7000 / portTICK_RATE_MS);
+    StateVersion::bump();
+}
 
+void Blind::finishMove()
+{
     enableOutput(false);
 }
 
@@ -241,6 +256,11 @@ const char* Blind::getName()
 
 uint32_t Blind::calculateHash()
 {
+    //
+    // Name based hash that buttons were bound with before entity IDs
+    // (only used to move the bindings of old settings to IDs)
+    //
+
     uint32_t hsh = 0;
     for (int i = 0; i < strlen(name); i++)
     {
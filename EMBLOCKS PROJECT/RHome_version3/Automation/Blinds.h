@@ -38,6 +38,8 @@ const char allBlindChannels[][11] = {"1", "2", "3", "4"};
 #define kBlindStateMid 1
 #define kBlindStateMax 2
 
+#define kBlindMoveTime 7000
+
 const char autoBlindPositions[][11] = {"Min", "Mid", "Max"};
 #define kAutoBLindPositions 3
 
@@ -72,6 +74,7 @@ class Blind
     int midPosition;
     int step;
     int btCode;
+    uint32_t id;                        // Entity ID (EntityTable)
 
     BlindType getType();
     void setType(BlindType type);
@@ -82,6 +85,8 @@ class Blind
     void setName(const char* nm);
     const char* getName();
     void toggleState(int newState = -1);
+    void startMove(int newState = -1);
+    void finishMove();
     int getState();
 
     static void initLocalBlinds();
@@ -0,0 +1,133 @@
+/*
+**
+**                           EntityTable.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "EntityTable.h"
+
+uint32_t EntityTable::allocate()
+{
+    //
+    // Returns a new ID (IDs of deleted devices are not given out again)
+    //
+
+    if (next > kENTITY_ID_MAX)
+        next = 1;
+
+    return next++;
+}
+
+void EntityTable::reserve(uint32_t id)
+{
+    //
+    // Keeps the next ID above an ID loaded from flash
+    //
+
+    if (isValid(id) && id >= next)
+        next = id + 1;
+}
+
+uint32_t EntityTable::nextId()
+{
+    return next;
+}
+
+void EntityTable::setNextId(uint32_t id)
+{
+    next = (isValid(id))? id : 1;
+}
+
+bool EntityTable::isValid(uint32_t id)
+{
+    return id != kENTITY_ID_NONE && id <= kENTITY_ID_MAX;
+}
+
+int EntityTable::slotOf(uint32_t id)
+{
+    return (uint32_t)(id * 2654435761U) >> (32 - kENTITY_BITS);
+}
+
+void EntityTable::insert(EntitySlot *table, uint32_t id, Light *light, Blind *blind)
+{
+    int slot = slotOf(id);
+    while (table[slot].id != kENTITY_ID_NONE)
+    {
+        slot = (slot + 1) & (kENTITY_SLOTS - 1);
+    }
+
+    table[slot].id = id;
+    table[slot].light = light;
+    table[slot].blind = blind;
+}
+
+void EntityTable::build(const std::vector<Light *> &lights, const std::vector<Blind *> &blinds)
+{
+    //
+    // Builds the table from the current devices and makes it active
+    //
+
+    EntitySlot *table = tables[active ^ 1];
+    int count = 0;
+
+    memset(table, 0, sizeof(tables[0]));
+
+    for (int i = 0; i < lights.size() && count < kENTITY_SLOTS / 2; i++, count++)
+    {
+        insert(table, lights[i]->id, lights[i], NULL);
+    }
+
+    for (int i = 0; i < blinds.size() && count < kENTITY_SLOTS / 2; i++, count++)
+    {
+        insert(table, blinds[i]->id, NULL, blinds[i]);
+    }
+
+    active ^= 1;
+}
+
+const EntitySlot *EntityTable::find(uint32_t id)
+{
+    const EntitySlot *table = tables[active];
+
+    if (id == kENTITY_ID_NONE)
+        return NULL;
+
+    int slot = slotOf(id);
+    while (table[slot].id != kENTITY_ID_NONE)
+    {
+        if (table[slot].id == id)
+            return &table[slot];
+
+        slot = (slot + 1) & (kENTITY_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+Light *EntityTable::findLight(uint32_t id)
+{
+    const EntitySlot *slot = find(id);
+    return (slot != NULL)? slot->light : NULL;
+}
+
+Blind *EntityTable::findBlind(uint32_t id)
+{
+    const EntitySlot *slot = find(id);
+    return (slot != NULL)? slot->blind : NULL;
+}
+
+EntitySlot EntityTable::tables[2][kENTITY_SLOTS];
+volatile int EntityTable::active = 0;
+uint32_t EntityTable::next = 1;
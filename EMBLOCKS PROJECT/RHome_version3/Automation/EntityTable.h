@@ -0,0 +1,67 @@
+/*
+**
+**                           EntityTable.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef ENTITYTABLE_H_INCLUDED
+#define ENTITYTABLE_H_INCLUDED
+
+#include "Lighting.h"
+#include "Blinds.h"
+#include <vector>
+
+//
+// Entity IDs of lights and blinds
+// Every device gets an ID when it is created, the ID is kept in its flash record and never reused
+// (the next free ID is kept in the settings header). Remote buttons are bound to these IDs, so renaming
+// or changing a device does not break its buttons. Devices are found by their ID through an open addressing
+// table rebuilt whenever the configuration changes (two tables, like the remote index).
+//
+
+#define kENTITY_ID_NONE 0
+#define kENTITY_ID_MAX 0xFFFFFE         // Next free ID is kept in the upper 24 bits of the settings header word
+#define kENTITY_BITS 5
+#define kENTITY_SLOTS (1 << kENTITY_BITS) // At least twice the number of lights and blinds
+
+typedef struct
+{
+    uint32_t id;                        // kENTITY_ID_NONE marks an empty slot
+    Light *light;                       // One of them is set
+    Blind *blind;
+} EntitySlot;
+
+class EntityTable
+{
+    public:
+    static uint32_t allocate();
+    static void reserve(uint32_t id);
+    static uint32_t nextId();
+    static void setNextId(uint32_t id);
+    static bool isValid(uint32_t id);
+    static void build(const std::vector<Light *> &lights, const std::vector<Blind *> &blinds);
+    static Light *findLight(uint32_t id);
+    static Blind *findBlind(uint32_t id);
+
+    private:
+    static int slotOf(uint32_t id);
+    static const EntitySlot *find(uint32_t id);
+    static void insert(EntitySlot *table, uint32_t id, Light *light, Blind *blind);
+    static EntitySlot tables[2][kENTITY_SLOTS];
+    static volatile int active;
+    static uint32_t next;
+};
+
+#endif /* ENTITYTABLE_H_INCLUDED */
@@ -17,7 +17,62 @@
 **********************************************************************/
 
 #include "Lighting.h"
-#include "RemoteReceiver.h"
+#include "StateVersion.h"
+#include "Metrics.h"
+
+unsigned long Light::newKakuAddress = kNEW_KAKU_ADDRESS;
+
+Light::~Light()
+{
+    //
+    // Telegrams still waiting for this light (or its group) are not sent any more
+    //
+
+    RfScheduler::forget(this);
+    RfScheduler::forget(groupTelegrams);
+}
+
+void Light::setType(LightType type, char address, unsigned short unit)
+{
+    //
+    // Sets an RF type from the address letter and unit used by the menus, the configuration and the flash
+    // (device and systemCode keep them for every type), values out of the limits of the type are clamped
+    //
+
+    if (type > RF_NEW_KAKU)
+        return;
+
+    const LightAddressing *limits = &lightAddressing[type];
+
+    if (address < 'A' || address > limits->lastAddress)
+        address = 'A';
+
+    if (unit < limits->minUnit)
+        unit = limits->minUnit;
+    else if (unit > limits->maxUnit)
+        unit = limits->maxUnit;
+
+    switch (type)
+    {
+    case RF_KAKU:
+        setTypeKaku(address, unit);
+        break;
+    case RF_ELRO:
+        setTypeElro(unit, address);
+        break;
+    case RF_BLOKKER:
+        setTypeBlokker(unit);
+        break;
+    case RF_ACTION:
+        setTypeAction(unit, address);
+        break;
+    case RF_NEW_KAKU:
+        setTypeNewKaku(address, unit);
+        break;
+    default:
+        break;
+    }
+}
 
 void Light::setTypeKaku(char address, unsigned short device)
 {
@@ -25,23 +80,79 @@ void Light::setTypeKaku(char address, unsigned short device)
     this->device = address;
     this->systemCode = device;
 
-    KaKuTransmitter* transmitter = new KaKuTransmitter();
-    this->rfTransmitter = transmitter;
+    KaKuTransmitter transmitter;
+
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(address, device, false), &telegrams[0]);
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(address, device, true), &telegrams[1]);
 }
 
 void Light::setTypeElro(unsigned short systemCode, char device)
 {
+    this->type = RF_ELRO;
+    this->device = device;
+    this->systemCode = systemCode;
 
+    ElroTransmitter transmitter;
+
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(systemCode, device, false), &telegrams[0]);
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(systemCode, device, true), &telegrams[1]);
 }
 
 void Light::setTypeBlokker(unsigned short device)
 {
+    this->type = RF_BLOKKER;
+    this->device = 'A';
+    this->systemCode = device;
 
+    BlokkerTransmitter transmitter;
+
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(device, false), &telegrams[0]);
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(device, true), &telegrams[1]);
 }
 
 void Light::setTypeAction(unsigned short systemCode, char device)
 {
+    this->type = RF_ACTION;
+    this->device = device;
+    this->systemCode = systemCode;
+
+    ActionTransmitter transmitter;
+
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(systemCode, device, false), &telegrams[0]);
+    RemoteTransmitter::prepareTelegram(transmitter.getTelegram(systemCode, device, true), &telegrams[1]);
+}
+
+void Light::setTypeNewKaku(char address, unsigned short unit)
+{
+    //
+    // Lights with the same address letter share a remote address, group telegrams switch all of them
+    //
 
+    this->type = RF_NEW_KAKU;
+    this->device = address;
+    this->systemCode = unit;
+
+    NewKaKuTransmitter transmitter;
+
+    unsigned long remoteAddress = newKakuAddress + (address - 'A');
+
+    transmitter.prepareSignal(remoteAddress, false, unit, false, &telegrams[0]);
+    transmitter.prepareSignal(remoteAddress, false, unit, true, &telegrams[1]);
+    transmitter.prepareSignal(remoteAddress, true, unit, false, &groupTelegrams[0]);
+    transmitter.prepareSignal(remoteAddress, true, unit, true, &groupTelegrams[1]);
+}
+
+void Light::setNewKakuAddress(unsigned long address)
+{
+    //
+    // Sets the remote address of the self-learning KaKu lights of this unit
+    // (so that receivers do not follow another unit, has to be set before the lights get their type)
+    //
+
+    address &= kNEW_KAKU_ADDRESS_MASK;
+
+    if (address != 0)
+        newKakuAddress = address;
 }
 
 void Light::setName(const char* nm)
@@ -65,23 +176,121 @@ bool Light::isOn()
     return this->on;
 }
 
-void Light::onOff(bool on)
+void Light::onOff(bool on, RfPriority priority, xSemaphoreHandle done)
 {
+    //
+    // Queues the telegram and returns, state is changed right away
+    // done (optional) is given when the telegram is on air
+    //
+
     switch (this->type)
     {
     case RF_KAKU:
-        taskENTER_CRITICAL();
-        RemoteReceiver::disable();
-        ((KaKuTransmitter *)rfTransmitter)->sendSignal(device, systemCode, on);
+    case RF_ELRO:
+    case RF_BLOKKER:
+    case RF_ACTION:
+    case RF_NEW_KAKU:
+        RfScheduler::send(this, &telegrams[(on)? 1 : 0], priority, done);
         this->on = on;
-        RemoteReceiver::enable();
-        taskEXIT_CRITICAL();
+        break;
+    default:
         break;
     }
+
+    StateVersion::bump();
+}
+
+bool Light::inGroup(const Light *light)
+{
+    //
+    // True if a group telegram of this light also switches light
+    //
+
+    return this->type == RF_NEW_KAKU && light->type == RF_NEW_KAKU && light->device == this->device;
+}
+
+void Light::switchLights(Light *const *lights, int count, const int8_t *target, RfPriority priority)
+{
+    //
+    // Switches several lights at once, target is 0 (off), 1 (on) or kLIGHT_KEEP for every light (at most 32 lights)
+    // Lights of an address that has group telegrams get one group telegram when at least kLIGHT_GROUP_MIN of them
+    // are switched to the same state and the kept ones already are in it. Switched lights of the address that
+    // have to end up in the other state get their own telegram after it, all other lights are switched one by one.
+    //
+
+    uint32_t planned = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        Light *first = lights[i];
+
+        if ((planned & (1 << i)) != 0 || target[i] == kLIGHT_KEEP || !first->inGroup(first))
+            continue;
+
+        const void *members[32];
+        int memberCount = 0;
+        int switched[2] = {0, 0};
+        bool blocked[2] = {false, false};
+
+        for (int j = 0; j < count; j++)
+        {
+            if (!first->inGroup(lights[j]))
+                continue;
+
+            members[memberCount++] = lights[j];
+
+            if (target[j] != kLIGHT_KEEP)
+                switched[target[j]]++;
+            else
+                blocked[(lights[j]->on)? 0 : 1] = true;
+        }
+
+        int on = (switched[1] > switched[0])? 1 : 0;
+        if (blocked[on])
+            on = 1 - on;
+
+        if (blocked[on] || switched[on] < kLIGHT_GROUP_MIN)
+            continue;
+
+        // Queued under the group telegrams of the first light, so a newer group command for the address replaces it
+        RfScheduler::sendGroup(first->groupTelegrams, members, memberCount, &first->groupTelegrams[on], priority);
+        Metrics::add(METRIC_RF_GROUPED, switched[on]);
+
+        for (int j = 0; j < count; j++)
+        {
+            if (!first->inGroup(lights[j]) || target[j] == kLIGHT_KEEP)
+                continue;
+
+            if (target[j] != on)
+                RfScheduler::send(lights[j], &lights[j]->telegrams[target[j]], priority);
+
+            lights[j]->on = target[j];
+            planned |= 1 << j;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (target[i] == kLIGHT_KEEP)
+            continue;
+
+        if ((planned & (1 << i)) == 0)
+            lights[i]->onOff(target[i], priority);
+        changed = true;
+    }
+
+    if (changed)
+        StateVersion::bump();
 }
 
 uint32_t Light::calculateHash()
 {
+    //
+    // Name based hash that buttons were bound with before entity IDs
+    // (only used to move the bindings of old settings to IDs)
+    //
+
     uint32_t hsh = 0;
     for (int i = 0; i < strlen(name); i++)
     {
@@ -33,12 +33,13 @@ extern "C"
 
 #include "RemoteTransmitter.h"
 #include "RemoteReceiver.h"
-#include "FreeRTOS.h"
+#include "RfScheduler.h"
+#include "FreeRTOS.h"
 #include "task.h"
 #include <string.h>
 
-const char allLightTypes[][11] = {"KakuSwitch", "Elro RM", "Blokker RM", "Action RM"/*, "Bluetooth"*/};
-#define kAllLightTypes 4
+const char allLightTypes[][11] = {"KakuSwitch", "Elro RM", "Blokker RM", "Action RM", "New KaKu"/*, "Bluetooth"*/};
+#define kAllLightTypes 5
 
 const char lightAddresses1[][11] = {"A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P"};
 #define kLightAddresses1 16
@@ -52,34 +53,67 @@ typedef enum
     RF_ELRO,
     RF_BLOKKER,
     RF_ACTION,
+    RF_NEW_KAKU,
     BLUETOOTH,
     IR_LED_ANALOG
 } LightType;
 
+//
+// Address and unit limits of the RF light types (same order as LightType)
+// KaKu: address A-P and unit 1-16, Elro and Action: device A-D or A-E and system code 0-31, Blokker: unit 1-8 (no address)
+// Self-learning KaKu: address A-P (added to the remote address of the unit, receivers learn it) and unit 1-16
+//
+typedef struct
+{
+    char lastAddress;
+    unsigned short minUnit;
+    unsigned short maxUnit;
+} LightAddressing;
+
+const LightAddressing lightAddressing[kAllLightTypes] = {{'P', 1, 16}, {'D', 0, 31}, {'A', 1, 8}, {'E', 0, 31}, {'P', 1, 16}};
+
+#define kNEW_KAKU_ADDRESS 0x1B6D5C0     // 26 bit remote address of the self-learning KaKu lights (A is 0) until one is set
+#define kNEW_KAKU_ADDRESS_MASK 0x3FFFFF0 // Address bits that are left to the unit, the lowest 4 are the address letter
+
+#define kLIGHT_KEEP -1                  // Light::switchLights, light is not changed
+#define kLIGHT_GROUP_MIN 2              // Lights that have to be switched for a group telegram
+
 class Light
 {
     private:
     LightType type;
     bool on;
-    RemoteTransmitter* rfTransmitter;
+    RfTelegram telegrams[2];            // Off and on telegrams, encoded when the type is set
+    RfTelegram groupTelegrams[2];       // Off and on telegrams for all lights of the address (self-learning KaKu)
     char name[12];
+    static unsigned long newKakuAddress;
+
+    bool inGroup(const Light *light);
 
     public:
+    ~Light();
+
     unsigned short systemCode;
     char device;
     uint32_t btCode;
+    uint32_t id;                        // Entity ID (EntityTable)
+    void setType(LightType type, char address, unsigned short unit);
     void setTypeKaku(char address, unsigned short device);
     void setTypeElro(unsigned short systemCode, char device);
     void setTypeBlokker(unsigned short device);
     void setTypeAction(unsigned short systemCode, char device);
+    void setTypeNewKaku(char address, unsigned short unit);
 
     void setName(const char* nm);
     const char* getName();
 
     LightType getType();
-    void onOff(bool on);
+    void onOff(bool on, RfPriority priority = RF_PRIORITY_USER, xSemaphoreHandle done = NULL);
     bool isOn();
 
+    static void switchLights(Light *const *lights, int count, const int8_t *target, RfPriority priority = RF_PRIORITY_USER);
+    static void setNewKakuAddress(unsigned long address);
+
     uint32_t calculateHash();
 };
 
@@ -36,7 +36,7 @@ class RemoteButton
 {
     public:
     uint32_t remoteButton;
-    uint32_t eventHash;
+    uint32_t eventId;                   // Entity ID of the light or blind, action number for TYPE_ACTION
     RemoteEventType eventType;
     const char* getEventTypeName();
 
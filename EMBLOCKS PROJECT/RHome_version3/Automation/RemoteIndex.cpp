@@ -0,0 +1,111 @@
+/*
+**
+**                           RemoteIndex.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "RemoteIndex.h"
+
+int RemoteIndex::slotOf(uint32_t code)
+{
+    //
+    // First slot to probe for a code (multiplicative hash, RF codes differ mostly in the low bits)
+    //
+
+    return (uint32_t)(code * 2654435761U) >> (32 - kREMOTE_INDEX_BITS);
+}
+
+void RemoteIndex::build(const std::vector<RemoteButton *> &buttons)
+{
+    //
+    // Builds the index from the current configuration and makes it active
+    // Only the first button with a code is used, like the buttons were searched before
+    //
+
+    RemoteIndexTable *table = &tables[active ^ 1];
+    int actionCount = 0;
+
+    memset(table->slots, 0, sizeof(table->slots));
+
+    for (int i = 0; i < buttons.size() && i < kREMOTE_INDEX_SLOTS / 2; i++)
+    {
+        const RemoteButton *button = buttons[i];
+
+        if (button->remoteButton == 0)
+            continue;
+
+        int slot = slotOf(button->remoteButton);
+        while (table->slots[slot].code != 0 && table->slots[slot].code != button->remoteButton)
+        {
+            slot = (slot + 1) & (kREMOTE_INDEX_SLOTS - 1);
+        }
+
+        if (table->slots[slot].code != 0)
+            continue;
+
+        table->slots[slot].code = button->remoteButton;
+        table->slots[slot].first = actionCount;
+
+        void *device = NULL;
+        if (button->eventType == TYPE_LIGHT_ON || button->eventType == TYPE_LIGHT_OFF || button->eventType == TYPE_LIGHT_TOGGLE)
+        {
+            device = EntityTable::findLight(button->eventId);
+        }
+        else if (button->eventType == TYPE_BLIND_TOGGLE)
+        {
+            device = EntityTable::findBlind(button->eventId);
+        }
+
+        // Buttons of deleted devices stay in the table without actions
+        if ((device != NULL || button->eventType == TYPE_ACTION) && actionCount < kREMOTE_INDEX_ACTIONS)
+        {
+            table->actions[actionCount].eventType = button->eventType;
+            table->actions[actionCount].device = device;
+            table->actions[actionCount].eventId = button->eventId;
+            actionCount++;
+        }
+
+        table->slots[slot].count = actionCount - table->slots[slot].first;
+    }
+
+    active ^= 1;
+}
+
+const RemoteAction *RemoteIndex::find(uint32_t code, int *count)
+{
+    //
+    // Returns the actions of a remote code (count is 0 if no button has it)
+    //
+
+    const RemoteIndexTable *table = &tables[active];
+
+    int slot = slotOf(code);
+    while (table->slots[slot].code != 0)
+    {
+        if (table->slots[slot].code == code)
+        {
+            *count = table->slots[slot].count;
+            return &table->actions[table->slots[slot].first];
+        }
+
+        slot = (slot + 1) & (kREMOTE_INDEX_SLOTS - 1);
+    }
+
+    *count = 0;
+    return NULL;
+}
+
+RemoteIndexTable RemoteIndex::tables[2];
+volatile int RemoteIndex::active = 0;
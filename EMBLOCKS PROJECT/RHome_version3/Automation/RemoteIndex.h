@@ -0,0 +1,69 @@
+/*
+**
+**                           RemoteIndex.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef REMOTEINDEX_H_INCLUDED
+#define REMOTEINDEX_H_INCLUDED
+
+#include "Remote.h"
+#include "EntityTable.h"
+#include <vector>
+
+//
+// Remote button dispatch index
+// Rebuilt whenever the configuration changes (after the entity table): remote codes are kept in an
+// open addressing table and the device of every button is resolved up front.
+// Two tables are kept, the new one is built while the other can still be used.
+//
+
+#define kREMOTE_INDEX_BITS 7
+#define kREMOTE_INDEX_SLOTS (1 << kREMOTE_INDEX_BITS)  // At least twice the number of buttons
+#define kREMOTE_INDEX_ACTIONS (kREMOTE_INDEX_SLOTS / 2) // One for every button
+
+typedef struct
+{
+    RemoteEventType eventType;
+    void *device;                       // Light or Blind, NULL for TYPE_ACTION
+    uint32_t eventId;                   // Action number for TYPE_ACTION
+} RemoteAction;
+
+typedef struct
+{
+    uint32_t code;                      // 0 marks an empty slot (code 0 is never pressed)
+    uint16_t first;
+    uint16_t count;
+} RemoteIndexSlot;
+
+typedef struct
+{
+    RemoteIndexSlot slots[kREMOTE_INDEX_SLOTS];
+    RemoteAction actions[kREMOTE_INDEX_ACTIONS];
+} RemoteIndexTable;
+
+class RemoteIndex
+{
+    public:
+    static void build(const std::vector<RemoteButton *> &buttons);
+    static const RemoteAction *find(uint32_t code, int *count);
+
+    private:
+    static int slotOf(uint32_t code);
+    static RemoteIndexTable tables[2];
+    static volatile int active;
+};
+
+#endif /* REMOTEINDEX_H_INCLUDED */
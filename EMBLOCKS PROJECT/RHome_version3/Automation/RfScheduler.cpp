@@ -0,0 +1,389 @@
+/*
+**
+**                           RfScheduler.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "RfScheduler.h"
+#include "Metrics.h"
+#include "essentials.h"
+#include <string.h>
+
+void RfScheduler::init()
+{
+    //
+    // Can be used before the scheduler starts (jobs wait for the task)
+    // Task has to be started by the application
+    //
+
+    vSemaphoreCreateBinary(pending);
+    xSemaphoreTake(pending, 0);
+}
+
+bool RfScheduler::send(const void *device, const RfTelegram *telegram, RfPriority priority, xSemaphoreHandle done)
+{
+    //
+    // Queues a telegram for a device, done (optional) is given once the telegram or the one that replaced it was sent
+    // Returns false if the queue is full
+    //
+
+    taskENTER_CRITICAL();
+    bool queued = queue(device, telegram, priority, done) != NULL;
+    taskEXIT_CRITICAL();
+
+    if (queued)
+        xSemaphoreGive(pending);
+
+    return queued;
+}
+
+bool RfScheduler::sendGroup(const void *group, const void *const *members, int memberCount, const RfTelegram *telegram, RfPriority priority)
+{
+    //
+    // Queues a telegram that switches several devices (members) at once, group identifies it like a device
+    // Waiting jobs of the members are dropped, their callers are notified once the group telegram was sent
+    // Returns false if the queue is full
+    //
+
+    xSemaphoreHandle notify[kRF_MAX_JOBS * kRF_JOB_NOTIFY];
+    int notifyCount = 0;
+
+    taskENTER_CRITICAL();
+
+    for (int i = 0; i < kRF_MAX_JOBS; i++)
+    {
+        RfJob *job = &jobs[i];
+
+        for (int j = 0; j < memberCount && job->used; j++)
+        {
+            if (job->device != members[j])
+                continue;
+
+            for (int k = 0; k < kRF_JOB_NOTIFY; k++)
+            {
+                if (job->notify[k] != NULL)
+                    notify[notifyCount++] = job->notify[k];
+            }
+
+            if (job->priority > priority)
+                priority = (RfPriority)job->priority;
+
+            job->used = false;
+            Metrics::add(METRIC_RF_COALESCED);
+        }
+    }
+
+    RfJob *job = queue(group, telegram, priority, NULL);
+    if (job != NULL)
+        job->statsDevice = members[0];
+
+    // Callers of the dropped jobs wait for the group telegram (as far as it has room for them)
+    for (int i = 0; job != NULL && i < kRF_JOB_NOTIFY && notifyCount > 0; i++)
+    {
+        if (job->notify[i] == NULL)
+            job->notify[i] = notify[--notifyCount];
+    }
+
+    taskEXIT_CRITICAL();
+
+    // No room left, these callers are released right away
+    while (notifyCount > 0)
+    {
+        xSemaphoreGive(notify[--notifyCount]);
+    }
+
+    if (job != NULL)
+        xSemaphoreGive(pending);
+
+    return job != NULL;
+}
+
+RfJob *RfScheduler::queue(const void *device, const RfTelegram *telegram, RfPriority priority, xSemaphoreHandle done)
+{
+    //
+    // Adds a job or replaces the telegram of the job still waiting for the device, has to be called in a critical section
+    // Returns the job or NULL if the queue is full
+    //
+
+    int freeJob = -1;
+    RfJob *queued = NULL;
+
+    for (int i = 0; i < kRF_MAX_JOBS && queued == NULL; i++)
+    {
+        RfJob *job = &jobs[i];
+
+        if (!job->used)
+        {
+            if (freeJob < 0)
+                freeJob = i;
+            continue;
+        }
+
+        if (job->device != device)
+            continue;
+
+        int notify = 0;
+        while (done != NULL && notify < kRF_JOB_NOTIFY && job->notify[notify] != NULL)
+        {
+            notify++;
+        }
+
+        if (notify < kRF_JOB_NOTIFY)
+        {
+            // Earlier command was not sent yet, only the new state goes on air
+            job->telegram = *telegram;
+            if (priority > job->priority)
+                job->priority = priority;
+            if (done != NULL)
+                job->notify[notify] = done;
+
+            Metrics::add(METRIC_RF_COALESCED);
+            queued = job;
+        }
+    }
+
+    if (queued == NULL && freeJob >= 0)
+    {
+        RfJob *job = &jobs[freeJob];
+
+        job->used = true;
+        job->priority = priority;
+        job->sequence = sequence++;
+        job->device = device;
+        job->statsDevice = device;
+        job->telegram = *telegram;
+        job->notify[0] = done;
+        for (int i = 1; i < kRF_JOB_NOTIFY; i++)
+        {
+            job->notify[i] = NULL;
+        }
+
+        queued = job;
+    }
+
+    return queued;
+}
+
+bool RfScheduler::takeNextJob(RfJob *job)
+{
+    //
+    // Removes the job to be sent next (highest priority, oldest first) from the queue
+    //
+
+    int next = -1;
+
+    taskENTER_CRITICAL();
+
+    for (int i = 0; i < kRF_MAX_JOBS; i++)
+    {
+        if (!jobs[i].used)
+            continue;
+
+        if (next < 0 || jobs[i].priority > jobs[next].priority ||
+            (jobs[i].priority == jobs[next].priority && (int32_t)(jobs[i].sequence - jobs[next].sequence) < 0))
+        {
+            next = i;
+        }
+    }
+
+    if (next >= 0)
+    {
+        *job = jobs[next];
+        jobs[next].used = false;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return next >= 0;
+}
+
+void RfScheduler::transmit(const RfJob *job)
+{
+    //
+    // Sends a job in bursts of kRF_BURST_REPEATS, every burst waits for a free channel first
+    // kRF_CLEAR_BURSTS bursts that started on a free channel are enough, further ones (retries) are only sent
+    // after bursts that had to go out on a busy channel, up to the repeats of the telegram
+    //
+
+    RfTelegram burst = job->telegram;
+    RfDeviceStats *entry = statsFor(job->statsDevice, job->sequence);
+
+    int bursts = (burst.repeats + kRF_BURST_REPEATS - 1) / kRF_BURST_REPEATS;
+    int clearNeeded = (bursts < kRF_CLEAR_BURSTS)? bursts : kRF_CLEAR_BURSTS;
+    int clear = 0;
+
+    if (burst.repeats > kRF_BURST_REPEATS)
+        burst.repeats = kRF_BURST_REPEATS;
+
+    for (int i = 0; i < bursts && clear < clearNeeded; i++)
+    {
+        if (waitForChannel(entry))
+            clear++;
+
+        if (i >= clearNeeded)
+        {
+            entry->retries++;
+            Metrics::add(METRIC_RF_RETRIES);
+        }
+
+        RemoteTransmitter::sendPrepared(&burst);
+        entry->bursts++;
+    }
+
+    entry->telegrams++;
+}
+
+bool RfScheduler::waitForChannel(RfDeviceStats *entry)
+{
+    //
+    // Listens for kRF_LISTEN_TIME and backs off as long as another remote is heard
+    // Returns false if the channel was still busy after kRF_MAX_BACKOFFS back-offs
+    //
+
+    for (int backoff = 0; RemoteReceiver::isReceiving(kRF_LISTEN_TIME); backoff++)
+    {
+        if (backoff == kRF_MAX_BACKOFFS)
+            return false;
+
+        // Random part keeps two waiting transmitters from starting at the same time again
+        unsigned int window = kRF_BACKOFF_MIN << backoff;
+        vTaskDelay((window + micros() % window) / portTICK_RATE_MS);
+
+        entry->backoffs++;
+        Metrics::add(METRIC_RF_BACKOFFS);
+    }
+
+    return true;
+}
+
+RfDeviceStats *RfScheduler::statsFor(const void *device, uint32_t jobSequence)
+{
+    //
+    // Statistics entry of a device, the least recently sent device is replaced when there is none yet
+    // (only used by the RF task)
+    //
+
+    RfDeviceStats *oldest = &stats[0];
+
+    for (int i = 0; i < kRF_STATS_DEVICES; i++)
+    {
+        if (stats[i].device == device)
+        {
+            stats[i].lastSent = jobSequence;
+            return &stats[i];
+        }
+
+        if (stats[i].device == NULL || (oldest->device != NULL && (int32_t)(stats[i].lastSent - oldest->lastSent) < 0))
+            oldest = &stats[i];
+    }
+
+    memset(oldest, 0, sizeof(RfDeviceStats));
+    oldest->device = device;
+    oldest->lastSent = jobSequence;
+    return oldest;
+}
+
+bool RfScheduler::deviceStats(const void *device, RfDeviceStats *copy)
+{
+    //
+    // Copies the transmit statistics of a device, returns false if nothing was sent for it (or it was replaced)
+    //
+
+    for (int i = 0; i < kRF_STATS_DEVICES; i++)
+    {
+        if (stats[i].device == device)
+        {
+            *copy = stats[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void RfScheduler::forget(const void *device)
+{
+    //
+    // Drops the waiting jobs and the statistics of a device that is about to be deleted
+    // (a new device can get the same address, it must not inherit them)
+    // Callers waiting for the dropped jobs are released
+    //
+
+    xSemaphoreHandle notify[kRF_MAX_JOBS * kRF_JOB_NOTIFY];
+    int notifyCount = 0;
+
+    taskENTER_CRITICAL();
+
+    for (int i = 0; i < kRF_MAX_JOBS; i++)
+    {
+        RfJob *job = &jobs[i];
+
+        if (!job->used || (job->device != device && job->statsDevice != device))
+            continue;
+
+        for (int j = 0; j < kRF_JOB_NOTIFY; j++)
+        {
+            if (job->notify[j] != NULL)
+                notify[notifyCount++] = job->notify[j];
+        }
+
+        job->used = false;
+    }
+
+    for (int i = 0; i < kRF_STATS_DEVICES; i++)
+    {
+        if (stats[i].device == device)
+            memset(&stats[i], 0, sizeof(RfDeviceStats));
+    }
+
+    taskEXIT_CRITICAL();
+
+    while (notifyCount > 0)
+    {
+        xSemaphoreGive(notify[--notifyCount]);
+    }
+}
+
+void RfScheduler::task(void *pvParameters)
+{
+    //
+    // RF transmit task, sends queued jobs one after another
+    //
+
+    (void)pvParameters;
+
+    RfJob job;
+
+    while (1)
+    {
+        xSemaphoreTake(pending, portMAX_DELAY);
+
+        while (takeNextJob(&job))
+        {
+            transmit(&job);
+
+            for (int i = 0; i < kRF_JOB_NOTIFY; i++)
+            {
+                if (job.notify[i] != NULL)
+                    xSemaphoreGive(job.notify[i]);
+            }
+        }
+    }
+}
+
+RfJob RfScheduler::jobs[kRF_MAX_JOBS];
+RfDeviceStats RfScheduler::stats[kRF_STATS_DEVICES];
+uint32_t RfScheduler::sequence = 0;
+xSemaphoreHandle RfScheduler::pending = NULL;
@@ -0,0 +1,97 @@
+/*
+**
+**                           RfScheduler.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef RFSCHEDULER_H_INCLUDED
+#define RFSCHEDULER_H_INCLUDED
+
+#include "RemoteTransmitter.h"
+#include "RemoteReceiver.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+//
+// RF transmit scheduler
+// Devices queue their (already encoded) telegrams and return right away, a single task puts them on air.
+// User commands go before background ones, a job that is still waiting for the same device is replaced
+// by the new telegram so only the final state is sent. A group telegram replaces the waiting jobs of all
+// devices it switches.
+// Repeats are sent in bursts with listen-before-talk: the receiver runs between the bursts, a burst waits
+// (bounded random back-off) while another remote is heard, so remote presses are decoded in between and
+// neighbouring remotes are not overrun. Fewer repeats are sent when the channel was free.
+//
+
+#define kRF_MAX_JOBS 8
+#define kRF_JOB_NOTIFY 2                // Callers waiting for the same job
+#define kRF_BURST_REPEATS 4             // Repeats sent back to back
+#define kRF_CLEAR_BURSTS 2              // Bursts a telegram needs when the channel was free before each of them
+#define kRF_LISTEN_TIME 60              // ms the channel is checked before a burst (longer than a slow PT2262 telegram)
+#define kRF_BACKOFF_MIN 40              // ms, first back-off on a busy channel (doubled for every further one, plus up to as much at random)
+#define kRF_MAX_BACKOFFS 4              // Burst is sent anyway after this many back-offs
+#define kRF_STATS_DEVICES 8             // Devices with transmit statistics (least recently sent ones are replaced)
+
+typedef enum
+{
+    RF_PRIORITY_BACKGROUND,             // Restored state, timed actions
+    RF_PRIORITY_USER                    // Menu, remote buttons, web and API
+} RfPriority;
+
+typedef struct
+{
+    bool used;
+    uint8_t priority;
+    uint32_t sequence;                  // Order of jobs with the same priority
+    const void *device;                 // Only compared, never dereferenced (device can be deleted while queued)
+    const void *statsDevice;            // Statistics are kept for this device (first member of a group telegram)
+    RfTelegram telegram;
+    xSemaphoreHandle notify[kRF_JOB_NOTIFY];
+} RfJob;
+
+typedef struct
+{
+    const void *device;
+    uint32_t lastSent;                  // Sequence of the last job
+    uint32_t telegrams;                 // Jobs sent
+    uint32_t bursts;
+    uint32_t retries;                   // Bursts sent because an earlier one started on a busy channel
+    uint32_t backoffs;
+} RfDeviceStats;
+
+class RfScheduler
+{
+    public:
+    static void init();
+    static bool send(const void *device, const RfTelegram *telegram, RfPriority priority, xSemaphoreHandle done = NULL);
+    static bool sendGroup(const void *group, const void *const *members, int memberCount, const RfTelegram *telegram, RfPriority priority);
+    static bool deviceStats(const void *device, RfDeviceStats *stats);
+    static void forget(const void *device);
+    static void task(void *pvParameters);
+
+    private:
+    static RfJob *queue(const void *device, const RfTelegram *telegram, RfPriority priority, xSemaphoreHandle done);
+    static bool takeNextJob(RfJob *job);
+    static void transmit(const RfJob *job);
+    static bool waitForChannel(RfDeviceStats *entry);
+    static RfDeviceStats *statsFor(const void *device, uint32_t jobSequence);
+    static RfJob jobs[kRF_MAX_JOBS];
+    static RfDeviceStats stats[kRF_STATS_DEVICES];
+    static uint32_t sequence;
+    static xSemaphoreHandle pending;
+};
+
+#endif /* RFSCHEDULER_H_INCLUDED */
@@ -0,0 +1,35 @@
+/*
+**
+**                           StateVersion.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "StateVersion.h"
+
+void StateVersion::bump()
+{
+    version++;
+
+    // 0 is reserved for "no version"
+    if (version == 0)
+        version = 1;
+}
+
+uint32_t StateVersion::get()
+{
+    return version;
+}
+
+volatile uint32_t StateVersion::version = 1;
@@ -0,0 +1,39 @@
+/*
+**
+**                           StateVersion.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef STATEVERSION_H_INCLUDED
+#define STATEVERSION_H_INCLUDED
+
+#include "stm32f4xx.h"
+
+//
+// Global state version
+// Incremented whenever a device or the configuration changes so that
+// anything derived from the state (cached web responses) knows when it is stale
+//
+class StateVersion
+{
+    public:
+    static void bump();
+    static uint32_t get();
+
+    private:
+    static volatile uint32_t version;
+};
+
+#endif /* STATEVERSION_H_INCLUDED */
@@ -120,8 +120,8 @@ void Label::setColor(uint16_t bgColor1, uint16_t color1)
     clearCurrent();
     needsUpdate = true;
 
-    bgColor = bgColor;
-    color = color;
+    bgColor = bgColor1;
+    color = color1;
 
     draw();
 }
@@ -293,7 +293,7 @@ void TM_ILI9341_Rotate(TM_ILI9341_Orientation_t orientation)
 	}
 }
 
-void TM_ILI9341_Puts(uint16_t x, uint16_t y, char *str, TM_FontDef_t *font, uint16_t foreground, uint16_t background)
+void TM_ILI9341_Puts(uint16_t x, uint16_t y, const char *str, TM_FontDef_t *font, uint16_t foreground, uint16_t background)
 {
     taskENTER_CRITICAL();
 
@@ -325,7 +325,7 @@ void TM_ILI9341_Puts(uint16_t x, uint16_t y, char *str, TM_FontDef_t *font, uint
 	taskEXIT_CRITICAL();
 }
 
-void TM_ILI9341_GetStringSize(char *str, TM_FontDef_t *font, uint16_t *width, uint16_t *height)
+void TM_ILI9341_GetStringSize(const char *str, TM_FontDef_t *font, uint16_t *width, uint16_t *height)
 {
 	uint16_t w = 0;
 	*height = font->FontHeight;
@@ -270,7 +270,7 @@ extern void TM_ILI9341_Putc(uint16_t x, uint16_t y, char c, TM_FontDef_t *font,
  * 	- uint16_t foreground: color for string
  * 	- uint16_t background: color for string background
  */
-extern void TM_ILI9341_Puts(uint16_t x, uint16_t y, char *str, TM_FontDef_t *font, uint16_t foreground, uint16_t background);
+extern void TM_ILI9341_Puts(uint16_t x, uint16_t y, const char *str, TM_FontDef_t *font, uint16_t foreground, uint16_t background);
 
 /**
  * Get width and height of box with text
@@ -281,7 +281,7 @@ extern void TM_ILI9341_Puts(uint16_t x, uint16_t y, char *str, TM_FontDef_t *fon
  * 	- uint16_t *width: Pointer to variable to store width
  * 	- uint16_t *height: ointer to variable to store height
  */
-extern void TM_ILI9341_GetStringSize(char *str, TM_FontDef_t *font, uint16_t *width, uint16_t *height);
+extern void TM_ILI9341_GetStringSize(const char *str, TM_FontDef_t *font, uint16_t *width, uint16_t *height);
 
 /**
  * Draw line to LCD
@@ -119,6 +119,8 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend			1
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_uxTaskGetStackHighWaterMark	1
+#define INCLUDE_pcTaskGetTaskName		1
 
 // JEK -> No idea!  See line 456 in task.c where this is used.
 #define portALIGNMENT_ASSERT_pxCurrentTCB
@@ -6,6 +6,7 @@
  */
 
 #include "RemoteReceiver.h"
+#include "Metrics.h"
 
 /*
 #define bitRead(value, bit) (((value) >> (bit)) & 0x01)
@@ -19,11 +20,24 @@
 ************/
 
 int8_t RemoteReceiver::_interrupt;
-volatile int8_t RemoteReceiver::_state;
+RfDecoderState RemoteReceiver::_decoders[kRF_CODINGS];
+unsigned long RemoteReceiver::_lastEdge = 0;
+volatile bool RemoteReceiver::_active = false;
+volatile portTickType RemoteReceiver::_lastActivity = 0;
 uint8_t RemoteReceiver::_minRepeats;
 RemoteReceiverCallBack RemoteReceiver::_callback;
 bool RemoteReceiver::_inCallback = false;
 bool RemoteReceiver::_enabled = false;
+volatile bool RemoteReceiver::_resync = false;
+volatile bool RemoteReceiver::_overrun = false;
+volatile uint32_t RemoteReceiver::_edges[kRF_EDGE_BUFFER];
+volatile uint16_t RemoteReceiver::_edgeHead = 0;
+volatile uint16_t RemoteReceiver::_edgeTail = 0;
+volatile bool RemoteReceiver::_capturing = false;
+volatile uint32_t RemoteReceiver::_captureCount = 0;
+bool RemoteReceiver::_captureHasLast = false;
+uint32_t RemoteReceiver::_captureLast = 0;
+uint16_t RemoteReceiver::_capture[kRF_CAPTURE_SIZE];
 
 void RemoteReceiver::init(unsigned short minRepeats, RemoteReceiverCallBack callback) {
 
@@ -63,7 +77,8 @@ void RemoteReceiver::init(unsigned short minRepeats, RemoteReceiverCallBack call
 }
 
 void RemoteReceiver::enable() {
-	_state = -1;
+	resetDecoders();
+	_resync = true;
 	_enabled = true;
 }
 
@@ -77,143 +92,378 @@ void RemoteReceiver::interruptHandler() {
 		return;
 	}
 
-	static unsigned int period;				// Calculated duration of 1 period
-	static uint16_t receivedBit;				// Contains "bit" currently receiving
-	static unsigned long receivedCode;		// Contains received code
-	static unsigned long previousCode;		// Contains previous received code
-	static uint8_t repeats = 0;				// The number of times the an identical code is received in a row.
-	static unsigned long edgeTimeStamp[3] = {0, };	// Timestamp of edges
-	static unsigned int min1Period, max1Period, min3Period, max3Period;
-	static bool skip;
+	// Only the time of the edge is taken here, noise costs a few cycles per edge
+	uint16_t head = _edgeHead;
+	if ((uint16_t)(head - _edgeTail) >= kRF_EDGE_BUFFER) {
+		Metrics::add(METRIC_RF_EDGES_DROPPED);
+		_overrun = true;
+		return;
+	}
 
-	// Filter out too short pulses. This method works as a low pass filter.
-	edgeTimeStamp[1] = edgeTimeStamp[2];
-	edgeTimeStamp[2] = micros();
+	_edges[head & (kRF_EDGE_BUFFER - 1)] = micros();
+	_edgeHead = head + 1;
+}
 
-	if (skip) {
-		skip = false;
-		return;
+void RemoteReceiver::decode() {
+	if (_resync) {
+		// Edges stored before enable() belong to our own transmission
+		_resync = false;
+		_edgeTail = _edgeHead;
+		resetDecoders();
+	}
+
+	uint16_t head = _edgeHead;
+	bool received = _edgeTail != head;
+
+	while (_edgeTail != head) {
+		uint32_t edgeTime = _edges[_edgeTail & (kRF_EDGE_BUFFER - 1)];
+		if (_capturing) {
+			capture(edgeTime, false);
+		}
+		handleEdge(edgeTime);
+		_edgeTail++;
+	}
+
+	// A telegram in progress keeps the channel busy for isReceiving (complete ones are noted by report)
+	for (int i = 0; i < kRF_CODINGS && received; i++) {
+		if (_decoders[i].state >= kRF_REJECT_MIN_PARTS) {
+			_lastActivity = xTaskGetTickCount();
+			_active = true;
+		}
 	}
 
-	if (_state >= 0 && edgeTimeStamp[2]-edgeTimeStamp[1] < min1Period) {
-		// Last edge was too short.
-		// Skip this edge, and the next too.
-		skip = true;
+	if (_overrun) {
+		// Edges were lost, the code that was being received can not be complete
+		_overrun = false;
+		resetDecoders();
+		if (_capturing) {
+			capture(0, true);
+		}
+	}
+}
+
+void RemoteReceiver::capture(uint32_t edgeTime, bool lost) {
+	if (lost) {
+		_capture[_captureCount & (kRF_CAPTURE_SIZE - 1)] = kRF_CAPTURE_LOST;
+		_captureCount++;
+		_captureHasLast = false;
 		return;
 	}
 
-	unsigned int duration = edgeTimeStamp[1] - edgeTimeStamp[0];
-	edgeTimeStamp[0] = edgeTimeStamp[1];
+	if (_captureHasLast) {
+		uint32_t duration = edgeTime - _captureLast;
+		if (duration == kRF_CAPTURE_LOST) {
+			duration = 1;
+		}
+		_capture[_captureCount & (kRF_CAPTURE_SIZE - 1)] = (duration > kRF_CAPTURE_MAX)? kRF_CAPTURE_MAX : duration;
+		_captureCount++;
+	}
 
-	// Note that if state>=0, duration is always >= 1 period.
+	_captureLast = edgeTime;
+	_captureHasLast = true;
+}
 
-	if (_state==-1) { // Waiting for sync-signal
-		if (duration>3720) { // =31*120 minimal time between two edges before decoding starts.
-			// Sync signal received.. Preparing for decoding
-			period=duration/31;
-			receivedCode=previousCode=repeats=0;
+void RemoteReceiver::startCapture() {
+	_capturing = false;
+	_captureCount = 0;
+	_captureHasLast = false;
+	_capturing = true;
+}
+
+void RemoteReceiver::stopCapture() {
+	_capturing = false;
+}
+
+bool RemoteReceiver::isCapturing() {
+	return _capturing;
+}
+
+int RemoteReceiver::captureLength() {
+	return (_captureCount > kRF_CAPTURE_SIZE)? kRF_CAPTURE_SIZE : _captureCount;
+}
+
+uint16_t RemoteReceiver::captureAt(int index) {
+	uint32_t first = _captureCount - captureLength();
+	return _capture[(first + index) & (kRF_CAPTURE_SIZE - 1)];
+}
 
-			// Allow for large error-margin. ElCheapo-hardware :(
-			min1Period=period*4/10; // Avoid floating point math; saves memory.
-			max1Period=period*16/10;
-			min3Period=period*23/10;
-			max3Period=period*37/10;
+void RemoteReceiver::task(void *pvParameters) {
+	(void)pvParameters;
+
+	while (1) {
+		decode();
+		vTaskDelay(kRF_DECODE_INTERVAL / portTICK_RATE_MS);
+	}
+}
+
+void RemoteReceiver::resetDecoders() {
+	for (int i = 0; i < kRF_CODINGS; i++) {
+		_decoders[i].state = -1;
+		_decoders[i].mergeNext = false;
+	}
+}
+
+void RemoteReceiver::handleEdge(unsigned long edgeTime) {
+	// Duration is taken once, every coding steps its own state machine with it
+	unsigned int duration = edgeTime - _lastEdge;
+	_lastEdge = edgeTime;
+
+	for (int i = 0; i < kRF_CODINGS; i++) {
+		stepDecoder((RfCoding)i, duration);
+	}
+}
+
+void RemoteReceiver::stepDecoder(RfCoding coding, unsigned int duration) {
+	RfDecoderState *decoder = &_decoders[coding];
+
+	// Filter out too short pulses. This method works as a low pass filter: a glitch and the pulse after it
+	// are added to the pulse before, which is only handled once the next edge shows it was not split.
+	if (decoder->state >= 0) {
+		if (decoder->mergeNext) {
+			decoder->held += duration;
+			decoder->mergeNext = false;
+			return;
 		}
-		else {
+		if (duration < decoder->glitch) {
+			decoder->held += duration;
+			decoder->mergeNext = true;
 			return;
 		}
-	} else if (_state<48) { // Decoding message
-		receivedBit <<= 1;
+	}
+
+	unsigned int part = decoder->held;
+	decoder->held = duration;
+
+	if (decoder->state < 0) {
+		sync(coding, part);
+	}
+	else if (coding == RF_CODING_TRIT) {
+		handleTritPart(decoder, part);
+	}
+	else {
+		handlePulseDistancePart(decoder, part);
+	}
+}
+
+void RemoteReceiver::sync(RfCoding coding, unsigned int duration) {
+	const RfCodingTiming *timing = RfProtocols::timing(coding);
+	RfDecoderState *decoder = &_decoders[coding];
+	unsigned int period = duration / timing->syncPeriods;
+
+	if (period < timing->minPeriod || period > timing->maxPeriod) {
+		return;
+	}
+
+	// Sync signal received.. Preparing for decoding. Part limits are calculated once per sync.
+	decoder->period = period;
+	decoder->glitch = period * timing->glitch / 10;
+	decoder->dataParts = timing->dataParts;
+	for (int i = 0; i < kRF_PARTS; i++) {
+		decoder->bounds[i][0] = period * timing->parts[i].min / 10;
+		decoder->bounds[i][1] = period * timing->parts[i].max / 10;
+	}
+
+	decoder->previousCode = 0;
+	decoder->repeats = 0;
+	restart(decoder);
+}
+
+void RemoteReceiver::restart(RfDecoderState *decoder) {
+	decoder->data = 0;
+	decoder->symbol = 0;
+	decoder->dim = false;
+	decoder->dimLevel = 0;
+	decoder->state = 0;
+}
+
+void RemoteReceiver::reject(RfDecoderState *decoder) {
+	// A sync of one coding is often a sync of another, only signals that got further are counted
+	if (decoder->state >= kRF_REJECT_MIN_PARTS) {
+		Metrics::add(METRIC_RF_REJECTED);
+	}
+	decoder->state = -1;
+}
+
+bool RemoteReceiver::isPart(const RfDecoderState *decoder, RfPart part, unsigned int duration) {
+	return duration >= decoder->bounds[part][0] && duration <= decoder->bounds[part][1];
+}
+
+void RemoteReceiver::handleTritPart(RfDecoderState *decoder, unsigned int duration) {
+	if (decoder->state < decoder->dataParts) { // Decoding message
+		decoder->symbol <<= 1;
 
 		// bit part durations can ONLY be 1 or 3 periods.
-		if (duration<=max1Period) {
-			receivedBit &= 0b1110; // Clear LSB of receivedBit
-		}
-		else if (duration>=min3Period && duration<=max3Period) {
-			receivedBit |= 0b1; // Set LSB of receivedBit
+		if (isPart(decoder, RF_PART_LONG, duration)) {
+			decoder->symbol |= 0b1;
 		}
-		else { // Otherwise the entire sequence is invalid
-			_state=-1;
+		else if (!isPart(decoder, RF_PART_SHORT, duration)) { // Otherwise the entire sequence is invalid
+			reject(decoder);
 			return;
 		}
 
-		if ((_state%4)==3) { // Last bit part?
-			// Shift
-			receivedCode*=3;
-
+		if ((decoder->state % 4) == 3) { // Last bit part?
 			// Only 4 LSB's are used; trim the rest.
-			switch (receivedBit & 0b1111) {
+			switch (decoder->symbol & 0b1111) {
 				case 0b0101: // short long short long == B0101
 					// bit "0" received
-					receivedCode+=0; // I hope the optimizer handles this ;)
+					decoder->data = decoder->data * 3;
 					break;
 				case 0b1010: // long short long short == B1010
 					// bit "1" received
-					receivedCode+=1;
+					decoder->data = decoder->data * 3 + 1;
 					break;
 				case 0b0110: // short long long short
 					// bit "f" received
-					receivedCode+=2;
+					decoder->data = decoder->data * 3 + 2;
 					break;
 				default:
 					// Bit was rubbish. Abort.
-					_state=-1;
+					reject(decoder);
 					return;
 			}
 		}
-	} else if (_state==48) { // Waiting for sync bit part 1
+	}
+	else if (decoder->state == decoder->dataParts) { // Waiting for sync bit part 1
 		// Must be 1 period.
-		if (duration>max1Period) {
-			_state=-1;
+		if (!isPart(decoder, RF_PART_SHORT, duration)) {
+			reject(decoder);
 			return;
 		}
-	} else { // Waiting for sync bit part 2
+	}
+	else { // Waiting for sync bit part 2
 		// Must be 31 periods.
-		if (duration<period*25 || duration>period*36) {
-		  _state=-1;
-		  return;
+		if (!isPart(decoder, RF_PART_STOP, duration)) {
+			reject(decoder);
+			return;
 		}
 
-		// receivedCode is a valid code!
+		RfCode code;
+		RfProtocols::parseTrits(decoder->data, decoder->period, &code);
+		report(decoder, &code);
+		return;
+	}
 
-		if (receivedCode!=previousCode) {
-			repeats=0;
-			previousCode=receivedCode;
+	decoder->state++;
+}
+
+void RemoteReceiver::handlePulseDistancePart(RfDecoderState *decoder, unsigned int duration) {
+	// Dim telegrams have 4 more bits (the dim level)
+	int dataParts = decoder->dataParts + ((decoder->dim)? 16 : 0);
+
+	if ((decoder->state % 2) == 0) { // High parts are always 1 period
+		if (!isPart(decoder, RF_PART_SHORT, duration)) {
+			reject(decoder);
+			return;
 		}
+	}
+	else if (decoder->state == 1) { // Low part of the start pulse, 10 periods
+		if (!isPart(decoder, RF_PART_START, duration)) {
+			reject(decoder);
+			return;
+		}
+	}
+	else if (decoder->state < dataParts) { // Low parts of the bits, 1 or 5 periods
+		decoder->symbol <<= 1;
 
-		repeats++;
+		if (isPart(decoder, RF_PART_LONG, duration)) {
+			decoder->symbol |= 0b1;
+		}
+		else if (!isPart(decoder, RF_PART_SHORT, duration)) {
+			reject(decoder);
+			return;
+		}
+
+		if ((decoder->state % 4) == 1) { // Second pulse of a bit
+			int bit = (decoder->state - 2) / 4;
+			uint8_t value;
 
-		if (repeats>=_minRepeats) {
-			if (!_inCallback) {
-				_inCallback = true;
-				(_callback)(receivedCode, period);
-				_inCallback = false;
+			switch (decoder->symbol & 0b11) {
+				case 0b01:
+					value = 0;
+					break;
+				case 0b10:
+					value = 1;
+					break;
+				case 0b00:
+					// Neither on nor off, a dim level follows
+					if (bit != kRF_NEW_KAKU_DIM_BIT) {
+						reject(decoder);
+						return;
+					}
+					decoder->dim = true;
+					value = 0;
+					break;
+				default:
+					reject(decoder);
+					return;
 			}
-			// Reset after callback.
-			_state=-1;
+
+			if (bit < kRF_NEW_KAKU_BITS) {
+				decoder->data = (decoder->data << 1) | value;
+			}
+			else {
+				decoder->dimLevel = (decoder->dimLevel << 1) | value;
+			}
+		}
+	}
+	else { // Low part of the stop pulse, 40 periods
+		if (!isPart(decoder, RF_PART_STOP, duration)) {
+			reject(decoder);
 			return;
 		}
 
-		// Reset for next round
-		receivedCode = 0;
-		_state=0; // no need to wait for another sync-bit!
+		RfCode code;
+		RfProtocols::parseNewKaku(decoder->data, decoder->dim, decoder->dimLevel, decoder->period, &code);
+		report(decoder, &code);
+		return;
+	}
+
+	decoder->state++;
+}
+
+void RemoteReceiver::report(RfDecoderState *decoder, const RfCode *code) {
+	// code is a valid code!
+
+	_lastActivity = xTaskGetTickCount();
+	_active = true;
+
+	if (code->code != decoder->previousCode) {
+		decoder->repeats = 0;
+		decoder->previousCode = code->code;
+	}
+
+	decoder->repeats++;
+
+	if (decoder->repeats >= _minRepeats) {
+		Metrics::add(METRIC_RF_DECODED);
+		if (!_inCallback) {
+			_inCallback = true;
+			(_callback)(code);
+			_inCallback = false;
+		}
+		// Reset after callback.
+		decoder->state = -1;
 		return;
 	}
 
-	_state++;
-	return;
+	// Reset for next round, no need to wait for another sync-bit!
+	restart(decoder);
 }
 
 bool RemoteReceiver::isReceiving(int waitMillis) {
-	unsigned long startTime=millis();
+	portTickType start = xTaskGetTickCount();
 
-	int waited; // Signed int!
-	do {
-		if (_state == 48) { // Abort if a valid code has been received in the mean time
+	while (1) {
+		portTickType now = xTaskGetTickCount();
+
+		if (_active && now - _lastActivity < kRF_ACTIVITY_HOLD / portTICK_RATE_MS) {
 			return true;
 		}
-		waited = (millis()-startTime);
-	} while(waited>=0 && waited <= waitMillis); // Yes, clock wraps every 50 days. And then you'd have to wait for a looooong time.
+		if (now - start >= waitMillis / portTICK_RATE_MS) {
+			return false;
+		}
 
-	return false;
+		// Decoding runs in the RF task, there is nothing new before its next run
+		vTaskDelay(kRF_DECODE_INTERVAL / portTICK_RATE_MS);
+	}
 }
@@ -21,8 +21,38 @@
 #include "misc.h"
 #include "stm32f4xx_syscfg.h"
 #include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "RfProtocol.h"
 
-typedef void (*RemoteReceiverCallBack)(unsigned long, unsigned int);
+#define kRF_EDGE_BUFFER 128			// Edge timestamps waiting to be decoded (power of two)
+#define kRF_DECODE_INTERVAL 10		// ms between decoding runs of the RF task
+#define kRF_CAPTURE_SIZE 1024		// Edge durations kept by the capture mode (power of two)
+#define kRF_CAPTURE_MAX 0xFFFF		// Longer durations are recorded as this
+#define kRF_CAPTURE_LOST 0			// Recorded where edges were lost (the edge buffer overran)
+#define kRF_REJECT_MIN_PARTS 4		// Signals rejected earlier are not counted (the sync of one coding is often the sync of another)
+#define kRF_ACTIVITY_HOLD 100		// ms the channel counts as busy after a compatible signal was seen
+
+typedef void (*RemoteReceiverCallBack)(const RfCode *code);
+
+/**
+* State machine of one coding (see RfCoding).
+*/
+typedef struct {
+	volatile int16_t state;		// -1 while waiting for a sync, otherwise the number of parts received
+	uint16_t period;
+	uint8_t dataParts;			// Parts before the sync (without a dim level)
+	uint32_t bounds[kRF_PARTS][2];	// Part limits in microseconds, calculated from the sync
+	uint32_t glitch;			// Shorter pulses are merged into their neighbours
+	uint32_t held;				// Last part, handled once the next edge shows it was not split by a glitch
+	bool mergeNext;				// Next part belongs to held (it follows a glitch)
+	uint8_t symbol;				// Parts of the current trit or bit, 1 for long ones
+	uint32_t data;				// Trits as a base 3 number or bits
+	bool dim;
+	uint8_t dimLevel;
+	uint32_t previousCode;
+	uint8_t repeats;			// The number of times the an identical code is received in a row.
+} RfDecoderState;
 
 /**
 * See RemoteSwitch for introduction.
@@ -31,7 +61,12 @@ typedef void (*RemoteReceiverCallBack)(unsigned long, unsigned int);
 * as well as the signal sent by the RemoteSwtich class. When a correct signal is received,
 * a user-defined callback function is called.
 *
-* Note that in the callback function, the interrupts are still disabled. You can enabled them, if needed.
+* Every line coding (RfCoding) has its own state machine with timing limits from a table (RfProtocols::timing).
+* The duration of an edge is calculated once and every machine takes one step with it. Complete telegrams are
+* parsed into protocol, address, unit and command (PT2262 telegrams by the layouts of the supported brands).
+*
+* The interrupt handler only stores the time of each edge (TIM2 counter) into a ring buffer. Edges are decoded
+* in batches by task() and the callback is called from that task, with interrupts enabled.
 * A call to the callback must b finished before RemoteReceiver will call the callback function again, thus
 * there is no re-entrant problem.
 *
@@ -52,7 +87,7 @@ class RemoteReceiver {
 		* @param interrupt 	The interrupt as is used by Arduino's attachInterrupt function. See attachInterrupt for details.
 							If < 0, you must call interruptHandler() yourself.
 		* @param minRepeats The number of times the same code must be received in a row before the callback is calles
-		* @param callback Pointer to a callback function, with signature void (*func)(unsigned long, unsigned int). First parameter is the decoded data, the second the period of the timing.
+		* @param callback Pointer to a callback function, with signature void (*func)(const RfCode *). The code is only valid during the call.
 		*/
 		static void init(unsigned short minRepeats, RemoteReceiverCallBack callback);
 
@@ -71,24 +106,89 @@ class RemoteReceiver {
 		* Since it makes no sense to transmit while another transmitter is active, it's best to wait for isReceiving() to false.
 		* By default it waits for 150ms, in which a (relative slow) KaKu signal can be broadcasted three times.
 		*
-		* Note: isReceiving() depends on interrupts enabled. Thus, when disabled()'ed, or when interrupts are disabled (as is
-		* the case in the callback), isReceiving() will not work properly.
+		* A signal is compatible once a decoder accepted at least kRF_REJECT_MIN_PARTS parts after a sync, the channel then
+		* counts as busy for kRF_ACTIVITY_HOLD ms. Activity is noted by decode(), so the RF task has to run.
+		*
+		* Note: isReceiving() sleeps between its checks and has to be called from a task. When disabled()'ed, no signal
+		* is seen.
 		*
 		* @param waitMillis number of milliseconds to monitor for signal.
 		* @return boolean If after waitMillis no signal was being processed, returns false. If before expiration a signal was being processed, returns true.
 		*/
 		static bool isReceiving(int waitMillis = 150);
 
+		/**
+		* Stores the time of an edge. Has to be called on every change of the receiver output.
+		*/
 		static void interruptHandler();
 
+		/**
+		* Decodes all stored edges, calls the callback when a code is complete.
+		*/
+		static void decode();
+
+		/**
+		* RF task, runs decode() every kRF_DECODE_INTERVAL ms. Has to be started by the application.
+		*/
+		static void task(void *pvParameters);
+
+		/**
+		* Starts the capture mode: durations between received edges (in microseconds) are recorded by decode(),
+		* earlier recordings are dropped. Only the last kRF_CAPTURE_SIZE durations are kept, decoding goes on as usual.
+		*/
+		static void startCapture();
+
+		/**
+		* Stops recording, the recorded durations stay available.
+		*/
+		static void stopCapture();
+
+		static bool isCapturing();
+
+		/**
+		* @return Number of recorded durations (at most kRF_CAPTURE_SIZE).
+		*/
+		static int captureLength();
+
+		/**
+		* @param index 0 for the oldest recorded duration.
+		* @return Duration in microseconds, kRF_CAPTURE_MAX for longer ones and kRF_CAPTURE_LOST where edges were lost.
+		*/
+		static uint16_t captureAt(int index);
+
 	private:
 
+		static void handleEdge(unsigned long edgeTime);
+		static void stepDecoder(RfCoding coding, unsigned int duration);
+		static void sync(RfCoding coding, unsigned int duration);
+		static void handleTritPart(RfDecoderState *decoder, unsigned int duration);
+		static void handlePulseDistancePart(RfDecoderState *decoder, unsigned int duration);
+		static bool isPart(const RfDecoderState *decoder, RfPart part, unsigned int duration);
+		static void report(RfDecoderState *decoder, const RfCode *code);
+		static void restart(RfDecoderState *decoder);
+		static void reject(RfDecoderState *decoder);
+		static void resetDecoders();
+		static void capture(uint32_t edgeTime, bool lost);
+
 		static int8_t _interrupt;					// Radio input interrupt
-		volatile static int8_t _state;				// State of decoding process. There are 49 states, 1 for "waiting for signal" and 48 for decoding the 48 edges in a valid code.
+		static RfDecoderState _decoders[kRF_CODINGS];
+		static unsigned long _lastEdge;				// Time of the last decoded edge
+		volatile static bool _active;				// A compatible signal was seen (at _lastActivity)
+		volatile static portTickType _lastActivity;
 		static uint8_t _minRepeats;
 		static RemoteReceiverCallBack _callback;
 		static bool _inCallback;					// When true, the callback function is being executed; prevents re-entrance.
 		static bool _enabled;					// If true, monitoring and decoding is enabled. If false, interruptHandler will return immediately.
+		volatile static bool _resync;				// Set by enable(), the decoder drops the stored edges and waits for a new sync
+		volatile static bool _overrun;				// Set by interruptHandler when an edge did not fit into the buffer
+		volatile static uint32_t _edges[kRF_EDGE_BUFFER];	// Edge timestamps, written by interruptHandler and read by decode
+		volatile static uint16_t _edgeHead;			// Written only by interruptHandler
+		volatile static uint16_t _edgeTail;			// Written only by decode
+		volatile static bool _capturing;
+		volatile static uint32_t _captureCount;		// Durations recorded since startCapture
+		static bool _captureHasLast;				// False until the first edge of a capture (or after lost edges)
+		static uint32_t _captureLast;				// Time of the last recorded edge
+		static uint16_t _capture[kRF_CAPTURE_SIZE];	// Ring of recorded durations
 
 
 };
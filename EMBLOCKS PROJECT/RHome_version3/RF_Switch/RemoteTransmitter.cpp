@@ -7,28 +7,67 @@
 
 #include "RemoteTransmitter.h"
 #include "RemoteReceiver.h"
+#include "Metrics.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_gpio.h"
+#include "stm32f4xx_tim.h"
+#include "misc.h"
 
 
 /************
 * RemoteTransmitter
 ************/
 
+uint8_t RemoteTransmitter::_pulses[kRF_NEW_KAKU_PULSES];
+uint8_t RemoteTransmitter::_pulseCount = kRF_TELEGRAM_PULSES;
+volatile uint8_t RemoteTransmitter::_pulse = 0;
+volatile uint16_t RemoteTransmitter::_repeatsLeft = 0;
+unsigned int RemoteTransmitter::_period = 0;
+xSemaphoreHandle RemoteTransmitter::_done = NULL;
+xSemaphoreHandle RemoteTransmitter::_lock = NULL;
+
 void RemoteTransmitter::initGPIO()
 {
     GPIO_InitTypeDef GPIO_InitStructure;
 
+  if (_done != NULL) {
+	// Shared by all transmitters
+	return;
+  }
+
   RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
 
   GPIO_InitStructure.GPIO_Pin = RF_Transmit_Pin;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
+  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
   GPIO_InitStructure.GPIO_Speed = GPIO_Speed_100MHz;
   GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
   GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
 
 
   GPIO_Init(GPIOA, &GPIO_InitStructure);
+  GPIO_PinAFConfig(GPIOA, GPIO_PinSource15, GPIO_AF_TIM2);
+
+  // TIM2 already runs at 1MHz (essentials), channel 1 is used in output compare mode
+  // Output is held low between transmissions
+  TIM_OCInitTypeDef TIM_OCInitStructure;
+  TIM_OCStructInit(&TIM_OCInitStructure);
+  TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_Timing;
+  TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
+  TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
+  TIM_OC1Init(TIM2, &TIM_OCInitStructure);
+  TIM_ForcedOC1Config(TIM2, TIM_ForcedAction_InActive);
+
+  // Interrupt gives a semaphore, has to be below configMAX_SYSCALL_INTERRUPT_PRIORITY
+  NVIC_InitTypeDef NVIC_InitStructure;
+  NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+
+  vSemaphoreCreateBinary(_done);
+  xSemaphoreTake(_done, 0);
+  _lock = xSemaphoreCreateMutex();
 }
 
 RemoteTransmitter::RemoteTransmitter(unsigned int periodusec, unsigned short repeats) {
@@ -68,17 +107,25 @@ void RemoteTransmitter::sendTelegram(unsigned short trits[]) {
 * d = data
 */
 void RemoteTransmitter::sendTelegram(unsigned long data) {
-    RemoteReceiver::disable();
+	RfTelegram telegram;
+	prepareTelegram(data, &telegram);
+	sendPrepared(&telegram);
+}
 
+void RemoteTransmitter::prepareTelegram(unsigned long data, RfTelegram *telegram) {
 	unsigned int periodusec = (unsigned long)data >> 23;
 	unsigned short repeats = ((unsigned long)data >> 20) & 0b111;
 
-	sendCode(data, periodusec, repeats);
-
-	RemoteReceiver::enable();
+	prepareCode(data, periodusec, repeats, telegram);
 }
 
 void RemoteTransmitter::sendCode(unsigned long code, unsigned int periodusec, unsigned short repeats) {
+	RfTelegram telegram;
+	prepareCode(code, periodusec, repeats, &telegram);
+	sendPrepared(&telegram);
+}
+
+void RemoteTransmitter::prepareCode(unsigned long code, unsigned int periodusec, unsigned short repeats, RfTelegram *telegram) {
 	code &= 0xfffff; // Truncate to 20 bit ;
 	// Convert the base3-code to base4, to avoid lengthy calculations when transmitting.. Messes op timings.
 	unsigned long dataBase4 = 0;
@@ -89,55 +136,136 @@ void RemoteTransmitter::sendCode(unsigned long code, unsigned int periodusec, un
 		code/=3;
 	}
 
-	repeats = 1 << (repeats & 0b111); // repeats := 2^repeats;
+	telegram->dataBase4 = dataBase4;
+	telegram->periodusec = periodusec;
+	telegram->repeats = 1 << (repeats & 0b111); // repeats := 2^repeats;
+	telegram->coding = RF_CODING_TRIT;
+}
+
+void RemoteTransmitter::sendPrepared(const RfTelegram *telegram) {
+	unsigned int periodusec = telegram->periodusec;
+	unsigned short repeats = telegram->repeats;
+
+	Metrics::add(METRIC_RF_TRANSMISSIONS);
+
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	RemoteReceiver::disable();
+
+	unsigned int periods = buildPulses(telegram);
+	startPulses(periodusec, repeats);
+
+	portTickType timeout = ((unsigned long)periodusec * periods * repeats / 1000 + kRF_DONE_MARGIN) / portTICK_RATE_MS;
+	if (xSemaphoreTake(_done, timeout) != pdTRUE) {
+		// Timer did not finish, stop it so the next transmission starts clean
+		TIM_ITConfig(TIM2, TIM_IT_CC1, DISABLE);
+		TIM_ForcedOC1Config(TIM2, TIM_ForcedAction_InActive);
+	}
+
+	RemoteReceiver::enable();
+	xSemaphoreGive(_lock);
+}
 
-	for (unsigned short int j=0;j<repeats;j++) {
-		// Sent one telegram
+/**
+* Fills the pulse table, returns the length of one telegram in periods.
+*/
+unsigned int RemoteTransmitter::buildPulses(const RfTelegram *telegram) {
+	// Pulse lengths of the three trit values (high, low, high, low)
+	static const uint8_t tritPulses[3][4] = {
+		{1, 3, 1, 3},	// 0
+		{3, 1, 3, 1},	// 1
+		{1, 3, 3, 1}	// 2, KA: X or float
+	};
+	// Pulse lengths of the two pulse distance bits
+	static const uint8_t bitPulses[2][4] = {
+		{1, 1, 1, 5},	// 0
+		{1, 5, 1, 1}	// 1
+	};
+
+	unsigned long data = telegram->dataBase4;
+	unsigned int periods = 0;
+	uint8_t *pulse = _pulses;
+
+	if (telegram->coding == RF_CODING_PULSE_DISTANCE) {
+		// Start pulse
+		*pulse++ = 1;
+		*pulse++ = 10;
+
+		for (unsigned short i=0; i<kRF_NEW_KAKU_BITS; i++) {
+			const uint8_t *bit = bitPulses[(data >> 31) & 1];
+			for (unsigned short j=0; j<4; j++) {
+				*pulse++ = bit[j];
+			}
+			data<<=1;
+		}
 
-		// Recycle code as working var to save memory
-		code=dataBase4;
+		// Stop pulse, also the pause before the next repeat
+		*pulse++ = 1;
+		*pulse++ = 40;
+	}
+	else {
 		for (unsigned short i=0; i<12; i++) {
-			switch (code & 0b11) {
-				case 0:
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					break;
-				case 1:
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					break;
-				case 2: // KA: X or float
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec*3);
-					GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-					delay_micro(periodusec);
-					break;
+			const uint8_t *trit = tritPulses[data & 0b11];
+			for (unsigned short j=0; j<4; j++) {
+				*pulse++ = trit[j];
 			}
 			// Next trit
-			code>>=2;
+			data>>=2;
 		}
 
-		// Send termination/synchronisation-signal. Total length: 32 periods
-		GPIO_SetBits(RF_Transmit_Port, RF_Transmit_Pin);
-		delay_micro(periodusec);
-		GPIO_ResetBits(RF_Transmit_Port, RF_Transmit_Pin);
-		delay_micro(periodusec*31);
+		// Termination/synchronisation-signal. Total length: 32 periods
+		*pulse++ = 1;
+		*pulse++ = 31;
+	}
+
+	_pulseCount = pulse - _pulses;
+	for (unsigned short i=0; i<_pulseCount; i++) {
+		periods += _pulses[i];
+	}
+
+	return periods;
+}
+
+void RemoteTransmitter::startPulses(unsigned int periodusec, unsigned short repeats) {
+	_period = periodusec;
+	_pulse = 0;
+	_repeatsLeft = repeats;
+
+	// First compare match raises the output, every following one toggles it
+	TIM_ClearITPendingBit(TIM2, TIM_IT_CC1);
+	TIM2->CCR1 = TIM2->CNT + kRF_START_DELAY;
+	TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_OC1M) | TIM_OCMode_Toggle;
+	TIM_ITConfig(TIM2, TIM_IT_CC1, ENABLE);
+}
+
+void RemoteTransmitter::interruptHandler() {
+	if (TIM_GetITStatus(TIM2, TIM_IT_CC1) == RESET) {
+		return;
+	}
+	TIM_ClearITPendingBit(TIM2, TIM_IT_CC1);
+
+	if (_pulse == _pulseCount) {
+		// End of the last sync (compare was frozen, output stayed low)
+		TIM_ITConfig(TIM2, TIM_IT_CC1, DISABLE);
+		TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_OC1M) | TIM_ForcedAction_InActive;
+
+		signed portBASE_TYPE woken = pdFALSE;
+		xSemaphoreGiveFromISR(_done, &woken);
+		portEND_SWITCHING_ISR(woken);
+		return;
+	}
+
+	TIM2->CCR1 += _pulses[_pulse] * _period;
+	_pulse++;
+
+	if (_pulse == _pulseCount) {
+		if (--_repeatsLeft > 0) {
+			// Next telegram starts with the toggle at the end of this sync
+			_pulse = 0;
+		}
+		else {
+			// Last sync, the compare match at its end must not raise the output
+			TIM2->CCMR1 &= ~TIM_CCMR1_OC1M;
+		}
 	}
 }
 
@@ -250,7 +378,7 @@ unsigned long KaKuTransmitter::getTelegram(char address, unsigned short device,
 }
 
 void KaKuTransmitter::sendSignal(char address, unsigned short group, unsigned short device, bool on) {
-	sendTelegram(getTelegram(address, group, on));
+	sendTelegram(getTelegram(address, group, device, on));
 }
 
 unsigned long KaKuTransmitter::getTelegram(char address, unsigned short group, unsigned short device, bool on) {
@@ -323,3 +451,32 @@ unsigned long ElroTransmitter::getTelegram(unsigned short systemCode, char devic
 
 	return encodeTelegram(trits);
 }
+
+
+/************
+* NewKaKuTransmitter
+************/
+
+NewKaKuTransmitter::NewKaKuTransmitter(unsigned int periodusec, unsigned short repeats) : RemoteTransmitter(periodusec, repeats) {
+	// Call contructor
+}
+
+void NewKaKuTransmitter::sendSignal(unsigned long address, unsigned short unit, bool on) {
+	RfTelegram telegram;
+	prepareSignal(address, false, unit, on, &telegram);
+	sendPrepared(&telegram);
+}
+
+void NewKaKuTransmitter::sendGroup(unsigned long address, bool on) {
+	RfTelegram telegram;
+	prepareSignal(address, true, 1, on, &telegram);
+	sendPrepared(&telegram);
+}
+
+void NewKaKuTransmitter::prepareSignal(unsigned long address, bool group, unsigned short unit, bool on, RfTelegram *telegram) {
+	// Bits 31-6 address, bit 5 group, bit 4 on/off, bits 3-0 unit (see RfProtocols::parseNewKaku)
+	telegram->dataBase4 = ((address & 0x3FFFFFF) << 6) | ((group)? 0x20 : 0) | ((on)? 0x10 : 0) | ((group)? 0 : (unit - 1) & 0xF);
+	telegram->periodusec = _periodusec;
+	telegram->repeats = 1 << (_repeats & 0b111);
+	telegram->coding = RF_CODING_PULSE_DISTANCE;
+}
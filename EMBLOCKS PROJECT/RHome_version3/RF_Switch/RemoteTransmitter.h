@@ -21,9 +21,27 @@ extern "C"
 #endif
 
 #include "essentials.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "RfProtocol.h"
 
-#define RF_Transmit_Port			GPIOA
-#define RF_Transmit_Pin				GPIO_Pin_15
+#define RF_Transmit_Port			GPIOA
+#define RF_Transmit_Pin				GPIO_Pin_15	// TIM2 channel 1
+
+#define kRF_TELEGRAM_PULSES		50			// 12 trits of 4 pulses and the sync pulse pair
+#define kRF_NEW_KAKU_PULSES		(4 + kRF_NEW_KAKU_BITS * 4)	// Start pulse pair, 32 bits of 4 pulses and the stop pulse pair
+#define kRF_START_DELAY			50			// us between arming the timer and the first edge
+#define kRF_DONE_MARGIN			20			// ms added to the telegram duration before a transmission is aborted
+
+/**
+* Telegram ready to be sent (see RemoteTransmitter::prepareTelegram), can be kept by the application
+*/
+typedef struct {
+	unsigned long dataBase4;		// 12 trits of 2 bits, first trit in the lowest bits (pulse distance: 32 bits, first bit highest)
+	uint16_t periodusec;
+	uint16_t repeats;			// Actual number of repeats (not the 2log)
+	uint8_t coding;				// RfCoding
+} RfTelegram;
 
 
 /**
@@ -43,10 +61,25 @@ extern "C"
 *   when appropriate.
 * - I measured the period lengths with a scope.  Thus: they work for my remotes, but may fail for yours...
 *   A better way would be to calculate the 'target'-timings using the datasheets and the resistor-values on the remotes.
+* - A telegram is converted into a table of pulse lengths (in periods) and played out by TIM2 output compare
+*   (toggle mode) on the transmitter pin. The interrupt only loads the next compare value, so edges do not
+*   depend on interrupt latency and the calling task blocks on a semaphore until the last repeat is sent.
+*   The same table is used for the pulse distance telegrams of self-learning KaKu remotes.
 */
 class RemoteTransmitter {
     private:
         void initGPIO();
+        static void prepareCode(unsigned long code, unsigned int periodusec, unsigned short repeats, RfTelegram *telegram);
+        static unsigned int buildPulses(const RfTelegram *telegram);
+        static void startPulses(unsigned int periodusec, unsigned short repeats);
+
+        static uint8_t _pulses[kRF_NEW_KAKU_PULSES];	// Pulse lengths in periods, high and low alternating
+        static uint8_t _pulseCount;			// Pulses of one telegram
+        volatile static uint8_t _pulse;			// Next pulse to load into the compare register
+        volatile static uint16_t _repeatsLeft;		// Telegrams still to be played, including the current one
+        static unsigned int _period;
+        static xSemaphoreHandle _done;			// Given by the interrupt after the last telegram
+        static xSemaphoreHandle _lock;			// One transmission at a time
 	public:
 		/**
 		* Constructor.
@@ -103,6 +136,19 @@ class RemoteTransmitter {
 		*/
 		static void sendCode(unsigned long code, unsigned int periodusec, unsigned short repeats);
 
+		/**
+		* Does all the conversions of sendTelegram without sending. The result can be sent (many times) with sendPrepared.
+		*
+		* @param data data, period and repeats (see sendTelegram).
+		* @param telegram Prepared telegram.
+		*/
+		static void prepareTelegram(unsigned long data, RfTelegram *telegram);
+
+		/**
+		* Sends a prepared telegram. Blocks the calling task until all repeats are sent.
+		*/
+		static void sendPrepared(const RfTelegram *telegram);
+
 		/**
 		* Compares the data received with RemoteReceive with the data obtained by one of the getTelegram-functions.
 		* Period duration and repetitions are ignored by this function; only the data-payload is compared.
@@ -111,6 +157,11 @@ class RemoteTransmitter {
 		*/
 		static bool isSameCode(unsigned long encodedTelegram, unsigned long receivedData);
 
+		/**
+		* TIM2 capture/compare interrupt, loads the next pulse of the transmission.
+		*/
+		static void interruptHandler();
+
 	protected:
 		unsigned int _periodusec;	// Oscillator period in microseconds
 		unsigned short _repeats;	// Number over repetitions of one telegram
@@ -265,6 +316,45 @@ class ElroTransmitter: public RemoteTransmitter {
 		unsigned long getTelegram(unsigned short systemCode, char device, bool on);
 };
 
+/**
+* NewKaKuTransmitter simulates a self-learning KlikAanKlikUit remote (the ones without dials).
+* Receivers learn the address of the remote when they are switched on while in learning mode. A group telegram
+* switches every receiver that learned the address, whatever its unit.
+* Telegrams do not fit the 32 bit data format of the other transmitters, they are prepared directly.
+*/
+class NewKaKuTransmitter: public RemoteTransmitter {
+	public:
+		/**
+		* Constructor
+		*
+		* @param periodsec	Duration of one period, in microseconds. Default is 260usec
+		* @param repeats	[0..7] The 2log-Number of times the signal is repeated. Receivers act on the first good
+		*					telegram, the remotes send 4.
+		* @see RemoteTransmitter
+		*/
+		NewKaKuTransmitter(unsigned int periodusec=260, unsigned short repeats=2);
+
+		/**
+		* Send a on or off signal to a device.
+		*
+		* @param address	26-bit address of the remote. Range [0..67108863]
+		* @param unit	Unit to switch. Range: [1..16]
+		* @param on	True, to switch on. False to switch off,
+		*/
+		void sendSignal(unsigned long address, unsigned short unit, bool on);
+
+		/**
+		* Send a on or off signal to all devices that learned the address.
+		*/
+		void sendGroup(unsigned long address, bool on);
+
+		/**
+		* Prepares a telegram for RemoteTransmitter::sendPrepared. See sendSignal for details on the parameters,
+		* unit is ignored for group telegrams.
+		*/
+		void prepareSignal(unsigned long address, bool group, unsigned short unit, bool on, RfTelegram *telegram);
+};
+
 //
 // END CODE
 // ------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,222 @@
+/*
+**
+**                           RfProtocol.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "RfProtocol.h"
+
+typedef bool (*RfTritParser)(const uint8_t *trits, RfCode *code);
+
+typedef struct {
+	const char *name;
+	uint16_t period;			// Nominal period (us)
+	RfTritParser parseTrits;	// Layout of PT2262 protocols
+} RfProtocolInfo;
+
+static bool parseKaku(const uint8_t *trits, RfCode *code);
+static bool parseElro(const uint8_t *trits, RfCode *code);
+static bool parseBlokker(const uint8_t *trits, RfCode *code);
+static bool parseAction(const uint8_t *trits, RfCode *code);
+
+/**
+* Same order as RfCoding. Part ranges are in tenths of a period: short, long, start, stop.
+* Pulse distance telegrams start with a start pulse (2 parts) before the bits.
+*/
+static const RfCodingTiming kCodingTimings[kRF_CODINGS] = {
+	{31, 120, 1000, 4, kRF_TRITS * 4, {{0, 16}, {23, 37}, {0, 0}, {250, 360}}},
+	{40, 150, 500, 3, 2 + kRF_NEW_KAKU_BITS * 4, {{0, 25}, {35, 80}, {70, 140}, {250, 500}}}
+};
+
+/**
+* Same order as RfProtocol, periods are the defaults of the transmitters.
+*/
+static const RfProtocolInfo kProtocols[kRF_PROTOCOLS] = {
+	{"KakuSwitch", 375, parseKaku},
+	{"Elro RM", 320, parseElro},
+	{"Blokker RM", 230, parseBlokker},
+	{"Action RM", 190, parseAction},
+	{"New KaKu", 260, 0},
+	{"PT2262", 0, 0}
+};
+
+const RfCodingTiming *RfProtocols::timing(RfCoding coding) {
+	return &kCodingTimings[coding];
+}
+
+const char *RfProtocols::name(RfProtocol protocol) {
+	return kProtocols[protocol].name;
+}
+
+uint16_t RfProtocols::period(RfProtocol protocol) {
+	return kProtocols[protocol].period;
+}
+
+/**
+* Reads trits that are either 2 (bit set) or other (bit clear), first trit is the lowest bit.
+* Returns false if a trit is neither.
+*/
+static bool readBits(const uint8_t *trits, int count, uint8_t set, uint8_t clear, uint32_t *value) {
+	*value = 0;
+	for (int i = count - 1; i >= 0; i--) {
+		if (trits[i] != set && trits[i] != clear) {
+			return false;
+		}
+		*value = (*value << 1) | ((trits[i] == set)? 1 : 0);
+	}
+	return true;
+}
+
+/**
+* Inverse of KaKuTransmitter::getTelegram: address in trits 0-3, unit in 4-7, fixed 0 2 2, on/off.
+*/
+static bool parseKaku(const uint8_t *trits, RfCode *code) {
+	uint32_t address, unit;
+
+	if (trits[8] != 0 || trits[9] != 2 || trits[10] != 2 || (trits[11] != 0 && trits[11] != 2)) {
+		return false;
+	}
+	if (!readBits(trits, 4, 2, 0, &address) || !readBits(&trits[4], 4, 2, 0, &unit)) {
+		return false;
+	}
+
+	code->address = address;
+	code->unit = unit;
+	code->command = (trits[11] == 2)? RF_COMMAND_ON : RF_COMMAND_OFF;
+	return true;
+}
+
+/**
+* Elro and Action: system code in trits 0-4, device in 5-9 (one trit 0, others float), two complementary on/off trits.
+*/
+static bool parseSystemCode(const uint8_t *trits, uint8_t bitSet, bool onFirst, RfCode *code) {
+	uint32_t address;
+	int device = -1;
+
+	if (!readBits(trits, 5, bitSet, 2, &address)) {
+		return false;
+	}
+
+	for (int i = 0; i < 5; i++) {
+		if (trits[5 + i] == 0 && device < 0) {
+			device = i;
+		}
+		else if (trits[5 + i] != 2) {
+			return false;
+		}
+	}
+
+	if (device < 0 || trits[10] + trits[11] != 2 || trits[10] == 1) {
+		return false;
+	}
+
+	code->address = address;
+	code->unit = device;
+	code->command = ((trits[10] == 0) == onFirst)? RF_COMMAND_ON : RF_COMMAND_OFF;
+	return true;
+}
+
+static bool parseElro(const uint8_t *trits, RfCode *code) {
+	return parseSystemCode(trits, 0, true, code);
+}
+
+static bool parseAction(const uint8_t *trits, RfCode *code) {
+	return parseSystemCode(trits, 1, false, code);
+}
+
+/**
+* Inverse of BlokkerTransmitter::getTelegram: unit in trits 1-3 (inverted), on/off in trit 8, all others 0.
+*/
+static bool parseBlokker(const uint8_t *trits, RfCode *code) {
+	uint32_t unit;
+
+	for (int i = 0; i < kRF_TRITS; i++) {
+		if ((i < 1 || i > 3) && i != 8 && trits[i] != 0) {
+			return false;
+		}
+	}
+	if (!readBits(&trits[1], 3, 0, 1, &unit) || trits[8] > 1) {
+		return false;
+	}
+
+	code->address = 0;
+	code->unit = unit;
+	code->command = (trits[8] == 1)? RF_COMMAND_ON : RF_COMMAND_OFF;
+	return true;
+}
+
+void RfProtocols::parseTrits(uint32_t received, uint16_t period, RfCode *code) {
+	uint8_t trits[kRF_TRITS];
+	uint32_t value = received;
+	int bestDistance = -1;
+
+	for (int i = kRF_TRITS - 1; i >= 0; i--) {
+		trits[i] = value % 3;
+		value /= 3;
+	}
+
+	code->protocol = RF_PROTOCOL_TRIT;
+	code->command = RF_COMMAND_UNKNOWN;
+	code->address = received;
+	code->unit = 0;
+
+	for (int i = 0; i < kRF_PROTOCOLS; i++) {
+		RfCode candidate;
+
+		if (kProtocols[i].parseTrits == 0 || !kProtocols[i].parseTrits(trits, &candidate)) {
+			continue;
+		}
+
+		int distance = (period > kProtocols[i].period)? period - kProtocols[i].period : kProtocols[i].period - period;
+		if (bestDistance < 0 || distance < bestDistance) {
+			bestDistance = distance;
+			code->protocol = (RfProtocol)i;
+			code->command = candidate.command;
+			code->address = candidate.address;
+			code->unit = candidate.unit;
+		}
+	}
+
+	code->dimLevel = 0;
+	code->period = period;
+	code->code = received;
+}
+
+void RfProtocols::parseNewKaku(uint32_t bits, bool dim, uint8_t dimLevel, uint16_t period, RfCode *code) {
+	bool group = (bits >> 5) & 1;
+	bool on = (bits >> 4) & 1;
+
+	code->protocol = RF_PROTOCOL_NEW_KAKU;
+	code->address = bits >> 6;
+	code->unit = bits & 0xF;
+	code->dimLevel = (dim)? dimLevel : 0;
+	code->period = period;
+
+	if (dim) {
+		code->command = RF_COMMAND_DIM;
+	}
+	else if (group) {
+		code->command = (on)? RF_COMMAND_GROUP_ON : RF_COMMAND_GROUP_OFF;
+	}
+	else {
+		code->command = (on)? RF_COMMAND_ON : RF_COMMAND_OFF;
+	}
+
+	code->code = newKakuCode(code->address, group, code->unit, on || dim);
+}
+
+uint32_t RfProtocols::newKakuCode(uint32_t address, bool group, uint8_t unit, bool on) {
+	return kRF_NEW_KAKU_TAG | ((address & 0x1FFFFFF) << 6) | ((group)? 0x20 : 0) | ((unit & 0xF) << 1) | ((on)? 1 : 0);
+}
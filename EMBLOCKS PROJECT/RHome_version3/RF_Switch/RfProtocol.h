@@ -0,0 +1,146 @@
+/*
+**
+**                           RfProtocol.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef RfProtocol_h
+#define RfProtocol_h
+
+#include <stdint.h>
+
+#define kRF_TRITS				12			// Trits of a PT2262 style telegram
+#define kRF_NEW_KAKU_BITS		32			// Bits of a self-learning KaKu telegram (36 with a dim level)
+#define kRF_NEW_KAKU_DIM_BIT	27			// Dim telegrams have neither 0 nor 1 here, the level follows the unit
+#define kRF_NEW_KAKU_TAG		0x80000000	// Marks codes of self-learning KaKu remotes (PT2262 codes are below 3^12)
+
+/**
+* Line codings, the receiver runs one state machine per coding over the same edges.
+*/
+typedef enum {
+	RF_CODING_TRIT,				// PT2262 and clones: trits of 4 parts (1 or 3 periods), sync of 1 + 31 periods
+	RF_CODING_PULSE_DISTANCE,	// Self-learning KaKu: start of 1 + 10 periods, bits of 2 pulses (1 + 1 or 1 + 5 periods), stop of 1 + 40 periods
+	kRF_CODINGS
+} RfCoding;
+
+typedef enum {
+	RF_PROTOCOL_KAKU,			// Same order as LightType
+	RF_PROTOCOL_ELRO,
+	RF_PROTOCOL_BLOKKER,
+	RF_PROTOCOL_ACTION,
+	RF_PROTOCOL_NEW_KAKU,
+	RF_PROTOCOL_TRIT,			// PT2262 telegram with an unknown layout
+	kRF_PROTOCOLS
+} RfProtocol;
+
+typedef enum {
+	RF_COMMAND_OFF,
+	RF_COMMAND_ON,
+	RF_COMMAND_GROUP_OFF,
+	RF_COMMAND_GROUP_ON,
+	RF_COMMAND_DIM,
+	RF_COMMAND_UNKNOWN
+} RfCommand;
+
+/**
+* Decoded telegram.
+*
+* Address and unit are 0 based: KaKu address A-P and unit 1-16, Elro and Action system code 0-31 and
+* device A-E, Blokker unit 1-8 (no address), self-learning KaKu 26 bit address and unit 0-15.
+* code identifies the button of the remote: PT2262 codes are the trits as a base 3 number (like the original
+* library reported them), self-learning KaKu codes are tagged with kRF_NEW_KAKU_TAG (see RfProtocols::newKakuCode).
+*/
+typedef struct {
+	RfProtocol protocol;
+	RfCommand command;
+	uint32_t address;
+	uint8_t unit;
+	uint8_t dimLevel;			// 0-15, only for RF_COMMAND_DIM
+	uint16_t period;			// Measured period in microseconds
+	uint32_t code;
+} RfCode;
+
+/**
+* Accepted length of a part in tenths of a period.
+*/
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+} RfPartRange;
+
+typedef enum {
+	RF_PART_SHORT,
+	RF_PART_LONG,
+	RF_PART_START,				// Low part of the start pulse (pulse distance coding)
+	RF_PART_STOP,				// Low part that ends a telegram, also the sync of the next one
+	kRF_PARTS
+} RfPart;
+
+/**
+* Timing of a coding. The period is measured from the sync (the last low part of a telegram).
+*/
+typedef struct {
+	uint8_t syncPeriods;		// Nominal length of the sync
+	uint16_t minPeriod;			// Syncs of other periods (us) are ignored
+	uint16_t maxPeriod;
+	uint8_t glitch;				// Shorter pulses (tenths of a period) are merged into their neighbours
+	uint8_t dataParts;			// Parts before the high part of the sync
+	RfPartRange parts[kRF_PARTS];
+} RfCodingTiming;
+
+/**
+* Protocol descriptors and telegram layouts shared by the receiver and the lights.
+*/
+class RfProtocols {
+	public:
+		/**
+		* @return Timing descriptor of a coding.
+		*/
+		static const RfCodingTiming *timing(RfCoding coding);
+
+		/**
+		* @return Name of a protocol (light type names for the light protocols).
+		*/
+		static const char *name(RfProtocol protocol);
+
+		/**
+		* @return Nominal period of a protocol in microseconds (the transmitter default).
+		*/
+		static uint16_t period(RfProtocol protocol);
+
+		/**
+		* Fills a decoded PT2262 telegram. Layouts of different brands overlap, the matching layout whose
+		* nominal period is closest to the measured one is used.
+		*
+		* @param trits Received trits as a base 3 number, first trit most significant.
+		*/
+		static void parseTrits(uint32_t trits, uint16_t period, RfCode *code);
+
+		/**
+		* Fills a decoded self-learning KaKu telegram.
+		*
+		* @param bits First 32 bits, first bit most significant (the dim bit is 0 for dim telegrams).
+		* @param dim True if the dim bit was received, dimLevel holds the last 4 bits then.
+		*/
+		static void parseNewKaku(uint32_t bits, bool dim, uint8_t dimLevel, uint16_t period, RfCode *code);
+
+		/**
+		* Button code of a self-learning KaKu telegram: the tag, 25 lowest address bits, group, unit and on bit.
+		* Dim telegrams are coded like on telegrams.
+		*/
+		static uint32_t newKakuCode(uint32_t address, bool group, uint8_t unit, bool on);
+};
+
+#endif
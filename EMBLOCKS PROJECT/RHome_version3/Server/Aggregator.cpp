@@ -0,0 +1,289 @@
+/*
+**
+**                           Aggregator.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Aggregator.h"
+#include "StateVersion.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define kPEER_REQUEST "GET /%s/%s/%s HTTP/1.1\r\nHost: rhome\r\n"
+#define kPEER_REQUEST_VERSION "If-None-Match: \"%lu\"\r\n"
+
+static char request[kPEER_COMMAND_LENGTH + 128];
+
+static int findHeader(const char *response, int headerLength, const char *name)
+{
+    //
+    // Finds a response header (case insensitive), returns the offset of its value or -1
+    //
+
+    int nameLength = strlen(name);
+
+    for (int i = 0; i < headerLength - nameLength - 1; i++)
+    {
+        if (response[i] != '\n')
+            continue;
+
+        int j = 0;
+        while (j < nameLength && tolower(response[i + 1 + j]) == tolower(name[j]))
+        {
+            j++;
+        }
+
+        if (j == nameLength && response[i + 1 + j] == ':')
+        {
+            int value = i + 2 + j;
+            while (value < headerLength && response[value] == ' ')
+            {
+                value++;
+            }
+            return value;
+        }
+    }
+
+    return -1;
+}
+
+void Aggregator::init(const PeerPort *peerPort, const char *webUser, const char *webPass)
+{
+    //
+    // Peer uses the same credentials as this unit (legacy path authentication)
+    // Task has to be started by the application
+    //
+
+    port = peerPort;
+    user = webUser;
+    pass = webPass;
+    commands = xQueueCreate(kPEER_QUEUE_LENGTH, sizeof(PeerCommand));
+    roomsLock = xSemaphoreCreateMutex();
+    peerRooms[0] = '\0';
+    peerVersion = 0;
+    online = false;
+    running = true;
+}
+
+bool Aggregator::forward(int room, const char *action)
+{
+    //
+    // Queues a command (API path after the room, like lght/0/on) for a room of the peer chain
+    // (room 1 is the peer itself, action ends at the first space)
+    // Returns false if this unit is not an aggregator or the queue is full
+    //
+
+    if (!running || room < 1)
+        return false;
+
+    PeerCommand command;
+    int length = snprintf(command.path, sizeof(command.path), "house/%d/", room - 1);
+
+    for (int i = 0; action[i] != '\0' && action[i] != ' ' && length < kPEER_COMMAND_LENGTH - 1; i++)
+    {
+        command.path[length++] = action[i];
+    }
+    command.path[length] = '\0';
+
+    return xQueueSendToBack(commands, &command, 0) == pdTRUE;
+}
+
+const char *Aggregator::rooms()
+{
+    //
+    // Rooms of the peer chain as a JSON list continuation (",{...},{...}" or "")
+    // Has to be called with the lock taken
+    //
+
+    return peerRooms;
+}
+
+const char *Aggregator::status()
+{
+    return (!running)? "none" : (online)? "online" : "offline";
+}
+
+void Aggregator::lock()
+{
+    if (running)
+        xSemaphoreTake(roomsLock, portMAX_DELAY);
+}
+
+void Aggregator::unlock()
+{
+    if (running)
+        xSemaphoreGive(roomsLock);
+}
+
+void Aggregator::sendRequest(const char *path, bool poll)
+{
+    //
+    // Sends one request to the peer, polls carry the last known peer state version
+    //
+
+    int length = sprintf(request, kPEER_REQUEST, user, pass, path);
+
+    if (poll && peerVersion != 0)
+    {
+        length += sprintf(request + length, kPEER_REQUEST_VERSION, (unsigned long)peerVersion);
+    }
+
+    strcpy(request + length, "\r\n");
+    port->send(request, length + 2);
+}
+
+void Aggregator::storeRooms(const char *body, int length, uint32_t version)
+{
+    //
+    // Keeps the rooms of a peer /house response (everything between the list brackets)
+    //
+
+    int prefixLength = strlen(kHOUSE_PREFIX);
+    if (length <= prefixLength || strncmp(body, kHOUSE_PREFIX, prefixLength) != 0)
+        return;
+
+    int end = length - 1;
+    while (end > prefixLength && body[end] != ']')
+    {
+        end--;
+    }
+
+    int roomsLength = end - prefixLength;
+    if (roomsLength <= 0 || roomsLength + 2 > kPEER_ROOMS_SIZE)
+        return;
+
+    lock();
+    peerRooms[0] = ',';
+    memcpy(&peerRooms[1], &body[prefixLength], roomsLength);
+    peerRooms[roomsLength + 1] = '\0';
+    unlock();
+
+    if (version != peerVersion)
+    {
+        peerVersion = version;
+        StateVersion::bump();
+    }
+}
+
+int Aggregator::handleResponse()
+{
+    //
+    // Handles the first response in the receive buffer
+    // Returns 1 if a response was handled, 0 if it was not completely received yet
+    //
+
+    const char *buff = (const char *)port->buff;
+    int length = *port->buffIndicator;
+
+    int headerLength = 0;
+    for (int i = 3; i < length && headerLength == 0; i++)
+    {
+        if (buff[i - 3] == '\r' && buff[i - 2] == '\n' && buff[i - 1] == '\r' && buff[i] == '\n')
+            headerLength = i + 1;
+    }
+
+    if (headerLength == 0)
+        return 0;
+
+    int contentLength = findHeader(buff, headerLength, "Content-Length");
+    int bodyLength = (contentLength >= 0)? atoi(&buff[contentLength]) : 0;
+
+    if (headerLength + bodyLength > length)
+        return 0;
+
+    int status = (length > 12 && strncmp(buff, "HTTP/1.", 7) == 0)? atoi(&buff[9]) : 0;
+
+    if (status == 200)
+    {
+        int etag = findHeader(buff, headerLength, "ETag");
+        uint32_t version = (etag >= 0)? strtoul(&buff[etag + 1], NULL, 10) : 0;
+
+        storeRooms(&buff[headerLength], bodyLength, version);
+    }
+
+    online = (status == 200 || status == 304);
+    port->consume(headerLength + bodyLength);
+
+    return 1;
+}
+
+void Aggregator::task(void *pvParameters)
+{
+    //
+    // Peer connection task
+    // Commands are sent as soon as they are queued, state is polled once per kPEER_POLL_INTERVAL when
+    // nothing else is outstanding. Up to kPEER_PIPELINE_DEPTH requests are sent before the responses come back.
+    //
+
+    (void)pvParameters;
+
+    int outstanding = 0;
+    portTickType lastPoll = 0;
+    portTickType waitingSince = 0;
+    PeerCommand command;
+
+    while (1)
+    {
+        portTickType now = xTaskGetTickCount();
+
+        while (outstanding < kPEER_PIPELINE_DEPTH && xQueueReceive(commands, &command, 0) == pdTRUE)
+        {
+            sendRequest(command.path, false);
+            if (outstanding++ == 0)
+                waitingSince = now;
+        }
+
+        if (outstanding == 0 && now - lastPoll >= kPEER_POLL_INTERVAL / portTICK_RATE_MS)
+        {
+            sendRequest("house", true);
+            outstanding++;
+            lastPoll = now;
+            waitingSince = now;
+        }
+
+        while (outstanding > 0 && handleResponse())
+        {
+            outstanding--;
+            waitingSince = now;
+        }
+
+        if (outstanding > 0 && now - waitingSince >= kPEER_TIMEOUT / portTICK_RATE_MS)
+        {
+            // Peer is not answering (or the module is reconnecting), start over
+            online = false;
+            outstanding = 0;
+            port->consume(*port->buffIndicator);
+        }
+        else if (outstanding == 0 && *port->buffIndicator > 0)
+        {
+            // Nothing is expected, drop whatever arrived
+            port->consume(*port->buffIndicator);
+        }
+
+        vTaskDelay(kPEER_TASK_DELAY / portTICK_RATE_MS);
+    }
+}
+
+const PeerPort *Aggregator::port = NULL;
+const char *Aggregator::user = NULL;
+const char *Aggregator::pass = NULL;
+xQueueHandle Aggregator::commands = NULL;
+xSemaphoreHandle Aggregator::roomsLock = NULL;
+char Aggregator::peerRooms[kPEER_ROOMS_SIZE];
+uint32_t Aggregator::peerVersion = 0;
+bool Aggregator::running = false;
+bool Aggregator::online = false;
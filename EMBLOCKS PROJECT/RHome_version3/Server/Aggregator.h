@@ -0,0 +1,92 @@
+/*
+**
+**                           Aggregator.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef AGGREGATOR_H_INCLUDED
+#define AGGREGATOR_H_INCLUDED
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+//
+// Multi-room aggregation
+// Wifi connection 2 runs as a TCP client to a peer unit. The peer's /house state is polled (pipelined
+// with forwarded commands, rate limited, If-None-Match with the peer's state version) and kept so that
+// /house of this unit returns the rooms of the whole chain: this unit is room 0, the peer's rooms follow.
+// The module has one client connection, so more rooms are added by chaining units (the chain must not loop).
+//
+
+#define kPEER_ADDRESS_LENGTH 16
+#define kPEER_ROOMS_SIZE 1024
+#define kPEER_COMMAND_LENGTH 96
+#define kPEER_QUEUE_LENGTH 4
+#define kPEER_PIPELINE_DEPTH 4          // Requests sent before waiting for their responses
+#define kPEER_POLL_INTERVAL 1000        // ms between state polls
+#define kPEER_TIMEOUT 3000              // ms to wait for a response
+#define kPEER_TASK_DELAY 20             // ms
+
+//
+// Beginning of the /house JSON, the rooms of a peer are found by it
+//
+#define kHOUSE_PREFIX "{\"rooms\":["
+
+//
+// Connection with the peer (provided by the application)
+//
+typedef struct
+{
+    void (*send)(const char *data, int length);
+    volatile char *buff;
+    int buffSize;
+    volatile int *buffIndicator;
+    void (*consume)(int length);
+} PeerPort;
+
+typedef struct
+{
+    char path[kPEER_COMMAND_LENGTH];
+} PeerCommand;
+
+class Aggregator
+{
+    public:
+    static void init(const PeerPort *peerPort, const char *user, const char *pass);
+    static bool forward(int room, const char *action);
+    static const char *rooms();
+    static const char *status();
+    static void lock();
+    static void unlock();
+    static void task(void *pvParameters);
+
+    private:
+    static void sendRequest(const char *path, bool poll);
+    static int handleResponse();
+    static void storeRooms(const char *body, int length, uint32_t version);
+    static const PeerPort *port;
+    static const char *user;
+    static const char *pass;
+    static xQueueHandle commands;
+    static xSemaphoreHandle roomsLock;
+    static char peerRooms[kPEER_ROOMS_SIZE];
+    static uint32_t peerVersion;
+    static bool running;
+    static bool online;
+};
+
+#endif /* AGGREGATOR_H_INCLUDED */
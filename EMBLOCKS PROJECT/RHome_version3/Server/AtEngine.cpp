@@ -0,0 +1,257 @@
+/*
+**
+**                           AtEngine.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "AtEngine.h"
+#include <string.h>
+#include <ctype.h>
+
+typedef struct
+{
+    xSemaphoreHandle done;
+    AtResult result;
+    char *response;
+    int responseSize;
+} AtWait;
+
+static void atWaitCallback(AtResult result, const char *response, void *arg)
+{
+    //
+    // Completes a sendWait call
+    //
+
+    AtWait *wait = (AtWait *)arg;
+
+    wait->result = result;
+    if (wait->response != NULL && wait->responseSize > 0)
+    {
+        strncpy(wait->response, response, wait->responseSize - 1);
+        wait->response[wait->responseSize - 1] = '\0';
+    }
+
+    xSemaphoreGive(wait->done);
+}
+
+static bool lineStartsWith(const char *line, const char *prefix)
+{
+    //
+    // Case insensitive prefix compare
+    //
+
+    while (*prefix != '\0')
+    {
+        if (tolower(*line) != tolower(*prefix))
+            return false;
+        line++;
+        prefix++;
+    }
+
+    return true;
+}
+
+void AtEngine::init(const AtPort *atPort)
+{
+    //
+    // Initializes the engine (call before the scheduler starts)
+    //
+
+    port = atPort;
+    queue = xQueueCreate(kAT_QUEUE_LENGTH, sizeof(AtRequest));
+    inCommandMode = false;
+}
+
+bool AtEngine::send(const char *command, bool expectData, uint16_t timeout, AtCallback callback, void *arg)
+{
+    //
+    // Queues a command (without line ending)
+    // Callback is called from the engine task once the module answers or the timeout expires
+    // Blocks while the queue is full, returns false if there was still no room after kAT_SEND_TIMEOUT
+    // (must not be called from the engine task or its callbacks)
+    //
+
+    AtRequest request;
+
+    strncpy(request.command, command, kAT_COMMAND_LENGTH - 1);
+    request.command[kAT_COMMAND_LENGTH - 1] = '\0';
+    request.expectData = expectData;
+    request.timeout = timeout;
+    request.callback = callback;
+    request.arg = arg;
+
+    return xQueueSend(queue, &request, kAT_SEND_TIMEOUT / portTICK_RATE_MS) == pdTRUE;
+}
+
+AtResult AtEngine::sendWait(const char *command, char *response, int responseSize, uint16_t timeout)
+{
+    //
+    // Sends a query and blocks the calling task until the module answers
+    // The data line of the answer is copied to response
+    //
+
+    AtWait wait;
+    wait.result = AT_RESULT_ERROR;
+    wait.response = response;
+    wait.responseSize = responseSize;
+
+    vSemaphoreCreateBinary(wait.done);
+    if (wait.done == NULL)
+        return AT_RESULT_ERROR;
+    xSemaphoreTake(wait.done, 0);
+
+    if (send(command, true, timeout, atWaitCallback, &wait))
+    {
+        xSemaphoreTake(wait.done, portMAX_DELAY);
+    }
+
+    vQueueDelete(wait.done);
+
+    return wait.result;
+}
+
+AtResult AtEngine::execute(AtRequest *request)
+{
+    //
+    // Sends a single command and parses the answer line by line
+    // (echoed command, optional data line, then ok or error)
+    // Only ok or error end the command and lines before the echo are skipped, so a late answer
+    // can not be taken for the answer of the next command
+    //
+
+    char line[kAT_RESPONSE_LENGTH];
+    bool dataSeen = false;
+
+    response[0] = '\0';
+
+    port->clear();
+    port->send(request->command);
+    port->send("\r\n");
+
+    portTickType start = xTaskGetTickCount();
+    int parsed = 0;
+    bool echoSeen = false;
+
+    while ((xTaskGetTickCount() - start) * portTICK_RATE_MS < request->timeout)
+    {
+        int received = *port->buffIndicator;
+
+        for (int i = parsed; i < received; i++)
+        {
+            if (port->buff[i] != '\n')
+                continue;
+
+            int lineStart = parsed;
+            int lineLength = i - parsed;
+            parsed = i + 1;
+
+            if (lineLength > 0 && port->buff[lineStart + lineLength - 1] == '\r')
+                lineLength--;
+
+            if (lineLength <= 0)
+                continue;
+
+            if (lineLength >= kAT_RESPONSE_LENGTH)
+                lineLength = kAT_RESPONSE_LENGTH - 1;
+
+            for (int j = 0; j < lineLength; j++)
+            {
+                line[j] = port->buff[lineStart + j];
+            }
+            line[lineLength] = '\0';
+
+            if (!echoSeen && lineStartsWith(line, "at+"))
+            {
+                echoSeen = true;
+                continue;
+            }
+
+            // Anything before the echo is left over from an earlier command
+            if (!echoSeen)
+                continue;
+
+            if (strstr(line, "rror") != NULL)
+            {
+                strcpy(response, line);
+                return AT_RESULT_ERROR;
+            }
+
+            if (lineStartsWith(line, "+ok") || lineStartsWith(line, "ok"))
+            {
+                // Values can also be returned as +ok=<value>
+                char *value = strchr(line, '=');
+                if (value != NULL)
+                    strcpy(response, value + 1);
+
+                return AT_RESULT_OK;
+            }
+
+            // Data line before the ok (other output is skipped)
+            if (request->expectData && !dataSeen)
+            {
+                strcpy(response, line);
+                dataSeen = true;
+            }
+        }
+
+        vTaskDelay(10 / portTICK_RATE_MS);
+    }
+
+    response[0] = '\0';
+    return AT_RESULT_TIMEOUT;
+}
+
+void AtEngine::task(void *pvParameters)
+{
+    //
+    // Engine task, executes queued commands
+    //
+
+    (void)pvParameters;
+
+    AtRequest request;
+
+    while (1)
+    {
+        portTickType wait = (inCommandMode)? kAT_IDLE_TIME / portTICK_RATE_MS : portMAX_DELAY;
+
+        if (xQueueReceive(queue, &request, wait) != pdTRUE)
+        {
+            // Nothing more to do, return to transparent mode
+            port->send("at+out_trans=0\r\n");
+            port->commandMode(false);
+            inCommandMode = false;
+            continue;
+        }
+
+        if (!inCommandMode)
+        {
+            port->commandMode(true);
+            inCommandMode = true;
+        }
+
+        AtResult result = execute(&request);
+
+        if (request.callback != NULL)
+        {
+            request.callback(result, response, request.arg);
+        }
+    }
+}
+
+const AtPort *AtEngine::port;
+xQueueHandle AtEngine::queue;
+bool AtEngine::inCommandMode;
+char AtEngine::response[kAT_RESPONSE_LENGTH];
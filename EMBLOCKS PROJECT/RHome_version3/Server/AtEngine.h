@@ -0,0 +1,87 @@
+/*
+**
+**                           AtEngine.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef ATENGINE_H_INCLUDED
+#define ATENGINE_H_INCLUDED
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+//
+// AT command engine for the HLK-RM04 module
+// Commands are queued and executed one by one by the engine task. The module is put into
+// AT mode when the first command arrives and back into transparent mode once the queue is empty.
+// A command is done once the module answers ok or error, the echo alone does not count.
+//
+
+#define kAT_QUEUE_LENGTH 8
+#define kAT_COMMAND_LENGTH 96
+#define kAT_RESPONSE_LENGTH 64
+#define kAT_DEFAULT_TIMEOUT 1000
+#define kAT_IDLE_TIME 200
+#define kAT_SEND_TIMEOUT 10000      // ms to wait for room in the queue (longer than the slowest command)
+
+typedef enum
+{
+    AT_RESULT_OK,
+    AT_RESULT_ERROR,
+    AT_RESULT_TIMEOUT
+} AtResult;
+
+typedef void (*AtCallback)(AtResult result, const char *response, void *arg);
+
+//
+// Connection with the module (provided by the application)
+//
+typedef struct
+{
+    void (*send)(const char *data);
+    volatile char *buff;
+    volatile int *buffIndicator;
+    void (*clear)();
+    void (*commandMode)(bool enable);
+} AtPort;
+
+typedef struct
+{
+    char command[kAT_COMMAND_LENGTH];
+    bool expectData;
+    uint16_t timeout;
+    AtCallback callback;
+    void *arg;
+} AtRequest;
+
+class AtEngine
+{
+    public:
+    static void init(const AtPort *atPort);
+    static bool send(const char *command, bool expectData = false, uint16_t timeout = kAT_DEFAULT_TIMEOUT, AtCallback callback = NULL, void *arg = NULL);
+    static AtResult sendWait(const char *command, char *response, int responseSize, uint16_t timeout = kAT_DEFAULT_TIMEOUT);
+    static void task(void *pvParameters);
+
+    private:
+    static AtResult execute(AtRequest *request);
+    static const AtPort *port;
+    static xQueueHandle queue;
+    static bool inCommandMode;
+    static char response[kAT_RESPONSE_LENGTH];
+};
+
+#endif /* ATENGINE_H_INCLUDED */
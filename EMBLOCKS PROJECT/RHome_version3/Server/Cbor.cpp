@@ -0,0 +1,136 @@
+/*
+**
+**                           Cbor.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Cbor.h"
+#include <string.h>
+
+#define kCBOR_TYPE_UINT 0
+#define kCBOR_TYPE_NEGATIVE 1
+#define kCBOR_TYPE_TEXT 3
+#define kCBOR_TYPE_ARRAY 4
+#define kCBOR_TYPE_MAP 5
+#define kCBOR_TYPE_SIMPLE 7
+
+#define kCBOR_FALSE 20
+#define kCBOR_TRUE 21
+
+static void cborWrite(CborStream *stream, const uint8_t *data, int length)
+{
+    //
+    // Passes encoded bytes to the writer and keeps track of the total length
+    //
+
+    stream->length += length;
+    if (stream->write)
+        stream->write(stream, data, length);
+}
+
+static void cborHead(CborStream *stream, uint8_t type, uint32_t value)
+{
+    //
+    // Encodes the initial byte of an item (major type and value/length) in the shortest form
+    //
+
+    uint8_t head[5];
+    int length;
+
+    if (value < 24)
+    {
+        head[0] = (type << 5) | value;
+        length = 1;
+    }
+    else if (value <= 0xFF)
+    {
+        head[0] = (type << 5) | 24;
+        head[1] = value;
+        length = 2;
+    }
+    else if (value <= 0xFFFF)
+    {
+        head[0] = (type << 5) | 25;
+        head[1] = value >> 8;
+        head[2] = value;
+        length = 3;
+    }
+    else
+    {
+        head[0] = (type << 5) | 26;
+        head[1] = value >> 24;
+        head[2] = value >> 16;
+        head[3] = value >> 8;
+        head[4] = value;
+        length = 5;
+    }
+
+    cborWrite(stream, head, length);
+}
+
+void cborInit(CborStream *stream, CborWriter writer, void *userData)
+{
+    //
+    // Prepares a stream, writer can be NULL to only measure the encoded length
+    //
+
+    stream->write = writer;
+    stream->length = 0;
+    stream->userData = userData;
+}
+
+void cborUint(CborStream *stream, uint32_t value)
+{
+    cborHead(stream, kCBOR_TYPE_UINT, value);
+}
+
+void cborInt(CborStream *stream, int32_t value)
+{
+    //
+    // Negative values are encoded as -1 - n
+    //
+
+    if (value < 0)
+    {
+        cborHead(stream, kCBOR_TYPE_NEGATIVE, (uint32_t)(-1 - value));
+    }
+    else
+    {
+        cborHead(stream, kCBOR_TYPE_UINT, value);
+    }
+}
+
+void cborBool(CborStream *stream, bool value)
+{
+    cborHead(stream, kCBOR_TYPE_SIMPLE, (value)? kCBOR_TRUE : kCBOR_FALSE);
+}
+
+void cborText(CborStream *stream, const char *text)
+{
+    int length = strlen(text);
+
+    cborHead(stream, kCBOR_TYPE_TEXT, length);
+    cborWrite(stream, (const uint8_t *)text, length);
+}
+
+void cborArray(CborStream *stream, uint32_t count)
+{
+    cborHead(stream, kCBOR_TYPE_ARRAY, count);
+}
+
+void cborMap(CborStream *stream, uint32_t count)
+{
+    cborHead(stream, kCBOR_TYPE_MAP, count);
+}
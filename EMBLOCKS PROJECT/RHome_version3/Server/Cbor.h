@@ -0,0 +1,50 @@
+/*
+**
+**                           Cbor.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef CBOR_H_INCLUDED
+#define CBOR_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Streaming CBOR (RFC 7049) encoder
+// Every item is passed to the writer as soon as it is encoded, nothing is buffered.
+// Maps and arrays are encoded with definite length, so item counts have to be known up front.
+//
+
+struct CborStream;
+
+typedef void (*CborWriter)(CborStream *stream, const uint8_t *data, int length);
+
+typedef struct CborStream
+{
+    CborWriter write;       // NULL only counts the length of the encoded data
+    int length;
+    void *userData;
+} CborStream;
+
+void cborInit(CborStream *stream, CborWriter writer, void *userData);
+void cborUint(CborStream *stream, uint32_t value);
+void cborInt(CborStream *stream, int32_t value);
+void cborBool(CborStream *stream, bool value);
+void cborText(CborStream *stream, const char *text);
+void cborArray(CborStream *stream, uint32_t count);
+void cborMap(CborStream *stream, uint32_t count);
+
+#endif /* CBOR_H_INCLUDED */
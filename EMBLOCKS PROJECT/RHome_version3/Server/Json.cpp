@@ -0,0 +1,263 @@
+/*
+**
+**                           Json.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Json.h"
+#include <string.h>
+
+static int openContainer(const JsonToken *tokens, int count)
+{
+    //
+    // Innermost object or array that is not closed yet (-1 at the top level)
+    //
+
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (tokens[i].type <= JSON_ARRAY && tokens[i].end < 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static int addToken(JsonToken *tokens, int *count, int maxTokens, int parent, JsonType type, int start)
+{
+    //
+    // Adds a token to the parent, object keys have to be strings and there can only be one value at the top level
+    //
+
+    if (*count >= maxTokens)
+        return JSON_ERROR_NO_TOKENS;
+
+    if (parent < 0 && *count > 0)
+        return JSON_ERROR_INVALID;
+
+    if (parent >= 0)
+    {
+        if (tokens[parent].type == JSON_OBJECT && (tokens[parent].size % 2) == 0 && type != JSON_STRING)
+            return JSON_ERROR_INVALID;
+
+        tokens[parent].size++;
+    }
+
+    JsonToken *token = &tokens[*count];
+    token->type = type;
+    token->start = start;
+    token->end = -1;
+    token->size = 0;
+
+    return (*count)++;
+}
+
+int jsonParse(const char *json, int length, JsonToken *tokens, int maxTokens, int *errorOffset)
+{
+    //
+    // Splits json into tokens (parents come before their children)
+    // Returns the number of tokens or a JsonError (errorOffset is where the problem was found)
+    //
+
+    int count = 0;
+    int parent = -1;
+    int result = 0;
+    int pos;
+
+    for (pos = 0; pos < length && result >= 0; pos++)
+    {
+        char c = json[pos];
+
+        if (c == '{' || c == '[')
+        {
+            result = addToken(tokens, &count, maxTokens, parent, (c == '{')? JSON_OBJECT : JSON_ARRAY, pos);
+            if (result >= 0)
+                parent = result;
+        }
+        else if (c == '}' || c == ']')
+        {
+            JsonType type = (c == '}')? JSON_OBJECT : JSON_ARRAY;
+            if (parent < 0 || tokens[parent].type != type || (type == JSON_OBJECT && (tokens[parent].size % 2) != 0))
+            {
+                result = JSON_ERROR_INVALID;
+                break;
+            }
+
+            tokens[parent].end = pos + 1;
+            parent = openContainer(tokens, count);
+        }
+        else if (c == '"')
+        {
+            result = addToken(tokens, &count, maxTokens, parent, JSON_STRING, pos + 1);
+            if (result < 0)
+                break;
+
+            int token = result;
+            for (pos++; pos < length && json[pos] != '"'; pos++)
+            {
+                if ((unsigned char)json[pos] < ' ')
+                {
+                    result = JSON_ERROR_INVALID;
+                    break;
+                }
+
+                if (json[pos] == '\\')
+                    pos++;
+            }
+
+            if (result >= 0 && pos >= length)
+                result = JSON_ERROR_PARTIAL;
+            else if (result >= 0)
+                tokens[token].end = pos;
+        }
+        else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')
+        {
+            result = addToken(tokens, &count, maxTokens, parent, JSON_PRIMITIVE, pos);
+            if (result < 0)
+                break;
+
+            int token = result;
+            while (pos < length && json[pos] != ',' && json[pos] != ']' && json[pos] != '}' && json[pos] != ' ' && json[pos] != '\t' && json[pos] != '\r' && json[pos] != '\n')
+            {
+                if (json[pos] < ' ' || json[pos] == '"' || json[pos] == ':')
+                {
+                    result = JSON_ERROR_INVALID;
+                    break;
+                }
+                pos++;
+            }
+
+            tokens[token].end = pos;
+            pos--;
+        }
+        else if (c != ':' && c != ',' && c != ' ' && c != '\t' && c != '\r' && c != '\n')
+        {
+            result = JSON_ERROR_INVALID;
+        }
+    }
+
+    if (result >= 0 && (parent >= 0 || count == 0))
+        result = JSON_ERROR_PARTIAL;
+
+    if (result < 0)
+    {
+        if (errorOffset != NULL)
+            *errorOffset = (pos < length)? pos : length;
+        return result;
+    }
+
+    return count;
+}
+
+int jsonNext(const JsonToken *tokens, int count, int index)
+{
+    //
+    // Index of the next token that is not a child of the token at index
+    //
+
+    int end = tokens[index].end;
+    int next = index + 1;
+
+    while (next < count && tokens[next].start < end)
+    {
+        next++;
+    }
+
+    return next;
+}
+
+int jsonFind(const char *json, const JsonToken *tokens, int count, int object, const char *key)
+{
+    //
+    // Returns the index of the value of key in the object or -1
+    //
+
+    if (object < 0 || tokens[object].type != JSON_OBJECT)
+        return -1;
+
+    int member = object + 1;
+    for (int i = 0; i < tokens[object].size / 2; i++)
+    {
+        if (jsonEquals(json, &tokens[member], key))
+            return member + 1;
+
+        member = jsonNext(tokens, count, member + 1);
+    }
+
+    return -1;
+}
+
+bool jsonEquals(const char *json, const JsonToken *token, const char *text)
+{
+    int length = token->end - token->start;
+
+    return token->type == JSON_STRING && (int)strlen(text) == length && strncmp(&json[token->start], text, length) == 0;
+}
+
+bool jsonUint(const char *json, const JsonToken *token, uint32_t *value)
+{
+    //
+    // Reads a non-negative integer (no fraction or exponent)
+    //
+
+    if (token->type != JSON_PRIMITIVE || token->end == token->start || token->end - token->start > 10)
+        return false;
+
+    uint64_t result = 0;
+    for (int i = token->start; i < token->end; i++)
+    {
+        if (json[i] < '0' || json[i] > '9')
+            return false;
+
+        result = result*10 + (json[i] - '0');
+    }
+
+    if (result > 0xFFFFFFFF)
+        return false;
+
+    *value = (uint32_t)result;
+    return true;
+}
+
+bool jsonInt(const char *json, const JsonToken *token, int32_t *value)
+{
+    JsonToken digits = *token;
+    bool negative = (token->type == JSON_PRIMITIVE && json[token->start] == '-');
+    if (negative)
+        digits.start++;
+
+    uint32_t magnitude;
+    if (!jsonUint(json, &digits, &magnitude) || magnitude > (negative? 0x80000000 : 0x7FFFFFFF))
+        return false;
+
+    *value = (negative)? -(int32_t)(magnitude - 1) - 1 : (int32_t)magnitude;
+    return true;
+}
+
+bool jsonBool(const char *json, const JsonToken *token, bool *value)
+{
+    int length = token->end - token->start;
+
+    if (token->type != JSON_PRIMITIVE)
+        return false;
+
+    if (length == 4 && strncmp(&json[token->start], "true", 4) == 0)
+        *value = true;
+    else if (length == 5 && strncmp(&json[token->start], "false", 5) == 0)
+        *value = false;
+    else
+        return false;
+
+    return true;
+}
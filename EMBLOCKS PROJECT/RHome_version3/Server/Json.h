@@ -0,0 +1,64 @@
+/*
+**
+**                           Json.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef JSON_H_INCLUDED
+#define JSON_H_INCLUDED
+
+#include <stdint.h>
+
+//
+// In place JSON tokenizer (in the style of jsmn)
+// Tokens only hold offsets into the parsed text, nothing is copied and nothing is allocated.
+// Strings are not unescaped, values have to be checked by the user of the tokens.
+//
+
+typedef enum
+{
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,                // start and end exclude the quotes
+    JSON_PRIMITIVE              // number, true, false or null
+} JsonType;
+
+typedef enum
+{
+    JSON_ERROR_NO_TOKENS = -1,  // More tokens than the token array holds
+    JSON_ERROR_INVALID = -2,
+    JSON_ERROR_PARTIAL = -3     // Text ends inside of a value
+} JsonError;
+
+//
+// size is the number of direct children (keys and values of an object are both counted)
+//
+typedef struct
+{
+    uint8_t type;
+    int16_t start;
+    int16_t end;
+    int16_t size;
+} JsonToken;
+
+int jsonParse(const char *json, int length, JsonToken *tokens, int maxTokens, int *errorOffset);
+int jsonNext(const JsonToken *tokens, int count, int index);
+int jsonFind(const char *json, const JsonToken *tokens, int count, int object, const char *key);
+bool jsonEquals(const char *json, const JsonToken *token, const char *text);
+bool jsonInt(const char *json, const JsonToken *token, int32_t *value);
+bool jsonUint(const char *json, const JsonToken *token, uint32_t *value);
+bool jsonBool(const char *json, const JsonToken *token, bool *value);
+
+#endif /* JSON_H_INCLUDED */
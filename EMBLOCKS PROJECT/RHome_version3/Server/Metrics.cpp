@@ -0,0 +1,86 @@
+/*
+**
+**                           Metrics.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Metrics.h"
+
+//
+// Names (without the rhome_ prefix) and descriptions in Prometheus text format, same order as MetricId
+//
+static const MetricInfo kMetricInfo[METRIC_COUNT] =
+{
+    {"http_requests_total", "HTTP requests served", METRIC_TYPE_COUNTER},
+    {"http_received_bytes_total", "Bytes of served HTTP requests", METRIC_TYPE_COUNTER},
+    {"http_sent_bytes_total", "Bytes sent to the wifi module", METRIC_TYPE_COUNTER},
+    {"uart_rx_dropped_bytes_total", "Bytes dropped by the wifi UARTs because the buffer was full", METRIC_TYPE_COUNTER},
+    {"rf_decoded_total", "Remote codes received and decoded", METRIC_TYPE_COUNTER},
+    {"rf_rejected_total", "Remote signals rejected after a valid sync", METRIC_TYPE_COUNTER},
+    {"rf_edges_dropped_total", "Receiver edges dropped because the decoder fell behind", METRIC_TYPE_COUNTER},
+    {"rf_transmissions_total", "RF telegrams transmitted", METRIC_TYPE_COUNTER},
+    {"rf_coalesced_total", "Queued RF telegrams replaced by a newer command for the same device", METRIC_TYPE_COUNTER},
+    {"rf_grouped_total", "Light commands sent as part of a group telegram", METRIC_TYPE_COUNTER},
+    {"rf_backoffs_total", "Transmissions delayed because another remote was heard", METRIC_TYPE_COUNTER},
+    {"rf_retries_total", "Extra bursts sent after a burst went out on a busy channel", METRIC_TYPE_COUNTER},
+    {"flash_erases_total", "Settings flash sector erases", METRIC_TYPE_COUNTER},
+    {"flash_writes_total", "Words programmed to the settings flash", METRIC_TYPE_COUNTER},
+    {"publish_records_total", "State and telemetry records sent to the MQTT broker", METRIC_TYPE_COUNTER},
+    {"publish_dropped_total", "Records dropped because the publisher outbox was full", METRIC_TYPE_COUNTER},
+    {"free_heap_bytes", "Free FreeRTOS heap", METRIC_TYPE_GAUGE},
+    {"uptime_seconds", "Time since the scheduler started", METRIC_TYPE_GAUGE},
+    {"temperature_celsius", "Last temperature reading", METRIC_TYPE_GAUGE}
+};
+
+const MetricInfo *Metrics::info(MetricId id)
+{
+    return &kMetricInfo[id];
+}
+
+void Metrics::watchTask(xTaskHandle handle)
+{
+    //
+    // Adds a task to the stack high-water mark report
+    //
+
+    if (handle == NULL || tasksUsed >= kMETRICS_MAX_TASKS)
+        return;
+
+    tasks[tasksUsed] = handle;
+    tasksUsed++;
+}
+
+int Metrics::taskCount()
+{
+    return tasksUsed;
+}
+
+const char *Metrics::taskName(int index)
+{
+    return (const char *)pcTaskGetTaskName(tasks[index]);
+}
+
+uint32_t Metrics::taskStackFree(int index)
+{
+    //
+    // Lowest amount of free stack (in words) since the task started
+    //
+
+    return uxTaskGetStackHighWaterMark(tasks[index]);
+}
+
+volatile uint32_t Metrics::values[METRIC_COUNT];
+xTaskHandle Metrics::tasks[kMETRICS_MAX_TASKS];
+int Metrics::tasksUsed = 0;
@@ -0,0 +1,102 @@
+/*
+**
+**                           Metrics.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+//
+// Firmware performance counters
+// Counters are incremented from tasks and interrupt handlers without locking (ldrex/strex),
+// gauges are set when the values are read. Exported by the web server on /metrics.
+//
+
+#define kMETRICS_MAX_TASKS 10
+
+typedef enum
+{
+    METRIC_HTTP_REQUESTS,
+    METRIC_HTTP_BYTES_IN,
+    METRIC_HTTP_BYTES_OUT,
+    METRIC_UART_RX_DROPPED,
+    METRIC_RF_DECODED,
+    METRIC_RF_REJECTED,
+    METRIC_RF_EDGES_DROPPED,
+    METRIC_RF_TRANSMISSIONS,
+    METRIC_RF_COALESCED,
+    METRIC_RF_GROUPED,
+    METRIC_RF_BACKOFFS,
+    METRIC_RF_RETRIES,
+    METRIC_FLASH_ERASES,
+    METRIC_FLASH_WRITES,
+    METRIC_PUBLISH_RECORDS,
+    METRIC_PUBLISH_DROPPED,
+    METRIC_FREE_HEAP,
+    METRIC_UPTIME,
+    METRIC_TEMPERATURE,
+    METRIC_COUNT
+} MetricId;
+
+typedef enum
+{
+    METRIC_TYPE_COUNTER,
+    METRIC_TYPE_GAUGE
+} MetricType;
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    MetricType type;
+} MetricInfo;
+
+class Metrics
+{
+    public:
+    static inline void add(MetricId id, uint32_t value = 1)
+    {
+        __sync_fetch_and_add(&values[id], value);
+    }
+
+    static inline void set(MetricId id, uint32_t value)
+    {
+        values[id] = value;
+    }
+
+    static inline uint32_t get(MetricId id)
+    {
+        return values[id];
+    }
+
+    static const MetricInfo *info(MetricId id);
+
+    static void watchTask(xTaskHandle handle);
+    static int taskCount();
+    static const char *taskName(int index);
+    static uint32_t taskStackFree(int index);
+
+    private:
+    static volatile uint32_t values[METRIC_COUNT];
+    static xTaskHandle tasks[kMETRICS_MAX_TASKS];
+    static int tasksUsed;
+};
+
+#endif /* METRICS_H_INCLUDED */
@@ -0,0 +1,319 @@
+/*
+**
+**                           Publisher.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Publisher.h"
+#include "StateVersion.h"
+#include "Metrics.h"
+#include <string.h>
+
+//
+// MQTT 3.1.1 control packet types
+//
+#define kMQTT_CONNECT 1
+#define kMQTT_CONNACK 2
+#define kMQTT_PUBLISH 3
+#define kMQTT_PINGREQ 12
+#define kMQTT_PINGRESP 13
+
+#define kMQTT_PUBLISH_RETAIN 0x01
+#define kMQTT_CONNECT_CLEAN_SESSION 0x02
+
+void Publisher::init(const PeerPort *brokerPort, const char *clientId, PublishCollector collector)
+{
+    //
+    // Task has to be started by the application
+    //
+
+    port = brokerPort;
+    client = clientId;
+    collect = collector;
+    outboxHead = 0;
+    outboxTail = 0;
+    outboxUsed = 0;
+    connected = false;
+    resync = true;
+    running = true;
+}
+
+bool Publisher::publish(const char *name, const char *payload)
+{
+    //
+    // Queues a retained record, topic is rhome/<client id>/<name>
+    // Has to be called from the collector. Returns false if the record is too long.
+    //
+
+    int clientLength = strlen(client);
+    int nameLength = strlen(name);
+    int payloadLength = strlen(payload);
+    int topicLength = strlen(kPUBLISH_TOPIC_PREFIX) + clientLength + 1 + nameLength;
+
+    if (topicLength > kPUBLISH_TOPIC_LENGTH || payloadLength > kPUBLISH_TOPIC_LENGTH)
+        return false;
+
+    // Remaining length is at most 2 + 2*kPUBLISH_TOPIC_LENGTH, so it always fits into one byte
+    int remainingLength = 2 + topicLength + payloadLength;
+    uint8_t head[4] = {(kMQTT_PUBLISH << 4) | kMQTT_PUBLISH_RETAIN, (uint8_t)remainingLength, (uint8_t)(topicLength >> 8), (uint8_t)topicLength};
+    int packetLength = 2 + remainingLength;
+
+    if (outboxUsed + packetLength > kPUBLISH_OUTBOX_SIZE)
+    {
+        flush();
+    }
+
+    while (outboxUsed + packetLength > kPUBLISH_OUTBOX_SIZE)
+    {
+        // Broker is not reachable, the oldest records make room (state is resent once it is back)
+        outboxDrop(outboxPacketLength());
+        resync = true;
+        Metrics::add(METRIC_PUBLISH_DROPPED);
+    }
+
+    outboxWrite(head, sizeof(head));
+    outboxWrite((const uint8_t *)kPUBLISH_TOPIC_PREFIX, strlen(kPUBLISH_TOPIC_PREFIX));
+    outboxWrite((const uint8_t *)client, clientLength);
+    outboxWrite((const uint8_t *)"/", 1);
+    outboxWrite((const uint8_t *)name, nameLength);
+    outboxWrite((const uint8_t *)payload, payloadLength);
+
+    return true;
+}
+
+const char *Publisher::status()
+{
+    return (!running)? "none" : (connected)? "online" : "offline";
+}
+
+void Publisher::outboxWrite(const uint8_t *data, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        outbox[outboxHead] = data[i];
+        outboxHead = (outboxHead + 1) % kPUBLISH_OUTBOX_SIZE;
+    }
+
+    outboxUsed += length;
+}
+
+int Publisher::outboxPacketLength()
+{
+    //
+    // Length of the oldest packet in the outbox (all of them are PUBLISH packets with a one byte remaining length)
+    //
+
+    return 2 + outbox[(outboxTail + 1) % kPUBLISH_OUTBOX_SIZE];
+}
+
+void Publisher::outboxDrop(int length)
+{
+    outboxTail = (outboxTail + length) % kPUBLISH_OUTBOX_SIZE;
+    outboxUsed -= length;
+}
+
+void Publisher::flush()
+{
+    //
+    // Sends the whole outbox (at most two writes, the ring can wrap) while the broker is connected
+    //
+
+    if (!connected || outboxUsed == 0)
+        return;
+
+    int records = 0;
+    for (int offset = 0; offset < outboxUsed; records++)
+    {
+        offset += 2 + outbox[(outboxTail + offset + 1) % kPUBLISH_OUTBOX_SIZE];
+    }
+
+    int first = kPUBLISH_OUTBOX_SIZE - outboxTail;
+    if (first > outboxUsed)
+        first = outboxUsed;
+
+    port->send((const char *)&outbox[outboxTail], first);
+    if (first < outboxUsed)
+    {
+        port->send((const char *)&outbox[0], outboxUsed - first);
+    }
+
+    outboxDrop(outboxUsed);
+    Metrics::add(METRIC_PUBLISH_RECORDS, records);
+}
+
+void Publisher::sendConnect()
+{
+    //
+    // CONNECT with a clean session, no will and no credentials
+    //
+
+    int clientLength = strlen(client);
+    uint8_t packet[14 + kPUBLISH_CLIENT_ID_LENGTH] =
+    {
+        kMQTT_CONNECT << 4, (uint8_t)(12 + clientLength),
+        0, 4, 'M', 'Q', 'T', 'T', 4, kMQTT_CONNECT_CLEAN_SESSION, 0, kPUBLISH_KEEP_ALIVE,
+        0, (uint8_t)clientLength
+    };
+
+    memcpy(&packet[14], client, clientLength);
+    port->send((const char *)packet, 14 + clientLength);
+}
+
+void Publisher::sendPing()
+{
+    const uint8_t packet[2] = {kMQTT_PINGREQ << 4, 0};
+    port->send((const char *)packet, sizeof(packet));
+}
+
+int Publisher::handlePacket()
+{
+    //
+    // Handles the first packet from the broker
+    // Returns its type or 0 if it was not completely received yet
+    //
+
+    const uint8_t *buff = (const uint8_t *)port->buff;
+    int length = *port->buffIndicator;
+
+    if (length < 2)
+        return 0;
+
+    int headLength = 2;
+    int remainingLength = buff[1] & 0x7F;
+    if (buff[1] & 0x80)
+    {
+        if (length < 3)
+            return 0;
+
+        remainingLength += (buff[2] & 0x7F) << 7;
+        headLength = 3;
+    }
+
+    if (headLength + remainingLength > port->buffSize)
+    {
+        // Not something a broker sends to a client that has no subscriptions
+        port->consume(length);
+        return 0;
+    }
+
+    if (headLength + remainingLength > length)
+        return 0;
+
+    int type = buff[0] >> 4;
+
+    if (type == kMQTT_CONNACK)
+    {
+        connected = (remainingLength == 2 && buff[3] == 0);
+    }
+
+    port->consume(headLength + remainingLength);
+
+    return type;
+}
+
+void Publisher::task(void *pvParameters)
+{
+    //
+    // Broker connection task
+    // Once per kPUBLISH_WINDOW: handles broker packets, keeps the connection alive (or reconnects),
+    // collects the changes and sends the outbox
+    //
+
+    (void)pvParameters;
+
+    bool waiting = false;               // CONNACK or PINGRESP is outstanding
+    bool attempted = false;
+    portTickType waitingSince = 0;
+    portTickType lastAttempt = 0;
+    portTickType lastPing = 0;
+    portTickType lastTelemetry = 0;
+    uint32_t version = 0;
+
+    while (1)
+    {
+        portTickType now = xTaskGetTickCount();
+        int type;
+
+        while ((type = handlePacket()) != 0)
+        {
+            if (type == kMQTT_CONNACK || type == kMQTT_PINGRESP)
+            {
+                waiting = false;
+                lastPing = now;
+            }
+        }
+
+        if (waiting && now - waitingSince >= kPUBLISH_TIMEOUT / portTICK_RATE_MS)
+        {
+            // Broker is not answering (or the module is reconnecting), start over
+            // Records sent since the connection dropped are lost, so the whole state is sent again
+            connected = false;
+            waiting = false;
+            resync = true;
+            port->consume(*port->buffIndicator);
+        }
+
+        if (!connected && !waiting && (!attempted || now - lastAttempt >= kPUBLISH_RETRY_INTERVAL / portTICK_RATE_MS))
+        {
+            sendConnect();
+            attempted = true;
+            waiting = true;
+            waitingSince = now;
+            lastAttempt = now;
+        }
+        else if (connected && !waiting && now - lastPing >= kPUBLISH_KEEP_ALIVE * 1000 / 2 / portTICK_RATE_MS)
+        {
+            sendPing();
+            waiting = true;
+            waitingSince = now;
+            lastPing = now;
+        }
+
+        if (connected && resync)
+        {
+            resync = false;
+            version = StateVersion::get();
+            collect(PUBLISH_ALL);
+            collect(PUBLISH_TELEMETRY);
+            lastTelemetry = now;
+        }
+        else if (StateVersion::get() != version)
+        {
+            version = StateVersion::get();
+            collect(PUBLISH_CHANGES);
+        }
+
+        if (connected && now - lastTelemetry >= kPUBLISH_TELEMETRY_INTERVAL / portTICK_RATE_MS)
+        {
+            lastTelemetry = now;
+            collect(PUBLISH_TELEMETRY);
+        }
+
+        flush();
+
+        vTaskDelay(kPUBLISH_WINDOW / portTICK_RATE_MS);
+    }
+}
+
+const PeerPort *Publisher::port = NULL;
+const char *Publisher::client = NULL;
+PublishCollector Publisher::collect = NULL;
+uint8_t Publisher::outbox[kPUBLISH_OUTBOX_SIZE];
+int Publisher::outboxHead = 0;
+int Publisher::outboxTail = 0;
+int Publisher::outboxUsed = 0;
+bool Publisher::connected = false;
+bool Publisher::resync = true;
+bool Publisher::running = false;
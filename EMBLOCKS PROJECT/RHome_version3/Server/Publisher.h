@@ -0,0 +1,86 @@
+/*
+**
+**                           Publisher.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef PUBLISHER_H_INCLUDED
+#define PUBLISHER_H_INCLUDED
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "Aggregator.h"
+
+//
+// State change publisher
+// Wifi connection 2 runs as a TCP client to a local MQTT 3.1.1 broker. Changes are collected once per
+// kPUBLISH_WINDOW and queued as retained QoS 0 PUBLISH packets (topic rhome/<client id>/<name>) in an outbox
+// ring that is only sent while the broker answers. The module is transparent, so CONNACK and PINGRESP are the
+// only way to know the connection is up; data sent just before a connection drop is lost, everything queued
+// while it is down is kept (oldest records are dropped when the ring is full, then the whole state is resent).
+//
+
+#define kPUBLISH_OUTBOX_SIZE 1024
+#define kPUBLISH_TOPIC_PREFIX "rhome/"
+#define kPUBLISH_CLIENT_ID_LENGTH 24
+#define kPUBLISH_TOPIC_LENGTH 64
+#define kPUBLISH_WINDOW 250                 // ms changes are batched for
+#define kPUBLISH_KEEP_ALIVE 30              // s, MQTT keep alive (a ping is sent every half of it)
+#define kPUBLISH_TIMEOUT 3000               // ms to wait for CONNACK or PINGRESP
+#define kPUBLISH_RETRY_INTERVAL 5000        // ms between connection attempts
+#define kPUBLISH_TELEMETRY_INTERVAL 60000   // ms between telemetry records
+
+typedef enum
+{
+    PUBLISH_CHANGES,        // Only what changed since the last call
+    PUBLISH_ALL,            // Whole state (first connection or records were dropped)
+    PUBLISH_TELEMETRY       // Performance counters
+} PublishScope;
+
+//
+// Provided by the application, calls Publisher::publish() for every record of the scope
+// (runs in the publisher task)
+//
+typedef void (*PublishCollector)(PublishScope scope);
+
+class Publisher
+{
+    public:
+    static void init(const PeerPort *brokerPort, const char *clientId, PublishCollector collector);
+    static bool publish(const char *name, const char *payload);
+    static const char *status();
+    static void task(void *pvParameters);
+
+    private:
+    static void sendConnect();
+    static void sendPing();
+    static int handlePacket();
+    static void flush();
+    static void outboxWrite(const uint8_t *data, int length);
+    static int outboxPacketLength();
+    static void outboxDrop(int length);
+    static const PeerPort *port;
+    static const char *client;
+    static PublishCollector collect;
+    static uint8_t outbox[kPUBLISH_OUTBOX_SIZE];
+    static int outboxHead;
+    static int outboxTail;
+    static int outboxUsed;
+    static bool connected;
+    static bool resync;
+    static bool running;
+};
+
+#endif /* PUBLISHER_H_INCLUDED */
@@ -0,0 +1,148 @@
+/*
+**
+**                           Router.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Router.h"
+#include <string.h>
+
+static const struct
+{
+    const char *name;
+    RouteMethod method;
+} kRouteMethods[] =
+{
+    {"GET ", ROUTE_METHOD_GET},
+    {"POST ", ROUTE_METHOD_POST},
+    {"PUT ", ROUTE_METHOD_PUT}
+};
+
+void routeSplit(const char *request, int headerLength, RoutePath *path)
+{
+    //
+    // Splits the request path into segments (at most kROUTE_MAX_PATH characters are looked at,
+    // a segment that does not fit into kROUTE_SEGMENT_LENGTH ends the path)
+    //
+
+    path->method = 0;
+    for (unsigned int i = 0; i < sizeof(kRouteMethods) / sizeof(kRouteMethods[0]); i++)
+    {
+        if (strncmp(request, kRouteMethods[i].name, strlen(kRouteMethods[i].name)) == 0)
+            path->method = kRouteMethods[i].method;
+    }
+
+    for (int i = 0; i < kROUTE_MAX_SEGMENTS; i++)
+    {
+        path->text[i][0] = '\0';
+        path->hash[i] = kROUTE_FNV_OFFSET;
+        path->number[i] = -1;
+        path->start[i] = -1;
+    }
+
+    int pathStart = 0;
+    while (pathStart < headerLength && request[pathStart] != ' ')
+    {
+        pathStart++;
+    }
+
+    int segment = -1;
+    int length = 0;
+    for (int i = pathStart + 1; i < pathStart + kROUTE_MAX_PATH && i < headerLength; i++)
+    {
+        char c = request[i];
+
+        if (c == ' ')
+        {
+            if (length > 0)
+                segment++;
+            break;
+        }
+
+        if (c == '/')
+        {
+            segment++;
+            length = 0;
+            if (segment < kROUTE_MAX_SEGMENTS)
+                path->start[segment] = i + 1;
+            continue;
+        }
+
+        if (segment == -1 || segment >= kROUTE_MAX_SEGMENTS || length >= kROUTE_SEGMENT_LENGTH - 2)
+            break;
+
+        path->text[segment][length] = c;
+        path->text[segment][length + 1] = '\0';
+        path->hash[segment] = (path->hash[segment] ^ (uint8_t)c) * kROUTE_FNV_PRIME;
+
+        if (c >= '0' && c <= '9' && (length == 0 || (path->number[segment] >= 0 && path->number[segment] < 100000000)))
+            path->number[segment] = ((length == 0)? 0 : path->number[segment]*10) + (c - '0');
+        else
+            path->number[segment] = -1;
+
+        length++;
+    }
+
+    path->count = (segment > 0)? segment : 0;
+}
+
+bool routeIs(const RoutePath *path, int segment, uint32_t hash)
+{
+    return segment < kROUTE_MAX_SEGMENTS && path->hash[segment] == hash;
+}
+
+bool routeFind(const RouteTable *table, const RoutePath *path, int segment, RouteMatch *match)
+{
+    //
+    // Finds the route of the path segment and decodes the following segments as its parameters
+    // Returns false if the segment is not a route keyword
+    //
+
+    if (segment >= kROUTE_MAX_SEGMENTS)
+        return false;
+
+    const Route *routes = table->routes;
+    int index = table->slots[routeSlotOf(path->hash[segment], table->shift)];
+    if (index < 0 || strcmp(routes[index].keyword, path->text[segment]) != 0)
+        return false;
+
+    match->route = &routes[index];
+    match->methodAllowed = (routes[index].methods & path->method) != 0;
+
+    for (int i = 0; i < kROUTE_MAX_PARAMS; i++)
+    {
+        int param = segment + 1 + i;
+        bool present = param < path->count;
+
+        switch (routes[index].params[i])
+        {
+            case ROUTE_PARAM_INT:
+                match->param[i] = (present)? path->number[param] : -1;
+                break;
+            case ROUTE_PARAM_WORD:
+                match->param[i] = (present)? path->hash[param] : 0;
+                break;
+            case ROUTE_PARAM_REST:
+                // Not limited to complete segments, an action list can be longer than a segment
+                match->param[i] = (param < kROUTE_MAX_SEGMENTS)? path->start[param] : -1;
+                break;
+            default:
+                match->param[i] = 0;
+                break;
+        }
+    }
+
+    return true;
+}
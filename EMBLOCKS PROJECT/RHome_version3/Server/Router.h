@@ -0,0 +1,131 @@
+/*
+**
+**                           Router.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef ROUTER_H_INCLUDED
+#define ROUTER_H_INCLUDED
+
+#include <stdint.h>
+
+//
+// Table driven request router
+// The request path is split once: every segment gets its FNV-1a hash and its value (if it is a number).
+// Route keywords are hashed by the compiler and the compiler also builds a collision free slot table
+// (hash -> route). Finding a route is one table lookup and one string compare, so adding routes
+// costs nothing at run time.
+//
+
+#define kROUTE_MAX_SEGMENTS 8       // credentials, api, house and room come before the route
+#define kROUTE_SEGMENT_LENGTH 20
+#define kROUTE_MAX_PATH 100
+#define kROUTE_MAX_PARAMS 3
+#define kROUTE_SLOT_BITS 5
+#define kROUTE_SLOTS (1 << kROUTE_SLOT_BITS)
+
+#define kROUTE_FNV_OFFSET 2166136261u
+#define kROUTE_FNV_PRIME 16777619u
+
+typedef enum
+{
+    ROUTE_METHOD_GET = 0x01,
+    ROUTE_METHOD_POST = 0x02,
+    ROUTE_METHOD_PUT = 0x04,
+    ROUTE_METHOD_ANY = 0x07
+} RouteMethod;
+
+typedef enum
+{
+    ROUTE_PARAM_NONE,
+    ROUTE_PARAM_INT,                // Value of the segment, -1 if it is missing or not a number
+    ROUTE_PARAM_WORD,               // Hash of the segment (compare with routeHash("...")), 0 if missing
+    ROUTE_PARAM_REST                // Request offset of the segment and everything after it, -1 if missing
+} RouteParam;
+
+typedef struct
+{
+    const char *keyword;
+    uint8_t methods;
+    uint8_t params[kROUTE_MAX_PARAMS];
+    uint8_t handler;                // Handler ID of the application
+    const char *contentType;        // NULL if it depends on the client (web page or API)
+} Route;
+
+typedef struct
+{
+    uint8_t method;                 // RouteMethod, 0 for anything else
+    int count;                      // Complete segments (an empty last one is not counted)
+    char text[kROUTE_MAX_SEGMENTS][kROUTE_SEGMENT_LENGTH];
+    uint32_t hash[kROUTE_MAX_SEGMENTS];
+    int32_t number[kROUTE_MAX_SEGMENTS];
+    int start[kROUTE_MAX_SEGMENTS];
+} RoutePath;
+
+typedef struct
+{
+    const Route *route;
+    bool methodAllowed;
+    int32_t param[kROUTE_MAX_PARAMS];
+} RouteMatch;
+
+constexpr uint32_t routeHash(const char *text, uint32_t hash = kROUTE_FNV_OFFSET)
+{
+    return (*text == '\0')? hash : routeHash(text + 1, (hash ^ (uint8_t)*text) * kROUTE_FNV_PRIME);
+}
+
+//
+// Routes of the application with their slot table
+// Slot of a keyword is a 5 bit window of its hash, the compiler picks the first window (shift) in which
+// all keywords of the table get their own slot. Build with ROUTE_TABLE(routes, count) and
+// static_assert(table.shift >= 0, ...) next to it.
+//
+typedef struct
+{
+    const Route *routes;
+    int8_t shift;
+    int8_t slots[kROUTE_SLOTS];     // Route index, -1 for an empty slot
+} RouteTable;
+
+constexpr int routeSlotOf(uint32_t hash, int shift)
+{
+    return (hash >> shift) & (kROUTE_SLOTS - 1);
+}
+
+constexpr int routeSlot(const Route *routes, int count, int shift, int slot, int i = 0)
+{
+    return (i == count || shift < 0)? -1 : (routeSlotOf(routeHash(routes[i].keyword), shift) == slot)? i : routeSlot(routes, count, shift, slot, i + 1);
+}
+
+constexpr bool routeSlotsUnique(const Route *routes, int count, int shift, int i = 0)
+{
+    return i == count || (routeSlot(routes, count, shift, routeSlotOf(routeHash(routes[i].keyword), shift)) == i && routeSlotsUnique(routes, count, shift, i + 1));
+}
+
+constexpr int routeShift(const Route *routes, int count, int shift = 0)
+{
+    return (shift > 32 - kROUTE_SLOT_BITS)? -1 : routeSlotsUnique(routes, count, shift)? shift : routeShift(routes, count, shift + 1);
+}
+
+#define ROUTE_SLOTS_4(r, n, s) routeSlot(r, n, routeShift(r, n), s), routeSlot(r, n, routeShift(r, n), s + 1), \
+    routeSlot(r, n, routeShift(r, n), s + 2), routeSlot(r, n, routeShift(r, n), s + 3)
+#define ROUTE_SLOTS_16(r, n, s) ROUTE_SLOTS_4(r, n, s), ROUTE_SLOTS_4(r, n, s + 4), ROUTE_SLOTS_4(r, n, s + 8), ROUTE_SLOTS_4(r, n, s + 12)
+#define ROUTE_TABLE(r, n) {r, routeShift(r, n), {ROUTE_SLOTS_16(r, n, 0), ROUTE_SLOTS_16(r, n, 16)}}
+
+void routeSplit(const char *request, int headerLength, RoutePath *path);
+bool routeFind(const RouteTable *table, const RoutePath *path, int segment, RouteMatch *match);
+bool routeIs(const RoutePath *path, int segment, uint32_t hash);
+
+#endif /* ROUTER_H_INCLUDED */
@@ -0,0 +1,135 @@
+/*
+**
+**                           Template.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Template.h"
+#include <string.h>
+
+static const TemplateOp *skipLoop(const TemplateOp *op)
+{
+    //
+    // Returns the TPL_LOOP_END that closes the loop whose body starts at op
+    //
+
+    int depth = 0;
+
+    while (op->opcode != TPL_END)
+    {
+        if (op->opcode == TPL_LOOP)
+        {
+            depth++;
+        }
+        else if (op->opcode == TPL_LOOP_END)
+        {
+            if (depth == 0)
+                return op;
+            depth--;
+        }
+        op++;
+    }
+
+    return op;
+}
+
+static const TemplateOp *runTemplate(const TemplateOp *op, TemplateContext *ctx, TemplateWriter writer, int index, bool last, int *length)
+{
+    //
+    // Executes ops until the end of the template (or the end of the current loop body)
+    // Only counts the output length when writer is NULL
+    // Returns the op that stopped the execution
+    //
+
+    while (op->opcode != TPL_END && op->opcode != TPL_LOOP_END)
+    {
+        switch (op->opcode)
+        {
+            case TPL_SEPARATOR:
+                if (last)
+                    break;
+                // Fall through - separator is a literal between loop items
+            case TPL_LITERAL:
+                *length += op->value;
+                if (writer)
+                    writer(ctx, op->text, op->value);
+                break;
+
+            case TPL_SLOT:
+            {
+                const char *slot = ctx->resolve(ctx, op->value, index);
+                int slotLength = strlen(slot);
+
+                *length += slotLength;
+                if (writer && slotLength > 0)
+                    writer(ctx, slot, slotLength);
+                break;
+            }
+
+            case TPL_INCLUDE:
+                runTemplate(op->include, ctx, writer, index, last, length);
+                break;
+
+            case TPL_LOOP:
+            {
+                int count = (op->value < kTEMPLATE_MAX_LOOPS)? ctx->loopCount[op->value] : 0;
+                const TemplateOp *loopEnd = skipLoop(op + 1);
+
+                for (int i = 0; i < count; i++)
+                {
+                    runTemplate(op + 1, ctx, writer, i, (i == count - 1), length);
+                }
+
+                if (loopEnd->opcode == TPL_END)
+                    return loopEnd;
+
+                op = loopEnd;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        op++;
+    }
+
+    return op;
+}
+
+int templateLength(const TemplateOp *tpl, TemplateContext *ctx)
+{
+    //
+    // Returns the exact length of the rendered template
+    // Literal lengths are known in advance so only slots need to be evaluated
+    //
+
+    int length = 0;
+    runTemplate(tpl, ctx, NULL, 0, true, &length);
+
+    return length;
+}
+
+int templateRender(const TemplateOp *tpl, TemplateContext *ctx, TemplateWriter writer)
+{
+    //
+    // Streams the rendered template to the writer, returns the number of bytes written
+    //
+
+    int length = 0;
+    runTemplate(tpl, ctx, writer, 0, true, &length);
+
+    return length;
+}
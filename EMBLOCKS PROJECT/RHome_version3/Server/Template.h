@@ -0,0 +1,81 @@
+/*
+**
+**                           Template.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef TEMPLATE_H_INCLUDED
+#define TEMPLATE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Template engine
+// Templates are const op streams (placed in flash) made of literal spans with their length
+// known at compile time, typed value slots and loops. They are streamed straight to the output.
+//
+
+#define kTEMPLATE_MAX_LOOPS 5
+#define kTEMPLATE_SCRATCH_SIZE 48      // Longest formatted value is the batch result
+
+typedef enum
+{
+    TPL_END,
+    TPL_LITERAL,
+    TPL_SEPARATOR,
+    TPL_SLOT,
+    TPL_INCLUDE,
+    TPL_LOOP,
+    TPL_LOOP_END
+} TemplateOpcode;
+
+typedef struct TemplateOp
+{
+    uint8_t opcode;
+    uint16_t value;                 // Literal length, slot id or loop id
+    const char *text;
+    const struct TemplateOp *include;
+} TemplateOp;
+
+//
+// Helper macros for writing templates
+// TPL_TEXT only accepts string literals so that the length is calculated by the compiler
+//
+#define TPL_TEXT(s) { TPL_LITERAL, sizeof(s) - 1, s, NULL }
+#define TPL_SEP(s) { TPL_SEPARATOR, sizeof(s) - 1, s, NULL }
+#define TPL_VALUE(slot) { TPL_SLOT, slot, NULL, NULL }
+#define TPL_INSERT(tpl) { TPL_INCLUDE, 0, NULL, tpl }
+#define TPL_FOR(loop) { TPL_LOOP, loop, NULL, NULL }
+#define TPL_ENDFOR { TPL_LOOP_END, 0, NULL, NULL }
+#define TPL_DONE { TPL_END, 0, NULL, NULL }
+
+struct TemplateContext;
+
+typedef const char *(*TemplateResolver)(TemplateContext *ctx, int slot, int index);
+typedef void (*TemplateWriter)(TemplateContext *ctx, const char *data, int length);
+
+typedef struct TemplateContext
+{
+    TemplateResolver resolve;
+    int loopCount[kTEMPLATE_MAX_LOOPS];
+    void *userData;
+    char scratch[kTEMPLATE_SCRATCH_SIZE];
+} TemplateContext;
+
+int templateLength(const TemplateOp *tpl, TemplateContext *ctx);
+int templateRender(const TemplateOp *tpl, TemplateContext *ctx, TemplateWriter writer);
+
+#endif /* TEMPLATE_H_INCLUDED */
@@ -0,0 +1,241 @@
+/*
+**
+**                           WebPages.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "WebPages.h"
+
+//
+// Beginning of the control web page (including stylesheet)
+//
+static const TemplateOp kWebPageStart[] =
+{
+    TPL_TEXT("<!DOCTYPE html><html><head><style type='text/css'>html {height: 100%;} body {min-height: 100%; background: repeating-linear-gradient(45deg, #2c3339, #2c3339 7px, #161819 7px, #161819 12px); font-family: Arial, Helvetica, sans-serif; color: #F3F9FE;} h1 {padding:0px; margin:0px; color: #F3F9FE; font-size: 1.6em;} input {background-color: #9BCCF5; border: solid #161819 1px; width: 300px; height: 25px;} button {background-color:#9BCCF5; border: solid #9BCCF5 1px; height: 30px; vertical-align: middle; font-size: 0.65em;} .main {width: 1000px; height: 550px; border-radius: 275px; margin: auto; background-color: #5DB5FF; position: absolute; top: 0; left: 0; bottom: 0; right: 0; overflow: auto;} .left_top {float:left; width: 499px; height: 274px;} .light_off {border: solid #FFC719 2px; width: 22px; height: 22px; border-radius:11px; display: inline-block; position:relative; top:12px;} .light_on {background-color: #FFC719; width: 24px; height: 24px; border-radius:12px; display: inline-block; position:relative; top:12px;} .elements {color: #FFC719; font-size: 1.3em; line-height: 45px;} progress {width: 70px; apperance: none; -webkit-appearance: none; -moz-appearance: none; border: none; background-color: #F3F9FE;} progress::-webkit-progress-value {background-color: #FFC719;} progress::-moz-progress-bar {background-color: #FFC719;}</style><title>Rhome v3</title></head><body><div class='main'>"),
+    TPL_DONE
+};
+
+//
+// End of the control web page
+//
+static const TemplateOp kWebPageEnd[] =
+{
+    TPL_TEXT("</div></body></html>"),
+    TPL_DONE
+};
+
+//
+// Log in page
+//
+const TemplateOp kWebLoginTemplate[] =
+{
+    TPL_INSERT(kWebPageStart),
+    TPL_TEXT("<div style='width: 300px; height: 250px; margin: auto; padding-top:125px;'><h1>Please log in!</h1><form method='GET' onSubmit='return false;' id='login'><p>User: <input type='text' id='user' /></p><p>Password: <input type='password' id='pass' /></p><p><button id='sub' onclick=\"var user = document.getElementById('user').value; var pass = document.getElementById('pass').value; location.href = '/login/' + user + '/' + pass;\" >Submit</button></p></form></div>"),
+    TPL_INSERT(kWebPageEnd),
+    TPL_DONE
+};
+
+//
+// Incorrect username/password page
+//
+const TemplateOp kWebAuthErrorTemplate[] =
+{
+    TPL_INSERT(kWebPageStart),
+    TPL_TEXT("<div style='width: 300px; height: 250px; margin: auto; padding-top:125px;'><h1>You are not logged in!</h1>Check your username and password!<br /><br /><button id='sub' onclick=\"location.href = '/' \" >Go back</button></div>"),
+    TPL_INSERT(kWebPageEnd),
+    TPL_DONE
+};
+
+//
+// Main control page
+//
+const TemplateOp kWebIndexTemplate[] =
+{
+    TPL_INSERT(kWebPageStart),
+    TPL_TEXT("<div class='left_top' style='border-right: solid #9BCCF5 1px; border-bottom: solid #9BCCF5 1px; '><div style='padding: 10px; float: right;'><div style='text-align:right;' class='elements'>"),
+
+    TPL_FOR(WEB_LOOP_LIGHTS),
+        TPL_VALUE(WEB_SLOT_LIGHT_NAME),
+        TPL_TEXT(":&nbsp;&nbsp;<div class='"),
+        TPL_VALUE(WEB_SLOT_LIGHT_CLASS),
+        TPL_TEXT("'>&nbsp;</div>&nbsp;&nbsp;<button onclick=\"location.href = '"),
+        TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+        TPL_TEXT("/lght/"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT("/on';\" >On</button>&nbsp;<button onclick=\"location.href = '"),
+        TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+        TPL_TEXT("/lght/"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT("/off';\" >Off</button><br />"),
+    TPL_ENDFOR,
+
+    TPL_TEXT("</div></div><h1 style='position: relative; bottom:-235px; left: 10px; '>Lights</h1></div><div class='left_top' style='border-left: solid #9BCCF5 1px; border-bottom: solid #9BCCF5 1px;'><h1 style='position: relative; bottom:-235px; float: right; right: 10px;'>Blinds</h1><div style='padding: 10px'><div style='text-align:left;' class='elements'>"),
+
+    TPL_FOR(WEB_LOOP_BLINDS),
+        TPL_TEXT("<progress value='"),
+        TPL_VALUE(WEB_SLOT_BLIND_PROGRESS),
+        TPL_TEXT("' max='100'></progress>&nbsp;&nbsp;<button onclick=\"location.href = '"),
+        TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+        TPL_TEXT("/bld/"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT("/0';\" >&lt;</button>&nbsp;<button onclick=\"location.href = '"),
+        TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+        TPL_TEXT("/bld/"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT("/1';\" >-</button>&nbsp;<button onclick=\"location.href = '"),
+        TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+        TPL_TEXT("/bld/"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT("/2';\" >&gt;</button>&nbsp;&nbsp;"),
+        TPL_VALUE(WEB_SLOT_BLIND_NAME),
+        TPL_TEXT("<br />"),
+    TPL_ENDFOR,
+
+    TPL_TEXT("</div></div></div><div class='left_top' style='border-right: solid #9BCCF5 1px; border-top: solid #9BCCF5 1px;'><div style='padding: 10px; float: left;'><h1>Info</h1></div><div style='text-align:right; margin-right:50px;' class='elements'>Temperature: "),
+    TPL_VALUE(WEB_SLOT_TEMPERATURE),
+    TPL_TEXT("\xB0" "C<br />"),
+    TPL_VALUE(WEB_SLOT_TIME),
+    TPL_TEXT("<br /><button onclick=\"location.href = '"),
+    TPL_VALUE(WEB_SLOT_LINK_PREFIX),
+    TPL_TEXT("/';\" >Refresh</button>"),
+    TPL_TEXT("</div></div><div class='left_top' style='border-left: solid #9BCCF5 1px; border-top: solid #9BCCF5 1px;'><div class='elements' style='margin-left:50px;'>Rhome v3.0<br />http://www.r00li.com</div><div style='padding: 10px;'><h1 style='float:right;'>&nbsp;</h1></div></div><div style='background-color: #0284F0; display:block; width: 100px; border-radius: 50px; height: 100px; position: relative; left:450px; top: 225px;'></div>"),
+    TPL_INSERT(kWebPageEnd),
+    TPL_DONE
+};
+
+//
+// JSON API response
+//
+const TemplateOp kApiStatusTemplate[] =
+{
+    TPL_TEXT("{\"lights\":["),
+    TPL_FOR(WEB_LOOP_LIGHTS),
+        TPL_TEXT("{\"id\":"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT(",\"entity\":"),
+        TPL_VALUE(WEB_SLOT_LIGHT_ENTITY),
+        TPL_TEXT(",\"name\":\""),
+        TPL_VALUE(WEB_SLOT_LIGHT_NAME),
+        TPL_TEXT("\",\"status\":\""),
+        TPL_VALUE(WEB_SLOT_LIGHT_STATE),
+        TPL_TEXT("\"}"),
+        TPL_SEP(","),
+    TPL_ENDFOR,
+    TPL_TEXT("], \"blinds\":["),
+    TPL_FOR(WEB_LOOP_BLINDS),
+        TPL_TEXT("{\"id\":"),
+        TPL_VALUE(WEB_SLOT_INDEX),
+        TPL_TEXT(",\"entity\":"),
+        TPL_VALUE(WEB_SLOT_BLIND_ENTITY),
+        TPL_TEXT(",\"status\":"),
+        TPL_VALUE(WEB_SLOT_BLIND_STATE),
+        TPL_TEXT(",\"name\":\""),
+        TPL_VALUE(WEB_SLOT_BLIND_NAME),
+        TPL_TEXT("\"}"),
+        TPL_SEP(","),
+    TPL_ENDFOR,
+    TPL_TEXT("], \"temperature\":"),
+    TPL_VALUE(WEB_SLOT_TEMPERATURE),
+    TPL_TEXT(",\"time\":\""),
+    TPL_VALUE(WEB_SLOT_TIME),
+    TPL_TEXT("\","),
+    TPL_VALUE(WEB_SLOT_BATCH),
+    TPL_TEXT("\"api_ver\":1 }"),
+    TPL_DONE
+};
+
+//
+// Whole house status, this unit (API status) followed by the rooms of the peer chain
+//
+const TemplateOp kHouseStatusTemplate[] =
+{
+    TPL_TEXT("{\"rooms\":["),
+    TPL_INSERT(kApiStatusTemplate),
+    TPL_VALUE(WEB_SLOT_PEER_ROOMS),
+    TPL_TEXT("],\"peer\":\""),
+    TPL_VALUE(WEB_SLOT_PEER_STATUS),
+    TPL_TEXT("\"}"),
+    TPL_DONE
+};
+
+//
+// Firmware counters, one HELP/TYPE/value block for each and stack high-water marks of the tasks
+//
+const TemplateOp kMetricsTemplate[] =
+{
+    TPL_FOR(METRICS_LOOP_VALUES),
+        TPL_TEXT("# HELP rhome_"),
+        TPL_VALUE(METRICS_SLOT_NAME),
+        TPL_TEXT(" "),
+        TPL_VALUE(METRICS_SLOT_HELP),
+        TPL_TEXT("\n# TYPE rhome_"),
+        TPL_VALUE(METRICS_SLOT_NAME),
+        TPL_TEXT(" "),
+        TPL_VALUE(METRICS_SLOT_TYPE),
+        TPL_TEXT("\nrhome_"),
+        TPL_VALUE(METRICS_SLOT_NAME),
+        TPL_TEXT(" "),
+        TPL_VALUE(METRICS_SLOT_VALUE),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_TEXT("# HELP rhome_task_stack_free_words Lowest amount of free stack since the task started\n# TYPE rhome_task_stack_free_words gauge\n"),
+    TPL_FOR(METRICS_LOOP_TASKS),
+        TPL_TEXT("rhome_task_stack_free_words{task=\""),
+        TPL_VALUE(METRICS_SLOT_TASK_NAME),
+        TPL_TEXT("\"} "),
+        TPL_VALUE(METRICS_SLOT_TASK_STACK),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_TEXT("# HELP rhome_rf_light_telegrams_total RF telegrams sent for a light\n# TYPE rhome_rf_light_telegrams_total counter\n"),
+    TPL_FOR(METRICS_LOOP_LIGHT_TELEGRAMS),
+        TPL_TEXT("rhome_rf_light_telegrams_total{light=\""),
+        TPL_VALUE(METRICS_SLOT_LIGHT_ID),
+        TPL_TEXT("\"} "),
+        TPL_VALUE(METRICS_SLOT_LIGHT_TELEGRAMS),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_TEXT("# HELP rhome_rf_light_backoffs_total Transmissions for a light delayed because another remote was heard\n# TYPE rhome_rf_light_backoffs_total counter\n"),
+    TPL_FOR(METRICS_LOOP_LIGHT_BACKOFFS),
+        TPL_TEXT("rhome_rf_light_backoffs_total{light=\""),
+        TPL_VALUE(METRICS_SLOT_LIGHT_ID),
+        TPL_TEXT("\"} "),
+        TPL_VALUE(METRICS_SLOT_LIGHT_BACKOFFS),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_TEXT("# HELP rhome_rf_light_retries_total Extra bursts sent for a light after a burst went out on a busy channel\n# TYPE rhome_rf_light_retries_total counter\n"),
+    TPL_FOR(METRICS_LOOP_LIGHT_RETRIES),
+        TPL_TEXT("rhome_rf_light_retries_total{light=\""),
+        TPL_VALUE(METRICS_SLOT_LIGHT_ID),
+        TPL_TEXT("\"} "),
+        TPL_VALUE(METRICS_SLOT_LIGHT_RETRIES),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_DONE
+};
+
+//
+// Recorded RF receiver edges, in the trace format of the host replay harness (host/RfReplay.cpp)
+//
+const TemplateOp kRfTraceTemplate[] =
+{
+    TPL_TEXT("# rhome rf trace\n# durations "),
+    TPL_VALUE(RF_TRACE_SLOT_EDGES),
+    TPL_TEXT("\n"),
+    TPL_FOR(RF_TRACE_LOOP_DURATIONS),
+        TPL_VALUE(RF_TRACE_SLOT_DURATION),
+        TPL_TEXT("\n"),
+    TPL_ENDFOR,
+    TPL_DONE
+};
@@ -0,0 +1,123 @@
+/*
+**
+**                           WebPages.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef WEBPAGES_H_INCLUDED
+#define WEBPAGES_H_INCLUDED
+
+#include "Template.h"
+
+//
+// Values that can be inserted into web page templates
+//
+typedef enum
+{
+    WEB_SLOT_LINK_PREFIX,
+    WEB_SLOT_INDEX,
+    WEB_SLOT_LIGHT_NAME,
+    WEB_SLOT_LIGHT_ENTITY,
+    WEB_SLOT_LIGHT_STATE,
+    WEB_SLOT_LIGHT_CLASS,
+    WEB_SLOT_BLIND_NAME,
+    WEB_SLOT_BLIND_ENTITY,
+    WEB_SLOT_BLIND_STATE,
+    WEB_SLOT_BLIND_PROGRESS,
+    WEB_SLOT_TEMPERATURE,
+    WEB_SLOT_TIME,
+    WEB_SLOT_BATCH,
+    WEB_SLOT_PEER_ROOMS,
+    WEB_SLOT_PEER_STATUS
+} WebSlot;
+
+//
+// Loops available in web page templates
+//
+typedef enum
+{
+    WEB_LOOP_LIGHTS,
+    WEB_LOOP_BLINDS
+} WebLoop;
+
+//
+// Values and loops of the metrics template (Prometheus text format)
+//
+typedef enum
+{
+    METRICS_SLOT_NAME,
+    METRICS_SLOT_HELP,
+    METRICS_SLOT_TYPE,
+    METRICS_SLOT_VALUE,
+    METRICS_SLOT_TASK_NAME,
+    METRICS_SLOT_TASK_STACK,
+    METRICS_SLOT_LIGHT_ID,
+    METRICS_SLOT_LIGHT_TELEGRAMS,
+    METRICS_SLOT_LIGHT_BACKOFFS,
+    METRICS_SLOT_LIGHT_RETRIES
+} MetricsSlot;
+
+typedef enum
+{
+    METRICS_LOOP_VALUES,
+    METRICS_LOOP_TASKS,
+    METRICS_LOOP_LIGHT_TELEGRAMS,       // Per light RF statistics, one loop per metric
+    METRICS_LOOP_LIGHT_BACKOFFS,
+    METRICS_LOOP_LIGHT_RETRIES
+} MetricsLoop;
+
+//
+// Values and loops of the RF trace export (durations between receiver edges, one per line)
+//
+typedef enum
+{
+    RF_TRACE_SLOT_EDGES,
+    RF_TRACE_SLOT_DURATION
+} RfTraceSlot;
+
+typedef enum
+{
+    RF_TRACE_LOOP_DURATIONS
+} RfTraceLoop;
+
+//
+// Map keys of the compact (CBOR) API encoding
+// Same content as the JSON API, key names are replaced by these numbers
+//
+typedef enum
+{
+    API_KEY_LIGHTS = 1,
+    API_KEY_BLINDS,
+    API_KEY_TEMPERATURE,
+    API_KEY_TIME,               // seconds since midnight
+    API_KEY_BATCH,
+    API_KEY_API_VER,
+    API_KEY_ID,
+    API_KEY_NAME,
+    API_KEY_STATUS,
+    API_KEY_OK,
+    API_KEY_ACTIONS,
+    API_KEY_ENTITY              // entity ID of a light or blind (does not change when the list is replaced)
+} ApiKey;
+
+extern const TemplateOp kWebLoginTemplate[];
+extern const TemplateOp kWebAuthErrorTemplate[];
+extern const TemplateOp kWebIndexTemplate[];
+extern const TemplateOp kApiStatusTemplate[];
+extern const TemplateOp kHouseStatusTemplate[];
+extern const TemplateOp kMetricsTemplate[];
+extern const TemplateOp kRfTraceTemplate[];
+
+#endif /* WEBPAGES_H_INCLUDED */
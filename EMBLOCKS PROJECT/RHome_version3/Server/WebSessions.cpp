@@ -0,0 +1,196 @@
+/*
+**
+**                           WebSessions.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "WebSessions.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_rng.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+
+void WebSessions::init()
+{
+    //
+    // Enables the hardware random number generator and clears the session table
+    //
+
+    RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_RNG, ENABLE);
+    RNG_Cmd(ENABLE);
+
+    for (int i = 0; i < kMAX_SESSIONS; i++)
+    {
+        sessions[i].used = false;
+    }
+}
+
+uint32_t WebSessions::randomWord()
+{
+    //
+    // Returns next random number (new number is ready every 40 RNG clock cycles)
+    //
+
+    while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET) {}
+
+    return RNG_GetRandomNumber();
+}
+
+uint32_t WebSessions::now()
+{
+    return xTaskGetTickCount() / configTICK_RATE_HZ;
+}
+
+bool WebSessions::parseToken(const char *token, uint32_t *words)
+{
+    //
+    // Converts a token from its hex form, returns false if it is malformed
+    //
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t word = 0;
+
+        for (int j = 0; j < 8; j++)
+        {
+            char c = token[i*8 + j];
+            uint32_t digit;
+
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else
+                return false;
+
+            word = (word << 4) | digit;
+        }
+
+        words[i] = word;
+    }
+
+    return true;
+}
+
+int WebSessions::find(const uint32_t *token)
+{
+    //
+    // Looks up a session, always checks the whole table so lookup time does not depend on the token
+    // Returns session index or -1
+    //
+
+    int found = -1;
+    uint32_t time = now();
+
+    for (int i = 0; i < kMAX_SESSIONS; i++)
+    {
+        uint32_t diff = (sessions[i].token[0] ^ token[0]) | (sessions[i].token[1] ^ token[1]) | (sessions[i].token[2] ^ token[2]) | (sessions[i].token[3] ^ token[3]);
+
+        if (diff == 0 && sessions[i].used && (int32_t)(sessions[i].expires - time) > 0)
+        {
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+bool WebSessions::create(char *token)
+{
+    //
+    // Creates a new session and writes its token (kSESSION_TOKEN_LENGTH characters + terminator)
+    // Replaces an expired session or the one closest to expiry when the table is full
+    //
+
+    uint32_t time = now();
+    int slot = 0;
+
+    taskENTER_CRITICAL();
+
+    for (int i = 0; i < kMAX_SESSIONS; i++)
+    {
+        if (!sessions[i].used || (int32_t)(sessions[i].expires - time) <= 0)
+        {
+            slot = i;
+            break;
+        }
+
+        if ((int32_t)(sessions[i].expires - sessions[slot].expires) < 0)
+        {
+            slot = i;
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        sessions[slot].token[i] = randomWord();
+    }
+    sessions[slot].expires = time + kSESSION_LIFETIME;
+    sessions[slot].used = true;
+
+    taskEXIT_CRITICAL();
+
+    sprintf(token, "%08lx%08lx%08lx%08lx", (unsigned long)sessions[slot].token[0], (unsigned long)sessions[slot].token[1],
+            (unsigned long)sessions[slot].token[2], (unsigned long)sessions[slot].token[3]);
+
+    return true;
+}
+
+bool WebSessions::validate(const char *token)
+{
+    //
+    // Checks the token and extends its session
+    //
+
+    uint32_t words[4];
+    if (!parseToken(token, words))
+        return false;
+
+    taskENTER_CRITICAL();
+
+    int session = find(words);
+    if (session >= 0)
+    {
+        sessions[session].expires = now() + kSESSION_LIFETIME;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return session >= 0;
+}
+
+void WebSessions::remove(const char *token)
+{
+    //
+    // Ends a session (log out)
+    //
+
+    uint32_t words[4];
+    if (!parseToken(token, words))
+        return;
+
+    taskENTER_CRITICAL();
+
+    int session = find(words);
+    if (session >= 0)
+    {
+        sessions[session].used = false;
+    }
+
+    taskEXIT_CRITICAL();
+}
+
+WebSession WebSessions::sessions[kMAX_SESSIONS];
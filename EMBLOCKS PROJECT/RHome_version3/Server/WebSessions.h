@@ -0,0 +1,56 @@
+/*
+**
+**                           WebSessions.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef WEBSESSIONS_H_INCLUDED
+#define WEBSESSIONS_H_INCLUDED
+
+#include "stm32f4xx.h"
+
+//
+// Web server login sessions
+// Tokens are 128 bit random numbers from the hardware RNG, sent to the client as 32 hex characters
+//
+
+#define kMAX_SESSIONS 4
+#define kSESSION_TOKEN_LENGTH 32
+#define kSESSION_LIFETIME 1800      // seconds, extended on every use
+
+typedef struct
+{
+    uint32_t token[4];
+    uint32_t expires;
+    bool used;
+} WebSession;
+
+class WebSessions
+{
+    public:
+    static void init();
+    static bool create(char *token);
+    static bool validate(const char *token);
+    static void remove(const char *token);
+
+    private:
+    static int find(const uint32_t *token);
+    static bool parseToken(const char *token, uint32_t *words);
+    static uint32_t randomWord();
+    static uint32_t now();
+    static WebSession sessions[kMAX_SESSIONS];
+};
+
+#endif /* WEBSESSIONS_H_INCLUDED */
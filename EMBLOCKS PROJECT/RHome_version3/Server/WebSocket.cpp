@@ -0,0 +1,252 @@
+/*
+**
+**                           WebSocket.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "WebSocket.h"
+#include <string.h>
+
+#define kWEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline uint32_t rotateLeft(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+void WebSocket::sha1Block(uint32_t *hash, const uint8_t *block)
+{
+    //
+    // Processes one 64 byte block
+    // Message schedule is kept in a 16 word ring instead of 80 words to spare the task stack
+    //
+
+    uint32_t w[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4 + 1] << 16) | ((uint32_t)block[i*4 + 2] << 8) | block[i*4 + 3];
+    }
+
+    uint32_t a = hash[0];
+    uint32_t b = hash[1];
+    uint32_t c = hash[2];
+    uint32_t d = hash[3];
+    uint32_t e = hash[4];
+
+    for (int i = 0; i < 80; i++)
+    {
+        if (i >= 16)
+        {
+            w[i & 15] = rotateLeft(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+        }
+
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i & 15];
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    hash[0] += a;
+    hash[1] += b;
+    hash[2] += c;
+    hash[3] += d;
+    hash[4] += e;
+}
+
+void WebSocket::sha1(const uint8_t *data, int length, uint8_t *digest)
+{
+    //
+    // Calculates the SHA-1 digest (20 bytes) of data
+    //
+
+    uint32_t hash[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block[64];
+    int done = 0;
+
+    while (length - done >= 64)
+    {
+        sha1Block(hash, data + done);
+        done += 64;
+    }
+
+    // Last bytes, 0x80 and the message length in bits (one or two more blocks)
+    int rest = length - done;
+    memcpy(block, data + done, rest);
+    block[rest] = 0x80;
+    memset(block + rest + 1, 0, 63 - rest);
+
+    if (rest >= 56)
+    {
+        sha1Block(hash, block);
+        memset(block, 0, 60);
+    }
+
+    // Upper 32 bits of the length stay zero
+    uint32_t bits = (uint32_t)length * 8;
+    block[60] = bits >> 24;
+    block[61] = bits >> 16;
+    block[62] = bits >> 8;
+    block[63] = bits;
+    sha1Block(hash, block);
+
+    for (int i = 0; i < 20; i++)
+    {
+        digest[i] = hash[i / 4] >> (24 - (i % 4) * 8);
+    }
+}
+
+void WebSocket::base64(const uint8_t *data, int length, char *out)
+{
+    //
+    // Encodes data as base64 with padding, out is null terminated
+    //
+
+    for (int i = 0; i < length; i += 3)
+    {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < length)
+            group |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length)
+            group |= data[i + 2];
+
+        *out++ = kBase64Alphabet[(group >> 18) & 0x3F];
+        *out++ = kBase64Alphabet[(group >> 12) & 0x3F];
+        *out++ = (i + 1 < length)? kBase64Alphabet[(group >> 6) & 0x3F] : '=';
+        *out++ = (i + 2 < length)? kBase64Alphabet[group & 0x3F] : '=';
+    }
+
+    *out = '\0';
+}
+
+void WebSocket::acceptKey(const char *key, char *accept)
+{
+    //
+    // Calculates Sec-WebSocket-Accept from the Sec-WebSocket-Key of the upgrade request
+    // (key must be kWEBSOCKET_KEY_LENGTH characters, accept needs room for kWEBSOCKET_ACCEPT_LENGTH + 1)
+    //
+
+    uint8_t text[kWEBSOCKET_KEY_LENGTH + sizeof(kWEBSOCKET_GUID) - 1];
+    uint8_t digest[20];
+
+    memcpy(text, key, kWEBSOCKET_KEY_LENGTH);
+    memcpy(text + kWEBSOCKET_KEY_LENGTH, kWEBSOCKET_GUID, sizeof(kWEBSOCKET_GUID) - 1);
+
+    sha1(text, sizeof(text), digest);
+    base64(digest, sizeof(digest), accept);
+}
+
+int WebSocket::parseFrame(uint8_t *data, int length, WebSocketFrame *frame)
+{
+    //
+    // Parses a client frame at the start of data and unmasks its payload in place
+    // Returns the length of the whole frame, 0 if it was not completely received yet
+    // or -1 if it is not a valid client frame
+    //
+
+    if (length < 2)
+        return 0;
+
+    // Reserved bits have to be zero and clients must mask their frames
+    if ((data[0] & 0x70) != 0 || (data[1] & 0x80) == 0)
+        return -1;
+
+    frame->opcode = data[0] & 0x0F;
+    frame->final = (data[0] & 0x80) != 0;
+
+    int payloadLength = data[1] & 0x7F;
+    int headLength = 2;
+
+    if (payloadLength == 126)
+    {
+        if (length < 4)
+            return 0;
+
+        payloadLength = (data[2] << 8) | data[3];
+        headLength = 4;
+    }
+    else if (payloadLength == 127)
+    {
+        // 64 bit length, can never fit into the receive buffer
+        return -1;
+    }
+
+    // Control frames are short and can not be fragmented
+    if ((frame->opcode & 0x08) != 0 && (payloadLength > 125 || !frame->final))
+        return -1;
+
+    const uint8_t *mask = data + headLength;
+    headLength += 4;
+
+    if (length < headLength + payloadLength)
+        return 0;
+
+    frame->payload = data + headLength;
+    frame->payloadLength = payloadLength;
+
+    for (int i = 0; i < payloadLength; i++)
+    {
+        frame->payload[i] ^= mask[i & 3];
+    }
+
+    return headLength + payloadLength;
+}
+
+int WebSocket::frameHeader(uint8_t *head, uint8_t opcode, int payloadLength)
+{
+    //
+    // Writes the header of an unfragmented server frame (not masked)
+    // Returns the header length (at most kWEBSOCKET_MAX_HEAD)
+    //
+
+    head[0] = 0x80 | opcode;
+
+    if (payloadLength < 126)
+    {
+        head[1] = payloadLength;
+        return 2;
+    }
+
+    head[1] = 126;
+    head[2] = payloadLength >> 8;
+    head[3] = payloadLength;
+    return 4;
+}
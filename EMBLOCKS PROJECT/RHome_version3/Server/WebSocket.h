@@ -0,0 +1,72 @@
+/*
+**
+**                           WebSocket.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef WEBSOCKET_H_INCLUDED
+#define WEBSOCKET_H_INCLUDED
+
+#include <stdint.h>
+
+//
+// WebSocket (RFC 6455) handshake and framing
+// Only what the web server needs: unfragmented frames small enough to fit the receive buffer
+//
+
+#define kWEBSOCKET_KEY_LENGTH 24        // Sec-WebSocket-Key, base64 of 16 bytes
+#define kWEBSOCKET_ACCEPT_LENGTH 28     // Sec-WebSocket-Accept, base64 of the SHA-1 digest
+#define kWEBSOCKET_MAX_HEAD 4           // Server frame header, payloads are shorter than 64KB
+
+typedef enum
+{
+    WS_OPCODE_CONTINUATION = 0x0,
+    WS_OPCODE_TEXT = 0x1,
+    WS_OPCODE_BINARY = 0x2,
+    WS_OPCODE_CLOSE = 0x8,
+    WS_OPCODE_PING = 0x9,
+    WS_OPCODE_PONG = 0xA
+} WebSocketOpcode;
+
+typedef enum
+{
+    WS_CLOSE_NORMAL = 1000,
+    WS_CLOSE_PROTOCOL_ERROR = 1002,
+    WS_CLOSE_UNSUPPORTED = 1003,
+    WS_CLOSE_TOO_BIG = 1009
+} WebSocketCloseCode;
+
+typedef struct
+{
+    uint8_t opcode;
+    bool final;
+    uint8_t *payload;
+    int payloadLength;
+} WebSocketFrame;
+
+class WebSocket
+{
+    public:
+    static void acceptKey(const char *key, char *accept);
+    static int parseFrame(uint8_t *data, int length, WebSocketFrame *frame);
+    static int frameHeader(uint8_t *head, uint8_t opcode, int payloadLength);
+
+    private:
+    static void sha1(const uint8_t *data, int length, uint8_t *digest);
+    static void sha1Block(uint32_t *hash, const uint8_t *block);
+    static void base64(const uint8_t *data, int length, char *out);
+};
+
+#endif /* WEBSOCKET_H_INCLUDED */
@@ -0,0 +1,300 @@
+/*
+**
+**                           FreeRtosHost.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+//
+// The part of the FreeRTOS API used by the firmware, implemented with host threads
+// Every task is a thread (tasks run truly in parallel, not time sliced on one core).
+// Queues, mutexes and semaphores are the same object like in FreeRTOS: a queue of items,
+// semaphores being queues with zero sized items.
+// Critical sections share one recursive lock with the simulated interrupts (HostPlatform.h).
+// Heap usage is counted against configTOTAL_HEAP_SIZE, stack usage of the threads can not be measured.
+//
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include "HostPlatform.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <malloc.h>
+
+typedef struct
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    unsigned long length;
+    unsigned long itemSize;
+    unsigned long count;
+    unsigned long head;
+    uint8_t *storage;
+} HostQueue;
+
+typedef struct
+{
+    char name[configMAX_TASK_NAME_LEN];
+    unsigned short stackDepth;
+} HostTask;
+
+
+static std::mutex schedulerLock;
+static std::condition_variable schedulerStarted;
+static bool schedulerRunning = false;
+static volatile unsigned long taskCount = 0;
+static volatile size_t heapUsed = 0;
+
+static std::chrono::steady_clock::time_point deadlineAfter(portTickType ticks)
+{
+    //
+    // Converts a FreeRTOS timeout to an absolute host time
+    //
+
+    return std::chrono::steady_clock::now() + std::chrono::microseconds((uint64_t)ticks * 1000000 / configTICK_RATE_HZ);
+}
+
+static bool waitFor(HostQueue *queue, std::unique_lock<std::mutex> &lock, portTickType ticks, bool forSpace)
+{
+    //
+    // Blocks until the queue has an item (or space for one) or the timeout expires
+    //
+
+    auto ready = [queue, forSpace]() { return (forSpace)? queue->count < queue->length : queue->count > 0; };
+
+    if (ticks == portMAX_DELAY)
+    {
+        queue->changed.wait(lock, ready);
+        return true;
+    }
+
+    return queue->changed.wait_until(lock, deadlineAfter(ticks), ready);
+}
+
+extern "C"
+{
+    xQueueHandle xQueueGenericCreate(unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, unsigned char ucQueueType)
+    {
+        HostQueue *queue = new HostQueue();
+
+        queue->length = uxQueueLength;
+        queue->itemSize = uxItemSize;
+        queue->count = 0;
+        queue->head = 0;
+        queue->storage = (uxItemSize > 0)? (uint8_t *)malloc(uxQueueLength * uxItemSize) : NULL;
+
+        return queue;
+    }
+
+    xQueueHandle xQueueCreateMutex(unsigned char ucQueueType)
+    {
+        //
+        // Mutex is a semaphore that is available right after it is created
+        //
+
+        HostQueue *queue = (HostQueue *)xQueueGenericCreate(1, 0, ucQueueType);
+        queue->count = 1;
+
+        return queue;
+    }
+
+    void vQueueDelete(xQueueHandle xQueue)
+    {
+        HostQueue *queue = (HostQueue *)xQueue;
+
+        free(queue->storage);
+        delete queue;
+    }
+
+    signed portBASE_TYPE xQueueGenericSend(xQueueHandle xQueue, const void * const pvItemToQueue, portTickType xTicksToWait, portBASE_TYPE xCopyPosition)
+    {
+        HostQueue *queue = (HostQueue *)xQueue;
+        std::unique_lock<std::mutex> lock(queue->lock);
+
+        if (!waitFor(queue, lock, xTicksToWait, true))
+            return errQUEUE_FULL;
+
+        if (queue->itemSize > 0)
+        {
+            unsigned long slot;
+            if (xCopyPosition == queueSEND_TO_FRONT)
+            {
+                queue->head = (queue->head + queue->length - 1) % queue->length;
+                slot = queue->head;
+            }
+            else
+            {
+                slot = (queue->head + queue->count) % queue->length;
+            }
+
+            memcpy(queue->storage + slot * queue->itemSize, pvItemToQueue, queue->itemSize);
+        }
+
+        queue->count++;
+        queue->changed.notify_all();
+
+        return pdPASS;
+    }
+
+    signed portBASE_TYPE xQueueGenericSendFromISR(xQueueHandle xQueue, const void * const pvItemToQueue, signed portBASE_TYPE *pxHigherPriorityTaskWoken, portBASE_TYPE xCopyPosition)
+    {
+        if (pxHigherPriorityTaskWoken != NULL)
+            *pxHigherPriorityTaskWoken = pdFALSE;
+
+        return xQueueGenericSend(xQueue, pvItemToQueue, 0, xCopyPosition);
+    }
+
+    signed portBASE_TYPE xQueueGenericReceive(xQueueHandle xQueue, const void * const pvBuffer, portTickType xTicksToWait, portBASE_TYPE xJustPeek)
+    {
+        HostQueue *queue = (HostQueue *)xQueue;
+        std::unique_lock<std::mutex> lock(queue->lock);
+
+        if (!waitFor(queue, lock, xTicksToWait, false))
+            return errQUEUE_EMPTY;
+
+        if (queue->itemSize > 0)
+        {
+            memcpy((void *)pvBuffer, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+        }
+
+        if (!xJustPeek)
+        {
+            if (queue->itemSize > 0)
+                queue->head = (queue->head + 1) % queue->length;
+
+            queue->count--;
+            queue->changed.notify_all();
+        }
+
+        return pdPASS;
+    }
+
+    signed portBASE_TYPE xTaskGenericCreate(pdTASK_CODE pxTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, portSTACK_TYPE *puxStackBuffer, const xMemoryRegion * const xRegions)
+    {
+        //
+        // Task threads wait for vTaskStartScheduler() like they do on the device
+        //
+
+        std::thread task([pxTaskCode, pvParameters]()
+        {
+            {
+                std::unique_lock<std::mutex> lock(schedulerLock);
+                schedulerStarted.wait(lock, []() { return schedulerRunning; });
+            }
+
+            pxTaskCode(pvParameters);
+        });
+        task.detach();
+
+        taskCount++;
+
+        HostTask *handle = new HostTask();
+        strncpy(handle->name, (const char *)pcName, sizeof(handle->name) - 1);
+        handle->stackDepth = usStackDepth;
+
+        if (pxCreatedTask != NULL)
+            *pxCreatedTask = handle;
+
+        return pdPASS;
+    }
+
+    void vTaskStartScheduler(void)
+    {
+        //
+        // Unlike on the device this returns, the caller is free to drive the simulation
+        //
+
+        std::lock_guard<std::mutex> lock(schedulerLock);
+        schedulerRunning = true;
+        schedulerStarted.notify_all();
+    }
+
+    unsigned portBASE_TYPE uxTaskGetNumberOfTasks(void)
+    {
+        return taskCount;
+    }
+
+    signed char *pcTaskGetTaskName(xTaskHandle xTaskToQuery)
+    {
+        return (signed char *)((HostTask *)xTaskToQuery)->name;
+    }
+
+    unsigned portBASE_TYPE uxTaskGetStackHighWaterMark(xTaskHandle xTask)
+    {
+        //
+        // Threads have host sized stacks, report the configured depth as unused
+        //
+
+        return ((HostTask *)xTask)->stackDepth;
+    }
+
+    void vTaskDelay(portTickType xTicksToDelay)
+    {
+        std::this_thread::sleep_until(deadlineAfter(xTicksToDelay));
+    }
+
+    portTickType xTaskGetTickCount(void)
+    {
+        return (portTickType)(hostMicros() * configTICK_RATE_HZ / 1000000);
+    }
+
+    void vPortEnterCritical(void)
+    {
+        hostInterruptLock().lock();
+    }
+
+    void vPortExitCritical(void)
+    {
+        hostInterruptLock().unlock();
+    }
+
+    void *pvPortMalloc(size_t xSize)
+    {
+        void *block = malloc(xSize);
+        __sync_fetch_and_add(&heapUsed, malloc_usable_size(block));
+
+        return block;
+    }
+
+    void vPortFree(void *pv)
+    {
+        //
+        // Firmware also frees blocks that were allocated with malloc() before the scheduler started,
+        // so the usage is only an estimate and can not go below zero
+        //
+
+        size_t size = malloc_usable_size(pv);
+        size_t used = heapUsed;
+        while (!__sync_bool_compare_and_swap(&heapUsed, used, (used > size)? used - size : 0))
+        {
+            used = heapUsed;
+        }
+
+        free(pv);
+    }
+
+    size_t xPortGetFreeHeapSize(void)
+    {
+        size_t used = heapUsed;
+        return (used < configTOTAL_HEAP_SIZE)? configTOTAL_HEAP_SIZE - used : 0;
+    }
+}
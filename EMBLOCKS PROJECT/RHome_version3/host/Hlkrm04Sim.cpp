@@ -0,0 +1,529 @@
+/*
+**
+**                           Hlkrm04Sim.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "Hlkrm04Sim.h"
+#include "HostPlatform.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <string>
+
+extern "C"
+{
+    void USART1_IRQHandler(void);
+    void USART2_IRQHandler(void);
+}
+
+//
+// ES pin has to be held low at least this long for the module to enter AT mode
+// (holding it longer than kES_RESET_TIME restores factory settings on the real module, ignored here)
+//
+#define kES_MIN_PULSE 50000ULL
+#define kES_RESET_TIME 6000000ULL
+
+//
+// Module settings answered to AT queries (at+<name>=?)
+//
+static std::map<std::string, std::string> moduleSettings =
+{
+    {"ver", "V1.78 (host simulator)"},
+    {"netmode", "2"},
+    {"net_wanip", "192.168.1.50,255.255.255.0,192.168.1.1"},
+    {"mode", "server"},
+    {"remotepro", "tcp"},
+    {"remoteport", "8080"},
+    {"timeout", "60"},
+    {"uart", "115200,8,n,1"},
+    {"C2_mode", "server"},
+    {"C2_protocol", "tcp"},
+    {"C2_port", "8081"}
+};
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
+// SIMULATED USART
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SimUart::SimUart(int channel, void (*irqHandler)(void)) : rxBytes(0), txBytes(0), overruns(0)
+{
+    this->channel = channel;
+    this->irqHandler = irqHandler;
+    this->onTransmit = NULL;
+    this->txReadyAt = 0;
+    this->rxFull = false;
+    this->rxData = 0;
+    this->rxInterrupt = false;
+
+    setBaudRate(115200);
+}
+
+void SimUart::setBaudRate(uint32_t baudRate)
+{
+    //
+    // 8N1 frame is 10 bits long
+    //
+
+    byteTime = 10000000000ULL / baudRate;
+}
+
+uint32_t SimUart::getBaudRate()
+{
+    return 10000000000ULL / byteTime;
+}
+
+void SimUart::sendData(uint8_t data)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        uint64_t now = hostNanos();
+        txReadyAt = ((txReadyAt > now)? txReadyAt : now) + byteTime;
+    }
+
+    txBytes++;
+
+    if (onTransmit != NULL)
+        onTransmit(this, data);
+}
+
+bool SimUart::txEmpty()
+{
+    //
+    // Data register is free while the shift register holds at most one byte
+    //
+
+    return hostNanos() + byteTime >= txReadyAt;
+}
+
+bool SimUart::txComplete()
+{
+    return hostNanos() >= txReadyAt;
+}
+
+uint8_t SimUart::receiveData()
+{
+    std::lock_guard<std::recursive_mutex> guard(hostInterruptLock());
+
+    rxFull = false;
+    return rxData;
+}
+
+bool SimUart::rxNotEmpty()
+{
+    return rxFull;
+}
+
+void SimUart::setRxInterrupt(bool enabled)
+{
+    //
+    // Waits for a running handler, same as masking the interrupt on the device
+    //
+
+    {
+        std::lock_guard<std::recursive_mutex> guard(hostInterruptLock());
+        rxInterrupt = enabled;
+    }
+
+    // Pending byte fires the interrupt as soon as it is enabled
+    std::lock_guard<std::mutex> guard(lock);
+    received.notify_all();
+}
+
+void SimUart::interrupt()
+{
+    //
+    // Runs the firmware interrupt handler if the interrupt is pending and enabled
+    //
+
+    std::lock_guard<std::recursive_mutex> guard(hostInterruptLock());
+
+    if (rxFull && rxInterrupt)
+        irqHandler();
+}
+
+void SimUart::push(const uint8_t *data, int length)
+{
+    //
+    // Queues bytes sent by the module to the MCU
+    //
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    wire.insert(wire.end(), data, data + length);
+    received.notify_all();
+}
+
+void SimUart::run()
+{
+    //
+    // Receiver thread, moves one byte from the wire to the data register every byte time
+    //
+
+    uint64_t nextSlot = 0;
+
+    while (1)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            received.wait(guard, [this]() { return rxInterrupt && (!wire.empty() || rxFull); });
+        }
+
+        uint64_t now = hostNanos();
+        if (nextSlot < now)
+            nextSlot = now;
+
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nextSlot - now));
+        nextSlot += byteTime;
+
+        bool haveByte = false;
+        uint8_t data = 0;
+        {
+            // While the firmware masks the interrupt the byte waits on the wire instead of overrunning
+            // (masking only lasts a few instructions on the device, here the thread can be descheduled meanwhile)
+            std::lock_guard<std::mutex> guard(lock);
+            if (!wire.empty() && !(rxFull && !rxInterrupt))
+            {
+                data = wire.front();
+                wire.pop_front();
+                haveByte = true;
+            }
+        }
+
+        if (haveByte)
+        {
+            std::lock_guard<std::recursive_mutex> guard(hostInterruptLock());
+
+            rxBytes++;
+            if (rxFull)
+            {
+                overruns++;
+            }
+            else
+            {
+                rxData = data;
+                rxFull = true;
+            }
+        }
+
+        interrupt();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
+// SIMULATED MODULE
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int Hlkrm04Sim::listenPorts[2];
+volatile int Hlkrm04Sim::clients[2] = {-1, -1};
+volatile bool Hlkrm04Sim::commandMode = false;
+uint64_t Hlkrm04Sim::esLowSince = 0;
+char Hlkrm04Sim::atLine[128];
+int Hlkrm04Sim::atLineLength = 0;
+std::atomic<uint64_t> Hlkrm04Sim::txDiscarded(0);
+
+void Hlkrm04Sim::start(int webPort, int apiPort, int peerPort)
+{
+    //
+    // Creates the serial ports and starts listening for TCP clients
+    // (UARTs exist before this so that firmware can configure them first)
+    // With a peerPort serial port 2 is in client mode and connects to it on localhost
+    //
+
+    listenPorts[0] = webPort;
+    listenPorts[1] = (peerPort != 0)? peerPort : apiPort;
+
+    moduleSettings["remoteport"] = std::to_string(webPort);
+    moduleSettings["C2_port"] = std::to_string(listenPorts[1]);
+    moduleSettings["C2_mode"] = (peerPort != 0)? "2" : "1";
+
+    for (int i = 0; i < 2; i++)
+    {
+        SimUart *port = uart((i == 0)? USART1 : USART2);
+
+        std::thread receiver(&SimUart::run, port);
+        receiver.detach();
+
+        std::thread server((i == 1 && peerPort != 0)? connectTo : serve, i);
+        server.detach();
+    }
+}
+
+SimUart *Hlkrm04Sim::uart(USART_TypeDef *usart)
+{
+    //
+    // USART1 is serial port 1 of the module, USART2 serial port 2
+    //
+
+    static SimUart uart1(0, USART1_IRQHandler);
+    static SimUart uart2(1, USART2_IRQHandler);
+
+    if (usart == USART1)
+    {
+        uart1.onTransmit = transmit;
+        return &uart1;
+    }
+
+    if (usart == USART2)
+    {
+        uart2.onTransmit = transmit;
+        return &uart2;
+    }
+
+    return NULL;
+}
+
+void Hlkrm04Sim::setEsPin(bool high)
+{
+    uint64_t now = hostMicros();
+
+    if (!high)
+    {
+        esLowSince = now;
+        return;
+    }
+
+    if (esLowSince != 0 && now - esLowSince >= kES_MIN_PULSE && now - esLowSince < kES_RESET_TIME)
+    {
+        atLineLength = 0;
+        commandMode = true;
+    }
+
+    esLowSince = 0;
+}
+
+bool Hlkrm04Sim::inCommandMode()
+{
+    return commandMode;
+}
+
+void Hlkrm04Sim::transmit(SimUart *uart, uint8_t data)
+{
+    //
+    // Byte sent by the MCU, either an AT command or data for the TCP client
+    //
+
+    if (uart->channel == 0 && commandMode)
+    {
+        if (data == '\n')
+        {
+            if (atLineLength > 0 && atLine[atLineLength - 1] == '\r')
+                atLineLength--;
+            atLine[atLineLength] = '\0';
+
+            if (atLineLength > 0)
+                executeAtCommand(atLine);
+
+            atLineLength = 0;
+        }
+        else if (atLineLength < (int)sizeof(atLine) - 1)
+        {
+            atLine[atLineLength++] = data;
+        }
+        return;
+    }
+
+    int client = clients[uart->channel];
+    if (client < 0 || send(client, &data, 1, MSG_NOSIGNAL) != 1)
+    {
+        txDiscarded++;
+    }
+}
+
+void Hlkrm04Sim::reply(const char *text)
+{
+    uart(USART1)->push((const uint8_t *)text, strlen(text));
+}
+
+void Hlkrm04Sim::executeAtCommand(const char *command)
+{
+    //
+    // Answers like the module: echo of the command, then +ok, +ok=<value> or +ERROR
+    //
+
+    char answer[160];
+
+    snprintf(answer, sizeof(answer), "%s\r\n", command);
+    reply(answer);
+
+    if (strncasecmp(command, "at+", 3) != 0)
+    {
+        reply("+ERROR=-1\r\n");
+        return;
+    }
+
+    std::string name = command + 3;
+    std::string value;
+    size_t equals = name.find('=');
+    if (equals != std::string::npos)
+    {
+        value = name.substr(equals + 1);
+        name = name.substr(0, equals);
+    }
+
+    if (name == "out_trans")
+    {
+        reply("+ok\r\n");
+        commandMode = false;
+        return;
+    }
+
+    if (value == "?")
+    {
+        std::map<std::string, std::string>::iterator setting = moduleSettings.find(name);
+        if (setting == moduleSettings.end())
+        {
+            reply("+ERROR=-2\r\n");
+            return;
+        }
+
+        snprintf(answer, sizeof(answer), "+ok=%s\r\n", setting->second.c_str());
+        reply(answer);
+        return;
+    }
+
+    if (!value.empty())
+        moduleSettings[name] = value;
+
+    reply("+ok\r\n");
+}
+
+void Hlkrm04Sim::serve(int channel)
+{
+    //
+    // TCP server of one serial port, bridges the client to the UART
+    //
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(listenPorts[channel]);
+
+    if (bind(server, (sockaddr *)&address, sizeof(address)) != 0 || listen(server, 8) != 0)
+    {
+        fprintf(stderr, "Can not listen on port %d\n", listenPorts[channel]);
+        return;
+    }
+
+    while (1)
+    {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+            continue;
+
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        bridge(channel, client);
+    }
+}
+
+void Hlkrm04Sim::connectTo(int channel)
+{
+    //
+    // TCP client of one serial port, reconnects like the module does when the server closes the connection
+    //
+
+    while (1)
+    {
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        int enable = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(listenPorts[channel]);
+
+        if (connect(client, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(client);
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            continue;
+        }
+
+        bridge(channel, client);
+    }
+}
+
+void Hlkrm04Sim::bridge(int channel, int client)
+{
+    //
+    // Moves data from a TCP connection to the serial port until the connection is closed
+    //
+
+    SimUart *port = uart((channel == 0)? USART1 : USART2);
+    clients[channel] = client;
+
+    uint8_t buff[512];
+    while (1)
+    {
+        int length = recv(client, buff, sizeof(buff), 0);
+        if (length <= 0)
+            break;
+
+        // Client data waits while the module is in AT mode
+        while (channel == 0 && commandMode)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        port->push(buff, length);
+    }
+
+    clients[channel] = -1;
+    close(client);
+}
+
+uint64_t Hlkrm04Sim::droppedBytes()
+{
+    //
+    // Bytes lost on the way in (UART overrun) or out (no client to send them to)
+    //
+
+    uint64_t dropped = txDiscarded;
+
+    for (int i = 0; i < 2; i++)
+    {
+        dropped += uart((i == 0)? USART1 : USART2)->overruns;
+    }
+
+    return dropped;
+}
+
+void Hlkrm04Sim::printStats()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        SimUart *port = uart((i == 0)? USART1 : USART2);
+        printf("uart%d: %lu baud, rx %lu bytes, tx %lu bytes, rx overruns %lu\n", i + 1, (unsigned long)port->getBaudRate(), (unsigned long)port->rxBytes, (unsigned long)port->txBytes, (unsigned long)port->overruns);
+    }
+
+    printf("tx bytes without a client: %lu\n", (unsigned long)txDiscarded);
+}
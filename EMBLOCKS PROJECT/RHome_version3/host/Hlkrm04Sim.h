@@ -0,0 +1,110 @@
+/*
+**
+**                           Hlkrm04Sim.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef HLKRM04SIM_H_INCLUDED
+#define HLKRM04SIM_H_INCLUDED
+
+#include "stm32f4xx.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//
+// One simulated USART (MCU side registers and the wire to the module)
+// Bytes move at the configured baud rate (10 bits per byte) in both directions.
+// The receive data register holds one byte, a byte that arrives while it is still full is lost (overrun).
+//
+class SimUart
+{
+    private:
+    std::mutex lock;
+    std::condition_variable received;
+    std::deque<uint8_t> wire;           // Bytes on their way to the MCU
+    volatile uint32_t byteTime;         // ns per byte
+    uint64_t txReadyAt;                 // ns, when the transmitter finishes the last byte
+    volatile bool rxFull;
+    volatile uint8_t rxData;
+    volatile bool rxInterrupt;
+    void (*irqHandler)(void);
+
+    void interrupt();
+
+    public:
+    void (*onTransmit)(SimUart *uart, uint8_t data);
+    int channel;
+
+    std::atomic<uint64_t> rxBytes;
+    std::atomic<uint64_t> txBytes;
+    std::atomic<uint64_t> overruns;
+
+    SimUart(int channel, void (*irqHandler)(void));
+
+    void setBaudRate(uint32_t baudRate);
+    uint32_t getBaudRate();
+
+    // MCU side (SPL replacements)
+    void sendData(uint8_t data);
+    bool txEmpty();
+    bool txComplete();
+    uint8_t receiveData();
+    bool rxNotEmpty();
+    void setRxInterrupt(bool enabled);
+
+    // Module side
+    void push(const uint8_t *data, int length);
+    void run();
+};
+
+//
+// Simulated HLK-RM04 wifi module
+// Serial port 1 is bridged to a TCP server on webPort, serial port 2 to one on apiPort (one client at a time
+// each, like the module in transparent server mode) or, in client mode, to a connection to peerPort.
+// An ES pin pulse switches serial port 1 to AT command mode.
+//
+class Hlkrm04Sim
+{
+    private:
+    static int listenPorts[2];
+    static volatile int clients[2];
+    static volatile bool commandMode;
+    static uint64_t esLowSince;
+    static char atLine[128];
+    static int atLineLength;
+    static std::atomic<uint64_t> txDiscarded;
+
+    static void transmit(SimUart *uart, uint8_t data);
+    static void executeAtCommand(const char *command);
+    static void reply(const char *text);
+    static void bridge(int channel, int client);
+    static void serve(int channel);
+    static void connectTo(int channel);
+
+    public:
+    static void start(int webPort, int apiPort, int peerPort = 0);
+    static SimUart *uart(USART_TypeDef *usart);
+    static void setEsPin(bool high);
+    static bool inCommandMode();
+
+    static uint64_t droppedBytes();
+    static void printStats();
+};
+
+#endif /* HLKRM04SIM_H_INCLUDED */
@@ -0,0 +1,236 @@
+/*
+**
+**                           HostPlatform.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "HostPlatform.h"
+#include "Hlkrm04Sim.h"
+
+#include "stm32f4xx.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_usart.h"
+#include "essentials.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <thread>
+
+//
+// Address ranges of the STM32F407 that firmware accesses directly
+//
+typedef struct
+{
+    uintptr_t base;
+    size_t size;
+    uint8_t fill;
+} HostMemoryRegion;
+
+static const HostMemoryRegion kHostMemoryRegions[] =
+{
+    {FLASH_BASE, 0x100000, 0xFF},       // Erased flash (settings sector reads as empty)
+    {0x1FFF7000, 0x1000, 0x00},         // System memory with the unique device ID
+    {PERIPH_BASE, 0x10061000, 0x00},    // APB1, APB2, AHB1 and AHB2 peripherals
+    {FSMC_R_BASE, 0x1000, 0x00},
+    {SCS_BASE & ~0xFFFUL, 0x1000, 0x00} // NVIC, SCB and SysTick
+};
+
+static std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+static bool hostManualClock = false;
+static uint64_t hostManualMicros = 0;
+
+__attribute__((constructor(101))) static void mapPeripheralMemory()
+{
+    //
+    // Runs before any firmware code (including static constructors)
+    //
+
+    for (unsigned int i = 0; i < sizeof(kHostMemoryRegions) / sizeof(kHostMemoryRegions[0]); i++)
+    {
+        const HostMemoryRegion *region = &kHostMemoryRegions[i];
+
+        void *mapped = mmap((void *)region->base, region->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+        if (mapped != (void *)region->base)
+        {
+            fprintf(stderr, "Can not map simulated memory at 0x%08lx\n", (unsigned long)region->base);
+            exit(1);
+        }
+
+        if (region->fill != 0x00)
+            memset(mapped, region->fill, region->size);
+    }
+}
+
+uint64_t hostNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+uint64_t hostMicros()
+{
+    if (hostManualClock)
+        return hostManualMicros;
+
+    return hostNanos() / 1000;
+}
+
+void hostSetManualMicros(uint64_t micros)
+{
+    //
+    // Stops the firmware clock at the given time, it only moves when this is called again
+    //
+
+    hostManualMicros = micros;
+    hostManualClock = true;
+}
+
+std::recursive_mutex &hostInterruptLock()
+{
+    static std::recursive_mutex lock;
+    return lock;
+}
+
+//
+// Replacements for essentials.c (SysTick and timer based on the device)
+//
+extern "C"
+{
+    void init_essentials_time()
+    {
+    }
+
+    unsigned int millis()
+    {
+        return hostMicros() / 1000;
+    }
+
+    unsigned int micros()
+    {
+        return hostMicros();
+    }
+
+    void delay(uint32_t ms)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    void delay_micro(uint32_t micro)
+    {
+        // Busy wait like on the device (RF timing is done with interrupts locked)
+        uint64_t end = hostMicros() + micro;
+        while (hostMicros() < end) {}
+    }
+}
+
+//
+// Replacements for stm32f4xx_gpio.c
+// Only the wifi module ES pin (PA8) has an effect, other outputs are ignored
+//
+extern "C"
+{
+    void GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_InitStruct)
+    {
+    }
+
+    void GPIO_PinAFConfig(GPIO_TypeDef* GPIOx, uint16_t GPIO_PinSource, uint8_t GPIO_AF)
+    {
+    }
+
+    void GPIO_SetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+    {
+        GPIOx->ODR |= GPIO_Pin;
+
+        if (GPIOx == GPIOA && (GPIO_Pin & GPIO_Pin_8))
+            Hlkrm04Sim::setEsPin(true);
+    }
+
+    void GPIO_ResetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+    {
+        GPIOx->ODR &= ~GPIO_Pin;
+
+        if (GPIOx == GPIOA && (GPIO_Pin & GPIO_Pin_8))
+            Hlkrm04Sim::setEsPin(false);
+    }
+}
+
+//
+// Replacements for stm32f4xx_usart.c
+// USART1 and USART2 are connected to the simulated wifi module, others do not exist
+//
+extern "C"
+{
+    void USART_Init(USART_TypeDef* USARTx, USART_InitTypeDef* USART_InitStruct)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+        if (uart != NULL)
+            uart->setBaudRate(USART_InitStruct->USART_BaudRate);
+    }
+
+    void USART_Cmd(USART_TypeDef* USARTx, FunctionalState NewState)
+    {
+    }
+
+    void USART_ITConfig(USART_TypeDef* USARTx, uint16_t USART_IT, FunctionalState NewState)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+        if (uart != NULL && USART_IT == USART_IT_RXNE)
+            uart->setRxInterrupt(NewState == ENABLE);
+    }
+
+    FlagStatus USART_GetFlagStatus(USART_TypeDef* USARTx, uint16_t USART_FLAG)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+        if (uart == NULL)
+            return SET;
+
+        switch (USART_FLAG)
+        {
+            case USART_FLAG_TXE:
+                return (uart->txEmpty())? SET : RESET;
+            case USART_FLAG_TC:
+                return (uart->txComplete())? SET : RESET;
+            case USART_FLAG_RXNE:
+                return (uart->rxNotEmpty())? SET : RESET;
+            default:
+                return RESET;
+        }
+    }
+
+    ITStatus USART_GetITStatus(USART_TypeDef* USARTx, uint16_t USART_IT)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+
+        if (uart != NULL && USART_IT == USART_IT_RXNE)
+            return (uart->rxNotEmpty())? SET : RESET;
+
+        return RESET;
+    }
+
+    void USART_SendData(USART_TypeDef* USARTx, uint16_t Data)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+        if (uart != NULL)
+            uart->sendData(Data);
+    }
+
+    uint16_t USART_ReceiveData(USART_TypeDef* USARTx)
+    {
+        SimUart *uart = Hlkrm04Sim::uart(USARTx);
+        return (uart != NULL)? uart->receiveData() : 0;
+    }
+}
@@ -0,0 +1,48 @@
+/*
+**
+**                           HostPlatform.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef HOSTPLATFORM_H_INCLUDED
+#define HOSTPLATFORM_H_INCLUDED
+
+#include <stdint.h>
+#include <mutex>
+
+//
+// Host side of the simulated STM32
+// Peripheral registers are plain memory mapped at their real addresses, so SPL functions that only
+// write registers work unchanged. USART and GPIO are replaced (they talk to the simulated wifi module).
+//
+
+//
+// Time since the program started (time base of the simulation)
+//
+uint64_t hostNanos();
+uint64_t hostMicros();
+
+//
+// Replaces the firmware time (micros(), millis(), ticks) with a manually advanced clock
+// Used to replay recorded signals, hostNanos() keeps the real time
+//
+void hostSetManualMicros(uint64_t micros);
+
+//
+// Held by critical sections and by simulated interrupt handlers while they run
+//
+std::recursive_mutex &hostInterruptLock();
+
+#endif /* HOSTPLATFORM_H_INCLUDED */
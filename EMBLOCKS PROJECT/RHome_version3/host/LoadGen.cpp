@@ -0,0 +1,348 @@
+/*
+**
+**                           LoadGen.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "LoadGen.h"
+#include "HostPlatform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <vector>
+
+static int connectTo(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int findHeaderValue(const char *response, int headerLength, const char *name)
+{
+    //
+    // Returns the offset of a response header value or -1
+    //
+
+    int nameLength = strlen(name);
+
+    for (int i = 0; i + nameLength + 1 < headerLength; i++)
+    {
+        if (response[i] == '\n' && strncasecmp(&response[i + 1], name, nameLength) == 0 && response[i + 1 + nameLength] == ':')
+        {
+            int value = i + 2 + nameLength;
+            while (value < headerLength && response[value] == ' ')
+                value++;
+            return value;
+        }
+    }
+
+    return -1;
+}
+
+static int readResponse(int fd, char *buff, int size, int timeout, bool *closeAfter)
+{
+    //
+    // Reads one complete response (header and Content-Length bytes of body)
+    // Returns its length or -1 on timeout or a closed connection
+    //
+
+    int length = 0;
+    int headerLength = 0;
+    int totalLength = -1;
+    uint64_t deadline = hostMicros() + (uint64_t)timeout * 1000;
+
+    while (totalLength < 0 || length < totalLength)
+    {
+        int remaining = (int)((int64_t)(deadline - hostMicros()) / 1000);
+        if (remaining <= 0)
+            return -1;
+
+        pollfd wait = {fd, POLLIN, 0};
+        if (poll(&wait, 1, remaining) <= 0)
+            return -1;
+
+        int received = recv(fd, buff + length, size - length - 1, 0);
+        if (received <= 0)
+            return -1;
+
+        length += received;
+        buff[length] = '\0';
+
+        if (totalLength < 0)
+        {
+            char *end = strstr(buff, "\r\n\r\n");
+            if (end == NULL)
+                continue;
+
+            headerLength = end - buff + 4;
+
+            int contentLength = findHeaderValue(buff, headerLength, "Content-Length");
+            totalLength = headerLength + ((contentLength >= 0)? atoi(&buff[contentLength]) : 0);
+
+            int connection = findHeaderValue(buff, headerLength, "Connection");
+            *closeAfter = (connection >= 0 && strncasecmp(&buff[connection], "close", 5) == 0);
+
+            if (totalLength >= size)
+                return -1;
+        }
+    }
+
+    return length;
+}
+
+//
+// Sample handshake of RFC 6455 (section 1.3), the expected accept value checks the firmware SHA-1 and base64
+//
+#define kWEBSOCKET_SAMPLE_KEY "dGhlIHNhbXBsZSBub25jZQ=="
+#define kWEBSOCKET_SAMPLE_ACCEPT "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+static bool sendWebSocketMessage(int fd, const char *text)
+{
+    //
+    // Sends a masked text frame like a browser does
+    //
+
+    uint8_t frame[132];
+    int length = strlen(text);
+    uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+
+    frame[0] = 0x81;
+    frame[1] = 0x80 | length;
+    memcpy(&frame[2], mask, 4);
+    for (int i = 0; i < length; i++)
+    {
+        frame[6 + i] = text[i] ^ mask[i & 3];
+    }
+
+    return send(fd, frame, 6 + length, MSG_NOSIGNAL) == 6 + length;
+}
+
+static int readWebSocketMessage(int fd, uint8_t *buff, int *buffered, int size, int timeout, const char **payload)
+{
+    //
+    // Reads server frames until one carrying a batch result arrives, pushed state messages are skipped
+    // Returns the length of all frames read (they are removed from buff) or -1 on timeout
+    //
+
+    int total = 0;
+    uint64_t deadline = hostMicros() + (uint64_t)timeout * 1000;
+
+    while (1)
+    {
+        while (*buffered >= 2)
+        {
+            int headLength = ((buff[1] & 0x7F) == 126)? 4 : 2;
+            int length = (headLength == 4)? (buff[2] << 8) | buff[3] : buff[1] & 0x7F;
+
+            if (*buffered < headLength || *buffered < headLength + length)
+                break;
+
+            bool result = (length > 8 && memcmp(&buff[headLength], "{\"batch\"", 8) == 0);
+            *payload = (const char *)&buff[size];
+            if (result)
+            {
+                memcpy(&buff[size], &buff[headLength], length);
+                buff[size + length] = '\0';
+            }
+
+            total += headLength + length;
+            *buffered -= headLength + length;
+            memmove(buff, buff + headLength + length, *buffered);
+
+            if (result)
+                return total;
+        }
+
+        int remaining = (int)((int64_t)(deadline - hostMicros()) / 1000);
+        if (remaining <= 0)
+            return -1;
+
+        pollfd wait = {fd, POLLIN, 0};
+        if (poll(&wait, 1, remaining) <= 0)
+            return -1;
+
+        int received = recv(fd, buff + *buffered, size - *buffered, 0);
+        if (received <= 0)
+            return -1;
+
+        *buffered += received;
+    }
+}
+
+static void runWebSocketLoad(const LoadOptions *options, LoadResult *result, std::vector<double> &latencies, uint64_t *bytes)
+{
+    //
+    // Opens one WebSocket and toggles the first light with every message
+    //
+
+    static uint8_t buff[16384 + 256];
+    int buffered = 0;
+    const int size = 16384;
+
+    int fd = connectTo(options->port);
+    if (fd < 0)
+    {
+        result->failed = options->requests;
+        return;
+    }
+
+    char request[300];
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: rhome\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n", options->path, kWEBSOCKET_SAMPLE_KEY);
+
+    bool closeAfter = false;
+    char *response = (char *)buff;
+    int length = -1;
+    if (send(fd, request, strlen(request), MSG_NOSIGNAL) != (int)strlen(request) ||
+        (length = readResponse(fd, response, size, options->timeout, &closeAfter)) < 0 ||
+        strncmp(response, "HTTP/1.1 101", 12) != 0 || strstr(response, kWEBSOCKET_SAMPLE_ACCEPT) == NULL)
+    {
+        fprintf(stderr, "WebSocket handshake failed\n");
+        close(fd);
+        result->failed = options->requests;
+        return;
+    }
+
+    // Anything received after the handshake (the first state push) stays in the buffer
+    int headLength = strstr(response, "\r\n\r\n") + 4 - response;
+    buffered = length - headLength;
+    memmove(buff, buff + headLength, buffered);
+
+    for (int i = 0; i < options->requests; i++)
+    {
+        const char *payload;
+        uint64_t sent = hostMicros();
+        length = -1;
+
+        if (sendWebSocketMessage(fd, (i % 2 == 0)? "lght:0:on" : "lght:0:off"))
+        {
+            length = readWebSocketMessage(fd, buff, &buffered, size, options->timeout, &payload);
+        }
+
+        if (length < 0 || strstr(payload, "\"ok\":true") == NULL)
+        {
+            result->failed++;
+            continue;
+        }
+
+        latencies.push_back((hostMicros() - sent) / 1000.0);
+        *bytes += length;
+        result->completed++;
+    }
+
+    close(fd);
+}
+
+void runLoad(const LoadOptions *options, LoadResult *result)
+{
+    //
+    // Runs the configured number of requests and collects the statistics
+    //
+
+    char request[300];
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: rhome\r\n%s%s\r\n", options->path, (options->cbor)? "Accept: application/cbor\r\n" : "", (options->keepAlive)? "" : "Connection: close\r\n");
+
+    static char response[16384];
+    std::vector<double> latencies;
+    uint64_t bytes = 0;
+    int fd = -1;
+
+    memset(result, 0, sizeof(LoadResult));
+    uint64_t start = hostMicros();
+
+    if (options->websocket)
+    {
+        runWebSocketLoad(options, result, latencies, &bytes);
+    }
+
+    for (int i = 0; i < options->requests && !options->websocket; i++)
+    {
+        if (fd < 0)
+        {
+            fd = connectTo(options->port);
+            if (fd < 0)
+            {
+                result->failed++;
+                continue;
+            }
+        }
+
+        uint64_t sent = hostMicros();
+        bool closeAfter = false;
+        int length = -1;
+
+        if (send(fd, request, strlen(request), MSG_NOSIGNAL) == (int)strlen(request))
+        {
+            length = readResponse(fd, response, sizeof(response), options->timeout, &closeAfter);
+        }
+
+        if (length < 0)
+        {
+            result->failed++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        latencies.push_back((hostMicros() - sent) / 1000.0);
+        bytes += length;
+        result->completed++;
+
+        if (closeAfter || !options->keepAlive)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    result->seconds = (hostMicros() - start) / 1000000.0;
+
+    if (result->completed > 0)
+    {
+        std::sort(latencies.begin(), latencies.end());
+
+        result->requestsPerSecond = result->completed / result->seconds;
+        result->latencyP50 = latencies[(latencies.size() - 1) * 50 / 100];
+        result->latencyP99 = latencies[(latencies.size() - 1) * 99 / 100];
+        result->latencyMax = latencies.back();
+        result->bytesPerResponse = (double)bytes / result->completed;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+**
+**                           LoadGen.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef LOADGEN_H_INCLUDED
+#define LOADGEN_H_INCLUDED
+
+#include <stdint.h>
+
+//
+// HTTP load generator for the simulated web server
+// Sends requests one after another (the module serves one client per port) and times each response.
+//
+
+typedef struct
+{
+    int port;
+    const char *path;
+    int requests;
+    bool keepAlive;             // Reuse the connection, otherwise connect for every request
+    bool cbor;                  // Ask for CBOR API responses
+    bool websocket;             // Upgrade path to a WebSocket and send light commands as messages instead
+    int timeout;                // ms to wait for a response
+} LoadOptions;
+
+typedef struct
+{
+    int completed;
+    int failed;
+    double seconds;
+    double requestsPerSecond;
+    double latencyP50;          // ms
+    double latencyP99;          // ms
+    double latencyMax;          // ms
+    double bytesPerResponse;    // header and body
+} LoadResult;
+
+void runLoad(const LoadOptions *options, LoadResult *result);
+
+#endif /* LOADGEN_H_INCLUDED */
@@ -0,0 +1,321 @@
+/*
+**
+**                           RfReplay.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+//
+// RF decoder replay harness
+// Feeds recorded (/rftrace of the firmware) or synthetic receiver traces through the unmodified
+// RemoteReceiver: every duration moves the simulated clock and calls the interrupt handler, decode()
+// runs whenever half of the edge buffer is filled (like the RF task does on the device).
+//
+// Usage: rf_replay [options] trace...
+//   --passes <n>          replay every trace n times for the timing (default 20)
+//   --repeats <n>         minimal repeats of the decoder (default 0 like the firmware)
+//   --check               exit with 1 if a trace is below its min-rate or above its max-false
+//   --codes               list the decoded codes (protocol, address, unit and command)
+//   --synth <kind>        write a synthetic trace (clean, noisy, overlap or mixed) to stdout and exit
+//   --seed <n>            seed of the synthetic trace (default 1)
+//
+// Cycles are host timestamp counter cycles, they compare decoder changes but are not Cortex-M4 cycles.
+//
+
+// Before the firmware headers, CMSIS defines macros that clash with the intrinsics
+#include <x86intrin.h>
+
+#include "RfTrace.h"
+#include "HostPlatform.h"
+
+#include "RemoteReceiver.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define kREPLAY_FILE_GAP kRF_CAPTURE_MAX   // us of silence before every replayed trace (longest recorded duration)
+
+typedef struct
+{
+    int edges;
+    int expected;               // Telegrams the trace expects
+    int decoded;                // Decoded codes that were sent (each at most as often as expected)
+    int falseCodes;             // Decoded codes that were not sent
+    uint32_t rejected;          // Signals rejected by the decoder after a valid sync
+    double signalSeconds;       // Length of the trace
+    double seconds;             // Host time spent in the receiver (all passes)
+    uint64_t cycles;
+} ReplayResult;
+
+static std::vector<RfCode> decodedCodes;
+static uint64_t replayClock = 0;
+
+static const char *kCommandNames[] = {"off", "on", "group off", "group on", "dim", "?"};
+
+static void onCode(const RfCode *code)
+{
+    decodedCodes.push_back(*code);
+}
+
+static void printCodes()
+{
+    //
+    // Lists the codes decoded by the last pass (--codes), every pass starts with a reset decoder
+    //
+
+    for (unsigned int i = 0; i < decodedCodes.size(); i++)
+    {
+        const RfCode *code = &decodedCodes[i];
+
+        printf("  %-10s address %-8lu unit %-2u %-9s", RfProtocols::name(code->protocol), (unsigned long)code->address, code->unit,
+            kCommandNames[code->command]);
+        if (code->command == RF_COMMAND_DIM)
+            printf(" %-2u", code->dimLevel);
+        printf(" period %-4u code %lu\n", code->period, (unsigned long)code->code);
+    }
+}
+
+static void replayOnce(const RfTrace *trace)
+{
+    //
+    // Replays the durations of a trace through the receiver
+    //
+
+    int stored = 0;
+
+    // Starts like after a transmission: stored edges are dropped and a new sync is awaited
+    replayClock += kREPLAY_FILE_GAP;
+    hostSetManualMicros(replayClock);
+    RemoteReceiver::enable();
+    RemoteReceiver::decode();
+
+    for (unsigned int i = 0; i < trace->durations.size(); i++)
+    {
+        uint16_t duration = trace->durations[i];
+
+        if (duration == kRF_CAPTURE_LOST)
+        {
+            // Edges were lost on the device, the decoder starts over
+            RemoteReceiver::decode();
+            RemoteReceiver::enable();
+            stored = 0;
+            continue;
+        }
+
+        replayClock += duration;
+        hostSetManualMicros(replayClock);
+        RemoteReceiver::interruptHandler();
+
+        if (++stored == kRF_EDGE_BUFFER / 2)
+        {
+            RemoteReceiver::decode();
+            stored = 0;
+        }
+    }
+
+    RemoteReceiver::decode();
+}
+
+static void replay(const RfTrace *trace, int passes, ReplayResult *result)
+{
+    //
+    // First pass is checked against the expected codes, all of them are timed
+    //
+
+    memset(result, 0, sizeof(*result));
+    result->edges = trace->durations.size();
+
+    for (unsigned int i = 0; i < trace->durations.size(); i++)
+    {
+        result->signalSeconds += trace->durations[i] / 1000000.0;
+    }
+
+    for (unsigned int i = 0; i < trace->expected.size(); i++)
+    {
+        result->expected += trace->expected[i].count;
+    }
+
+    for (int pass = 0; pass < passes; pass++)
+    {
+        decodedCodes.clear();
+        uint32_t rejectedBefore = Metrics::get(METRIC_RF_REJECTED);
+
+        uint64_t start = hostNanos();
+        uint64_t startCycles = __rdtsc();
+        replayOnce(trace);
+        result->cycles += __rdtsc() - startCycles;
+        result->seconds += (hostNanos() - start) / 1000000000.0;
+
+        if (pass > 0)
+            continue;
+
+        result->rejected = Metrics::get(METRIC_RF_REJECTED) - rejectedBefore;
+
+        // A code counts at most as often as it is expected, extra decodes of one code do not make up for missing ones
+        std::vector<int> found(trace->expected.size(), 0);
+
+        for (unsigned int i = 0; i < decodedCodes.size(); i++)
+        {
+            int sent = -1;
+            for (unsigned int j = 0; j < trace->expected.size() && sent < 0; j++)
+            {
+                if (trace->expected[j].code == decodedCodes[i].code)
+                    sent = j;
+            }
+
+            if (sent < 0)
+                result->falseCodes++;
+            else if (found[sent] < trace->expected[sent].count)
+                found[sent]++;
+        }
+
+        for (unsigned int i = 0; i < found.size(); i++)
+        {
+            result->decoded += found[i];
+        }
+    }
+}
+
+static int synthesize(const char *kind, uint32_t seed)
+{
+    RfSynthKind synthKind;
+
+    if (strcmp(kind, "clean") == 0)
+        synthKind = RF_SYNTH_CLEAN;
+    else if (strcmp(kind, "noisy") == 0)
+        synthKind = RF_SYNTH_NOISY;
+    else if (strcmp(kind, "overlap") == 0)
+        synthKind = RF_SYNTH_OVERLAP;
+    else if (strcmp(kind, "mixed") == 0)
+        synthKind = RF_SYNTH_MIXED;
+    else
+    {
+        fprintf(stderr, "Unknown trace kind: %s\n", kind);
+        return 2;
+    }
+
+    RfTrace trace;
+    char comment[64];
+
+    rfTraceSynthesize(synthKind, seed, &trace);
+    snprintf(comment, sizeof(comment), "synthetic %s, seed %lu", kind, (unsigned long)seed);
+    rfTraceWrite(stdout, &trace, comment);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int passes = 20;
+    int repeats = 0;
+    bool check = false;
+    bool codes = false;
+    const char *synthKind = NULL;
+    uint32_t seed = 1;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc)? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--check") == 0)
+            check = true;
+        else if (strcmp(arg, "--codes") == 0)
+            codes = true;
+        else if (strncmp(arg, "--", 2) != 0)
+            paths.push_back(arg);
+        else if (value == NULL)
+        {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+            return 2;
+        }
+        else
+        {
+            i++;
+            if (strcmp(arg, "--passes") == 0)
+                passes = (atoi(value) > 0)? atoi(value) : 1;
+            else if (strcmp(arg, "--repeats") == 0)
+                repeats = atoi(value);
+            else if (strcmp(arg, "--synth") == 0)
+                synthKind = value;
+            else if (strcmp(arg, "--seed") == 0)
+                seed = strtoul(value, NULL, 10);
+            else
+            {
+                fprintf(stderr, "Unknown option: %s\n", arg);
+                return 2;
+            }
+        }
+    }
+
+    if (synthKind != NULL)
+        return synthesize(synthKind, seed);
+
+    if (paths.empty())
+    {
+        fprintf(stderr, "Usage: rf_replay [--passes n] [--repeats n] [--check] [--codes] trace... | --synth clean|noisy|overlap|mixed [--seed n]\n");
+        return 2;
+    }
+
+    hostSetManualMicros(0);
+    RemoteReceiver::init(repeats, onCode);
+
+    bool failed = false;
+
+    printf("%-28s %7s %9s %7s %6s %8s %10s %12s %8s\n", "trace", "edges", "decoded", "rate", "false", "rejected", "signal/s", "sustained/s", "cyc/edge");
+
+    for (unsigned int i = 0; i < paths.size(); i++)
+    {
+        RfTrace trace;
+        ReplayResult result;
+
+        if (!rfTraceLoad(paths[i], &trace))
+        {
+            fprintf(stderr, "Can not read %s\n", paths[i]);
+            failed = true;
+            continue;
+        }
+
+        replay(&trace, passes, &result);
+
+        double rate = (result.expected > 0)? (double)result.decoded / result.expected : 0;
+        char rateText[16];
+        if (result.expected > 0)
+            snprintf(rateText, sizeof(rateText), "%.2f", rate);
+        else
+            strcpy(rateText, "-");
+
+        const char *name = strrchr(paths[i], '/');
+        name = (name != NULL)? name + 1 : paths[i];
+
+        printf("%-28s %7d %4d/%-4d %7s %6d %8lu %10.0f %12.0f %8.0f\n", name, result.edges, result.decoded, result.expected, rateText,
+            result.falseCodes, (unsigned long)result.rejected, result.edges / result.signalSeconds,
+            result.edges * passes / result.seconds, (double)result.cycles / ((double)result.edges * passes));
+
+        if (check && ((result.expected > 0 && rate < trace.minRate) || result.falseCodes > trace.maxFalse))
+        {
+            printf("  FAILED: expected a rate of at least %.2f and at most %d false codes\n", trace.minRate, trace.maxFalse);
+            failed = true;
+        }
+
+        if (codes)
+            printCodes();
+    }
+
+    return (failed)? 1 : 0;
+}
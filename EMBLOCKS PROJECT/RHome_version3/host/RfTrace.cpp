@@ -0,0 +1,433 @@
+/*
+**
+**                           RfTrace.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#include "RfTrace.h"
+#include "RfProtocol.h"
+#include "RemoteTransmitter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define kSYNTH_TRITS 12                 // Trits of a KaKu style code
+#define kSYNTH_SYNC_PERIODS 31
+#define kSYNTH_REPEATS 8                // 2^3 like RemoteTransmitter sends by default
+#define kSYNTH_PRESSES 6
+#define kSYNTH_GAP 250000               // us between presses
+#define kSYNTH_QUIET 20000              // us without noise after a transmission
+#define kSYNTH_MAX_DURATION 65535
+
+//
+// Parts of a trit in periods, high and low alternate starting with high (same table as RemoteTransmitter)
+//
+static const uint8_t kTritParts[3][4] = {{1, 3, 1, 3}, {3, 1, 3, 1}, {1, 3, 3, 1}};
+
+bool rfTraceLoad(const char *path, RfTrace *trace)
+{
+    //
+    // Reads a trace file, returns false if it can not be read
+    //
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    trace->durations.clear();
+    trace->expected.clear();
+    trace->minRate = 1.0;
+    trace->maxFalse = 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#')
+        {
+            RfExpected expected;
+            unsigned long code;
+
+            if (sscanf(line, "# expect %lu %d", &code, &expected.count) == 2)
+            {
+                expected.code = code;
+                trace->expected.push_back(expected);
+            }
+            else
+            {
+                sscanf(line, "# min-rate %lf", &trace->minRate);
+                sscanf(line, "# max-false %d", &trace->maxFalse);
+            }
+        }
+        else if (line[0] >= '0' && line[0] <= '9')
+        {
+            unsigned long duration = strtoul(line, NULL, 10);
+            trace->durations.push_back((duration > kSYNTH_MAX_DURATION)? kSYNTH_MAX_DURATION : duration);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+void rfTraceWrite(FILE *file, const RfTrace *trace, const char *comment)
+{
+    fprintf(file, "# rhome rf trace\n# %s\n# durations %d\n", comment, (int)trace->durations.size());
+
+    for (unsigned int i = 0; i < trace->expected.size(); i++)
+    {
+        fprintf(file, "# expect %lu %d\n", (unsigned long)trace->expected[i].code, trace->expected[i].count);
+    }
+
+    fprintf(file, "# min-rate %.2f\n# max-false %d\n", trace->minRate, trace->maxFalse);
+
+    for (unsigned int i = 0; i < trace->durations.size(); i++)
+    {
+        fprintf(file, "%u\n", (unsigned int)trace->durations[i]);
+    }
+}
+
+//
+// Synthetic traces
+// A signal is a list of edge times (the level toggles on every edge, starting low)
+//
+typedef std::vector<uint64_t> RfEdges;
+
+static uint32_t nextRandom(uint32_t *state)
+{
+    // xorshift32, traces have to be the same on every host
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int randomBetween(uint32_t *state, int min, int max)
+{
+    return min + (int)(nextRandom(state) % (uint32_t)(max - min + 1));
+}
+
+static uint32_t randomTritCode(uint32_t *random)
+{
+    //
+    // Code of 12 random trits (as RemoteReceiver decodes it)
+    //
+
+    uint32_t code = 0;
+
+    for (int i = 0; i < kSYNTH_TRITS; i++)
+    {
+        code = code * 3 + randomBetween(random, 0, 2);
+    }
+
+    return code;
+}
+
+static void addParts(RfEdges *edges, uint64_t *time, const uint8_t *parts, int count, uint32_t *random, int period, int jitter, int distortion)
+{
+    //
+    // Adds kSYNTH_REPEATS telegrams, parts are in periods (high and low alternating, starting with high)
+    // jitter is in percent of a part, distortion (us) makes high parts longer and low parts shorter like cheap receivers do
+    //
+
+    for (int repeat = 0; repeat < kSYNTH_REPEATS; repeat++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int length = parts[i] * period;
+            length += length * randomBetween(random, -jitter, jitter) / 100;
+            length += (i % 2 == 0)? distortion : -distortion;
+
+            edges->push_back(*time);
+            *time += length;
+        }
+    }
+}
+
+static void addTritTelegrams(RfEdges *edges, uint64_t *time, uint32_t code, uint32_t *random, int period, int jitter, int distortion)
+{
+    //
+    // PT2262 telegrams: 12 trits of 4 parts and the sync
+    //
+
+    uint8_t parts[kSYNTH_TRITS * 4 + 2];
+
+    for (int i = kSYNTH_TRITS - 1; i >= 0; i--)
+    {
+        memcpy(&parts[i * 4], kTritParts[code % 3], 4);
+        code /= 3;
+    }
+    parts[kSYNTH_TRITS * 4] = 1;
+    parts[kSYNTH_TRITS * 4 + 1] = kSYNTH_SYNC_PERIODS;
+
+    addParts(edges, time, parts, kSYNTH_TRITS * 4 + 2, random, period, jitter, distortion);
+}
+
+static uint32_t addNewKakuTelegrams(RfEdges *edges, uint64_t *time, uint32_t *random, int period, int jitter)
+{
+    //
+    // Self-learning KaKu telegrams of a random address, unit and command (a quarter of them dim)
+    // Returns the button code the receiver reports
+    //
+
+    uint32_t address = nextRandom(random) & 0x3FFFFFF;
+    uint8_t unit = randomBetween(random, 0, 15);
+    bool on = randomBetween(random, 0, 1);
+    bool dim = randomBetween(random, 0, 3) == 0;
+    uint8_t dimLevel = randomBetween(random, 0, 15);
+
+    uint32_t bits = (address << 6) | ((on)? 0x10 : 0) | unit;
+    int bitCount = (dim)? kRF_NEW_KAKU_BITS + 4 : kRF_NEW_KAKU_BITS;
+    uint8_t parts[2 + (kRF_NEW_KAKU_BITS + 4) * 4 + 2];
+    int count = 0;
+
+    parts[count++] = 1;
+    parts[count++] = 10;
+
+    for (int i = 0; i < bitCount; i++)
+    {
+        bool value = (i < kRF_NEW_KAKU_BITS)? (bits >> (kRF_NEW_KAKU_BITS - 1 - i)) & 1 : (dimLevel >> (bitCount - 1 - i)) & 1;
+        bool dimBit = dim && i == kRF_NEW_KAKU_DIM_BIT;
+
+        parts[count++] = 1;
+        parts[count++] = (value && !dimBit)? 5 : 1;
+        parts[count++] = 1;
+        parts[count++] = (!value && !dimBit)? 5 : 1;
+    }
+
+    parts[count++] = 1;
+    parts[count++] = 40;
+
+    addParts(edges, time, parts, count, random, period, jitter, 0);
+
+    return RfProtocols::newKakuCode(address, false, unit, on || dim);
+}
+
+static uint32_t brandTritCode(uint32_t *random, int brand, int *period)
+{
+    //
+    // Code of a random light of a PT2262 brand (same order as RfProtocol), encoded by the firmware transmitters
+    //
+
+    static KaKuTransmitter kaku;
+    static ElroTransmitter elro;
+    static BlokkerTransmitter blokker;
+    static ActionTransmitter action;
+
+    bool on = randomBetween(random, 0, 1);
+    unsigned long telegram;
+
+    switch (brand)
+    {
+    case 0:
+        telegram = kaku.getTelegram('A' + randomBetween(random, 0, 15), randomBetween(random, 1, 16), on);
+        *period = RfProtocols::period(RF_PROTOCOL_KAKU);
+        break;
+    case 1:
+        telegram = elro.getTelegram(randomBetween(random, 0, 31), 'A' + randomBetween(random, 0, 3), on);
+        *period = RfProtocols::period(RF_PROTOCOL_ELRO);
+        break;
+    case 2:
+        telegram = blokker.getTelegram(randomBetween(random, 1, 8), on);
+        *period = RfProtocols::period(RF_PROTOCOL_BLOKKER);
+        break;
+    default:
+        telegram = action.getTelegram(randomBetween(random, 0, 31), 'A' + randomBetween(random, 0, 4), on);
+        *period = RfProtocols::period(RF_PROTOCOL_ACTION);
+        break;
+    }
+
+    *period = *period * randomBetween(random, 95, 105) / 100;
+    return telegram & 0xFFFFF;
+}
+
+static void addNoise(RfEdges *edges, uint64_t start, uint64_t end, uint32_t *random, int minLength, int maxLength)
+{
+    //
+    // Receiver output while nothing is sent: once the gain has gone up (kSYNTH_QUIET after a transmission)
+    // random short pulses come out. Starts and ends with the output low.
+    //
+
+    uint64_t time = start + kSYNTH_QUIET;
+    int count = 0;
+
+    while (time + maxLength * 2 < end || count % 2 != 0)
+    {
+        edges->push_back(time);
+        time += randomBetween(random, minLength, maxLength);
+        count++;
+    }
+}
+
+static void addGlitches(RfEdges *edges, uint32_t *random, int percent, int minLength, int maxLength)
+{
+    //
+    // Splits some pulses with a short pulse of the other level
+    //
+
+    RfEdges glitched;
+
+    for (unsigned int i = 0; i + 1 < edges->size(); i++)
+    {
+        glitched.push_back((*edges)[i]);
+
+        uint64_t length = (*edges)[i + 1] - (*edges)[i];
+        if (randomBetween(random, 1, 100) <= percent && length > (uint64_t)maxLength * 3)
+        {
+            uint64_t at = (*edges)[i] + length / 2;
+            glitched.push_back(at);
+            glitched.push_back(at + randomBetween(random, minLength, maxLength));
+        }
+    }
+
+    if (!edges->empty())
+        glitched.push_back(edges->back());
+
+    edges->swap(glitched);
+}
+
+static RfEdges combineSignals(const RfEdges &a, const RfEdges &b)
+{
+    //
+    // Receiver output when two remotes send at the same time: high while either carrier is on
+    //
+
+    RfEdges combined;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    bool levelA = false;
+    bool levelB = false;
+
+    while (i < a.size() || j < b.size())
+    {
+        bool before = levelA || levelB;
+        uint64_t time;
+
+        if (j >= b.size() || (i < a.size() && a[i] <= b[j]))
+        {
+            time = a[i++];
+            levelA = !levelA;
+        }
+        else
+        {
+            time = b[j++];
+            levelB = !levelB;
+        }
+
+        if ((levelA || levelB) != before)
+            combined.push_back(time);
+    }
+
+    return combined;
+}
+
+static void addExpected(RfTrace *trace, uint32_t code, int count)
+{
+    for (unsigned int i = 0; i < trace->expected.size(); i++)
+    {
+        if (trace->expected[i].code == code)
+        {
+            trace->expected[i].count += count;
+            return;
+        }
+    }
+
+    RfExpected expected = {code, count};
+    trace->expected.push_back(expected);
+}
+
+void rfTraceSynthesize(RfSynthKind kind, uint32_t seed, RfTrace *trace)
+{
+    //
+    // Generates a trace with known codes
+    // Every press can be decoded kSYNTH_REPEATS - 2 times: the first telegram has no sync before it
+    // and the sync after the last one does not end with an edge of the next telegram.
+    //
+
+    uint32_t random = (seed != 0)? seed : 1;
+    RfEdges edges;
+    uint64_t time = kSYNTH_GAP;
+
+    trace->durations.clear();
+    trace->expected.clear();
+    trace->minRate = 1.0;
+    trace->maxFalse = 0;
+
+    // Mixed traces have a press of every brand and as many self-learning KaKu presses
+    int presses = (kind == RF_SYNTH_MIXED)? 8 : kSYNTH_PRESSES;
+
+    for (int press = 0; press < presses; press++)
+    {
+        int period = randomBetween(&random, 300, 420);
+
+        if (kind == RF_SYNTH_OVERLAP)
+        {
+            // Second remote starts part way through the first one, it is slower or faster
+            RfEdges first;
+            RfEdges second;
+            uint64_t firstTime = time;
+            uint64_t secondTime = time + randomBetween(&random, 3, 5) * (kSYNTH_TRITS * 8 + 32) * period;
+            int secondPeriod = period * randomBetween(&random, 70, 130) / 100;
+
+            uint32_t firstCode = randomTritCode(&random);
+            addTritTelegrams(&first, &firstTime, firstCode, &random, period, 3, 0);
+            uint32_t secondCode = randomTritCode(&random);
+            addTritTelegrams(&second, &secondTime, secondCode, &random, secondPeriod, 3, 0);
+
+            RfEdges combined = combineSignals(first, second);
+            edges.insert(edges.end(), combined.begin(), combined.end());
+            time = std::max(firstTime, secondTime);
+
+            // How many telegrams survive the overlap is not known, but both remotes have telegrams outside of it
+            addExpected(trace, firstCode, 1);
+            addExpected(trace, secondCode, 1);
+        }
+        else if (kind == RF_SYNTH_MIXED && press % 2 == 1)
+        {
+            uint32_t code = addNewKakuTelegrams(&edges, &time, &random, RfProtocols::period(RF_PROTOCOL_NEW_KAKU) * randomBetween(&random, 90, 110) / 100, 3);
+            addExpected(trace, code, kSYNTH_REPEATS - 2);
+        }
+        else if (kind == RF_SYNTH_MIXED)
+        {
+            uint32_t code = brandTritCode(&random, (press / 2) % 4, &period);
+            addTritTelegrams(&edges, &time, code, &random, period, 3, 0);
+            addExpected(trace, code, kSYNTH_REPEATS - 2);
+        }
+        else
+        {
+            int distortion = (kind == RF_SYNTH_NOISY)? randomBetween(&random, 0, 60) : 0;
+            uint32_t code = randomTritCode(&random);
+            addTritTelegrams(&edges, &time, code, &random, period, (kind == RF_SYNTH_NOISY)? 8 : 3, distortion);
+            addExpected(trace, code, kSYNTH_REPEATS - 2);
+        }
+
+        uint64_t gapEnd = time + kSYNTH_GAP;
+        if (kind == RF_SYNTH_NOISY)
+            addNoise(&edges, time, gapEnd, &random, 40, 2500);
+
+        time = gapEnd;
+    }
+
+    if (kind == RF_SYNTH_NOISY)
+        addGlitches(&edges, &random, 3, 15, 90);
+
+    for (unsigned int i = 1; i < edges.size(); i++)
+    {
+        uint64_t duration = edges[i] - edges[i - 1];
+        trace->durations.push_back((duration > kSYNTH_MAX_DURATION)? kSYNTH_MAX_DURATION : (duration == 0)? 1 : duration);
+    }
+}
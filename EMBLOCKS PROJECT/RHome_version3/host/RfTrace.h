@@ -0,0 +1,62 @@
+/*
+**
+**                           RfTrace.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef RFTRACE_H_INCLUDED
+#define RFTRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+//
+// RF receiver traces
+// Same text format as the firmware exports on /rftrace: durations between receiver edges in microseconds,
+// one per line (65535 for longer ones, 0 where edges were lost). Lines starting with # are comments,
+// fixtures add what the replay checks:
+//   # expect <code> <count>   code sent <count> times in a way the decoder can see it
+//   # min-rate <rate>         lowest accepted decode rate (decoded / expected, default 1)
+//   # max-false <count>       highest accepted number of codes that were not sent (default 0)
+//
+
+typedef struct
+{
+    uint32_t code;
+    int count;
+} RfExpected;
+
+typedef struct
+{
+    std::vector<uint16_t> durations;
+    std::vector<RfExpected> expected;
+    double minRate;
+    int maxFalse;
+} RfTrace;
+
+typedef enum
+{
+    RF_SYNTH_CLEAN,             // Remote presses with small timing jitter and silence between them
+    RF_SYNTH_NOISY,             // Receiver noise between presses, glitches and distorted pulses inside them
+    RF_SYNTH_OVERLAP,           // Two remotes with different periods transmitting at partly the same time
+    RF_SYNTH_MIXED              // Lights of every PT2262 brand and self-learning KaKu remotes, one after the other
+} RfSynthKind;
+
+bool rfTraceLoad(const char *path, RfTrace *trace);
+void rfTraceWrite(FILE *file, const RfTrace *trace, const char *comment);
+void rfTraceSynthesize(RfSynthKind kind, uint32_t seed, RfTrace *trace);
+
+#endif /* RFTRACE_H_INCLUDED */
@@ -0,0 +1,267 @@
+/*
+**
+**                           SimMain.cpp
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+//
+// Host simulator of the web server
+// Runs the firmware web server tasks (src/main.cpp) against a simulated HLK-RM04 that is reachable over TCP
+// on localhost. Either serves until interrupted or runs a benchmark and prints the results.
+//
+// Usage: rhome_sim [options]
+//   --baud <rate>         wifi UART baud rate (default 115200)
+//   --web-port <port>     TCP port of wifi connection 1 (default 8080)
+//   --api-port <port>     TCP port of wifi connection 2 (default 8081)
+//   --lights <n>          number of simulated lights (default 3)
+//   --blinds <n>          number of simulated blinds (default 1)
+//   --bench <requests>    run the load generator and exit
+//   --path <path>         request path for the benchmark (default /user/user/api)
+//   --api                 benchmark the API port instead of the web port
+//   --close               new connection for every request
+//   --cbor                ask for CBOR API responses
+//   --ws                  benchmark light commands over a WebSocket (default path /user/user/ws)
+//   --timeout <ms>        response timeout (default 5000)
+//   --peer <port>         aggregator: connection 2 is a client of the unit with this API port on localhost
+//   --publish <port>      publisher: connection 2 is a client of the MQTT broker with this port on localhost
+//   --at <query>          send an AT query (at+<name>=?) through the firmware AT engine first and print the answer
+//
+
+#include "Hlkrm04Sim.h"
+#include "LoadGen.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "Lighting.h"
+#include "Blinds.h"
+#include "EntityTable.h"
+#include "AtEngine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+
+//
+// Firmware (src/main.cpp)
+//
+extern std::vector<Light *> lights;
+extern std::vector<Blind *> blinds;
+extern uint32_t wifiBaudRate;
+extern int c2Role;
+extern char peerAddress[];
+extern int peerPort;
+void initWifiES();
+void init_USART1();
+void init_USART2();
+void startWebServer();
+
+static volatile bool running = true;
+
+static void stop(int signal)
+{
+    running = false;
+}
+
+static void finish(int status)
+{
+    //
+    // Firmware tasks never end, exit without running static destructors under them
+    //
+
+    fflush(stdout);
+    _exit(status);
+}
+
+static void createDevices(int lightCount, int blindCount)
+{
+    //
+    // Same setup as loading them from flash, RF and servo outputs go to simulated registers
+    //
+
+    char name[20];
+
+    RfScheduler::init();
+    xTaskCreate(RfScheduler::task, (const signed char *)"RFTx", 200, NULL, tskIDLE_PRIORITY + 1UL, NULL);
+
+    for (int i = 0; i < lightCount; i++)
+    {
+        Light *light = new Light;
+        light->id = EntityTable::allocate();
+        snprintf(name, sizeof(name), "Light %d", i + 1);
+        light->setName(name);
+        light->setTypeKaku('A', i + 1);
+        light->onOff(false, RF_PRIORITY_BACKGROUND);
+        lights.push_back(light);
+    }
+
+    Blind::initLocalBlinds();
+
+    for (int i = 0; i < blindCount; i++)
+    {
+        Blind *blind = new Blind;
+        blind->id = EntityTable::allocate();
+        snprintf(name, sizeof(name), "Blind %d", i + 1);
+        blind->setName(name);
+        blind->setBounds(1000, 1500, 2000);
+        blind->setType(BLIND_LOCAL);
+        blind->setChannel((BlindChannel)(i % 4));
+        blinds.push_back(blind);
+    }
+
+    EntityTable::build(lights, blinds);
+}
+
+int main(int argc, char *argv[])
+{
+    int webPort = 8080;
+    int apiPort = 8081;
+    int lightCount = 3;
+    int blindCount = 1;
+    int peer = 0;
+    int role = 0;
+    bool api = false;
+    const char *atCommand = NULL;
+
+    LoadOptions load;
+    load.path = "/user/user/api";
+    load.requests = 0;
+    load.keepAlive = true;
+    load.cbor = false;
+    load.websocket = false;
+    bool pathSet = false;
+    load.timeout = 5000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc)? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--api") == 0)
+            api = true;
+        else if (strcmp(arg, "--close") == 0)
+            load.keepAlive = false;
+        else if (strcmp(arg, "--cbor") == 0)
+            load.cbor = true;
+        else if (strcmp(arg, "--ws") == 0)
+            load.websocket = true;
+        else if (value == NULL)
+        {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+            return 2;
+        }
+        else
+        {
+            i++;
+            if (strcmp(arg, "--baud") == 0)
+                wifiBaudRate = atoi(value);
+            else if (strcmp(arg, "--web-port") == 0)
+                webPort = atoi(value);
+            else if (strcmp(arg, "--api-port") == 0)
+                apiPort = atoi(value);
+            else if (strcmp(arg, "--lights") == 0)
+                lightCount = atoi(value);
+            else if (strcmp(arg, "--blinds") == 0)
+                blindCount = atoi(value);
+            else if (strcmp(arg, "--bench") == 0)
+                load.requests = atoi(value);
+            else if (strcmp(arg, "--path") == 0)
+            {
+                load.path = value;
+                pathSet = true;
+            }
+            else if (strcmp(arg, "--timeout") == 0)
+                load.timeout = atoi(value);
+            else if (strcmp(arg, "--at") == 0)
+                atCommand = value;
+            else if (strcmp(arg, "--peer") == 0 || strcmp(arg, "--publish") == 0)
+            {
+                peer = atoi(value);
+                role = (strcmp(arg, "--peer") == 0)? 2 : 3;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown option: %s\n", arg);
+                return 2;
+            }
+        }
+    }
+
+    load.port = (api)? apiPort : webPort;
+    if (load.websocket && !pathSet)
+        load.path = "/user/user/ws";
+
+    //
+    // Firmware start up (the part of main() that concerns the web server)
+    //
+    createDevices(lightCount, blindCount);
+
+    if (peer != 0)
+    {
+        // Same as the role loaded from flash (2 = aggregator, 3 = publisher)
+        c2Role = role;
+        strcpy(peerAddress, "127.0.0.1");
+        peerPort = peer;
+    }
+
+    initWifiES();
+    init_USART1();
+    init_USART2();
+    startWebServer();
+
+    Hlkrm04Sim::start(webPort, apiPort, peer);
+    vTaskStartScheduler();
+
+    // Give the server sockets time to start listening
+    usleep(100000);
+
+    if (atCommand != NULL)
+    {
+        char answer[kAT_RESPONSE_LENGTH];
+        AtResult atResult = AtEngine::sendWait(atCommand, answer, sizeof(answer), 2000);
+        printf("%s: %s %s\n", atCommand, (atResult == AT_RESULT_OK)? "ok" : (atResult == AT_RESULT_TIMEOUT)? "timeout" : "error", answer);
+    }
+
+    if (load.requests <= 0)
+    {
+        printf("Serving on 127.0.0.1:%d (web) and 127.0.0.1:%d (API) at %lu baud, Ctrl+C to stop\n", webPort, apiPort, (unsigned long)wifiBaudRate);
+
+        signal(SIGINT, stop);
+        while (running)
+        {
+            pause();
+        }
+
+        Hlkrm04Sim::printStats();
+        finish(0);
+    }
+
+    LoadResult result;
+    runLoad(&load, &result);
+
+    printf("GET %s on port %d, %lu baud, %s%s\n", load.path, load.port, (unsigned long)wifiBaudRate, (load.websocket)? "WebSocket" : (load.keepAlive)? "keep-alive" : "connection per request", (load.cbor)? ", CBOR" : "");
+    printf("requests:        %d completed, %d failed in %.2f s\n", result.completed, result.failed, result.seconds);
+    printf("requests/sec:    %.2f\n", result.requestsPerSecond);
+    printf("latency p50:     %.1f ms\n", result.latencyP50);
+    printf("latency p99:     %.1f ms\n", result.latencyP99);
+    printf("latency max:     %.1f ms\n", result.latencyMax);
+    printf("bytes/response:  %.0f\n", result.bytesPerResponse);
+    printf("dropped bytes:   %lu\n", (unsigned long)Hlkrm04Sim::droppedBytes());
+    Hlkrm04Sim::printStats();
+
+    finish((result.failed == 0)? 0 : 1);
+}
@@ -0,0 +1,56 @@
+/*
+**
+**                           HostCompat.h
+**
+**
+**********************************************************************/
+/*
+   Author:                 Andrej Rolih
+                           www.r00li.com
+   Version:                0.1
+   License:                GNU GPL v3
+                           See attached LICENSE file for details
+                           External library files do not include such header and
+                           are released under GPL v3 or their specific license.
+                           Check those files for more details.
+
+**********************************************************************/
+
+#ifndef HOSTCOMPAT_H_INCLUDED
+#define HOSTCOMPAT_H_INCLUDED
+
+//
+// Forced into every file of the host build (gcc -include)
+// Replaces the Cortex-M intrinsics (inline ARM assembly) so firmware sources compile for the PC.
+// CMSIS headers are skipped through their include guards.
+//
+
+#define __CORE_CMINSTR_H
+#define __CORE_CMFUNC_H
+
+#include <stdint.h>
+
+static inline void __NOP(void) {}
+static inline void __WFI(void) {}
+static inline void __WFE(void) {}
+static inline void __SEV(void) {}
+static inline void __ISB(void) { __sync_synchronize(); }
+static inline void __DSB(void) { __sync_synchronize(); }
+static inline void __DMB(void) { __sync_synchronize(); }
+
+static inline uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+static inline uint32_t __REV16(uint32_t value) { return ((value & 0xFF00FF00) >> 8) | ((value & 0x00FF00FF) << 8); }
+static inline int32_t __REVSH(int32_t value) { return (int16_t)__builtin_bswap16((uint16_t)value); }
+static inline uint8_t __CLZ(uint32_t value) { return (value == 0)? 32 : __builtin_clz(value); }
+
+//
+// Interrupts of the simulated peripherals are masked by critical sections only
+//
+static inline void __enable_irq(void) {}
+static inline void __disable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t priMask) { (void)priMask; }
+static inline uint32_t __get_BASEPRI(void) { return 0; }
+static inline void __set_BASEPRI(uint32_t basePri) { (void)basePri; }
+
+#endif /* HOSTCOMPAT_H_INCLUDED */
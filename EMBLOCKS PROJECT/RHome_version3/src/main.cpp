@@ -39,6 +39,7 @@
 #include <string>
 #include <sstream>
 #include <stdlib.h>
+#include <ctype.h>
 #include <functional>
 
 #include "Lighting.h"
@@ -48,6 +49,20 @@
 #include "RemoteReceiver.h"
 #include "TempSensor.h"
 #include "Remote.h"
+#include "StateVersion.h"
+#include "Template.h"
+#include "WebPages.h"
+#include "AtEngine.h"
+#include "WebSessions.h"
+#include "Cbor.h"
+#include "Metrics.h"
+#include "WebSocket.h"
+#include "Aggregator.h"
+#include "Publisher.h"
+#include "Json.h"
+#include "Router.h"
+#include "EntityTable.h"
+#include "RemoteIndex.h"
 
 #include "essentials.h"
 
@@ -88,6 +103,8 @@ void vTask2Function (void *pvParameters);
 void menuCheckerTask(void *pvParameters);
 void displayInfoScreen();
 void remoteEvent(uint32_t event_code);
+void setAutoBlinds();
+void save_data_to_flash();
 
 //
 // Settings for maximum number of automation units
@@ -100,6 +117,29 @@ std::vector<Light *> lights;
 std::vector<Blind *> blinds;
 std::vector<RemoteButton *> remoteButtons;
 
+static_assert(kMAX_BUTTONS * 2 <= kREMOTE_INDEX_SLOTS, "Remote index needs at least twice as many slots as buttons");
+static_assert((kMAX_LIGHTS + kMAX_BLINDS) * 2 <= kENTITY_SLOTS, "Entity table needs at least twice as many slots as devices");
+
+//
+// Batch API settings
+// (one action per light and blind is the most a batch can sensibly contain)
+//
+#define kMAX_BATCH_ACTIONS (kMAX_LIGHTS + kMAX_BLINDS)
+
+typedef struct
+{
+    bool isLight;
+    int index;
+    int value;
+} BatchAction;
+
+void runBatchActions(BatchAction *actions, int count);
+
+//
+// Flash button records with this flag are bound to an entity ID, older ones to a name hash
+//
+#define kBUTTON_BOUND_TO_ID 1
+
 //
 // Menu variables (menu stack, currently drawn menu options, ...)
 //
@@ -112,6 +152,7 @@ std::vector<MenuOption *> pressedMenuOptionsStack;
 //
 InternalTempSensor tempSensor;
 uint8_t tempAdjust = 0;
+volatile int currentTemperature = 0;
 
 //
 // Wifi connection 1 buffer
@@ -124,16 +165,38 @@ volatile uint8_t eth1_busy = 0;
 //
 // Wifi connection 2 buffer
 //
-const int eth2_buff_size = 400;
+const int eth2_buff_size = 1200;
 volatile char eth2_buff[eth2_buff_size];
 volatile int eth2_buff_indicator = 0;
 volatile uint8_t eth2_busy = 0;
 
 //
-// Ethernet response buffer
+// Web server state for each wifi connection
+// (connection 1 serves web pages and API, connection 2 is a dedicated API port)
+//
+typedef struct
+{
+    USART_TypeDef *usart;
+    volatile char *buff;
+    int buffSize;
+    volatile int *buffIndicator;
+    volatile uint8_t *busy;
+    volatile bool paused;
+    char headBuff[256];
+    bool websocket;             // Upgraded to a WebSocket, buffer holds frames instead of requests
+    uint32_t pushedVersion;     // State version last pushed over the WebSocket
+    RoutePath path;             // Split path of the request being served (kept here instead of the task stack)
+    xSemaphoreHandle received;  // Given by the receive interrupt at the end of a line or at wakeLength
+    volatile int wakeLength;    // Buffer length the incomplete request needs (0 = wait for a line end)
+} WebConnection;
+
+WebConnection webConnection1 = {USART1, eth1_buff, eth1_buff_size, &eth1_buff_indicator, &eth1_busy, false};
+WebConnection webConnection2 = {USART2, eth2_buff, eth2_buff_size, &eth2_buff_indicator, &eth2_busy, false};
+
+//
+// Protects lights and blinds when both web server tasks control them
 //
-char eth_send_buff[6000];
-volatile unsigned int eth_send_pointer = 0;
+xSemaphoreHandle deviceMutex;
 
 //
 // Some global buffers for use across the code
@@ -157,12 +220,45 @@ const char wifiEncryptionTypes[][11] = {"None", "WEP open", "WEP", "WPA TKIP", "
 const char wifiEcnryptionCommands[][13] = {"none", "wep_open", "wep", "wpa_tkip", "wpa_aes", "wpa2_tkip", "wpa2_aes", "wpawpa2_tkip", "wpawpa2_aes"};
 #define kWifiEncryptionTypes 9
 
+//
+// HLK-RM04 UART settings
+// Baud rates are tried from the fastest down, the working one is stored in flash
+// RTS/CTS are not wired on this board, set kWIFI_FLOW_CONTROL to 1 on boards where they are
+// (USART1: CTS PA11, RTS PA12, USART2: CTS PA0, RTS PA1)
+//
+#define kWIFI_FLOW_CONTROL 0
+#define kWIFI_DEFAULT_BAUD 115200
+const uint32_t wifiBaudRates[] = {460800, 230400, 115200};
+#define kWifiBaudRates 3
+uint32_t wifiBaudRate = kWIFI_DEFAULT_BAUD;
+
 //
 // Default web server settings
 //
-char web_user[15] = "user";
-char web_pass[15] = "user";
+char web_user[16] = "user";                 // 16 bytes are kept in flash, names are up to 14 characters
+char web_pass[16] = "user";
 int webPort = 8080;
+int apiPort = 8081;
+int webIdleTimeout = 60;
+
+//
+// Role of wifi connection 2 (applied at start up)
+// Peer is the unit an aggregator connects to or the MQTT broker of a publisher
+//
+typedef enum
+{
+    C2_ROLE_OFF,
+    C2_ROLE_SERVER,
+    C2_ROLE_AGGREGATOR,
+    C2_ROLE_PUBLISHER
+} C2Role;
+
+#define kC2_ROLES 4
+const char *kC2RoleNames[kC2_ROLES] = {"Off", "API server", "Aggregator", "Publisher"};
+
+int c2Role = C2_ROLE_SERVER;
+char peerAddress[kPEER_ADDRESS_LENGTH] = "";
+int peerPort = 8081;
 
 //
 // Variables for blue status LED
@@ -215,28 +311,54 @@ extern "C"
         {
             if (eth1_buff_indicator >= eth1_buff_size || eth1_busy)
             {
+                // No room for the byte, read it anyway to clear the interrupt
+                USART_ReceiveData(USART1);
+                Metrics::add(METRIC_UART_RX_DROPPED);
                 return;
             }
 
-            eth1_buff[eth1_buff_indicator] = USART_ReceiveData(USART1);
+            char c = USART_ReceiveData(USART1);
+            eth1_buff[eth1_buff_indicator] = c;
             eth1_buff_indicator++;
+
+            // Wakes the web server task once there is something new to parse
+            if (webConnection1.received != NULL &&
+                (c == '\n' || eth1_buff_indicator == webConnection1.wakeLength || eth1_buff_indicator >= eth1_buff_size))
+            {
+                signed portBASE_TYPE woken = pdFALSE;
+                xSemaphoreGiveFromISR(webConnection1.received, &woken);
+                portEND_SWITCHING_ISR(woken);
+            }
         }
     }
 
     void USART2_IRQHandler(void)
     {
         //
-        // Wifi connection 2 handler (client)
+        // Wifi connection 2 handler (API server)
         //
         if(USART_GetITStatus(USART2, USART_IT_RXNE) != RESET)
         {
             if (eth2_buff_indicator >= eth2_buff_size || eth2_busy)
             {
+                // No room for the byte, read it anyway to clear the interrupt
+                USART_ReceiveData(USART2);
+                Metrics::add(METRIC_UART_RX_DROPPED);
                 return;
             }
 
-            eth2_buff[eth2_buff_indicator] = USART_ReceiveData(USART2);
+            char c = USART_ReceiveData(USART2);
+            eth2_buff[eth2_buff_indicator] = c;
             eth2_buff_indicator++;
+
+            // Wakes the web server task once there is something new to parse
+            if (webConnection2.received != NULL &&
+                (c == '\n' || eth2_buff_indicator == webConnection2.wakeLength || eth2_buff_indicator >= eth2_buff_size))
+            {
+                signed portBASE_TYPE woken = pdFALSE;
+                xSemaphoreGiveFromISR(webConnection2.received, &woken);
+                portEND_SWITCHING_ISR(woken);
+            }
         }
     }
 
@@ -262,15 +384,20 @@ extern "C"
         //
         if (EXTI_GetITStatus(EXTI_Line6) != RESET)
         {
-            taskENTER_CRITICAL();
-            //taskDISABLE_INTERRUPTS();
+            // Only timestamps the edge, codes are decoded by the RF task
             RemoteReceiver::interruptHandler();
             EXTI_ClearITPendingBit(EXTI_Line6);
-            taskEXIT_CRITICAL();
-            //taskENABLE_INTERRUPTS();
         }
     }
 
+    void TIM2_IRQHandler(void)
+    {
+        //
+        // RF-transmitter handler (output compare)
+        //
+        RemoteTransmitter::interruptHandler();
+    }
+
     void EXTI15_10_IRQHandler(void)
     {
         //
@@ -335,6 +462,33 @@ extern "C"
 // FLASH FUNCTIONS
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
 
+uint32_t findEntityByHash(uint32_t hash, bool blind)
+{
+    //
+    // Finds the entity ID of the device that a button of older settings was bound to
+    // (bindings that were already broken stay unbound)
+    //
+
+    if (blind)
+    {
+        for (int i = 0; i < blinds.size(); i++)
+        {
+            if (blinds[i]->calculateHash() == hash)
+                return blinds[i]->id;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < lights.size(); i++)
+        {
+            if (lights[i]->calculateHash() == hash)
+                return lights[i]->id;
+        }
+    }
+
+    return kENTITY_ID_NONE;
+}
+
 void loadFromFlash()
 {
     //
@@ -348,9 +502,13 @@ void loadFromFlash()
     }
     else
     {
-        uint8_t* address = (uint8_t *) &flash_data[0];
+        uint8_t* address = (uint8_t *)flash_data;
         address += 4;
 
+        // Upper bytes of the header are the next entity ID (erased in settings of older versions)
+        EntityTable::setNextId(*((uint32_t *)flash_data) >> 8);
+        bool migrated = false;
+
         //restore lights
         for (int i = 0 ; i < kMAX_LIGHTS; i++)
         {
@@ -375,19 +533,24 @@ void loadFromFlash()
             uint32_t system_code = *((uint32_t *)address);
             address += 4;
 
+            uint32_t entity_id = *((uint32_t *)address);
+            address += 4;
+
             //additional unused bits
-            address += 8;
+            address += 4;
 
             if (light_present == 0)
             {
                 Light *lght = new Light;
                 lght->setName(name);
                 lght->btCode = bt_code;
+                lght->id = entity_id;
+                EntityTable::reserve(entity_id);
 
-                if (light_type == RF_KAKU)
-                    lght->setTypeKaku(device, (unsigned short) system_code);
+                if (light_type <= RF_NEW_KAKU)
+                    lght->setType((LightType)light_type, device, (unsigned short) system_code);
 
-                lght->onOff(false);
+                lght->onOff(false, RF_PRIORITY_BACKGROUND);
 
                 lights.push_back(lght);
             }
@@ -427,14 +590,19 @@ void loadFromFlash()
             }
             name[11] = '\0';
 
+            uint32_t entity_id = *((uint32_t *)address);
+            address += 4;
+
             //additional unused bits
-            address += 8;
+            address += 4;
 
             if (blind_present == 0)
             {
                 Blind *bld = new Blind;
                 bld->setName(name);
                 bld->btCode = bt_code;
+                bld->id = entity_id;
+                EntityTable::reserve(entity_id);
                 bld->setBounds(min_pos, mid_pos, max_pos);
                 bld->step = step;
                 bld->setType((BlindType) blind_type);
@@ -449,6 +617,24 @@ void loadFromFlash()
             }
         }
 
+        //devices stored by older versions get their entity IDs now
+        for (int i = 0; i < lights.size(); i++)
+        {
+            if (!EntityTable::isValid(lights[i]->id))
+            {
+                lights[i]->id = EntityTable::allocate();
+                migrated = true;
+            }
+        }
+        for (int i = 0; i < blinds.size(); i++)
+        {
+            if (!EntityTable::isValid(blinds[i]->id))
+            {
+                blinds[i]->id = EntityTable::allocate();
+                migrated = true;
+            }
+        }
+
         //restore remote/buttons
         for (int i = 0 ; i < kMAX_BUTTONS; i++)
         {
@@ -461,16 +647,22 @@ void loadFromFlash()
             uint32_t buttonCode = *((uint32_t *)address);
             address += 4;
 
-            uint32_t eventHash = *((uint32_t *)address);
+            uint32_t eventId = *((uint32_t *)address);
             address += 4;
 
             if (button_present == 0)
             {
                 RemoteButton* btn = new RemoteButton();
-                btn->eventHash = eventHash;
+                btn->eventId = eventId;
                 btn->remoteButton = buttonCode;
                 btn->eventType = (RemoteEventType) event_type;
 
+                if (event_type != TYPE_ACTION && data1[2] != kBUTTON_BOUND_TO_ID)
+                {
+                    btn->eventId = findEntityByHash(eventId, event_type == TYPE_BLIND_TOGGLE);
+                    migrated = true;
+                }
+
                 remoteButtons.push_back(btn);
             }
         }
@@ -538,6 +730,81 @@ void loadFromFlash()
                 tempAdjust = data1[1];
             }
         }
+
+        //restore web connection settings
+        {
+            unsigned char *data1 = address;
+            address += 4;
+
+            uint32_t idle_timeout = *((uint32_t *)address);
+            address += 4;
+
+            if (data1[0] == 0)
+            {
+                webIdleTimeout = idle_timeout;
+            }
+        }
+
+        //restore API server settings
+        {
+            unsigned char *data1 = address;
+            address += 4;
+
+            uint32_t port = *((uint32_t *)address);
+            address += 4;
+
+            if (data1[0] == 0)
+            {
+                apiPort = port;
+            }
+        }
+
+        //restore wifi UART settings
+        {
+            unsigned char *data1 = address;
+            address += 4;
+
+            uint32_t baud_rate = *((uint32_t *)address);
+            address += 4;
+
+            if (data1[0] == 0)
+            {
+                wifiBaudRate = baud_rate;
+            }
+        }
+
+        //restore connection 2 role and peer unit
+        {
+            unsigned char *data1 = address;
+            address += 4;
+
+            uint32_t port = *((uint32_t *)address);
+            address += 4;
+
+            char peer[16];
+            for (int j=0; j < 16; j++)
+            {
+                peer[j] = *address;
+                address++;
+            }
+            peer[15] = '\0';
+
+            if (data1[0] == 0 && data1[1] <= C2_ROLE_PUBLISHER)
+            {
+                c2Role = data1[1];
+                peerPort = port;
+                strncpy(peerAddress, peer, kPEER_ADDRESS_LENGTH);
+            }
+        }
+
+        EntityTable::build(lights, blinds);
+        RemoteIndex::build(remoteButtons);
+
+        if (migrated)
+        {
+            // Keep the new IDs, otherwise they would change on every start
+            save_data_to_flash();
+        }
     }
 }
 
@@ -545,13 +812,19 @@ void save_data_to_flash()
 {
     //
     // Function stores settings to internal flash
+    // (every configuration change ends here, so the remote index is rebuilt as well)
     //
 
+    StateVersion::bump();
+    EntityTable::build(lights, blinds);
+    RemoteIndex::build(remoteButtons);
+
     flash_status = FLASH_COMPLETE;
 
     FLASH_Unlock();
     FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
     flash_status = FLASH_EraseSector(FLASH_Sector_11, VoltageRange_3);
+    Metrics::add(METRIC_FLASH_ERASES);
 
     if (flash_status != FLASH_COMPLETE)
     {
@@ -559,10 +832,10 @@ void save_data_to_flash()
         return;
     }
 
-    uint8_t* address = (uint8_t *) &flash_data[0];
+    uint8_t* address = (uint8_t *)flash_data;
 
-    //program first run status bit
-    flash_status = FLASH_ProgramByte((uint32_t)address, 0x00);
+    //program first run status bit (and the next entity ID in the upper bytes)
+    flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, EntityTable::nextId() << 8);
     address += 4;
     if (flash_status != FLASH_COMPLETE)
     {
@@ -576,32 +849,32 @@ void save_data_to_flash()
     {
         light_counter++;
         Light* lght = lights[i];
-        uint8_t data1[4] = {0, lght->getType(), 0, lght->device};
+        uint8_t data1[4] = {0, lght->getType(), 0, (uint8_t)lght->device};
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data1));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data1));
         address += 4;
 
         char* name_pointer = (char *)lght->getName();
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)lght->btCode);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)lght->btCode);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)lght->systemCode);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)lght->systemCode);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, 0);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, lght->id);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, 0);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, 0);
         address += 4;
     }
     address += 32*(kMAX_LIGHTS - light_counter);
@@ -614,39 +887,39 @@ void save_data_to_flash()
         Blind* bld = blinds[i];
         uint8_t data1[4] = {0, bld->channel, bld->type, 0};
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data1));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data1));
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)bld->btCode);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)bld->btCode);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)bld->minPosition);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)bld->minPosition);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)bld->midPosition);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)bld->midPosition);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)bld->maxPosition);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)bld->maxPosition);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)bld->step);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)bld->step);
         address += 4;
 
         char* name_pointer = (char *)bld->getName();
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)name_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)name_pointer));
         name_pointer += 4;
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, 0);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, bld->id);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, 0);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, 0);
         address += 4;
     }
     address += 44*(kMAX_BLINDS - blind_counter);
@@ -658,14 +931,14 @@ void save_data_to_flash()
         button_counter++;
         RemoteButton* btn = remoteButtons[i];
 
-        uint8_t data[4] = {0, (uint8_t) btn->eventType, 0, 0};
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data));
+        uint8_t data[4] = {0, (uint8_t) btn->eventType, kBUTTON_BOUND_TO_ID, 0};
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)btn->remoteButton);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)btn->remoteButton);
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)btn->eventHash);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)btn->eventId);
         address += 4;
     }
     address += 12*(kMAX_BUTTONS - button_counter);
@@ -673,37 +946,37 @@ void save_data_to_flash()
     //save web server settings
     {
         uint8_t data[4] = {0, 0, 0, 0};
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
         address += 4;
 
-        flash_status = FLASH_ProgramWord((uint32_t)address, (uint32_t)webPort);
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)webPort);
         address += 4;
 
         char* user_pointer = web_user;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)user_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)user_pointer));
         user_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)user_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)user_pointer));
         user_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)user_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)user_pointer));
         user_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)user_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)user_pointer));
         user_pointer += 4;
         address += 4;
 
         char* pass_pointer = web_pass;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)pass_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)pass_pointer));
         pass_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)pass_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)pass_pointer));
         pass_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)pass_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)pass_pointer));
         pass_pointer += 4;
         address += 4;
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)pass_pointer));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)pass_pointer));
         pass_pointer += 4;
         address += 4;
     }
@@ -711,11 +984,11 @@ void save_data_to_flash()
     //save auto blinds settings
     {
         uint8_t data[4] = {autoOpenBlindEnabled, automaticBlindOpenHour, automaticBlindOpenMinute, automaticBlindOpenPosition};
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
         address += 4;
 
         uint8_t data2[4] = {autoCloseBlindEnabled, automaticBlindCloseHour, automaticBlindCloseMinute, automaticBlindClosePosition};
-        flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data2));
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data2));
         address += 4;
     }
 
@@ -724,11 +997,62 @@ void save_data_to_flash()
         if (tempAdjust != 0)
         {
             uint8_t data[4] = {0, tempAdjust, 0, 0};
-            flash_status = FLASH_ProgramWord((uint32_t)address, *((uint32_t *)&data));
+            flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
         }
         address += 4;
     }
 
+    //save web connection settings
+    {
+        uint8_t data[4] = {0, 0, 0, 0};
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
+        address += 4;
+
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)webIdleTimeout);
+        address += 4;
+    }
+
+    //save API server settings
+    {
+        uint8_t data[4] = {0, 0, 0, 0};
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
+        address += 4;
+
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)apiPort);
+        address += 4;
+    }
+
+    //save wifi UART settings
+    {
+        uint8_t data[4] = {0, 0, 0, 0};
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
+        address += 4;
+
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)wifiBaudRate);
+        address += 4;
+    }
+
+    //save connection 2 role and peer unit
+    {
+        uint8_t data[4] = {0, (uint8_t)c2Role, 0, 0};
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)&data));
+        address += 4;
+
+        flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, (uint32_t)peerPort);
+        address += 4;
+
+        char* peer_pointer = peerAddress;
+        for (int j=0; j < 4; j++)
+        {
+            flash_status = FLASH_ProgramWord((uint32_t)(uintptr_t)address, *((uint32_t *)peer_pointer));
+            peer_pointer += 4;
+            address += 4;
+        }
+    }
+
+    // Every setting is programmed as one word
+    Metrics::add(METRIC_FLASH_WRITES, (address - (uint8_t *)flash_data) / 4);
+
     FLASH_Lock();
 
    // NVIC_SystemReset();
@@ -743,6 +1067,7 @@ void deleteFlash()
     FLASH_Unlock();
     FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR |FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
     flash_status = FLASH_EraseSector(FLASH_Sector_11, VoltageRange_3);
+    Metrics::add(METRIC_FLASH_ERASES);
 
     NVIC_SystemReset();
 }
@@ -751,14 +1076,14 @@ void deleteFlash()
 // WIFI (WEB SERVER) FUNCTIONS - PART 1
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
 
-void sendWifiUsart1(char* data)
+void sendWifiUsart1(const char* data)
 {
     //
     // Sends data to wifi module using connection 1
     // For now PIO only
     //
 
-    int sent;
+    unsigned int sent;
 
     for (sent = 0; sent < strlen(data); sent++)
     {
@@ -767,32 +1092,67 @@ void sendWifiUsart1(char* data)
     }
 }
 
-void clearWifiUsart1Buffer()
+void sendWifiData(USART_TypeDef *usart, const char *data, int length)
 {
     //
-    // Clears entire wifi buffer for connection 1
+    // Sends a block of known length to wifi module using the given connection
     //
 
-    eth1_busy = 1;
-    eth1_buff_indicator = 0;
-    for (int i = 0; i < eth1_buff_size; i++)
+    for (int sent = 0; sent < length; sent++)
     {
-        eth1_buff[i] = '\0';
+        while(!USART_GetFlagStatus(usart, USART_FLAG_TXE)) {}
+        USART_SendData(usart, data[sent]);
     }
-    eth1_busy = 0;
+
+    Metrics::add(METRIC_HTTP_BYTES_OUT, length);
+}
+
+void consumeWebConnectionBuffer(WebConnection *conn, int length)
+{
+    //
+    // Removes the first length bytes (a served request) from the connection buffer
+    // Anything received after them (pipelined requests) is moved to the beginning of the buffer
+    // Length is limited to what has been received
+    //
+
+    if (length < 0)
+        length = 0;
+
+    USART_ITConfig(conn->usart, USART_IT_RXNE, DISABLE);
+
+    if (length > *conn->buffIndicator)
+        length = *conn->buffIndicator;
+
+    int remaining = *conn->buffIndicator - length;
+
+    for (int i = 0; i < remaining; i++)
+    {
+        conn->buff[i] = conn->buff[i + length];
+    }
+
+    for (int i = remaining; i < *conn->buffIndicator; i++)
+    {
+        conn->buff[i] = '\0';
+    }
+
+    *conn->buffIndicator = remaining;
+
+    USART_ITConfig(conn->usart, USART_IT_RXNE, ENABLE);
 }
 
-void clearEthSendBuffer()
+void clearWifiUsart1Buffer()
 {
     //
-    // Clears the entire wifi send buffer
+    // Clears entire wifi buffer for connection 1
     //
 
-    eth_send_pointer = 0;
-    for (int i = 0; i < sizeof(eth_send_buff); i++)
+    eth1_busy = 1;
+    eth1_buff_indicator = 0;
+    for (int i = 0; i < eth1_buff_size; i++)
     {
-        eth_send_buff[i] = '\0';
+        eth1_buff[i] = '\0';
     }
+    eth1_busy = 0;
 }
 
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -891,16 +1251,36 @@ long int_map(long x, long in_min, long in_max, long out_min, long out_max)
 // BACKGROUND TASK FUNCTIONS
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
 
+void sampleTemperature()
+{
+    //
+    // Measures the temperature in the background (web responses use the last measurement)
+    //
+
+    int temperature = (int)tempSensor.getTemp();
+
+    if (temperature != currentTemperature)
+    {
+        currentTemperature = temperature;
+        StateVersion::bump();
+    }
+}
+
 void vTask1Function (void *pvParameters)
 {
     //
     // Task function for refreshing the info display. Calls displayInfoScreen every few seconds
     // and refreshing the information (clock, temperature, light status)
     // Only do this if the info screen is currently displayed
+    // Also samples the temperature for the web server
     //
 
+    (void)pvParameters;
+
     while (1)
     {
+        sampleTemperature();
+
         if (Menu::onInfoScreen)
         {
             taskENTER_CRITICAL();
@@ -919,6 +1299,8 @@ void vTask2Function (void *pvParameters)
     // LED status displays and autoblind feature
     //
 
+    (void)pvParameters;
+
     int greenBlinkNum = 0;
     bool greenOn = true;
     bool greenBlink = false;
@@ -931,65 +1313,88 @@ void vTask2Function (void *pvParameters)
             greenBlinkNum = 2;
             greenOn = true;
 
-            RemoteButton* butt = NULL;
+            // Devices of the button were resolved when the configuration changed. They are only compared
+            // with the current lists while the devices are locked (a configuration request may delete them).
+            int actionCount;
+            int8_t lightTarget[kMAX_LIGHTS];
+            BatchAction batch[kMAX_BATCH_ACTIONS];
+            int batchCount = 0;
 
-            for (int i = 0; i < remoteButtons.size(); i++)
+            xSemaphoreTake(deviceMutex, portMAX_DELAY);
+
+            const RemoteAction *actions = RemoteIndex::find(RemoteButton::remoteCodePressed, &actionCount);
+
+            for (int i = 0; i < lights.size(); i++)
             {
-                if (RemoteButton::remoteCodePressed == remoteButtons[i]->remoteButton)
-                {
-                    butt = remoteButtons[i];
-                    break;
-                }
+                lightTarget[i] = kLIGHT_KEEP;
             }
 
-            if (butt->eventType == TYPE_LIGHT_ON || butt->eventType == TYPE_LIGHT_OFF || butt->eventType == TYPE_LIGHT_TOGGLE)
+            for (int i = 0; i < actionCount; i++)
             {
-                for (int j=0; j < lights.size(); j++)
+                const RemoteAction *action = &actions[i];
+
+                if (action->eventType == TYPE_LIGHT_TOGGLE || action->eventType == TYPE_LIGHT_ON || action->eventType == TYPE_LIGHT_OFF)
                 {
-                    if (lights[j]->calculateHash() == butt->eventHash)
+                    for (int j = 0; j < lights.size(); j++)
                     {
-                        taskENTER_CRITICAL();
-                        if (butt->eventType == TYPE_LIGHT_TOGGLE)
-                        {
-                            lights[j]->onOff(!lights[j]->isOn());
-                        }
+                        if (lights[j] != action->device)
+                            continue;
+
+                        if (action->eventType != TYPE_LIGHT_TOGGLE)
+                            lightTarget[j] = (action->eventType == TYPE_LIGHT_ON)? 1 : 0;
+                        else if (lightTarget[j] != kLIGHT_KEEP)
+                            lightTarget[j] = 1 - lightTarget[j];
                         else
+                            lightTarget[j] = (lights[j]->isOn())? 0 : 1;
+                    }
+                }
+                else if (action->eventType == TYPE_BLIND_TOGGLE)
+                {
+                    for (int j = 0; j < blinds.size() && batchCount < kMAX_BLINDS; j++)
+                    {
+                        if (blinds[j] == action->device)
                         {
-                            lights[j]->onOff(butt->eventType == TYPE_LIGHT_ON);
+                            BatchAction toggle = {false, j, -1};
+                            batch[batchCount++] = toggle;
                         }
-                        taskEXIT_CRITICAL();
                     }
                 }
-            }
-            else if (butt->eventType == TYPE_BLIND_TOGGLE)
-            {
-                for (int j=0; j < blinds.size(); j++)
+                else if (action->eventType == TYPE_ACTION)
                 {
-                    if (blinds[j]->calculateHash() == butt->eventHash)
+                    if (action->eventId == 0)
                     {
-                        blinds[j]->toggleState();
+                        blueLedOn = true;
+                        blueLedOnTime = 50000;
+
+                        delayedActionTime = 30000;
+                        delayLightOff = true;
                     }
                 }
             }
-            else if (butt->eventType == TYPE_ACTION)
+
+            for (int i = 0; i < lights.size(); i++)
             {
-                if (butt->eventHash == 0)
+                if (lightTarget[i] != kLIGHT_KEEP)
                 {
-                    blueLedOn = true;
-                    blueLedOnTime = 50000;
-
-                    delayedActionTime = 30000;
-                    delayLightOff = true;
+                    BatchAction light = {true, i, lightTarget[i]};
+                    batch[batchCount++] = light;
                 }
             }
+
+            xSemaphoreGive(deviceMutex);
+
+            // Lights are switched together (group telegrams for lights that share an address), blinds move at the same time
+            runBatchActions(batch, batchCount);
             RemoteButton::remoteCodePressed = 0;
         }
 
         if (delayBlindOpen && autoOpenBlindEnabled)
         {
+            // One after another, devices are only locked while a blind is changed
             for (int i=0; i < blinds.size(); i++)
             {
-                blinds[i]->toggleState(automaticBlindOpenPosition);
+                BatchAction action = {false, i, automaticBlindOpenPosition};
+                runBatchActions(&action, 1);
             }
             delayBlindOpen = false;
 
@@ -1001,7 +1406,8 @@ void vTask2Function (void *pvParameters)
         {
             for (int i=0; i < blinds.size(); i++)
             {
-                blinds[i]->toggleState(automaticBlindClosePosition);
+                BatchAction action = {false, i, automaticBlindClosePosition};
+                runBatchActions(&action, 1);
             }
             delayBlindClose = false;
 
@@ -1020,10 +1426,16 @@ void vTask2Function (void *pvParameters)
                 delayLightOff = false;
                 delayedActionTime = 0;
 
+                // Lights that share an address go off with one group telegram
+                int8_t lightTarget[kMAX_LIGHTS];
+
+                xSemaphoreTake(deviceMutex, portMAX_DELAY);
                 for (int i=0; i < lights.size(); i++)
                 {
-                    lights[i]->onOff(false);
+                    lightTarget[i] = 0;
                 }
+                Light::switchLights(lights.data(), lights.size(), lightTarget, RF_PRIORITY_BACKGROUND);
+                xSemaphoreGive(deviceMutex);
 
             }
         }
@@ -1075,516 +1487,2645 @@ void vTask2Function (void *pvParameters)
 //
 // HTTP server defines
 //
-#define kHTTP_OK_HEAD "HTTP/1.1 200 OK\r\nConnection: close\r\nServer: RHome\r\nPragma: no-cache\r\nContent-Length: "
-#define kHTTP_AUTH_HEAD "HTTP/1.1 403 Forbidden\r\nConnection: close\r\nServer: RHome\r\nPragma: no-cache\r\nContent-Length: "
+#define kHTTP_OK_HEAD "HTTP/1.1 200 OK\r\n"
+#define kHTTP_REDIRECT_HEAD "HTTP/1.1 303 See Other\r\n"
+#define kHTTP_NOT_MODIFIED_HEAD "HTTP/1.1 304 Not Modified\r\n"
+#define kHTTP_BAD_REQUEST_HEAD "HTTP/1.1 400 Bad Request\r\n"
+#define kHTTP_AUTH_HEAD "HTTP/1.1 403 Forbidden\r\n"
+#define kHTTP_METHOD_NOT_ALLOWED_HEAD "HTTP/1.1 405 Method Not Allowed\r\n"
+#define kHTTP_TOO_LARGE_HEAD "HTTP/1.1 413 Payload Too Large\r\n"
+#define kHTTP_ALLOW_HEAD "Allow: "
+#define kHTTP_ETAG_HEAD "ETag: \"%lu\"\r\n"
+#define kHTTP_LOGIN_HEAD "Location: /\r\nSet-Cookie: session=%s; Path=/; HttpOnly\r\n"
+#define kHTTP_LOGOUT_HEAD "Location: /\r\nSet-Cookie: session=; Path=/; Max-Age=0\r\n"
+#define kHTTP_CLOSE_HEAD "Connection: close\r\n"
+#define kHTTP_KEEP_ALIVE_HEAD "Connection: keep-alive\r\nKeep-Alive: timeout=%d\r\n"
+#define kHTTP_COMMON_HEAD "Server: RHome\r\nPragma: no-cache\r\nContent-Length: "
 #define kHTTP_HEAD_PART2 "\r\nContent-Type: text/html\r\n\r\n"
 #define kHTTP_HEAD_PART2_API "\r\nContent-Type: application/json\r\n\r\n"
+#define kHTTP_HEAD_PART2_CBOR "\r\nContent-Type: application/cbor\r\n\r\n"
+#define kHTTP_HEAD_PART2_METRICS "\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n"
+#define kHTTP_HEAD_PART2_TEXT "\r\nContent-Type: text/plain\r\n\r\n"
+#define kHTTP_HEAD_PART2_EMPTY "\r\n\r\n"
 
-void printWebPageStart(char *dest)
-{
-    //
-    // Prints (copies to destination) the beginning of the control web page (including stylesheet)
-    //
+//
+// Errors of getHttpRequestLength
+//
+#define kHTTP_REQUEST_INVALID -1
+#define kHTTP_REQUEST_TOO_LARGE -2
 
-    dest[0] = '\0';
-    strcat(dest, "<!DOCTYPE html><html><head><style type='text/css'>html {height: 100%;} body {min-height: 100%; background: repeating-linear-gradient(45deg, #2c3339, #2c3339 7px, #161819 7px, #161819 12px); font-family: Arial, Helvetica, sans-serif; color: #F3F9FE;} h1 {padding:0px; margin:0px; color: #F3F9FE; font-size: 1.6em;} input {background-color: #9BCCF5; border: solid #161819 1px; width: 300px; height: 25px;} button {background-color:#9BCCF5; border: solid #9BCCF5 1px; height: 30px; vertical-align: middle; font-size: 0.65em;} .main {width: 1000px; height: 550px; border-radius: 275px; margin: auto; background-color: #5DB5FF; position: absolute; top: 0; left: 0; bottom: 0; right: 0; overflow: auto;} .left_top {float:left; width: 499px; height: 274px;} .light_off {border: solid #FFC719 2px; width: 22px; height: 22px; border-radius:11px; display: inline-block; position:relative; top:12px;} .light_on {background-color: #FFC719; width: 24px; height: 24px; border-radius:12px; display: inline-block; position:relative; top:12px;} .elements {color: #FFC719; font-size: 1.3em; line-height: 45px;} progress {width: 70px; apperance: none; -webkit-appearance: none; -moz-appearance: none; border: none; background-color: #F3F9FE;} progress::-webkit-progress-value {background-color: #FFC719;} progress::-moz-progress-bar {background-color: #FFC719;}</style><title>Rhome v3</title></head><body><div class='main'>");
-}
+#define kHTTP_WEBSOCKET_HEAD "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
+
+//
+// WebSocket connections are polled more often than HTTP requests to keep the interaction latency low
+//
+#define kWEBSOCKET_POLL_TIME 20     // ms
+
+//
+// Rendered response cache (one entry per response format)
+// Bodies are rebuilt only when the state version changes, time is patched in when sent
+//
+#define kWEB_CACHE_HTML_SIZE 6000
+#define kWEB_CACHE_JSON_SIZE 768
+#define kWEB_TIME_LENGTH 8
+#define kWEB_NAME_SIZE 12
 
-void printWebPageEnd(char *dest)
+typedef enum
 {
-    //
-    // Prints the end of the control web page
-    //
+    WEB_CACHE_HTML,
+    WEB_CACHE_JSON
+} WebCacheFormat;
 
-    strcat(dest, "</div></body></html>\0");
-}
+typedef struct
+{
+    char *body;
+    int size;
+    int length;             // -1 if the entry is not valid
+    uint32_t version;
+    int timeOffset;         // -1 if the body contains no time
+    bool legacyLinks;       // links contain credentials (legacy authentication)
+    xSemaphoreHandle lock;
+} WebCacheEntry;
+
+char webCacheHtml[kWEB_CACHE_HTML_SIZE];
+char webCacheJson[kWEB_CACHE_JSON_SIZE];
+WebCacheEntry webCache[2] =
+{
+    {webCacheHtml, kWEB_CACHE_HTML_SIZE, -1, 0, -1, false, NULL},
+    {webCacheJson, kWEB_CACHE_JSON_SIZE, -1, 0, -1, false, NULL}
+};
 
-void printWebErrorResponse(char *dest, char *content_buff, int error)
+typedef struct
+{
+    WebConnection *connection;
+    const char *linkPrefix;
+    int batchCount;
+    int temperature;
+    RTC_TimeTypeDef time;
+    int lightCount;
+    int blindCount;
+    bool lightOn[kMAX_LIGHTS];
+    int blindState[kMAX_BLINDS];
+    char lightName[kMAX_LIGHTS][kWEB_NAME_SIZE];
+    char blindName[kMAX_BLINDS][kWEB_NAME_SIZE];
+    uint32_t lightId[kMAX_LIGHTS];
+    uint32_t blindId[kMAX_BLINDS];
+    WebCacheEntry *cache;
+    bool cacheOverflow;
+    int timeOffset;
+} WebPageState;
+
+void prepareWebPageState(WebPageState *state, TemplateContext *ctx)
 {
     //
-    // Prints server errors (Log in and incorrect username/password)
+    // Takes a snapshot of everything the web page templates display
+    // (measuring and sending the page must see the same values, and a config replace
+    // on the other connection may delete the devices while the page is sent)
     //
 
-    char temp_buff[6];
-    dest[0] = '\0';
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
 
-    printWebPageStart(content_buff);
+    state->lightCount = (lights.size() < kMAX_LIGHTS)? lights.size() : kMAX_LIGHTS;
+    state->blindCount = (blinds.size() < kMAX_BLINDS)? blinds.size() : kMAX_BLINDS;
 
-    if (error == 1)
+    for (int i = 0; i < state->lightCount; i++)
     {
-        strcat(content_buff, "<div style='width: 300px; height: 250px; margin: auto; padding-top:125px;'><h1>Please log in!</h1><form method='GET' onSubmit='return false;' id='login'><p>User: <input type='text' id='user' /></p><p>Password: <input type='password' id='pass' /></p><p><button id='sub' onclick=\"var user = document.getElementById('user').value; var pass = document.getElementById('pass').value; location.href = user+'/' + pass;\" >Submit</button></p></form></div>");
+        state->lightOn[i] = lights[i]->isOn();
+        state->lightId[i] = lights[i]->id;
+        strncpy(state->lightName[i], lights[i]->getName(), kWEB_NAME_SIZE - 1);
+        state->lightName[i][kWEB_NAME_SIZE - 1] = '\0';
     }
-    else if (error == 2)
+
+    for (int i = 0; i < state->blindCount; i++)
     {
-        strcat(content_buff, "<div style='width: 300px; height: 250px; margin: auto; padding-top:125px;'><h1>You are not logged in!</h1>Check your username and password!<br /><br /><button id='sub' onclick=\"location.href = '/' \" >Go back</button></div>");
+        state->blindState[i] = blinds[i]->getState();
+        state->blindId[i] = blinds[i]->id;
+        strncpy(state->blindName[i], blinds[i]->getName(), kWEB_NAME_SIZE - 1);
+        state->blindName[i][kWEB_NAME_SIZE - 1] = '\0';
     }
 
-    printWebPageEnd(content_buff);
+    xSemaphoreGive(deviceMutex);
+
+    state->temperature = currentTemperature;
+    RTC_GetTime(RTC_Format_BIN, &state->time);
 
-    sprintf(temp_buff, "%d", strlen(content_buff));
-    strcat(dest, (error == 1)?kHTTP_OK_HEAD : kHTTP_AUTH_HEAD);
-    strcat(dest, temp_buff);
-    strcat(dest, kHTTP_HEAD_PART2);
+    ctx->loopCount[WEB_LOOP_LIGHTS] = state->lightCount;
+    ctx->loopCount[WEB_LOOP_BLINDS] = state->blindCount;
 }
 
-void task3(void *pvParameters)
+const char *resolveWebSlot(TemplateContext *ctx, int slot, int index)
 {
     //
-    // The actual web server task
+    // Returns the value of a web page template slot
     //
 
-    char tokens[6][20];
-    char user_pass[45];
-    int token = -1;
-    int token_pointer = 0;
-
-    char web_buff[100];
-    std::string delim = "/";
+    WebPageState *state = (WebPageState *)ctx->userData;
 
-    while(1)
+    switch (slot)
     {
-        if (eth1_busy || eth1_buff_indicator < 5)
-        {
-            vTaskDelay(200 / portTICK_RATE_MS);
-            continue;
-        }
+        case WEB_SLOT_LINK_PREFIX:
+            return state->linkPrefix;
+        case WEB_SLOT_INDEX:
+            sprintf(ctx->scratch, "%d", index);
+            return ctx->scratch;
+        case WEB_SLOT_LIGHT_NAME:
+            return state->lightName[index];
+        case WEB_SLOT_LIGHT_ENTITY:
+            sprintf(ctx->scratch, "%lu", (unsigned long)state->lightId[index]);
+            return ctx->scratch;
+        case WEB_SLOT_LIGHT_STATE:
+            return (state->lightOn[index])? "1" : "0";
+        case WEB_SLOT_LIGHT_CLASS:
+            return (state->lightOn[index])? "light_on" : "light_off";
+        case WEB_SLOT_BLIND_NAME:
+            return state->blindName[index];
+        case WEB_SLOT_BLIND_ENTITY:
+            sprintf(ctx->scratch, "%lu", (unsigned long)state->blindId[index]);
+            return ctx->scratch;
+        case WEB_SLOT_BLIND_STATE:
+            return (state->blindState[index] == 0)? "0" : (state->blindState[index] == 1)? "1" : "2";
+        case WEB_SLOT_BLIND_PROGRESS:
+            return (state->blindState[index] == 0)? "1" : (state->blindState[index] == 1)? "50" : "100";
+        case WEB_SLOT_TEMPERATURE:
+            sprintf(ctx->scratch, "%d", state->temperature);
+            return ctx->scratch;
+        case WEB_SLOT_TIME:
+            state->timeOffset = (state->cache != NULL)? state->cache->length : -1;
+            sprintf(ctx->scratch, "%02d:%02d:%02d", state->time.RTC_Hours, state->time.RTC_Minutes, state->time.RTC_Seconds);
+            return ctx->scratch;
+        case WEB_SLOT_BATCH:
+            if (state->batchCount == -2)
+                return "";
+            sprintf(ctx->scratch, "\"batch\":{\"ok\":%s,\"actions\":%d},", (state->batchCount >= 0)? "true" : "false", (state->batchCount >= 0)? state->batchCount : 0);
+            return ctx->scratch;
+        case WEB_SLOT_PEER_ROOMS:
+            return Aggregator::rooms();
+        case WEB_SLOT_PEER_STATUS:
+            return Aggregator::status();
+        default:
+            return "";
+    }
+}
 
-        clearEthSendBuffer();
+void writeWebTemplate(TemplateContext *ctx, const char *data, int length)
+{
+    //
+    // Template writer, sends rendered data to the connection the request came from
+    //
 
-        for (int i=0; i < 6; i++)
-        {
-            tokens[i][0] = '\0';
+    sendWifiData(((WebPageState *)ctx->userData)->connection->usart, data, length);
+}
+
+void writeWebCache(TemplateContext *ctx, const char *data, int length)
+{
+    //
+    // Template writer, stores rendered data to the cache entry that is being built
+    //
+
+    WebPageState *state = (WebPageState *)ctx->userData;
+    WebCacheEntry *cache = state->cache;
+
+    if (cache->length + length > cache->size)
+    {
+        state->cacheOverflow = true;
+        return;
+    }
+
+    memcpy(cache->body + cache->length, data, length);
+    cache->length += length;
+}
+
+void sendHttpHead(WebConnection *conn, const char *head, bool keepAlive, uint32_t version, int contentLength, const char *contentType, const char *extraHead = NULL)
+{
+    //
+    // Sends the HTTP response header
+    // (version is sent as ETag, 0 = no ETag)
+    //
+
+    char *head_buff = conn->headBuff;
+
+    strcpy(head_buff, head);
+
+    if (keepAlive)
+    {
+        sprintf(head_buff + strlen(head_buff), kHTTP_KEEP_ALIVE_HEAD, webIdleTimeout);
+    }
+    else
+    {
+        strcat(head_buff, kHTTP_CLOSE_HEAD);
+    }
+
+    if (version != 0)
+    {
+        sprintf(head_buff + strlen(head_buff), kHTTP_ETAG_HEAD, (unsigned long)version);
+    }
+
+    if (extraHead != NULL)
+    {
+        strcat(head_buff, extraHead);
+    }
+
+    strcat(head_buff, kHTTP_COMMON_HEAD);
+    sprintf(head_buff + strlen(head_buff), "%d", contentLength);
+    strcat(head_buff, contentType);
+
+    sendWifiData(conn->usart, head_buff, strlen(head_buff));
+}
+
+void sendWebTemplate(const char *head, bool keepAlive, const char *contentType, const TemplateOp *page, TemplateContext *ctx)
+{
+    //
+    // Sends the HTTP header (with exact Content-Length) and streams the page template directly to the wifi module
+    //
+
+    WebConnection *conn = ((WebPageState *)ctx->userData)->connection;
+
+    sendHttpHead(conn, head, keepAlive, 0, templateLength(page, ctx), contentType);
+
+    templateRender(page, ctx, writeWebTemplate);
+}
+
+void sendWebCached(WebCacheFormat format, bool keepAlive, const char *contentType, const TemplateOp *page, TemplateContext *ctx)
+{
+    //
+    // Sends a response from the cache, page is only rendered if the state changed since it was cached
+    // Current time is inserted while sending so the cached body stays valid
+    //
+
+    WebPageState *state = (WebPageState *)ctx->userData;
+    WebCacheEntry *cache = &webCache[format];
+    uint32_t version = StateVersion::get();
+    bool legacyLinks = (state->linkPrefix[0] != '\0');
+
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+
+    if (cache->length < 0 || cache->version != version || cache->legacyLinks != legacyLinks)
+    {
+        prepareWebPageState(state, ctx);
+
+        state->cache = cache;
+        state->cacheOverflow = false;
+        state->timeOffset = -1;
+        cache->length = 0;
+
+        templateRender(page, ctx, writeWebCache);
+
+        state->cache = NULL;
+        cache->version = version;
+        cache->timeOffset = state->timeOffset;
+        cache->legacyLinks = legacyLinks;
+
+        if (state->cacheOverflow)
+        {
+            // Does not fit into the cache, send it the old way
+            cache->length = -1;
+            xSemaphoreGive(cache->lock);
+
+            sendWebTemplate(kHTTP_OK_HEAD, keepAlive, contentType, page, ctx);
+            return;
+        }
+    }
+
+    sendHttpHead(state->connection, kHTTP_OK_HEAD, keepAlive, version, cache->length, contentType);
+
+    if (cache->timeOffset >= 0)
+    {
+        RTC_TimeTypeDef RTC_TimeStruct;
+        RTC_GetTime(RTC_Format_BIN, &RTC_TimeStruct);
+
+        char time_buff[12];             // Only kWEB_TIME_LENGTH are sent, RTC fields are bytes (up to 3 digits each)
+        sprintf(time_buff, "%02d:%02d:%02d", RTC_TimeStruct.RTC_Hours, RTC_TimeStruct.RTC_Minutes, RTC_TimeStruct.RTC_Seconds);
+
+        sendWifiData(state->connection->usart, cache->body, cache->timeOffset);
+        sendWifiData(state->connection->usart, time_buff, kWEB_TIME_LENGTH);
+        sendWifiData(state->connection->usart, cache->body + cache->timeOffset + kWEB_TIME_LENGTH, cache->length - cache->timeOffset - kWEB_TIME_LENGTH);
+    }
+    else
+    {
+        sendWifiData(state->connection->usart, cache->body, cache->length);
+    }
+
+    xSemaphoreGive(cache->lock);
+}
+
+void writeApiCbor(CborStream *stream, const uint8_t *data, int length)
+{
+    //
+    // CBOR writer, sends encoded data to the connection the request came from
+    //
+
+    sendWifiData(((WebPageState *)stream->userData)->connection->usart, (const char *)data, length);
+}
+
+void encodeApiStatus(CborStream *stream, WebPageState *state)
+{
+    //
+    // Encodes the API status (same content as kApiStatusTemplate) in CBOR with integer keys
+    //
+
+    cborMap(stream, (state->batchCount == -2)? 5 : 6);
+
+    cborUint(stream, API_KEY_LIGHTS);
+    cborArray(stream, state->lightCount);
+    for (int i = 0; i < state->lightCount; i++)
+    {
+        cborMap(stream, 4);
+        cborUint(stream, API_KEY_ID);
+        cborUint(stream, i);
+        cborUint(stream, API_KEY_ENTITY);
+        cborUint(stream, state->lightId[i]);
+        cborUint(stream, API_KEY_NAME);
+        cborText(stream, state->lightName[i]);
+        cborUint(stream, API_KEY_STATUS);
+        cborUint(stream, (state->lightOn[i])? 1 : 0);
+    }
+
+    cborUint(stream, API_KEY_BLINDS);
+    cborArray(stream, state->blindCount);
+    for (int i = 0; i < state->blindCount; i++)
+    {
+        cborMap(stream, 4);
+        cborUint(stream, API_KEY_ID);
+        cborUint(stream, i);
+        cborUint(stream, API_KEY_ENTITY);
+        cborUint(stream, state->blindId[i]);
+        cborUint(stream, API_KEY_STATUS);
+        cborUint(stream, state->blindState[i]);
+        cborUint(stream, API_KEY_NAME);
+        cborText(stream, state->blindName[i]);
+    }
+
+    cborUint(stream, API_KEY_TEMPERATURE);
+    cborInt(stream, state->temperature);
+
+    cborUint(stream, API_KEY_TIME);
+    cborUint(stream, state->time.RTC_Hours * 3600 + state->time.RTC_Minutes * 60 + state->time.RTC_Seconds);
+
+    if (state->batchCount != -2)
+    {
+        cborUint(stream, API_KEY_BATCH);
+        cborMap(stream, 2);
+        cborUint(stream, API_KEY_OK);
+        cborBool(stream, state->batchCount >= 0);
+        cborUint(stream, API_KEY_ACTIONS);
+        cborUint(stream, (state->batchCount >= 0)? state->batchCount : 0);
+    }
+
+    cborUint(stream, API_KEY_API_VER);
+    cborUint(stream, 1);
+}
+
+void sendApiCbor(bool keepAlive, uint32_t version, TemplateContext *ctx)
+{
+    //
+    // Sends the API status in CBOR
+    // Encoded twice (length, then data) so it is streamed straight to the wifi module without buffering
+    //
+
+    WebPageState *state = (WebPageState *)ctx->userData;
+    CborStream stream;
+
+    prepareWebPageState(state, ctx);
+
+    cborInit(&stream, NULL, state);
+    encodeApiStatus(&stream, state);
+
+    sendHttpHead(state->connection, kHTTP_OK_HEAD, keepAlive, version, stream.length, kHTTP_HEAD_PART2_CBOR);
+
+    cborInit(&stream, writeApiCbor, state);
+    encodeApiStatus(&stream, state);
+}
+
+//
+// Metric values as they were when the /metrics response was started
+// (one snapshot is shared by both connections, metricsLock is held while it is sent)
+// Lights are labelled by their entity ID, their RF statistics are kept by the scheduler
+//
+typedef struct
+{
+    uint32_t values[METRIC_COUNT];
+    uint32_t taskStack[kMETRICS_MAX_TASKS];
+    uint32_t lightId[kMAX_LIGHTS];
+    RfDeviceStats lightRf[kMAX_LIGHTS];
+} MetricsSnapshot;
+
+MetricsSnapshot metricsSnapshot;
+xSemaphoreHandle metricsLock;
+
+const char *resolveMetricsSlot(TemplateContext *ctx, int slot, int index)
+{
+    //
+    // Returns the value of a metrics template slot
+    //
+
+    const MetricInfo *info = Metrics::info((MetricId)index);
+
+    switch (slot)
+    {
+        case METRICS_SLOT_NAME:
+            return info->name;
+        case METRICS_SLOT_HELP:
+            return info->help;
+        case METRICS_SLOT_TYPE:
+            return (info->type == METRIC_TYPE_COUNTER)? "counter" : "gauge";
+        case METRICS_SLOT_VALUE:
+            if (info->type == METRIC_TYPE_COUNTER)
+                sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.values[index]);
+            else
+                sprintf(ctx->scratch, "%ld", (long)(int32_t)metricsSnapshot.values[index]);
+            return ctx->scratch;
+        case METRICS_SLOT_TASK_NAME:
+            return Metrics::taskName(index);
+        case METRICS_SLOT_TASK_STACK:
+            sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.taskStack[index]);
+            return ctx->scratch;
+        case METRICS_SLOT_LIGHT_ID:
+            sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.lightId[index]);
+            return ctx->scratch;
+        case METRICS_SLOT_LIGHT_TELEGRAMS:
+            sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.lightRf[index].telegrams);
+            return ctx->scratch;
+        case METRICS_SLOT_LIGHT_BACKOFFS:
+            sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.lightRf[index].backoffs);
+            return ctx->scratch;
+        case METRICS_SLOT_LIGHT_RETRIES:
+            sprintf(ctx->scratch, "%lu", (unsigned long)metricsSnapshot.lightRf[index].retries);
+            return ctx->scratch;
+        default:
+            return "";
+    }
+}
+
+void writeMetricsTemplate(TemplateContext *ctx, const char *data, int length)
+{
+    //
+    // Template writer, sends rendered metrics to the connection the request came from
+    //
+
+    sendWifiData(((WebConnection *)ctx->userData)->usart, data, length);
+}
+
+void updateMetricGauges()
+{
+    //
+    // Gauges are only set when the metrics are read
+    //
+
+    Metrics::set(METRIC_FREE_HEAP, xPortGetFreeHeapSize());
+    Metrics::set(METRIC_UPTIME, xTaskGetTickCount() / configTICK_RATE_HZ);
+    Metrics::set(METRIC_TEMPERATURE, currentTemperature);
+}
+
+void sendMetrics(WebConnection *conn, bool keepAlive, const char *contentType)
+{
+    //
+    // Sends all firmware counters in Prometheus text format
+    // Gauges are updated and everything is copied first so that measuring and sending see the same values
+    //
+
+    TemplateContext ctx;
+    ctx.resolve = resolveMetricsSlot;
+    ctx.userData = conn;
+    ctx.loopCount[METRICS_LOOP_VALUES] = METRIC_COUNT;
+    ctx.loopCount[METRICS_LOOP_TASKS] = Metrics::taskCount();
+
+    xSemaphoreTake(metricsLock, portMAX_DELAY);
+
+    updateMetricGauges();
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        metricsSnapshot.values[i] = Metrics::get((MetricId)i);
+    }
+
+    for (int i = 0; i < Metrics::taskCount(); i++)
+    {
+        metricsSnapshot.taskStack[i] = Metrics::taskStackFree(i);
+    }
+
+    // Lights can be replaced by a configuration request meanwhile
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
+
+    int lightCount = lights.size();
+    for (int i = 0; i < lightCount; i++)
+    {
+        metricsSnapshot.lightId[i] = lights[i]->id;
+        if (!RfScheduler::deviceStats(lights[i], &metricsSnapshot.lightRf[i]))
+            memset(&metricsSnapshot.lightRf[i], 0, sizeof(RfDeviceStats));
+    }
+
+    xSemaphoreGive(deviceMutex);
+
+    ctx.loopCount[METRICS_LOOP_LIGHT_TELEGRAMS] = lightCount;
+    ctx.loopCount[METRICS_LOOP_LIGHT_BACKOFFS] = lightCount;
+    ctx.loopCount[METRICS_LOOP_LIGHT_RETRIES] = lightCount;
+
+    sendHttpHead(conn, kHTTP_OK_HEAD, keepAlive, 0, templateLength(kMetricsTemplate, &ctx), contentType);
+    templateRender(kMetricsTemplate, &ctx, writeMetricsTemplate);
+
+    xSemaphoreGive(metricsLock);
+}
+
+const char *resolveRfTraceSlot(TemplateContext *ctx, int slot, int index)
+{
+    //
+    // Returns the value of an RF trace template slot
+    //
+
+    if (slot == RF_TRACE_SLOT_EDGES)
+        sprintf(ctx->scratch, "%d", RemoteReceiver::captureLength());
+    else
+        sprintf(ctx->scratch, "%u", (unsigned int)RemoteReceiver::captureAt(index));
+
+    return ctx->scratch;
+}
+
+void sendRfTrace(WebConnection *conn, bool keepAlive, const char *contentType, bool start)
+{
+    //
+    // RF capture mode over HTTP: POST starts a new capture, GET stops it and sends the recorded edges
+    // (metricsLock is held so that the recording does not change between measuring and sending)
+    //
+
+    TemplateContext ctx;
+    ctx.resolve = resolveRfTraceSlot;
+    ctx.userData = conn;
+
+    xSemaphoreTake(metricsLock, portMAX_DELAY);
+
+    if (start)
+    {
+        RemoteReceiver::startCapture();
+
+        const char *response = "capturing\n";
+        sendHttpHead(conn, kHTTP_OK_HEAD, keepAlive, 0, strlen(response), contentType);
+        sendWifiData(conn->usart, response, strlen(response));
+    }
+    else
+    {
+        RemoteReceiver::stopCapture();
+        ctx.loopCount[RF_TRACE_LOOP_DURATIONS] = RemoteReceiver::captureLength();
+
+        sendHttpHead(conn, kHTTP_OK_HEAD, keepAlive, 0, templateLength(kRfTraceTemplate, &ctx), contentType);
+        templateRender(kRfTraceTemplate, &ctx, writeMetricsTemplate);
+    }
+
+    xSemaphoreGive(metricsLock);
+}
+
+void sendHouseStatus(bool keepAlive, TemplateContext *ctx)
+{
+    //
+    // Sends the state of all rooms (this unit and the peer chain)
+    // Peer rooms are locked so that measuring and sending see the same data
+    //
+
+    WebPageState *state = (WebPageState *)ctx->userData;
+    uint32_t version = StateVersion::get();
+
+    Aggregator::lock();
+
+    prepareWebPageState(state, ctx);
+    sendHttpHead(state->connection, kHTTP_OK_HEAD, keepAlive, version, templateLength(kHouseStatusTemplate, ctx), kHTTP_HEAD_PART2_API);
+    templateRender(kHouseStatusTemplate, ctx, writeWebTemplate);
+
+    Aggregator::unlock();
+}
+
+void sendWebLogin(WebConnection *conn, bool keepAlive, bool apiClient, const char *token)
+{
+    //
+    // Sends the new session token to the client
+    // Browsers get it as a cookie and are redirected to the control page, API clients get it in JSON
+    //
+
+    char extra_head[100];
+    sprintf(extra_head, kHTTP_LOGIN_HEAD, token);
+
+    if (apiClient)
+    {
+        char body[80];
+        sprintf(body, "{\"token\":\"%s\",\"expires\":%d}", token, kSESSION_LIFETIME);
+
+        sendHttpHead(conn, kHTTP_OK_HEAD, keepAlive, 0, strlen(body), kHTTP_HEAD_PART2_API, extra_head);
+        sendWifiData(conn->usart, body, strlen(body));
+    }
+    else
+    {
+        sendHttpHead(conn, kHTTP_REDIRECT_HEAD, keepAlive, 0, 0, kHTTP_HEAD_PART2_EMPTY, extra_head);
+    }
+}
+
+void sendWebNotModified(WebConnection *conn, bool keepAlive, uint32_t version)
+{
+    //
+    // Tells the client that its copy of the response is still valid
+    //
+
+    sendHttpHead(conn, kHTTP_NOT_MODIFIED_HEAD, keepAlive, version, 0, kHTTP_HEAD_PART2_EMPTY);
+}
+
+void sendMethodNotAllowed(WebConnection *conn, bool keepAlive, uint8_t methods)
+{
+    //
+    // Tells the client which methods the route accepts (RouteMethod flags)
+    //
+
+    char extra_head[40];
+    strcpy(extra_head, kHTTP_ALLOW_HEAD);
+
+    if (methods & ROUTE_METHOD_GET)
+        strcat(extra_head, "GET, ");
+    if (methods & ROUTE_METHOD_POST)
+        strcat(extra_head, "POST, ");
+    if (methods & ROUTE_METHOD_PUT)
+        strcat(extra_head, "PUT, ");
+
+    strcpy(extra_head + strlen(extra_head) - 2, "\r\n");
+
+    sendHttpHead(conn, kHTTP_METHOD_NOT_ALLOWED_HEAD, keepAlive, 0, 0, kHTTP_HEAD_PART2_EMPTY, extra_head);
+}
+
+int findHttpHeader(const char *request, int headerLength, const char *name)
+{
+    //
+    // Finds a header line in the request (case insensitive)
+    // Returns the offset of its value or -1 if the header is not present
+    //
+
+    int nameLength = strlen(name);
+
+    for (int i = 0; i < headerLength - nameLength - 1; i++)
+    {
+        if (request[i] != '\n')
+            continue;
+
+        int j = 0;
+        while (j < nameLength && tolower(request[i + 1 + j]) == tolower(name[j]))
+        {
+            j++;
+        }
+
+        if (j == nameLength && request[i + 1 + j] == ':')
+        {
+            int value = i + 2 + j;
+            while (value < headerLength && request[value] == ' ')
+            {
+                value++;
+            }
+            return value;
+        }
+    }
+
+    return -1;
+}
+
+int getHttpRequestLength(const char *request, int length, int buffSize, int *headerLength, int *neededLength)
+{
+    //
+    // Finds where the first request in the buffer ends (header and body)
+    // Returns 0 if the request has not been completely received yet, kHTTP_REQUEST_INVALID if Content-Length
+    // is not a plain decimal number or kHTTP_REQUEST_TOO_LARGE if the body can never fit into the buffer
+    // neededLength is the buffer length at which the request will be complete (0 while the header is incomplete)
+    //
+
+    *neededLength = 0;
+
+    for (int i = 3; i < length; i++)
+    {
+        if (request[i - 3] == '\r' && request[i - 2] == '\n' && request[i - 1] == '\r' && request[i] == '\n')
+        {
+            *headerLength = i + 1;
+
+            int bodyLength = 0;
+            int bodyOffset = findHttpHeader(request, *headerLength, "Content-Length");
+            if (bodyOffset >= 0)
+            {
+                int end = bodyOffset;
+                while (request[end] >= '0' && request[end] <= '9')
+                {
+                    // Digits are still checked after the limit is passed, only the value stops growing
+                    if (bodyLength <= buffSize)
+                        bodyLength = bodyLength*10 + (request[end] - '0');
+                    end++;
+                }
+                while (request[end] == ' ')
+                {
+                    end++;
+                }
+
+                if (end == bodyOffset || request[end] != '\r')
+                    return kHTTP_REQUEST_INVALID;
+            }
+
+            if (bodyLength > buffSize - *headerLength)
+                return kHTTP_REQUEST_TOO_LARGE;
+
+            *neededLength = *headerLength + bodyLength;
+            return (*neededLength <= length)? *neededLength : 0;
+        }
+    }
+
+    return 0;
+}
+
+bool getSessionToken(const char *request, int headerLength, char *token)
+{
+    //
+    // Reads the session token from X-Session header (API clients) or session cookie (browsers)
+    //
+
+    int value = findHttpHeader(request, headerLength, "X-Session");
+
+    if (value < 0)
+    {
+        int cookie = findHttpHeader(request, headerLength, "Cookie");
+        if (cookie < 0)
+            return false;
+
+        while (cookie < headerLength - 8 && request[cookie] != '\r')
+        {
+            if (strncmp(&request[cookie], "session=", 8) == 0 && (cookie == 0 || request[cookie - 1] == ' ' || request[cookie - 1] == ';' || request[cookie - 1] == ':'))
+            {
+                value = cookie + 8;
+                break;
+            }
+            cookie++;
+        }
+
+        if (value < 0)
+            return false;
+    }
+
+    if (value + kSESSION_TOKEN_LENGTH > headerLength)
+        return false;
+
+    memcpy(token, &request[value], kSESSION_TOKEN_LENGTH);
+    token[kSESSION_TOKEN_LENGTH] = '\0';
+
+    return true;
+}
+
+bool clientHasVersion(const char *request, int headerLength, uint32_t version)
+{
+    //
+    // Checks if the If-None-Match header of the request matches the current state version
+    //
+
+    int etag = findHttpHeader(request, headerLength, "If-None-Match");
+    if (etag < 0)
+        return false;
+
+    if (request[etag] == '"')
+        etag++;
+
+    return strtoul(&request[etag], NULL, 10) == version;
+}
+
+bool isHttpKeepAlive(const char *request, int headerLength)
+{
+    //
+    // Checks if the client wants to keep the connection open after the response
+    // (default for HTTP/1.1, HTTP/1.0 clients have to ask for it)
+    //
+
+    bool http10 = false;
+    for (int i = 0; i < headerLength - 8; i++)
+    {
+        if (request[i] == '\r')
+            break;
+
+        if (strncmp(&request[i], "HTTP/1.0", 8) == 0)
+        {
+            http10 = true;
+            break;
+        }
+    }
+
+    int connection = findHttpHeader(request, headerLength, "Connection");
+    if (connection >= 0)
+    {
+        if (tolower(request[connection]) == 'c')
+            return false;
+        if (tolower(request[connection]) == 'k')
+            return true;
+    }
+
+    return !http10;
+}
+
+bool acceptsCbor(const char *request, int headerLength)
+{
+    //
+    // Checks if the Accept header of the request asks for CBOR
+    //
+
+    int accept = findHttpHeader(request, headerLength, "Accept");
+    if (accept < 0)
+        return false;
+
+    for (int i = accept; i < headerLength - 16 && request[i] != '\r'; i++)
+    {
+        if (strncmp(&request[i], "application/cbor", 16) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int entityIndex(int32_t id, bool isLight)
+{
+    //
+    // Returns the list index of the light or blind with the entity ID, -1 if there is none
+    // (indexes change when the configuration is replaced, entity IDs do not)
+    //
+
+    if (id <= 0)
+        return -1;
+
+    int index = -1;
+
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
+
+    if (isLight)
+    {
+        Light *light = EntityTable::findLight(id);
+        for (int i = 0; light != NULL && i < lights.size(); i++)
+        {
+            if (lights[i] == light)
+                index = i;
+        }
+    }
+    else
+    {
+        Blind *blind = EntityTable::findBlind(id);
+        for (int i = 0; blind != NULL && i < blinds.size(); i++)
+        {
+            if (blinds[i] == blind)
+                index = i;
+        }
+    }
+
+    xSemaphoreGive(deviceMutex);
+
+    return index;
+}
+
+int parseBatchActions(const char *src, BatchAction *actions)
+{
+    //
+    // Parses a comma separated list of actions (lght:<i>:<on|off> and bld:<i>:<0|1|2> by list index,
+    // light:<id>:<on|off> and blind:<id>:<0|1|2> by entity ID)
+    // Returns the number of actions or -1 if any of them is invalid
+    //
+
+    int count = 0;
+    const char *p = src;
+
+    while (*p != '\0' && *p != ' ' && *p != '/')
+    {
+        if (count >= kMAX_BATCH_ACTIONS)
+            return -1;
+
+        BatchAction *action = &actions[count];
+        bool byEntity = false;
+
+        if (strncmp(p, "lght:", 5) == 0)
+        {
+            action->isLight = true;
+            p += 5;
+        }
+        else if (strncmp(p, "bld:", 4) == 0)
+        {
+            action->isLight = false;
+            p += 4;
+        }
+        else if (strncmp(p, "light:", 6) == 0)
+        {
+            action->isLight = true;
+            byEntity = true;
+            p += 6;
+        }
+        else if (strncmp(p, "blind:", 6) == 0)
+        {
+            action->isLight = false;
+            byEntity = true;
+            p += 6;
+        }
+        else
+        {
+            return -1;
+        }
+
+        if (*p < '0' || *p > '9')
+            return -1;
+
+        action->index = 0;
+        while (*p >= '0' && *p <= '9')
+        {
+            action->index = action->index*10 + (*p - '0');
+            p++;
+        }
+
+        if (*p != ':')
+            return -1;
+        p++;
+
+        if (byEntity)
+        {
+            action->index = entityIndex(action->index, action->isLight);
+            if (action->index < 0)
+                return -1;
+        }
+
+        if (action->isLight)
+        {
+            if (action->index >= lights.size())
+                return -1;
+
+            if (strncmp(p, "on", 2) == 0)
+            {
+                action->value = 1;
+                p += 2;
+            }
+            else if (strncmp(p, "off", 3) == 0)
+            {
+                action->value = 0;
+                p += 3;
+            }
+            else
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (action->index >= blinds.size() || *p < '0' || *p > '2')
+                return -1;
+
+            action->value = *p - '0';
+            p++;
+        }
+
+        count++;
+
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != ' ' && *p != '/')
+            return -1;
+    }
+
+    return count;
+}
+
+void runBatchActions(BatchAction *actions, int count)
+{
+    //
+    // Executes all (already validated) batch actions as a group
+    // RF telegrams for the lights are queued back to back (one group telegram for lights that share an address),
+    // blinds all move at the same time (devices are only locked while they are changed, not while the blinds are moving)
+    // Indices are checked again with the devices locked, a configuration replace may have shortened the lists
+    // since the actions were parsed (such actions are skipped). Moving blinds are remembered by pointer, only the
+    // ones still configured after the move are stopped (whoever removes a blind stops it).
+    //
+
+    int8_t lightTarget[kMAX_LIGHTS];
+    Blind *moving[kMAX_BATCH_ACTIONS];
+    int movingCount = 0;
+
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
+
+    for (int i = 0; i < lights.size(); i++)
+    {
+        lightTarget[i] = kLIGHT_KEEP;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (actions[i].isLight && actions[i].index < lights.size())
+        {
+            lightTarget[actions[i].index] = (actions[i].value)? 1 : 0;
+        }
+    }
+    Light::switchLights(lights.data(), lights.size(), lightTarget);
+
+    for (int i = 0; i < count && movingCount < kMAX_BATCH_ACTIONS; i++)
+    {
+        if (!actions[i].isLight && actions[i].index < blinds.size())
+        {
+            blinds[actions[i].index]->startMove(actions[i].value);
+            moving[movingCount++] = blinds[actions[i].index];
+        }
+    }
+
+    xSemaphoreGive(deviceMutex);
+
+    if (movingCount > 0)
+    {
+        vTaskDelay(kBlindMoveTime / portTICK_RATE_MS);
+
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
+        for (int i = 0; i < movingCount; i++)
+        {
+            for (int j = 0; j < blinds.size(); j++)
+            {
+                if (blinds[j] == moving[i])
+                    moving[i]->finishMove();
+            }
+        }
+        xSemaphoreGive(deviceMutex);
+    }
+}
+
+//
+// Configuration over HTTP (POST or PUT to /config or /api/config with a JSON body)
+// {"replace":false,
+//  "lights":[{"name":"Desk","type":"KakuSwitch","address":"A","unit":1}],
+//  "blinds":[{"name":"Left","channel":1,"min":1000,"mid":1500,"max":2000}],
+//  "buttons":[{"code":1234567,"event":"light_toggle","light":0}],
+//  "autoBlinds":{"open":"07:30","close":"21:00","openPosition":2,"closePosition":0,"openEnabled":true,"closeEnabled":true},
+//  "web":{"user":"user","pass":"pass"}}
+// Every part is optional. Lights, blinds and buttons are added to the existing ones unless replace is true.
+// Light types are the names of allLightTypes, address and unit limits depend on the type (lightAddressing).
+// Button light and blind indexes refer to the lists after this request. The whole body is checked first,
+// then applied and saved to flash once. Tokens are shared by both connections (used with deviceMutex taken).
+//
+#define kCONFIG_MAX_TOKENS 128
+JsonToken configTokens[kCONFIG_MAX_TOKENS];
+
+const char *kConfigButtonEvents[] = {"light_on", "light_off", "light_toggle", "blind_toggle", "sleep"};
+#define kCONFIG_BUTTON_EVENTS 5
+
+typedef struct
+{
+    const char *error;
+    int errorToken;
+    int lights;
+    int blinds;
+    int buttons;
+    int firstNewBlind;      // Blinds from this index on are added by the request
+} ConfigCheck;
+
+bool configError(ConfigCheck *check, int token, const char *error)
+{
+    check->error = error;
+    check->errorToken = token;
+    return false;
+}
+
+bool configKeysKnown(ConfigCheck *check, const char *json, int count, int object, const char *keys[], int keyCount)
+{
+    //
+    // Rejects members that are not in keys (most likely typing errors)
+    //
+
+    int member = object + 1;
+    for (int i = 0; i < configTokens[object].size / 2; i++)
+    {
+        bool known = false;
+        for (int j = 0; j < keyCount && !known; j++)
+        {
+            known = jsonEquals(json, &configTokens[member], keys[j]);
+        }
+
+        if (!known)
+            return configError(check, member, "unknown key");
+
+        member = jsonNext(configTokens, count, member + 1);
+    }
+
+    return true;
+}
+
+bool configName(ConfigCheck *check, const char *json, int token, int maxLength, bool path)
+{
+    //
+    // Names can only use the characters of the on-screen keyboard (no spaces in credentials). They are stored
+    // without unescaping and shown in pages and JSON as they are, so quotes, escapes and markup are not allowed.
+    //
+
+    if (token < 0 || configTokens[token].type != JSON_STRING)
+        return configError(check, token, "string expected");
+
+    int length = configTokens[token].end - configTokens[token].start;
+    if (length < 1 || length > maxLength)
+        return configError(check, token, "bad length");
+
+    for (int i = configTokens[token].start; i < configTokens[token].end; i++)
+    {
+        bool allowed = false;
+        for (int j = 0; j < kALPHABET_SIZE && !allowed; j++)
+        {
+            allowed = (json[i] == alphabet[j][0]);
+        }
+
+        if (!allowed || (path && json[i] == ' '))
+            return configError(check, token, "character not allowed");
+    }
+
+    return true;
+}
+
+bool configNumber(ConfigCheck *check, const char *json, int token, int32_t min, int32_t max, int32_t *value)
+{
+    if (token < 0)
+        return true;
+
+    if (!jsonInt(json, &configTokens[token], value) || *value < min || *value > max)
+        return configError(check, token, "number out of range");
+
+    return true;
+}
+
+int configOption(const char *json, int token, const char options[][11], int optionCount)
+{
+    //
+    // Index of the string value in a list of menu options or -1
+    //
+
+    for (int i = 0; i < optionCount; i++)
+    {
+        if (jsonEquals(json, &configTokens[token], options[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+bool configTime(ConfigCheck *check, const char *json, int token, uint8_t *hour, uint8_t *minute)
+{
+    //
+    // Reads "HH:MM"
+    //
+
+    const JsonToken *t = &configTokens[token];
+    const char *p = &json[t->start];
+
+    if (t->type != JSON_STRING || t->end - t->start != 5 || p[2] != ':' || !isdigit(p[0]) || !isdigit(p[1]) || !isdigit(p[3]) || !isdigit(p[4]))
+        return configError(check, token, "time expected (HH:MM)");
+
+    int h = (p[0] - '0')*10 + (p[1] - '0');
+    int m = (p[3] - '0')*10 + (p[4] - '0');
+    if (h > 23 || m > 59)
+        return configError(check, token, "time expected (HH:MM)");
+
+    *hour = h;
+    *minute = m;
+    return true;
+}
+
+bool checkConfigList(ConfigCheck *check, int count, int list, int *items)
+{
+    //
+    // Lists have to be arrays of objects
+    //
+
+    if (list < 0)
+        return true;
+
+    if (configTokens[list].type != JSON_ARRAY)
+        return configError(check, list, "array expected");
+
+    int item = list + 1;
+    for (int i = 0; i < configTokens[list].size; i++)
+    {
+        if (configTokens[item].type != JSON_OBJECT)
+            return configError(check, item, "object expected");
+
+        item = jsonNext(configTokens, count, item);
+    }
+
+    *items = configTokens[list].size;
+    return true;
+}
+
+bool checkConfig(ConfigCheck *check, const char *json, int count, bool apply)
+{
+    //
+    // Checks (apply false) or applies the configuration
+    // Applying is only done after a successful check, so it can not fail half way
+    // Strings are terminated in place while applying (the request is not used afterwards)
+    //
+
+    static const char *kRootKeys[] = {"replace", "lights", "blinds", "buttons", "autoBlinds", "web"};
+    static const char *kLightKeys[] = {"name", "type", "address", "unit"};
+    static const char *kBlindKeys[] = {"name", "channel", "min", "mid", "max"};
+    static const char *kButtonKeys[] = {"code", "event", "light", "blind"};
+    static const char *kAutoBlindKeys[] = {"open", "close", "openPosition", "closePosition", "openEnabled", "closeEnabled"};
+    static const char *kWebKeys[] = {"user", "pass"};
+
+    char *text = (char *)json;
+
+    if (configTokens[0].type != JSON_OBJECT)
+        return configError(check, 0, "object expected");
+
+    if (!configKeysKnown(check, json, count, 0, kRootKeys, 6))
+        return false;
+
+    bool replace = false;
+    int replaceToken = jsonFind(json, configTokens, count, 0, "replace");
+    if (replaceToken >= 0 && !jsonBool(json, &configTokens[replaceToken], &replace))
+        return configError(check, replaceToken, "true or false expected");
+
+    int lightList = jsonFind(json, configTokens, count, 0, "lights");
+    int blindList = jsonFind(json, configTokens, count, 0, "blinds");
+    int buttonList = jsonFind(json, configTokens, count, 0, "buttons");
+    int newLights = 0;
+    int newBlinds = 0;
+    int newButtons = 0;
+
+    if (!checkConfigList(check, count, lightList, &newLights) ||
+        !checkConfigList(check, count, blindList, &newBlinds) ||
+        !checkConfigList(check, count, buttonList, &newButtons))
+        return false;
+
+    check->lights = ((replace && lightList >= 0)? 0 : lights.size()) + newLights;
+    check->firstNewBlind = (replace && blindList >= 0)? 0 : blinds.size();
+    check->blinds = check->firstNewBlind + newBlinds;
+    check->buttons = ((replace && buttonList >= 0)? 0 : remoteButtons.size()) + newButtons;
+
+    if (check->lights > kMAX_LIGHTS)
+        return configError(check, lightList, "too many lights");
+    if (check->blinds > kMAX_BLINDS)
+        return configError(check, blindList, "too many blinds");
+    if (check->buttons > kMAX_BUTTONS)
+        return configError(check, buttonList, "too many buttons");
+
+    if (apply && replace)
+    {
+        // Buttons of removed devices stay (their entity IDs are unknown now, so they do nothing) unless buttons are replaced as well
+        if (lightList >= 0)
+        {
+            for (int i = 0; i < lights.size(); i++)
+            {
+                delete lights[i];
+            }
+            lights.clear();
+        }
+
+        if (blindList >= 0)
+        {
+            for (int i = 0; i < blinds.size(); i++)
+            {
+                // A batch may still be moving it, its output is not disabled by the batch any more
+                blinds[i]->finishMove();
+                delete blinds[i];
+            }
+            blinds.clear();
+        }
+
+        if (buttonList >= 0)
+        {
+            for (int i = 0; i < remoteButtons.size(); i++)
+            {
+                delete remoteButtons[i];
+            }
+            remoteButtons.clear();
+        }
+    }
+
+    int item = lightList + 1;
+    for (int i = 0; i < newLights; i++)
+    {
+        int name = jsonFind(json, configTokens, count, item, "name");
+        int type = jsonFind(json, configTokens, count, item, "type");
+        int address = jsonFind(json, configTokens, count, item, "address");
+        int32_t unit = 1;
+        int typeIndex = (type >= 0)? configOption(json, type, allLightTypes, kAllLightTypes) : RF_KAKU;
+        int addressIndex = (address >= 0)? configOption(json, address, lightAddresses1, kLightAddresses1) : 0;
+
+        if (!configKeysKnown(check, json, count, item, kLightKeys, 4) || !configName(check, json, name, 11, false))
+            return false;
+
+        if (typeIndex < 0)
+            return configError(check, type, "unknown light type");
+
+        // Limits depend on the type (Elro and Action units are system codes 0-31)
+        const LightAddressing *limits = &lightAddressing[typeIndex];
+
+        if (!configNumber(check, json, jsonFind(json, configTokens, count, item, "unit"), limits->minUnit, limits->maxUnit, &unit))
+            return false;
+        if (addressIndex < 0)
+            return configError(check, address, "address A-P expected");
+        if ('A' + addressIndex > limits->lastAddress)
+            return configError(check, address, "address out of range for the light type");
+
+        if (apply)
+        {
+            text[configTokens[name].end] = '\0';
+
+            Light *light = new Light();
+            light->id = EntityTable::allocate();
+            light->setName(&text[configTokens[name].start]);
+            light->setType((LightType)typeIndex, lightAddresses1[addressIndex][0], unit);
+            lights.push_back(light);
+        }
+
+        item = jsonNext(configTokens, count, item);
+    }
+
+    item = blindList + 1;
+    for (int i = 0; i < newBlinds; i++)
+    {
+        int name = jsonFind(json, configTokens, count, item, "name");
+        int32_t channel = 1;
+        int32_t bounds[3] = {1000, 1500, 2000};
+
+        if (!configKeysKnown(check, json, count, item, kBlindKeys, 5) || !configName(check, json, name, 11, false) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, item, "channel"), 1, kAllBlindChannels, &channel) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, item, "min"), 1000, 2000, &bounds[0]) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, item, "mid"), 1000, 2000, &bounds[1]) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, item, "max"), 1000, 2000, &bounds[2]))
+            return false;
+
+        if (bounds[0] > bounds[1] || bounds[1] > bounds[2])
+            return configError(check, item, "min <= mid <= max expected");
+
+        if (apply)
+        {
+            text[configTokens[name].end] = '\0';
+
+            Blind *blind = new Blind();
+            blind->id = EntityTable::allocate();
+            blind->setType(BLIND_LOCAL);
+            blind->setChannel((BlindChannel)(channel - 1));
+            blind->btCode = 0;
+            blind->setName(&text[configTokens[name].start]);
+            blind->setBounds(bounds[0], bounds[1], bounds[2]);
+            blinds.push_back(blind);
+        }
+
+        item = jsonNext(configTokens, count, item);
+    }
+
+    item = buttonList + 1;
+    for (int i = 0; i < newButtons; i++)
+    {
+        int code = jsonFind(json, configTokens, count, item, "code");
+        int event = jsonFind(json, configTokens, count, item, "event");
+        uint32_t buttonCode;
+
+        if (!configKeysKnown(check, json, count, item, kButtonKeys, 4))
+            return false;
+        if (code < 0 || !jsonUint(json, &configTokens[code], &buttonCode) || buttonCode == 0)
+            return configError(check, (code >= 0)? code : item, "remote code expected");
+
+        int eventType = -1;
+        for (int j = 0; event >= 0 && j < kCONFIG_BUTTON_EVENTS; j++)
+        {
+            if (jsonEquals(json, &configTokens[event], kConfigButtonEvents[j]))
+                eventType = j;
+        }
+        if (eventType < 0)
+            return configError(check, (event >= 0)? event : item, "unknown event");
+
+        // Sleep button has no device, the others need the index of one
+        bool blindEvent = (eventType == TYPE_BLIND_TOGGLE);
+        int target = jsonFind(json, configTokens, count, item, (blindEvent)? "blind" : "light");
+        int32_t index = 0;
+        if (eventType != TYPE_ACTION && (target < 0 || !configNumber(check, json, target, 0, ((blindEvent)? check->blinds : check->lights) - 1, &index)))
+            return configError(check, (target >= 0)? target : item, (blindEvent)? "blind index expected" : "light index expected");
+
+        if (apply)
+        {
+            RemoteButton *button = new RemoteButton();
+            button->remoteButton = buttonCode;
+            button->eventType = (RemoteEventType)eventType;
+            button->eventId = (eventType == TYPE_ACTION)? 0 : (blindEvent)? blinds[index]->id : lights[index]->id;
+            remoteButtons.push_back(button);
+        }
+
+        item = jsonNext(configTokens, count, item);
+    }
+
+    int autoBlinds = jsonFind(json, configTokens, count, 0, "autoBlinds");
+    if (autoBlinds >= 0)
+    {
+        if (configTokens[autoBlinds].type != JSON_OBJECT)
+            return configError(check, autoBlinds, "object expected");
+        if (!configKeysKnown(check, json, count, autoBlinds, kAutoBlindKeys, 6))
+            return false;
+
+        uint8_t openHour = automaticBlindOpenHour;
+        uint8_t openMinute = automaticBlindOpenMinute;
+        uint8_t closeHour = automaticBlindCloseHour;
+        uint8_t closeMinute = automaticBlindCloseMinute;
+        int32_t openPosition = automaticBlindOpenPosition;
+        int32_t closePosition = automaticBlindClosePosition;
+        bool openEnabled = autoOpenBlindEnabled;
+        bool closeEnabled = autoCloseBlindEnabled;
+
+        int open = jsonFind(json, configTokens, count, autoBlinds, "open");
+        int close = jsonFind(json, configTokens, count, autoBlinds, "close");
+        int openOn = jsonFind(json, configTokens, count, autoBlinds, "openEnabled");
+        int closeOn = jsonFind(json, configTokens, count, autoBlinds, "closeEnabled");
+
+        if ((open >= 0 && !configTime(check, json, open, &openHour, &openMinute)) ||
+            (close >= 0 && !configTime(check, json, close, &closeHour, &closeMinute)) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, autoBlinds, "openPosition"), 0, kAutoBLindPositions - 1, &openPosition) ||
+            !configNumber(check, json, jsonFind(json, configTokens, count, autoBlinds, "closePosition"), 0, kAutoBLindPositions - 1, &closePosition))
+            return false;
+
+        if (openOn >= 0 && !jsonBool(json, &configTokens[openOn], &openEnabled))
+            return configError(check, openOn, "true or false expected");
+        if (closeOn >= 0 && !jsonBool(json, &configTokens[closeOn], &closeEnabled))
+            return configError(check, closeOn, "true or false expected");
+
+        if (apply)
+        {
+            automaticBlindOpenHour = openHour;
+            automaticBlindOpenMinute = openMinute;
+            automaticBlindCloseHour = closeHour;
+            automaticBlindCloseMinute = closeMinute;
+            automaticBlindOpenPosition = openPosition;
+            automaticBlindClosePosition = closePosition;
+            autoOpenBlindEnabled = openEnabled;
+            autoCloseBlindEnabled = closeEnabled;
+        }
+    }
+
+    int web = jsonFind(json, configTokens, count, 0, "web");
+    if (web >= 0)
+    {
+        int user = jsonFind(json, configTokens, count, web, "user");
+        int pass = jsonFind(json, configTokens, count, web, "pass");
+
+        if (configTokens[web].type != JSON_OBJECT)
+            return configError(check, web, "object expected");
+        if (!configKeysKnown(check, json, count, web, kWebKeys, 2) ||
+            (user >= 0 && !configName(check, json, user, 14, true)) ||
+            (pass >= 0 && !configName(check, json, pass, 14, true)))
+            return false;
+
+        if (apply && user >= 0)
+        {
+            text[configTokens[user].end] = '\0';
+            strcpy(web_user, &text[configTokens[user].start]);
+        }
+
+        if (apply && pass >= 0)
+        {
+            text[configTokens[pass].end] = '\0';
+            strcpy(web_pass, &text[configTokens[pass].start]);
+        }
+    }
+
+    return true;
+}
+
+void handleConfigRequest(WebConnection *conn, bool keepAlive, const char *contentType, char *body, int length)
+{
+    //
+    // Checks and applies a configuration request, new blinds are moved to their mid position after the response
+    //
+
+    char response[96];
+    ConfigCheck check = {NULL, -1, 0, 0, 0, 0};
+    int errorOffset = 0;
+
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
+
+    int count = jsonParse(body, length, configTokens, kCONFIG_MAX_TOKENS, &errorOffset);
+
+    if (count < 0)
+    {
+        check.error = (count == JSON_ERROR_NO_TOKENS)? "too many values" : (count == JSON_ERROR_PARTIAL)? "incomplete" : "invalid JSON";
+    }
+    else if (checkConfig(&check, body, count, false))
+    {
+        checkConfig(&check, body, count, true);
+        save_data_to_flash();
+
+        if (jsonFind(body, configTokens, count, 0, "autoBlinds") >= 0)
+            setAutoBlinds();
+    }
+    else
+    {
+        errorOffset = (check.errorToken >= 0)? configTokens[check.errorToken].start : 0;
+    }
+
+    xSemaphoreGive(deviceMutex);
+
+    if (check.error != NULL)
+        sprintf(response, "{\"error\":\"%s\",\"at\":%d}", check.error, errorOffset);
+    else
+        sprintf(response, "{\"lights\":%d,\"blinds\":%d,\"buttons\":%d}", check.lights, check.blinds, check.buttons);
+
+    sendHttpHead(conn, (check.error != NULL)? kHTTP_BAD_REQUEST_HEAD : kHTTP_OK_HEAD, keepAlive, 0, strlen(response), contentType);
+    sendWifiData(conn->usart, response, strlen(response));
+
+    if (check.error == NULL && check.blinds > check.firstNewBlind)
+    {
+        BatchAction actions[kMAX_BLINDS];
+        for (int i = check.firstNewBlind; i < check.blinds; i++)
+        {
+            actions[i - check.firstNewBlind].isLight = false;
+            actions[i - check.firstNewBlind].index = i;
+            actions[i - check.firstNewBlind].value = kBlindStateMid;
+        }
+        runBatchActions(actions, check.blinds - check.firstNewBlind);
+    }
+}
+
+bool startWebSocket(WebConnection *conn, const char *request, int headerLength)
+{
+    //
+    // Answers a WebSocket upgrade request (RFC 6455 handshake)
+    // Returns false (and sends 400) if the request is not a valid upgrade
+    //
+
+    int upgrade = findHttpHeader(request, headerLength, "Upgrade");
+    int key = findHttpHeader(request, headerLength, "Sec-WebSocket-Key");
+
+    bool valid = (upgrade >= 0 && key >= 0 && key + kWEBSOCKET_KEY_LENGTH < headerLength && request[key + kWEBSOCKET_KEY_LENGTH] == '\r');
+    for (int i = 0; valid && i < 9; i++)
+    {
+        valid = (tolower(request[upgrade + i]) == "websocket"[i]);
+    }
+
+    if (!valid)
+    {
+        sendHttpHead(conn, kHTTP_BAD_REQUEST_HEAD, false, 0, 0, kHTTP_HEAD_PART2_EMPTY);
+        return false;
+    }
+
+    char accept[kWEBSOCKET_ACCEPT_LENGTH + 1];
+    WebSocket::acceptKey(&request[key], accept);
+
+    sprintf(conn->headBuff, kHTTP_WEBSOCKET_HEAD, accept);
+    sendWifiData(conn->usart, conn->headBuff, strlen(conn->headBuff));
+
+    // Current state is pushed right away
+    conn->websocket = true;
+    conn->pushedVersion = 0;
+
+    return true;
+}
+
+void sendWebSocketFrame(WebConnection *conn, uint8_t opcode, const char *data, int length)
+{
+    //
+    // Sends one unfragmented frame
+    //
+
+    uint8_t head[kWEBSOCKET_MAX_HEAD];
+    int headLength = WebSocket::frameHeader(head, opcode, length);
+
+    sendWifiData(conn->usart, (const char *)head, headLength);
+    sendWifiData(conn->usart, data, length);
+}
+
+void closeWebSocket(WebConnection *conn, int code)
+{
+    //
+    // Sends a close frame and goes back to HTTP (the module keeps the TCP connection until the client closes it)
+    //
+
+    char payload[2] = {(char)(code >> 8), (char)code};
+    sendWebSocketFrame(conn, WS_OPCODE_CLOSE, payload, 2);
+
+    conn->websocket = false;
+}
+
+void pushWebSocketState(TemplateContext *ctx)
+{
+    //
+    // Sends the API status (same JSON as /api) as a text frame
+    //
+
+    WebPageState *state = (WebPageState *)ctx->userData;
+    state->batchCount = -2;
+    prepareWebPageState(state, ctx);
+
+    uint8_t head[kWEBSOCKET_MAX_HEAD];
+    int headLength = WebSocket::frameHeader(head, WS_OPCODE_TEXT, templateLength(kApiStatusTemplate, ctx));
+
+    sendWifiData(state->connection->usart, (const char *)head, headLength);
+    templateRender(kApiStatusTemplate, ctx, writeWebTemplate);
+}
+
+void serveWebSocket(WebConnection *conn, TemplateContext *ctx, BatchAction *actions)
+{
+    //
+    // Handles received frames and pushes the state when it changed
+    // Text and binary messages carry batch actions (lght:<i>:<on|off>,bld:<i>:<0|1|2>, or light:/blind: with the entity ID), each one is answered
+    // with its result, state changes follow as separate messages
+    //
+
+    while (conn->websocket && *conn->buffIndicator > 0)
+    {
+        // Reserved bits set, not a frame but the start of a request from a new client (the previous one disconnected)
+        if ((conn->buff[0] & 0x70) != 0)
+        {
+            conn->websocket = false;
+            return;
+        }
+
+        WebSocketFrame frame;
+        int length = WebSocket::parseFrame((uint8_t *)conn->buff, *conn->buffIndicator, &frame);
+
+        if (length == 0)
+        {
+            if (*conn->buffIndicator < conn->buffSize)
+                break;
+
+            // Frame will never fit into the buffer
+            closeWebSocket(conn, WS_CLOSE_TOO_BIG);
+            consumeWebConnectionBuffer(conn, *conn->buffIndicator);
+            return;
+        }
+
+        if (length < 0 || frame.opcode == WS_OPCODE_CONTINUATION || !frame.final)
+        {
+            closeWebSocket(conn, (length < 0)? WS_CLOSE_PROTOCOL_ERROR : WS_CLOSE_UNSUPPORTED);
+            consumeWebConnectionBuffer(conn, *conn->buffIndicator);
+            return;
         }
 
-        char buff = '\0';
-        token = -1;
-        token_pointer = 0;
-        for (int i = 4; i < 100; i++)
+        Metrics::add(METRIC_HTTP_BYTES_IN, length);
+
+        switch (frame.opcode)
         {
-            buff = eth1_buff[i];
-            if (buff == ' ')
+            case WS_OPCODE_TEXT:
+            case WS_OPCODE_BINARY:
             {
-                if (token_pointer > 0)
+                // Header buffer is free while the message is handled, payload is copied there to terminate it
+                int count = -1;
+                if (frame.payloadLength < (int)sizeof(conn->headBuff))
+                {
+                    memcpy(conn->headBuff, frame.payload, frame.payloadLength);
+                    conn->headBuff[frame.payloadLength] = '\0';
+                    count = parseBatchActions(conn->headBuff, actions);
+                }
+
+                if (count > 0)
                 {
-                    token++;
+                    runBatchActions(actions, count);
                 }
+
+                sprintf(conn->headBuff, "{\"batch\":{\"ok\":%s,\"actions\":%d}}", (count >= 0)? "true" : "false", (count >= 0)? count : 0);
+                sendWebSocketFrame(conn, WS_OPCODE_TEXT, conn->headBuff, strlen(conn->headBuff));
                 break;
             }
+            case WS_OPCODE_PING:
+                sendWebSocketFrame(conn, WS_OPCODE_PONG, (const char *)frame.payload, frame.payloadLength);
+                break;
+            case WS_OPCODE_CLOSE:
+                closeWebSocket(conn, (frame.payloadLength >= 2)? (frame.payload[0] << 8) | frame.payload[1] : WS_CLOSE_NORMAL);
+                break;
+            case WS_OPCODE_PONG:
+                break;
+            default:
+                closeWebSocket(conn, WS_CLOSE_UNSUPPORTED);
+                consumeWebConnectionBuffer(conn, *conn->buffIndicator);
+                return;
+        }
+
+        consumeWebConnectionBuffer(conn, length);
+    }
+
+    if (conn->websocket && conn->pushedVersion != StateVersion::get())
+    {
+        conn->pushedVersion = StateVersion::get();
+        pushWebSocketState(ctx);
+    }
+}
+
+//
+// Request routes, found by the keyword hash (see Router.h)
+// api and house are prefixes, the route that follows them is looked up again
+//
+typedef enum
+{
+    WEB_ROUTE_NONE,
+    WEB_ROUTE_STATUS,
+    WEB_ROUTE_API,
+    WEB_ROUTE_HOUSE,
+    WEB_ROUTE_LIGHT,
+    WEB_ROUTE_BLIND,
+    WEB_ROUTE_LIGHT_ENTITY,
+    WEB_ROUTE_BLIND_ENTITY,
+    WEB_ROUTE_BATCH,
+    WEB_ROUTE_METRICS,
+    WEB_ROUTE_WEBSOCKET,
+    WEB_ROUTE_CONFIG,
+    WEB_ROUTE_RF_TRACE
+} WebRouteHandler;
+
+#define kWEB_ROUTES 11
+
+constexpr Route kWebRoutes[kWEB_ROUTES] =
+{
+    {"api", ROUTE_METHOD_ANY, {ROUTE_PARAM_NONE}, WEB_ROUTE_API, NULL},
+    {"house", ROUTE_METHOD_ANY, {ROUTE_PARAM_INT}, WEB_ROUTE_HOUSE, NULL},
+    {"lght", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_INT, ROUTE_PARAM_WORD}, WEB_ROUTE_LIGHT, NULL},
+    {"bld", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_INT, ROUTE_PARAM_INT}, WEB_ROUTE_BLIND, NULL},
+    {"light", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_INT, ROUTE_PARAM_WORD}, WEB_ROUTE_LIGHT_ENTITY, NULL},
+    {"blind", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_INT, ROUTE_PARAM_INT}, WEB_ROUTE_BLIND_ENTITY, NULL},
+    {"batch", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_REST}, WEB_ROUTE_BATCH, NULL},
+    {"metrics", ROUTE_METHOD_GET, {ROUTE_PARAM_NONE}, WEB_ROUTE_METRICS, kHTTP_HEAD_PART2_METRICS},
+    {"ws", ROUTE_METHOD_GET, {ROUTE_PARAM_NONE}, WEB_ROUTE_WEBSOCKET, NULL},
+    {"config", ROUTE_METHOD_POST | ROUTE_METHOD_PUT, {ROUTE_PARAM_NONE}, WEB_ROUTE_CONFIG, kHTTP_HEAD_PART2_API},
+    {"rftrace", ROUTE_METHOD_GET | ROUTE_METHOD_POST, {ROUTE_PARAM_NONE}, WEB_ROUTE_RF_TRACE, kHTTP_HEAD_PART2_TEXT}
+};
+
+constexpr RouteTable kWebRouteTable = ROUTE_TABLE(kWebRoutes, kWEB_ROUTES);
+static_assert(kWebRouteTable.shift >= 0, "Route keywords can not get a slot each, change a keyword or kROUTE_SLOT_BITS");
+
+void webServerTask(void *pvParameters)
+{
+    //
+    // The actual web server task
+    // One instance runs for each wifi connection (passed as the task parameter)
+    //
+
+    WebConnection *conn = (WebConnection *)pvParameters;
 
-            if (buff == '/')
+    char link_prefix[2 * kROUTE_SEGMENT_LENGTH + 2];
+    char session_token[kSESSION_TOKEN_LENGTH + 1];
+
+    BatchAction batch_actions[kMAX_BATCH_ACTIONS];
+    int batch_count = 0;
+
+    WebPageState page_state;
+    TemplateContext page_ctx;
+    page_ctx.resolve = resolveWebSlot;
+    page_ctx.userData = &page_state;
+    page_state.connection = conn;
+    page_state.linkPrefix = link_prefix;
+    page_state.cache = NULL;
+
+    while(1)
+    {
+        if (conn->websocket && !conn->paused && !*conn->busy)
+        {
+            serveWebSocket(conn, &page_ctx, batch_actions);
+
+            if (conn->websocket)
             {
-                token++;
-                token_pointer = 0;
+                vTaskDelay(kWEBSOCKET_POLL_TIME / portTICK_RATE_MS);
                 continue;
             }
+        }
+
+        if (conn->paused || *conn->busy || *conn->buffIndicator < 5)
+        {
+            // Woken by the receive interrupt, the timeout only notices a connection that is no longer paused
+            xSemaphoreTake(conn->received, 200 / portTICK_RATE_MS);
+            continue;
+        }
+
+        if (conn->buff[0] < 'A' || conn->buff[0] > 'Z')
+        {
+            // Not a start of a request (leftovers of a broken request or module output), drop the line
+            int line_end = 0;
+            while (line_end < *conn->buffIndicator && conn->buff[line_end] != '\n')
+            {
+                line_end++;
+            }
+            consumeWebConnectionBuffer(conn, line_end + 1);
+            continue;
+        }
+
+        int header_length = 0;
+        int needed_length = 0;
+        int request_length = getHttpRequestLength((char *)conn->buff, *conn->buffIndicator, conn->buffSize, &header_length, &needed_length);
+        if (request_length < 0)
+        {
+            // Body length is broken or too large, the rest of the buffer can not be trusted
+            sendHttpHead(conn, (request_length == kHTTP_REQUEST_TOO_LARGE)? kHTTP_TOO_LARGE_HEAD : kHTTP_BAD_REQUEST_HEAD,
+                         false, 0, 0, kHTTP_HEAD_PART2_EMPTY);
+            consumeWebConnectionBuffer(conn, *conn->buffIndicator);
+            continue;
+        }
+        if (request_length == 0)
+        {
+            if (*conn->buffIndicator >= conn->buffSize)
+            {
+                // Request will never fit into the buffer
+                consumeWebConnectionBuffer(conn, *conn->buffIndicator);
+            }
+
+            // Body does not have to end with a line end, the interrupt also wakes the task once it is all in
+            conn->wakeLength = needed_length;
+            xSemaphoreTake(conn->received, 200 / portTICK_RATE_MS);
+            continue;
+        }
+
+        conn->wakeLength = 0;
+
+        bool keep_alive = isHttpKeepAlive((char *)conn->buff, header_length);
+
+        RoutePath *path = &conn->path;
+        routeSplit((char *)conn->buff, header_length, path);
+
+        //
+        // Authentication
+        // Session token (cookie or X-Session header) or legacy /user/pass/ path prefix
+        // route is the first path segment after the credentials
+        //
+        int error = 0;
+        int route = 0;
+        link_prefix[0] = '\0';
+
+        int login = routeIs(path, 0, routeHash("login"))? 0 : (routeIs(path, 0, routeHash("api")) && routeIs(path, 1, routeHash("login")))? 1 : -1;
 
-            if (token == -1 || token > 5 || token_pointer >= 18)
+        if (login >= 0)
+        {
+            if (path->count > login + 2 && strcmp(web_user, path->text[login + 1]) == 0 && strcmp(web_pass, path->text[login + 2]) == 0)
+            {
+                WebSessions::create(session_token);
+                sendWebLogin(conn, keep_alive, login == 1, session_token);
+            }
+            else
             {
-                break;
+                error = 2;
             }
-
-            tokens[token][token_pointer] = buff;
-            tokens[token][token_pointer + 1] = '\0';
-            token_pointer++;
         }
-
-        //taskENTER_CRITICAL();
-        eth1_busy = 1;
-        USART_ITConfig(USART1, USART_IT_RXNE, DISABLE);
-
-
-        int error = 0;
-        if (!token)
+        else if (path->count >= 2 && strcmp(web_user, path->text[0]) == 0 && strcmp(web_pass, path->text[1]) == 0)
+        {
+            // Legacy authentication, links on the page have to carry the credentials as well
+            route = 2;
+            sprintf(link_prefix, "/%s/%s", path->text[0], path->text[1]);
+        }
+        else if (!(getSessionToken((char *)conn->buff, header_length, session_token) && WebSessions::validate(session_token)))
         {
-            error = 1;
+            error = (path->count <= 0)? 1 : 2;
         }
-        else if (!(strcmp(web_user, tokens[0]) == 0 && strcmp(web_pass, tokens[1]) == 0))
+        else if (routeIs(path, 0, routeHash("logout")))
         {
-            error = 2;
+            WebSessions::remove(session_token);
+            sendHttpHead(conn, kHTTP_REDIRECT_HEAD, keep_alive, 0, 0, kHTTP_HEAD_PART2_EMPTY, kHTTP_LOGOUT_HEAD);
+            login = 0;
         }
 
         if (error)
         {
-            printWebErrorResponse((char *)eth1_buff, eth_send_buff, error);
-            sendWifiUsart1((char *)eth1_buff);
-            sendWifiUsart1((char *)eth_send_buff);
+            sendWebTemplate((error == 1)? kHTTP_OK_HEAD : kHTTP_AUTH_HEAD, keep_alive, kHTTP_HEAD_PART2, (error == 1)? kWebLoginTemplate : kWebAuthErrorTemplate, &page_ctx);
         }
-        else
+        else if (login < 0)
         {
-            strcpy(user_pass, tokens[0]);
-            strcat(user_pass, "/");
-            strcat(user_pass, tokens[1]);
-
+            //
+            // Prefixes select the client and the room: /api (JSON instead of the web page) and
+            // /house or /house/<room>/<action> (whole house API, room 0 is this unit, others are forwarded)
+            // Paths without a route get the status
+            //
             bool webClient = true;
-            if (strcmp(tokens[2], "api") == 0)
+            int house_room = -1;
+            RouteMatch match;
+            bool found = routeFind(&kWebRouteTable, path, route, &match);
+
+            while (found && (match.route->handler == WEB_ROUTE_API || match.route->handler == WEB_ROUTE_HOUSE))
             {
-                // User wants to use API to control the room
-                // Do not show webpage, use JSON response
                 webClient = false;
+                route++;
+
+                if (match.route->handler == WEB_ROUTE_HOUSE)
+                {
+                    house_room = (match.param[0] > 0)? match.param[0] : 0;
+                    route++;
+
+                    if (house_room > 0 && route < kROUTE_MAX_SEGMENTS && path->start[route] >= 0)
+                    {
+                        Aggregator::forward(house_room, (char *)&conn->buff[path->start[route]]);
+                    }
+                }
+
+                found = routeFind(&kWebRouteTable, path, route, &match);
             }
 
-            if (strcmp(tokens[(webClient)? 2 : 3], "lght") == 0)
+            bool local = (house_room <= 0);
+            int handler = (found)? (int)match.route->handler : (int)WEB_ROUTE_STATUS;
+            const char *content_type = (found && match.route->contentType != NULL)? match.route->contentType : (webClient)? kHTTP_HEAD_PART2 : kHTTP_HEAD_PART2_API;
+
+            if (house_room >= 0 && (handler == WEB_ROUTE_METRICS || handler == WEB_ROUTE_WEBSOCKET || handler == WEB_ROUTE_CONFIG || handler == WEB_ROUTE_RF_TRACE))
             {
-                int index = atoi(tokens[(webClient)? 3 : 4]);
+                // Only the house status is served for other rooms
+                handler = WEB_ROUTE_STATUS;
+            }
 
-                if (index >= 0 && index < lights.size())
+            if (found && !match.methodAllowed)
+            {
+                sendMethodNotAllowed(conn, keep_alive, match.route->methods);
+            }
+            else if (handler == WEB_ROUTE_METRICS)
+            {
+                sendMetrics(conn, keep_alive, content_type);
+            }
+            else if (handler == WEB_ROUTE_WEBSOCKET)
+            {
+                startWebSocket(conn, (char *)conn->buff, header_length);
+            }
+            else if (handler == WEB_ROUTE_CONFIG)
+            {
+                handleConfigRequest(conn, keep_alive, content_type, (char *)&conn->buff[header_length], request_length - header_length);
+            }
+            else if (handler == WEB_ROUTE_RF_TRACE)
+            {
+                sendRfTrace(conn, keep_alive, content_type, path->method == ROUTE_METHOD_POST);
+            }
+            else
+            {
+                // lght and bld address the device by list index, light and blind by entity ID
+                if (local && (handler == WEB_ROUTE_LIGHT || handler == WEB_ROUTE_LIGHT_ENTITY))
                 {
-                    bool turnOn = (strcmp(tokens[(webClient)? 4 : 5], "on") == 0)?true:false;
-                    lights[index]->onOff(turnOn);
+                    int index = (handler == WEB_ROUTE_LIGHT)? match.param[0] : entityIndex(match.param[0], true);
+
+                    if (index >= 0 && index < lights.size())
+                    {
+                        bool turnOn = (match.param[1] == (int32_t)routeHash("on"));
+                        BatchAction action = {true, index, turnOn};
+                        runBatchActions(&action, 1);
+                    }
                 }
-            }
 
-            if (strcmp(tokens[(webClient)? 2 : 3], "bld") == 0)
-            {
-                int index = atoi(tokens[(webClient)? 3 : 4]);
+                if (local && (handler == WEB_ROUTE_BLIND || handler == WEB_ROUTE_BLIND_ENTITY))
+                {
+                    int index = (handler == WEB_ROUTE_BLIND)? match.param[0] : entityIndex(match.param[0], false);
+
+                    if (index >= 0 && index < blinds.size())
+                    {
+                        int newPos = match.param[1];
+                        if (newPos >= 0 && newPos <= 2)
+                        {
+                            BatchAction action = {false, index, newPos};
+                            runBatchActions(&action, 1);
+                        }
+                    }
+                }
 
-                if (index >= 0 && index < blinds.size())
+                batch_count = -2;
+                if (local && handler == WEB_ROUTE_BATCH)
                 {
-                    int newPos = atoi(tokens[(webClient)? 4 : 5]);
-                    if (newPos >= 0 && newPos <= 2)
+                    // Action list is read straight from the request as it can be longer than a single segment
+                    batch_count = (match.param[0] >= 0)? parseBatchActions((char *)&conn->buff[match.param[0]], batch_actions) : -1;
+
+                    if (batch_count > 0)
                     {
-                        blinds[index]->toggleState(newPos);
+                        runBatchActions(batch_actions, batch_count);
                     }
                 }
-            }
 
-            clearWifiUsart1Buffer();
-            clearEthSendBuffer();
+                page_state.batchCount = batch_count;
 
-            if (webClient)
-            {
-                printWebPageStart(eth_send_buff);
-                strcat((char *)eth_send_buff, "<div class='left_top' style='border-right: solid #9BCCF5 1px; border-bottom: solid #9BCCF5 1px; '><div style='padding: 10px; float: right;'><div style='text-align:right;' class='elements'>");
+                const TemplateOp *page = (webClient)? kWebIndexTemplate : kApiStatusTemplate;
+                bool cbor = !webClient && acceptsCbor((char *)conn->buff, header_length);
 
-                for (int i = 0; i < lights.size(); i++)
+                if (house_room >= 0)
                 {
-                    //light_off'>&nbsp;</div>&nbsp;&nbsp;<button>On</button>&nbsp;<button>Off</button><br />
-                    sprintf(web_buff, "%d", i);
-                    strcat((char *)eth_send_buff, lights[i]->getName());
-                    strcat((char *)eth_send_buff, ":&nbsp;&nbsp;<div class='");
-                    strcat((char *)eth_send_buff, (lights[i]->isOn())?"light_on":"light_off");
-                    strcat((char *)eth_send_buff, "'>&nbsp;</div>&nbsp;&nbsp;<button onclick=\"location.href = '/");
-                    strcat((char *)eth_send_buff, user_pass);
-                    strcat((char *)eth_send_buff, "/lght/");
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "/on';\" >On</button>");
-                    strcat((char *)eth_send_buff, "&nbsp;<button onclick=\"location.href = '/");
-                    strcat((char *)eth_send_buff, user_pass);
-                    strcat((char *)eth_send_buff, "/lght/");
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "/off';\" >Off</button>");
-                    strcat((char *)eth_send_buff, "<br />");
+                    if (batch_count == -2 && clientHasVersion((char *)conn->buff, header_length, StateVersion::get()))
+                        sendWebNotModified(conn, keep_alive, StateVersion::get());
+                    else
+                        sendHouseStatus(keep_alive, &page_ctx);
                 }
-                strcat((char *)eth_send_buff, "</div></div><h1 style='position: relative; bottom:-235px; left: 10px; '>Lights</h1></div><div class='left_top' style='border-left: solid #9BCCF5 1px; border-bottom: solid #9BCCF5 1px;'><h1 style='position: relative; bottom:-235px; float: right; right: 10px;'>Blinds</h1><div style='padding: 10px'><div style='text-align:left;' class='elements'>");
-                //Left:&nbsp;&nbsp;<progress value='10' max='100'></progress>&nbsp;&nbsp;<button>Min</button>&nbsp;<button>Mid</button>&nbsp;<button>Max</button><br />
-                for (int i = 0; i < blinds.size(); i++)
+                else if (batch_count != -2)
                 {
-                    sprintf(web_buff, "%d", i);
-                    strcat((char *)eth_send_buff, "<progress value='");
-                    strcat((char *)eth_send_buff, (blinds[i]->getState() == 0)? "1": (blinds[i]->getState() == 1)? "50" : "100");
-                    strcat((char *)eth_send_buff, "' max='100'></progress>&nbsp;&nbsp;<button onclick=\"location.href = '/");
-                    strcat((char *)eth_send_buff, user_pass);
-                    strcat((char *)eth_send_buff, "/bld/");
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "/0';\" >&lt;</button>");
-                    strcat((char *)eth_send_buff, "&nbsp;<button onclick=\"location.href = '/");
-                    strcat((char *)eth_send_buff, user_pass);
-                    strcat((char *)eth_send_buff, "/bld/");
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "/1';\" >-</button>");
-                    strcat((char *)eth_send_buff, "&nbsp;<button onclick=\"location.href = '/");
-                    strcat((char *)eth_send_buff, user_pass);
-                    strcat((char *)eth_send_buff, "/bld/");
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "/2';\" >&gt;</button>&nbsp;&nbsp;");
-                    strcat((char *)eth_send_buff, blinds[i]->getName());
-                    strcat((char *)eth_send_buff, "<br />");
+                    // Batch result is unique to this request, do not cache it
+                    if (cbor)
+                    {
+                        sendApiCbor(keep_alive, 0, &page_ctx);
+                    }
+                    else
+                    {
+                        prepareWebPageState(&page_state, &page_ctx);
+                        sendWebTemplate(kHTTP_OK_HEAD, keep_alive, content_type, page, &page_ctx);
+                    }
+                }
+                else if (clientHasVersion((char *)conn->buff, header_length, StateVersion::get()))
+                {
+                    sendWebNotModified(conn, keep_alive, StateVersion::get());
+                }
+                else if (cbor)
+                {
+                    // Small enough to be encoded on every request, nothing to cache
+                    sendApiCbor(keep_alive, StateVersion::get(), &page_ctx);
                 }
+                else
+                {
+                    sendWebCached((webClient)? WEB_CACHE_HTML : WEB_CACHE_JSON, keep_alive, content_type, page, &page_ctx);
+                }
+            }
+        }
 
-                strcat((char *)eth_send_buff, "</div></div></div><div class='left_top' style='border-right: solid #9BCCF5 1px; border-top: solid #9BCCF5 1px;'><div style='padding: 10px; float: left;'><h1>Info</h1></div><div style='text-align:right; margin-right:50px;' class='elements'>Temperature: ");
-                float temperature = tempSensor.getTemp();
-                sprintf((char *)web_buff, "%d", (int)temperature);
-                strcat((char *)eth_send_buff, web_buff);
-                strcat((char *)eth_send_buff, "C<br />");
-                //strcat((char *)eth_send_buff, "C<br />Outside: 34C<br />");
+        Metrics::add(METRIC_HTTP_REQUESTS);
+        Metrics::add(METRIC_HTTP_BYTES_IN, request_length);
 
-                RTC_TimeTypeDef RTC_TimeStruct;
-                RTC_GetTime(RTC_Format_BIN, &RTC_TimeStruct);
-                sprintf(web_buff,"%02d:%02d:%02d", RTC_TimeStruct.RTC_Hours, RTC_TimeStruct.RTC_Minutes, RTC_TimeStruct.RTC_Seconds);
-                strcat((char *)eth_send_buff, web_buff);
-                strcat((char *)eth_send_buff, "<br /><button onclick=\"location.href = '/");
-                strcat((char *)eth_send_buff, user_pass);
-                strcat((char *)eth_send_buff, "';\" >Refresh</button>");
+        // Remove the served request, pipelined requests that are already in the buffer are served right away
+        consumeWebConnectionBuffer(conn, request_length);
+    }
+}
 
-                strcat((char *)eth_send_buff, "</div></div><div class='left_top' style='border-left: solid #9BCCF5 1px; border-top: solid #9BCCF5 1px;'><div class='elements' style='margin-left:50px;'>Rhome v3.0<br />http://www.r00li.com</div><div style='padding: 10px;'><h1 style='float:right;'>&nbsp;</h1></div></div><div style='background-color: #0284F0; display:block; width: 100px; border-radius: 50px; height: 100px; position: relative; left:450px; top: 225px;'></div>");
-                printWebPageEnd(eth_send_buff);
-            }
-            else
-            {
-                strcat((char *)eth_send_buff, "{\"lights\":[");
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
+// WIFI (WEB SERVER) FUNCTIONS - PART 2
+// ------------------------------------------------------------------------------------------------------------------------------------------------------
 
-                for (int i = 0; i < lights.size(); i++)
-                {
-                    sprintf(web_buff, "{\"id\":%d,", i);
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "\"name\":\"");
-                    strcat((char *)eth_send_buff, lights[i]->getName());
-                    strcat((char *)eth_send_buff, "\",\"status\":\"");
-                    strcat((char *)eth_send_buff, (lights[i]->isOn())?"1":"0");
-                    strcat((char *)eth_send_buff, "\"}");
-
-                    strcat((char *)eth_send_buff, (i < lights.size()-1) ? "," : "");
-                }
-                strcat((char *)eth_send_buff, "], \"blinds\":[");
+void configureWifiUsart(USART_TypeDef *usart, uint32_t baudRate)
+{
+    //
+    // Sets the baud rate (and flow control) of a connection with the wifi module
+    //
 
-                for (int i = 0; i < blinds.size(); i++)
-                {
-                    sprintf(web_buff, "{\"id\":%d,", i);
-                    strcat((char *)eth_send_buff, web_buff);
-                    strcat((char *)eth_send_buff, "\"status\":");
-                    strcat((char *)eth_send_buff, (blinds[i]->getState() == 0)? "0": (blinds[i]->getState() == 1)? "1" : "2");
-                    strcat((char *)eth_send_buff, ",\"name\":\"");
-                    strcat((char *)eth_send_buff, blinds[i]->getName());
-                    strcat((char *)eth_send_buff, "\"}");
-
-                    strcat((char *)eth_send_buff, (i < blinds.size()-1) ? "," : "");
-                }
-                strcat((char *)eth_send_buff, "], \"temperature\":");
+    USART_InitTypeDef USART_InitStruct;
+
+    USART_InitStruct.USART_BaudRate = baudRate;
+    USART_InitStruct.USART_WordLength = USART_WordLength_8b;
+    USART_InitStruct.USART_StopBits = USART_StopBits_1;
+    USART_InitStruct.USART_Parity = USART_Parity_No;
+#if kWIFI_FLOW_CONTROL
+    USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_RTS_CTS;
+#else
+    USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+#endif
+    USART_InitStruct.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
+    USART_Init(usart, &USART_InitStruct);
+}
+
+void init_USART1()
+{
+    //
+    // Configuration of the first connection with the wifi module
+    //
 
-                float temperature = tempSensor.getTemp();
-                sprintf((char *)web_buff, "%d", (int)temperature);
-                strcat((char *)eth_send_buff, web_buff);
-                strcat((char *)eth_send_buff, ",\"time\":");
-                //strcat((char *)eth_send_buff, "C<br />Outside: 34C<br />");
+    GPIO_InitTypeDef GPIO_InitStruct;
+    NVIC_InitTypeDef NVIC_InitStructure;
 
-                RTC_TimeTypeDef RTC_TimeStruct;
-                RTC_GetTime(RTC_Format_BIN, &RTC_TimeStruct);
-                sprintf(web_buff,"\"%02d:%02d:%02d\",", RTC_TimeStruct.RTC_Hours, RTC_TimeStruct.RTC_Minutes, RTC_TimeStruct.RTC_Seconds);
-                strcat((char *)eth_send_buff, web_buff);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB, ENABLE);
 
-                strcat((char *)eth_send_buff, "\"api_ver\":1 }");
-            }
+    //inicializacija pinov 6 in 7 naprave GPIOB
+    //nastavimo, da naj bo na pin priklopljena alternativna funkcija
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_6 | GPIO_Pin_7;
+    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_DOWN;
+    GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    //za pina 6&7 naprav GPIOB definiramo, da ju prevzame USART1
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource6, GPIO_AF_USART1);
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource7, GPIO_AF_USART1);
+
+#if kWIFI_FLOW_CONTROL
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_11 | GPIO_Pin_12;
+    GPIO_Init(GPIOA, &GPIO_InitStruct);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource11, GPIO_AF_USART1);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource12, GPIO_AF_USART1);
+#endif
+
+    //nastavimo USART1
+    configureWifiUsart(USART1, wifiBaudRate);
+    USART_ITConfig(USART1, USART_IT_RXNE, ENABLE);
+
+    //inicializacija USART1 prekinitev v NVIC
+    // (gives a semaphore, has to be below configMAX_SYSCALL_INTERRUPT_PRIORITY)
+    NVIC_InitStructure.NVIC_IRQChannel = USART1_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+
+    USART_Cmd(USART1, ENABLE);
+
+}
+
+void init_USART2()
+{
+    //
+    // Configuration of the first connection with the wifi module
+    //
+
+    GPIO_InitTypeDef GPIO_InitStruct;
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    //inicializacija pinov 6 in 7 naprave GPIOB
+    //nastavimo, da naj bo na pin priklopljena alternativna funkcija
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3;
+    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
+    GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+    //za pina 6&7 naprav GPIOB definiramo, da ju prevzame USART1
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource2, GPIO_AF_USART2);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource3, GPIO_AF_USART2);
+
+#if kWIFI_FLOW_CONTROL
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_0 | GPIO_Pin_1;
+    GPIO_Init(GPIOA, &GPIO_InitStruct);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource0, GPIO_AF_USART2);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource1, GPIO_AF_USART2);
+#endif
+
+    //nastavimo USART2
+    configureWifiUsart(USART2, wifiBaudRate);
+    USART_ITConfig(USART2, USART_IT_RXNE, ENABLE);
+
+    //inicializacija USART1 prekinitev v NVIC
+    NVIC_InitStructure.NVIC_IRQChannel = USART2_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+
+    USART_Cmd(USART2, ENABLE);
+}
+
+void setWifiUsartBaudRate(uint32_t baudRate)
+{
+    //
+    // Switches both connections with the wifi module to a new baud rate
+    //
+
+    USART_Cmd(USART1, DISABLE);
+    USART_Cmd(USART2, DISABLE);
+
+    configureWifiUsart(USART1, baudRate);
+    configureWifiUsart(USART2, baudRate);
+
+    USART_Cmd(USART1, ENABLE);
+    USART_Cmd(USART2, ENABLE);
+}
+
+bool wifiModuleResponds()
+{
+    //
+    // Checks if the wifi module (in AT mode) understands us at the current baud rate
+    // (module echoes the command back when the link works)
+    //
+
+    clearWifiUsart1Buffer();
+    sendWifiUsart1("at+ver=?\r\n");
+
+    for (int i = 0; i < 10; i++)
+    {
+        delay(50);
+        if (strstr((char *)eth1_buff, "at+ver") != NULL)
+        {
+            clearWifiUsart1Buffer();
+            return true;
+        }
+    }
+
+    clearWifiUsart1Buffer();
+    return false;
+}
+
+uint32_t findWifiBaudRate()
+{
+    //
+    // Finds the baud rate the wifi module currently uses
+    // Returns 0 if the module does not respond at any rate
+    //
+
+    setWifiUsartBaudRate(wifiBaudRate);
+    if (wifiModuleResponds())
+        return wifiBaudRate;
+
+    for (int i = 0; i < kWifiBaudRates; i++)
+    {
+        setWifiUsartBaudRate(wifiBaudRates[i]);
+        if (wifiModuleResponds())
+            return wifiBaudRates[i];
+    }
+
+    return 0;
+}
+
+void negotiateWifiBaudRate()
+{
+    //
+    // Switches the wifi module to the fastest baud rate that works
+    // Each rate is verified after switching, if it fails the last working rate is restored
+    // The result is stored to flash so the next boot only needs to verify it
+    //
+
+    uint32_t oldBaudRate = wifiBaudRate;
+    webConnection1.paused = true;
+
+    GPIO_ResetBits(GPIOA, GPIO_Pin_8);
+    delay(500);
+    GPIO_SetBits(GPIOA, GPIO_Pin_8);
+    delay(100);
+
+    uint32_t current = findWifiBaudRate();
+    if (current == 0)
+    {
+        // Module is not responding, keep the stored setting
+        setWifiUsartBaudRate(wifiBaudRate);
+        webConnection1.paused = false;
+        return;
+    }
+
+    for (int i = 0; i < kWifiBaudRates && wifiBaudRates[i] > current; i++)
+    {
+        sprintf(text_buffer, "at+uart=%lu,8,n,1\r\n", (unsigned long)wifiBaudRates[i]);
+        sendWifiUsart1(text_buffer);
+        sprintf(text_buffer, "at+C2_uart=%lu,8,n,1\r\n", (unsigned long)wifiBaudRates[i]);
+        sendWifiUsart1(text_buffer);
+        sendWifiUsart1("at+net_commit=1\r\n");
+        sendWifiUsart1("at+save=1\r\n");
+        delay(3000);
+
+        setWifiUsartBaudRate(wifiBaudRates[i]);
+        if (wifiModuleResponds())
+        {
+            current = wifiBaudRates[i];
+            break;
+        }
+
+        // Fall back to the previous rate (or whatever the module ended up using)
+        wifiBaudRate = current;
+        current = findWifiBaudRate();
+        if (current == 0)
+        {
+            wifiBaudRate = oldBaudRate;
+            setWifiUsartBaudRate(wifiBaudRate);
+            webConnection1.paused = false;
+            return;
+        }
+    }
+
+    wifiBaudRate = current;
+    setWifiUsartBaudRate(wifiBaudRate);
+
+    sendWifiUsart1("at+out_trans=0\r\n");
+    clearWifiUsart1Buffer();
+    webConnection1.paused = false;
+
+    if (wifiBaudRate != oldBaudRate)
+    {
+        save_data_to_flash();
+    }
+}
+
+void initWifiES()
+{
+    //
+    // HLK-RM04 ES Pin configuration
+    //
+
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_8;
+    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_OUT;
+    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
+    GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+    GPIO_SetBits(GPIOA, GPIO_Pin_8);
+}
+
+bool commitWifiConfig()
+{
+    //
+    // Applies and saves queued module configuration
+    // (module restarts its network, so these take longer)
+    // Returns false if the commands could not be queued
+    //
+
+    return AtEngine::send("at+net_commit=1", false, 5000) &&
+           AtEngine::send("at+save=1", false, 3000) &&
+           AtEngine::send("at+reconn=1", false, 5000);
+}
 
-            sprintf(web_buff, "%d", strlen((char *)eth_send_buff));
+bool setWifiServerPort(int port, bool skipCommit = false)
+{
+    //
+    // sets web server port
+    // (connection 1)
+    //
 
-            strcat((char *)eth1_buff, kHTTP_OK_HEAD);
-            strcat((char *)eth1_buff, web_buff);
-            strcat((char *)eth1_buff, (webClient)? kHTTP_HEAD_PART2 : kHTTP_HEAD_PART2_API);
-            //strcat((char *)eth1_buff, (char *)eth_send_buff);
+    sprintf(text_buffer, "at+remoteport=%d", port);
+    if (!AtEngine::send(text_buffer))
+        return false;
 
-            sendWifiUsart1((char *)eth1_buff);
-            sendWifiUsart1((char *)eth_send_buff);
+    return skipCommit || commitWifiConfig();
+}
 
-        }
+bool setWifiIdleTimeout(int timeout, bool skipCommit = false)
+{
+    //
+    // sets how long (in seconds) an idle connection is kept open
+    // (connection 1, 0 = never close)
+    //
 
-        eth1_buff_indicator = 0;
+    sprintf(text_buffer, "at+timeout=%d", timeout);
+    if (!AtEngine::send(text_buffer))
+        return false;
 
-        eth1_busy = 0;
-        USART_ITConfig(USART1, USART_IT_RXNE, ENABLE);
+    return skipCommit || commitWifiConfig();
+}
 
-        clearWifiUsart1Buffer();
+bool setWifiApiPort(int port, bool skipCommit = false)
+{
+    //
+    // sets API server port
+    // (connection 2)
+    //
 
-        //taskEXIT_CRITICAL();
+    sprintf(text_buffer, "at+C2_port=%d", port);
+    if (!AtEngine::send(text_buffer))
+        return false;
 
-        vTaskDelay(200 / portTICK_RATE_MS);
-    }
+    return skipCommit || commitWifiConfig();
 }
 
-// ------------------------------------------------------------------------------------------------------------------------------------------------------
-// WIFI (WEB SERVER) FUNCTIONS - PART 2
-// ------------------------------------------------------------------------------------------------------------------------------------------------------
-
-void init_USART1()
+bool setWifiChannel2(bool skipCommit = false)
 {
     //
-    // Configuration of the first connection with the wifi module
+    // Configures connection 2 for its role
+    // (API server listens on the API port, aggregator and publisher connect to the peer)
     //
 
-    GPIO_InitTypeDef GPIO_InitStruct;
-    USART_InitTypeDef USART_InitStruct;
-    NVIC_InitTypeDef NVIC_InitStructure;
+    bool queued;
 
-    RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
-    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB, ENABLE);
+    if (c2Role == C2_ROLE_AGGREGATOR || c2Role == C2_ROLE_PUBLISHER)
+    {
+        queued = AtEngine::send("at+C2_mode=2");
+        sprintf(text_buffer, "at+C2_remoteip=%s", peerAddress);
+        queued = queued && AtEngine::send(text_buffer);
+        sprintf(text_buffer, "at+C2_port=%d", peerPort);
+        queued = queued && AtEngine::send(text_buffer);
+    }
+    else
+    {
+        sprintf(text_buffer, "at+C2_mode=%d", (c2Role == C2_ROLE_SERVER)? 1 : 0);
+        queued = AtEngine::send(text_buffer) && setWifiApiPort(apiPort, true);
+    }
 
-    //inicializacija pinov 6 in 7 naprave GPIOB
-    //nastavimo, da naj bo na pin priklopljena alternativna funkcija
-    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_6 | GPIO_Pin_7;
-    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
-    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
-    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_DOWN;
-    GPIO_Init(GPIOB, &GPIO_InitStruct);
+    return queued && (skipCommit || commitWifiConfig());
+}
 
-    //za pina 6&7 naprav GPIOB definiramo, da ju prevzame USART1
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource6, GPIO_AF_USART1);
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource7, GPIO_AF_USART1);
+bool setWifiBasicConfig(bool skipCommit = false)
+{
+    //
+    // Sets basic configuration for connection 1 (web server)
+    // and connection 2 (API server or aggregator)
+    // Returns false if the commands could not be queued (the rest is skipped)
+    //
 
-    //nastavimo USART1
-    //nastavimo baudrate
-    USART_InitStruct.USART_BaudRate = 115200;
-    //nastavimo dol?ino besede
-    USART_InitStruct.USART_WordLength = USART_WordLength_8b;
-    //nastavimo ?tevilo stop bitov
-    USART_InitStruct.USART_StopBits = USART_StopBits_1;
-    //nastavimo pariteto
-    USART_InitStruct.USART_Parity = USART_Parity_No;
-    //signalov RTS in CTS ne bomo uporabili
-    USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
-    //napravo USART bomo uporabili tako za sprejemanje in oddajanje
-    USART_InitStruct.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
-    USART_Init(USART1, &USART_InitStruct);
-    USART_ITConfig(USART1, USART_IT_RXNE, ENABLE);
+    if (!AtEngine::send("at+mode=Server") || !AtEngine::send("at+remotepro=Tcp"))
+        return false;
+    if (!setWifiServerPort(webPort, true) || !setWifiIdleTimeout(webIdleTimeout, true))
+        return false;
 
-    //inicializacija USART1 prekinitev v NVIC
-    NVIC_InitStructure.NVIC_IRQChannel = USART1_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
-    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
-    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-    NVIC_Init(&NVIC_InitStructure);
+    if (!AtEngine::send("at+uartpacktimeout=0") || !setWifiChannel2(true) || !AtEngine::send("at+C2_uartpacktimeout=0"))
+        return false;
+    sprintf(text_buffer, "at+C2_uart=%lu,8,n,1", (unsigned long)wifiBaudRate);
+    if (!AtEngine::send(text_buffer) || !AtEngine::send("at+C2_protocol=1"))
+        return false;
 
+    return skipCommit || commitWifiConfig();
+}
 
-    USART_Cmd(USART1, ENABLE);
+void showWifiSetupFailed()
+{
+    //
+    // Tells the user that module configuration could not be queued (module is not answering)
+    //
 
+    Menu::clearMenu();
+    TM_ILI9341_Puts(20, 38+25*0, "Wifi setup failed", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+    TM_ILI9341_Puts(20, 38+25*1, "Module is not answering", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+    delay(2000);
 }
 
-void init_USART2()
+bool wifiConnectTo(char* ssid, char* pass, int encr_type)
 {
     //
-    // Configuration of the first connection with the wifi module
+    // Connects to the specified wifi network
+    // Returns false if the commands could not be queued
     //
 
-    GPIO_InitTypeDef GPIO_InitStruct;
-    USART_InitTypeDef USART_InitStruct;
-    NVIC_InitTypeDef NVIC_InitStructure;
+    if (!setWifiBasicConfig(true) || !AtEngine::send("at+netmode=2"))
+        return false;
 
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
-    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+    sprintf(text_buffer, "at+wifi_conf=%s,%s,%s", ssid, wifiEcnryptionCommands[encr_type], pass);
+    if (!AtEngine::send(text_buffer))
+        return false;
 
-    //inicializacija pinov 6 in 7 naprave GPIOB
-    //nastavimo, da naj bo na pin priklopljena alternativna funkcija
-    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3;
-    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
-    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
-    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
-    GPIO_Init(GPIOA, &GPIO_InitStruct);
+    return commitWifiConfig();
+}
 
-    //za pina 6&7 naprav GPIOB definiramo, da ju prevzame USART1
-    GPIO_PinAFConfig(GPIOA, GPIO_PinSource2, GPIO_AF_USART2);
-    GPIO_PinAFConfig(GPIOA, GPIO_PinSource3, GPIO_AF_USART2);
+void sendWifiAtCommand(const char *data)
+{
+    //
+    // AT engine output (connection 1)
+    //
 
-    //nastavimo USART1
-    //nastavimo baudrate
-    USART_InitStruct.USART_BaudRate = 115200;
-    //nastavimo dol?ino besede
-    USART_InitStruct.USART_WordLength = USART_WordLength_8b;
-    //nastavimo ?tevilo stop bitov
-    USART_InitStruct.USART_StopBits = USART_StopBits_1;
-    //nastavimo pariteto
-    USART_InitStruct.USART_Parity = USART_Parity_No;
-    //signalov RTS in CTS ne bomo uporabili
-    USART_InitStruct.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
-    //napravo USART bomo uporabili tako za sprejemanje in oddajanje
-    USART_InitStruct.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
-    USART_Init(USART2, &USART_InitStruct);
-    USART_ITConfig(USART2, USART_IT_RXNE, ENABLE);
+    sendWifiUsart1((char *)data);
+}
 
-    //inicializacija USART1 prekinitev v NVIC
-    NVIC_InitStructure.NVIC_IRQChannel = USART2_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
-    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
-    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-    NVIC_Init(&NVIC_InitStructure);
+void setWifiCommandMode(bool enable)
+{
+    //
+    // Switches the wifi module between AT mode and transparent mode (AT engine callback)
+    // Web server on connection 1 is paused while the module is in AT mode
+    //
 
+    if (enable)
+    {
+        webConnection1.paused = true;
 
-    USART_Cmd(USART2, ENABLE);
+        GPIO_ResetBits(GPIOA, GPIO_Pin_8);
+        vTaskDelay(500 / portTICK_RATE_MS);
+        GPIO_SetBits(GPIOA, GPIO_Pin_8);
+        vTaskDelay(100 / portTICK_RATE_MS);
+    }
+    else
+    {
+        clearWifiUsart1Buffer();
+        webConnection1.paused = false;
+    }
 }
 
-void initWifiES()
+const AtPort wifiAtPort = {sendWifiAtCommand, eth1_buff, &eth1_buff_indicator, clearWifiUsart1Buffer, setWifiCommandMode};
+
+void sendPeerData(const char *data, int length)
 {
     //
-    // HLK-RM04 ES Pin configuration
+    // Aggregator output (connection 2 in client mode)
     //
 
-    GPIO_InitTypeDef GPIO_InitStruct;
+    sendWifiData(USART2, data, length);
+}
 
-    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+void consumePeerData(int length)
+{
+    consumeWebConnectionBuffer(&webConnection2, length);
+}
 
-    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_8;
-    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_OUT;
-    GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
-    GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
-    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
-    GPIO_Init(GPIOA, &GPIO_InitStruct);
+const PeerPort wifiPeerPort = {sendPeerData, eth2_buff, eth2_buff_size, &eth2_buff_indicator, consumePeerData};
 
-    GPIO_SetBits(GPIOA, GPIO_Pin_8);
-}
+//
+// Publisher client ID and the self-learning KaKu remote address are made of the MCU unique ID
+// (so that units do not take over each other's broker session or lights)
+//
+#define kUNIQUE_ID_ADDRESS 0x1FFF7A10
+char publishClientId[kPUBLISH_CLIENT_ID_LENGTH];
 
-void setWifiServerPort(int port, bool skipCommit = false)
+unsigned long uniqueRemoteAddress()
 {
     //
-    // sets web server port
-    // (connection 1)
+    // Returns the unique ID folded to the 26 bits of a self-learning KaKu remote address
     //
 
-    sprintf(text_buffer, "at+remoteport=%d\r\n", port);
-    sendWifiUsart1(text_buffer);
+    const uint32_t *uniqueId = (const uint32_t *)kUNIQUE_ID_ADDRESS;
+    uint32_t hash = uniqueId[0] ^ uniqueId[1] ^ uniqueId[2];
 
-    if (!skipCommit)
-    {
-        sendWifiUsart1("at+net_commit=1\r\n");
-        sendWifiUsart1("at+save=1\r\n");
-        sendWifiUsart1("at+reconn=1\r\n");
-    }
+    return hash ^ (hash >> 26);
 }
 
-void setWifiBasicConfig(bool skipCommit = false)
+void collectPublishedState(PublishScope scope)
 {
     //
-    // Sets basic configuration for connection 1
+    // Publishes lights, blinds and temperature that changed since the last call (or all of them),
+    // or the performance counters. Changes within one publisher window are merged.
     //
 
-    sendWifiUsart1("at+mode=Server\r\n");
-    sendWifiUsart1("at+remotepro=Tcp\r\n");
-    setWifiServerPort(webPort, true);
-    sendWifiUsart1("at+timeout=0\r\n");
+    static bool publishedLightOn[kMAX_LIGHTS];
+    static int publishedBlindState[kMAX_BLINDS];
+    static int publishedTemperature;
+    char name[kPUBLISH_TOPIC_LENGTH];
+    char value[12];
+
+    if (scope == PUBLISH_TELEMETRY)
+    {
+        updateMetricGauges();
+
+        for (int i = 0; i < METRIC_COUNT; i++)
+        {
+            snprintf(name, sizeof(name), "metrics/%s", Metrics::info((MetricId)i)->name);
+            sprintf(value, "%lu", (unsigned long)Metrics::get((MetricId)i));
+            Publisher::publish(name, value);
+        }
+        return;
+    }
 
-    sendWifiUsart1("at+uartpacktimeout=0\r\n");
-    sendWifiUsart1("at+C2_mode=0\r\n"); //0 = none, 1 = server, 2 = client
-    sendWifiUsart1("at+C2_uartpacktimeout=0\r\n");
-    sendWifiUsart1("at+C2_uart=115200,8,n,1\r\n");
-    sendWifiUsart1("at+C2_protocol=1\r\n");
+    bool all = (scope == PUBLISH_ALL);
 
-    if (!skipCommit)
+    for (int i = 0; i < lights.size(); i++)
     {
-        sendWifiUsart1("at+net_commit=1\r\n");
-        sendWifiUsart1("at+save=1\r\n");
-        sendWifiUsart1("at+reconn=1\r\n");
+        bool on = lights[i]->isOn();
+        if (all || on != publishedLightOn[i])
+        {
+            publishedLightOn[i] = on;
+            sprintf(name, "light/%d", i);
+            Publisher::publish(name, (on)? "1" : "0");
+        }
+    }
+
+    for (int i = 0; i < blinds.size(); i++)
+    {
+        int state = blinds[i]->getState();
+        if (all || state != publishedBlindState[i])
+        {
+            publishedBlindState[i] = state;
+            sprintf(name, "blind/%d", i);
+            sprintf(value, "%d", state);
+            Publisher::publish(name, value);
+        }
+    }
+
+    if (all || currentTemperature != publishedTemperature)
+    {
+        publishedTemperature = currentTemperature;
+        sprintf(value, "%d", publishedTemperature);
+        Publisher::publish("temperature", value);
     }
 }
 
-void wifiConnectTo(char* ssid, char* pass, int encr_type)
+void startWebServer()
 {
     //
-    // Connects to the specified wifi network
+    // Creates the web server state and its tasks (both connections and the AT engine)
+    // Connection 2 runs the API server, the aggregator or the publisher depending on its role
+    // Wifi UARTs have to be initialized already, tasks run once the scheduler starts
     //
 
-    GPIO_ResetBits(GPIOA, GPIO_Pin_8);
-    delay(500);
-    GPIO_SetBits(GPIOA, GPIO_Pin_8);
+    deviceMutex = xSemaphoreCreateMutex();
+    WebSessions::init();
+    webCache[WEB_CACHE_HTML].lock = xSemaphoreCreateMutex();
+    webCache[WEB_CACHE_JSON].lock = xSemaphoreCreateMutex();
+    metricsLock = xSemaphoreCreateMutex();
+    vSemaphoreCreateBinary(webConnection1.received);
+    vSemaphoreCreateBinary(webConnection2.received);
+    AtEngine::init(&wifiAtPort);
 
-    setWifiBasicConfig(true);
+    xTaskHandle handle;
 
-    sendWifiUsart1("at+netmode=2\r\n");
-    sprintf(text_buffer, "at+wifi_conf=%s,%s,%s\r\n", ssid, wifiEcnryptionCommands[encr_type], pass);
-    sendWifiUsart1(text_buffer);
+    xTaskCreate(
+        webServerTask,                   /* Pointer to the function that implements task*/
+        ( const signed char * ) "Task3",  /* Task name - for debugging only*/
+        200,         /* Stack depth in words */
+        ( void* ) &webConnection1,        /* Pointer to tasks arguments (parameter) */
+        tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+        &handle                           /* Task handle */
+    );
+    Metrics::watchTask(handle);
 
-    sendWifiUsart1("at+net_commit=1\r\n");
-    sendWifiUsart1("at+save=1\r\n");
-    sendWifiUsart1("at+reconn=1\r\n");
+    if (c2Role == C2_ROLE_AGGREGATOR)
+    {
+        // Connection 2 is a client of the peer unit instead of the API server
+        Aggregator::init(&wifiPeerPort, web_user, web_pass);
+
+        xTaskCreate(
+            Aggregator::task,                 /* Pointer to the function that implements task*/
+            ( const signed char * ) "Task5",  /* Task name - for debugging only*/
+            200,         /* Stack depth in words */
+            ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
+            tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+            &handle                           /* Task handle */
+        );
+        Metrics::watchTask(handle);
+    }
+    else if (c2Role == C2_ROLE_PUBLISHER)
+    {
+        const uint32_t *uniqueId = (const uint32_t *)kUNIQUE_ID_ADDRESS;
+        sprintf(publishClientId, "rhome-%08lx", (unsigned long)(uniqueId[0] ^ uniqueId[1] ^ uniqueId[2]));
+        Publisher::init(&wifiPeerPort, publishClientId, collectPublishedState);
+
+        xTaskCreate(
+            Publisher::task,                  /* Pointer to the function that implements task*/
+            ( const signed char * ) "Task5",  /* Task name - for debugging only*/
+            200,         /* Stack depth in words */
+            ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
+            tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+            &handle                           /* Task handle */
+        );
+        Metrics::watchTask(handle);
+    }
+    else if (c2Role == C2_ROLE_SERVER)
+    {
+        xTaskCreate(
+            webServerTask,                   /* Pointer to the function that implements task*/
+            ( const signed char * ) "Task5",  /* Task name - for debugging only*/
+            200,         /* Stack depth in words */
+            ( void* ) &webConnection2,        /* Pointer to tasks arguments (parameter) */
+            tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+            &handle                           /* Task handle */
+        );
+        Metrics::watchTask(handle);
+    }
 
-    sendWifiUsart1("at+out_trans=0\r\n");
+    xTaskCreate(
+        AtEngine::task,                   /* Pointer to the function that implements task*/
+        ( const signed char * ) "Task6",  /* Task name - for debugging only*/
+        200,         /* Stack depth in words */
+        ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
+        tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+        &handle                           /* Task handle */
+    );
+    Metrics::watchTask(handle);
 }
 
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1597,6 +4138,8 @@ void menuCheckerTask(void* pvParameters)
     // Main menu checker functions - controls the menu flow throughout the app
     //
 
+    (void)pvParameters;
+
     while (1)
     {
         if (millis() > Menu::lastInteractionTime + 30000 && !Menu::screenOff)
@@ -2399,7 +4942,7 @@ void keyboardPopup(bool skipLeftMenuRedraw = true, bool clearPopup = true, int m
 
 }
 
-void displayDropDown(const char opt[][11], int numOpt, MenuOption* selectedOpt, char* menuText, int saveToIndex)
+void displayDropDown(const char opt[][11], int numOpt, MenuOption* selectedOpt, const char* menuText, int saveToIndex)
 {
     //
     // Displays a drop-down menu
@@ -2524,10 +5067,10 @@ void drawRemoteButtons()
             else
             {
 
-                sprintf(text_buffer, "Button", option);
+                strcpy(text_buffer, "Button");
                 TM_ILI9341_Puts(237-(strlen(text_buffer)/2)*11, 40, text_buffer, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
 
-                sprintf(text_buffer, "Assigned to:", option);
+                strcpy(text_buffer, "Assigned to:");
                 TM_ILI9341_Puts(237-(strlen(text_buffer)/2)*11, 120, text_buffer, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
 
                 TM_ILI9341_Puts(237-(strlen(remoteButtons[option]->getEventTypeName())/2)*11, 145, (char *)remoteButtons[option]->getEventTypeName(), &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
@@ -2690,6 +5233,7 @@ void drawAddNewBlind()
         delete bld;
 
         Blind *saveBlind = new Blind();
+        saveBlind->id = EntityTable::allocate();
         saveBlind->setType((BlindType) globalIntBuffer[0]);
         saveBlind->setChannel((BlindChannel) globalIntBuffer[1]);
         saveBlind->btCode = 0;
@@ -2701,9 +5245,10 @@ void drawAddNewBlind()
         delay(2000);
         saveBlind->enableOutput(false);
 
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
         blinds.push_back(saveBlind);
-
         save_data_to_flash();
+        xSemaphoreGive(deviceMutex);
 
         Menu::clearMenu();
         for (int i=0; i < menuStack.front().size(); i++)
@@ -2762,18 +5307,22 @@ void drawBlindSettingsPopup()
     {
         if (Menu::positionSelected == 0)
         {
+            // Stopped here in case a batch is still moving it (batches only stop blinds that are still configured)
+            xSemaphoreTake(deviceMutex, portMAX_DELAY);
+            bld->finishMove();
             blinds.erase(blinds.begin() + selIndex);
+            save_data_to_flash();
+            xSemaphoreGive(deviceMutex);
+
             //delete lght;
             delete menuStack.back()[selIndex];
             menuStack.back().erase(menuStack.back().begin() + selIndex);
-
-            save_data_to_flash();
         }
         else if (Menu::positionSelected == 1)
         {
             RemoteButton *bt = new RemoteButton();
             bt->eventType = TYPE_BLIND_TOGGLE;
-            bt->eventHash = bld->calculateHash();
+            bt->eventId = bld->id;
 
             RemoteButton::shouldRunActions = false;
 
@@ -2930,20 +5479,23 @@ void drawAddNewLight()
     done->setOnClickListener([&]
     {
         Light* newLight = new Light();
+        newLight->id = EntityTable::allocate();
         newLight->setName(mini_text_buffer2);
 
-        if (globalIntBuffer[0] == RF_KAKU)
+        if (globalIntBuffer[0] <= RF_NEW_KAKU)
         {
-            newLight->setTypeKaku(lightAddresses1[globalIntBuffer[1]][0], atoi(lightAddresses2[globalIntBuffer[2]]));
+            newLight->setType((LightType)globalIntBuffer[0], lightAddresses1[globalIntBuffer[1]][0], atoi(lightAddresses2[globalIntBuffer[2]]));
         }
         else if (globalIntBuffer[0] == BLUETOOTH)
         {
             newLight->btCode = atoi(mini_text_buffer1);
         }
 
+        // Web pages take their snapshot of the lights under the same lock
+        xSemaphoreTake(deviceMutex, portMAX_DELAY);
         lights.push_back(newLight);
-
         save_data_to_flash();
+        xSemaphoreGive(deviceMutex);
 
         Menu::clearMenu();
         for (int i=0; i < menuStack.front().size(); i++)
@@ -3000,12 +5552,14 @@ void drawLightSettingsPopup()
     {
         if (Menu::positionSelected == 0)
         {
+            xSemaphoreTake(deviceMutex, portMAX_DELAY);
             lights.erase(lights.begin() + selIndex);
+            save_data_to_flash();
+            xSemaphoreGive(deviceMutex);
+
             //delete lght;
             delete menuStack.back()[selIndex];
             menuStack.back().erase(menuStack.back().begin() + selIndex);
-
-            save_data_to_flash();
         }
         else if (Menu::positionSelected == 1 || Menu::positionSelected == 2 || Menu::positionSelected == 3)
         {
@@ -3016,7 +5570,7 @@ void drawLightSettingsPopup()
                 case 2: bt->eventType = TYPE_LIGHT_OFF; break;
                 case 3: bt->eventType = TYPE_LIGHT_TOGGLE; break;
             }
-            bt->eventHash = lght->calculateHash();
+            bt->eventId = lght->id;
 
             RemoteButton::shouldRunActions = false;
 
@@ -3165,7 +5719,10 @@ void drawConnectToWifiPopup()
     MenuOption* done = new MenuOption(20, 240-35, "Done", ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     done->setOnClickListener([&]
     {
-        wifiConnectTo(mini_text_buffer1, mini_text_buffer2, globalIntBuffer[0]);
+        if (!wifiConnectTo(mini_text_buffer1, mini_text_buffer2, globalIntBuffer[0]))
+        {
+            showWifiSetupFailed();
+        }
 
         Menu::clearMenu();
         for (int i=0; i < menuStack.front().size(); i++)
@@ -3215,17 +5772,15 @@ void drawWifiStatusMenu()
     bck->setOnClickListener(backMenuButtonHandler);
     options.push_back(bck);
 
-    GPIO_ResetBits(GPIOA, GPIO_Pin_8);
-    delay(500);
-    GPIO_SetBits(GPIOA, GPIO_Pin_8);
-
     clearTextBuffer();
-    clearWifiUsart1Buffer();
+    mini_text_buffer1[0] = '\0';
+    mini_text_buffer3[0] = '\0';
 
-    sendWifiUsart1("at+net_wanip=?\r\n");
-    delay(2000);
-    eth1_busy = 1;
-    sscanf((char *)eth1_buff, "%s\r\n%[^,],%[^,],%[^,]", text_buffer, mini_text_buffer1, mini_text_buffer2, mini_text_buffer3);
+    // Values are drawn as soon as the module answers
+    if (AtEngine::sendWait("at+net_wanip=?", text_buffer, sizeof(text_buffer), 2000) == AT_RESULT_OK)
+    {
+        sscanf(text_buffer, "%[^,],%[^,],%[^,]", mini_text_buffer1, mini_text_buffer2, mini_text_buffer3);
+    }
 
     TM_ILI9341_Puts(160, 38+25*0, "IP:", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     sprintf(text_buffer, "%s", mini_text_buffer1);
@@ -3234,23 +5789,18 @@ void drawWifiStatusMenu()
     TM_ILI9341_Puts(160, 38+25*2, "Gateway:", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     sprintf(text_buffer, "%s", mini_text_buffer3);
     TM_ILI9341_Puts(160, 38+25*3, text_buffer, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
-    eth1_busy = 0;
 
     clearTextBuffer();
-    clearWifiUsart1Buffer();
-
-    sendWifiUsart1("at+remoteport=?\r\n");
-    delay(2000);
-    eth1_busy = 1;
+    mini_text_buffer1[0] = '\0';
 
-    sscanf((char *)eth1_buff, "%s\r\n%[^,]", text_buffer, mini_text_buffer1);
+    if (AtEngine::sendWait("at+remoteport=?", text_buffer, sizeof(text_buffer), 2000) == AT_RESULT_OK)
+    {
+        sscanf(text_buffer, "%[^,]", mini_text_buffer1);
+    }
 
     TM_ILI9341_Puts(160, 38+25*5, "Server port:", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     sprintf(text_buffer, "%s", mini_text_buffer1);
     TM_ILI9341_Puts(160, 38+25*6, text_buffer, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
-    eth1_busy = 0;
-
-    sendWifiUsart1("at+out_trans=0\r\n");
 
     options.front()->setSelected(true);
     Menu::positionSelected = 0;
@@ -3268,7 +5818,7 @@ void drawServerSettingsMenu()
 {
     //
     // Draws server settings menu
-    // (username, password, port)
+    // (username, password, port, idle connection timeout, API port, connection 2 role)
     //
 
     Menu::clearPopup();
@@ -3318,18 +5868,91 @@ void drawServerSettingsMenu()
     });
     options.push_back(port);
 
+    static int newIdleTimeout;
+    newIdleTimeout = webIdleTimeout;
+    sprintf(text_buffer, "Idle timeout: %d s          ", webIdleTimeout);
+    MenuOption *timeout = new MenuOption(20, 120, text_buffer, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+    timeout->setOnClickListener([&, timeout]
+    {
+        keyboardPopup(true, true, 5);
+        int value = atoi(text_buffer);
+        newIdleTimeout = (value >= 0 && value <= 86400)? value : webIdleTimeout;
+
+        sprintf(text_buffer, "Idle timeout: %d s", newIdleTimeout);
+        timeout->setText(text_buffer);
+    });
+    options.push_back(timeout);
+
+    static int newApiPort;
+    newApiPort = apiPort;
+    sprintf(text_buffer, "API port: %d          ", apiPort);
+    MenuOption *api = new MenuOption(20, 150, text_buffer, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+    api->setOnClickListener([&, api]
+    {
+        keyboardPopup(true, true, 5);
+        int value = atoi(text_buffer);
+        newApiPort = (value > 0 && value < 65535)? value : apiPort;
+
+        sprintf(text_buffer, "API port: %d", newApiPort);
+        api->setText(text_buffer);
+    });
+    options.push_back(api);
+
+    // Role is applied after a restart, aggregator and publisher ask for the peer as <ip>,<port>
+    static int newC2Role;
+    static char newPeerAddress[kPEER_ADDRESS_LENGTH];
+    static int newPeerPort;
+    newC2Role = c2Role;
+    strcpy(newPeerAddress, peerAddress);
+    newPeerPort = peerPort;
+    sprintf(text_buffer, "Connection 2: %s          ", kC2RoleNames[c2Role]);
+    MenuOption *role = new MenuOption(20, 180, text_buffer, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+    role->setOnClickListener([&, role]
+    {
+        newC2Role = (newC2Role + 1) % kC2_ROLES;
+
+        if (newC2Role == C2_ROLE_AGGREGATOR || newC2Role == C2_ROLE_PUBLISHER)
+        {
+            keyboardPopup(true, true, 21);
+            char *port_separator = strchr(text_buffer, ',');
+            if (port_separator != NULL)
+            {
+                *port_separator = '\0';
+                int value = atoi(port_separator + 1);
+                newPeerPort = (value > 0 && value < 65535)? value : newPeerPort;
+            }
+            strncpy(newPeerAddress, text_buffer, kPEER_ADDRESS_LENGTH - 1);
+            newPeerAddress[kPEER_ADDRESS_LENGTH - 1] = '\0';
+        }
+
+        sprintf(text_buffer, "Connection 2: %s          ", kC2RoleNames[newC2Role]);
+        role->setText(text_buffer);
+    });
+    options.push_back(role);
+
 
     MenuOption* done = new MenuOption(20, 240-35, "Done", ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     done->setOnClickListener([&]
     {
-        strncpy(web_user, mini_text_buffer1, 15);
-        strncpy(web_pass, mini_text_buffer2, 15);
+        strncpy(web_user, mini_text_buffer1, 14);
+        web_user[14] = '\0';
+        strncpy(web_pass, mini_text_buffer2, 14);
+        web_pass[14] = '\0';
         int newport = atoi(mini_text_buffer3);
         webPort = (newport > 0 && newport < 65535)? newport : 8080;
-        setWifiServerPort(webPort);
+        webIdleTimeout = newIdleTimeout;
+        apiPort = newApiPort;
+        c2Role = newC2Role;
+        strcpy(peerAddress, newPeerAddress);
+        peerPort = newPeerPort;
 
         save_data_to_flash();
 
+        if (!setWifiServerPort(webPort, true) || !setWifiIdleTimeout(webIdleTimeout, true) || !setWifiChannel2())
+        {
+            showWifiSetupFailed();
+        }
+
         Menu::clearMenu();
         for (int i=0; i < menuStack.front().size(); i++)
         {
@@ -3387,11 +6010,8 @@ void displayWifiSettingsMenu()
 
     MenuOption* op3 = new MenuOption(165, 38+25*3, "Wifi reset", ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
     op3->setOnClickListener([] {
-        GPIO_ResetBits(GPIOA, GPIO_Pin_8);
-        delay(500);
-        GPIO_SetBits(GPIOA, GPIO_Pin_8);
-        sendWifiUsart1("at+default=1\r\n");
-        sendWifiUsart1("at+reboot=1\r\n");
+        AtEngine::send("at+default=1");
+        AtEngine::send("at+reboot=1");
         Menu::clearRightMenu();
         pressedMenuOptionsStack.pop_back();
         TM_ILI9341_Puts(160, 38+25*0, "Resetting wifi", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
@@ -3399,15 +6019,15 @@ void displayWifiSettingsMenu()
 
         delay(40000);
 
-        GPIO_ResetBits(GPIOA, GPIO_Pin_8);
-        delay(500);
-        GPIO_SetBits(GPIOA, GPIO_Pin_8);
+        // Module is back at its default baud rate
+        wifiBaudRate = kWIFI_DEFAULT_BAUD;
+        setWifiUsartBaudRate(wifiBaudRate);
+        negotiateWifiBaudRate();
 
-        setWifiBasicConfig();
-        sendWifiUsart1("at+out_trans=0\r\n");
+        bool configured = setWifiBasicConfig();
 
         Menu::clearRightMenu();
-        TM_ILI9341_Puts(160, 38+25*0, "Reset complete", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+        TM_ILI9341_Puts(160, 38+25*0, (configured)? "Reset complete" : "Wifi setup failed", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
         TM_ILI9341_Puts(160, 38+20*2, "Setup your wifi", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
         TM_ILI9341_Puts(160, 38+20*3, "details (ssid, pass)", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
         TM_ILI9341_Puts(160, 38+20*5, "Or connect to", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
@@ -3589,7 +6209,7 @@ void drawActionSettingsPopup()
     {
         RemoteButton *bt = new RemoteButton();
         bt->eventType = TYPE_ACTION;
-        bt->eventHash = 0;
+        bt->eventId = 0;
 
         RemoteButton::shouldRunActions = false;
 
@@ -3887,13 +6507,30 @@ void remoteEvent(uint32_t event_code)
     }
 }
 
-void remoteEventRF(unsigned long code, unsigned int repeats)
+#define kREMOTE_HOLD_OFF 250     // ms of silence before the same code counts as a new press
+
+void remoteEventRF(const RfCode *code)
 {
     //
     // Handles remote button presses from the RF remote
+    // (called from the RF task, buttons are bound to the code of any protocol)
+    // A remote repeats its telegram while the button is held, repeats of the same code
+    // are ignored until reception pauses so that a toggle button switches only once per press
     //
 
-    remoteEvent(code);
+    static uint32_t lastCode = 0;
+    static unsigned int lastSeen = 0;
+
+    unsigned int now = millis();
+    bool repeat = (code->code == lastCode && now - lastSeen < kREMOTE_HOLD_OFF);
+
+    lastCode = code->code;
+    lastSeen = now;
+
+    if (!repeat)
+    {
+        remoteEvent(code->code);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -3927,6 +6564,9 @@ int main(void)
     lights.reserve(5);
     remoteButtons.reserve(50);
 
+    RfScheduler::init();
+    Light::setNewKakuAddress(uniqueRemoteAddress());
+
     loadFromFlash();
 
     setAutoBlinds();
@@ -3941,6 +6581,7 @@ int main(void)
 
     tempSensor.initTempSensor();
     tempSensor.calibration = tempAdjust;
+    sampleTemperature();
 
     Menu::clearMenu();
     Menu::clearTitle();
@@ -3972,19 +6613,26 @@ int main(void)
     initWifiES();
     init_USART1();
     init_USART2();
+    negotiateWifiBaudRate();
+
 
+    startWebServer();
 
     //
     // Create all Free RTOS tasks
+    // (handles are kept for the stack usage report on /metrics)
     //
+    xTaskHandle handle;
+
     xTaskCreate(
         vTask1Function,                   /*Pinter to the function that implements task*/
         ( const signed char * ) "Task1",  /* Task name - for debugging only*/
         200,         /* Stack depth in words */
         ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
         tskIDLE_PRIORITY + 1UL,           /* Task priority*/
-        NULL                              /* Task handle */
+        &handle                           /* Task handle */
     );
+    Metrics::watchTask(handle);
 
     xTaskCreate(
         vTask2Function,                   /* Pointer to the function that implements task*/
@@ -3992,17 +6640,29 @@ int main(void)
         200,         /* Stack depth in words */
         ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
         tskIDLE_PRIORITY + 1UL,           /* Task priority*/
-        NULL                              /* Task handle */
+        &handle                           /* Task handle */
     );
+    Metrics::watchTask(handle);
 
     xTaskCreate(
-        task3,                   /* Pointer to the function that implements task*/
-        ( const signed char * ) "Task3",  /* Task name - for debugging only*/
+        RfScheduler::task,                /* Pointer to the function that implements task*/
+        ( const signed char * ) "RFTx",   /* Task name - for debugging only*/
+        200,         /* Stack depth in words */
+        ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
+        tskIDLE_PRIORITY + 1UL,           /* Task priority*/
+        &handle                           /* Task handle */
+    );
+    Metrics::watchTask(handle);
+
+    xTaskCreate(
+        RemoteReceiver::task,             /* Pointer to the function that implements task*/
+        ( const signed char * ) "RF",     /* Task name - for debugging only*/
         200,         /* Stack depth in words */
         ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
         tskIDLE_PRIORITY + 1UL,           /* Task priority*/
-        NULL                              /* Task handle */
+        &handle                           /* Task handle */
     );
+    Metrics::watchTask(handle);
 
     xTaskCreate(
         menuCheckerTask,                   /* Pointer to the function that implements task*/
@@ -4010,8 +6670,9 @@ int main(void)
         600,         /* Stack depth in words */
         ( void* ) NULL,                   /* Pointer to tasks arguments (parameter) */
         tskIDLE_PRIORITY + 1UL,           /* Task priority*/
-        NULL                              /* Task handle */
+        &handle                           /* Task handle */
     );
+    Metrics::watchTask(handle);
 
     // Start task scheduler
     vTaskStartScheduler();